@@ -0,0 +1,104 @@
+#include "alloc.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ALLOC_TRACK_SITES
+typedef struct AllocSite
+{
+	_Atomic(const char *) site;
+	atomic_ulong allocations;
+	atomic_ulong bytes;
+} AllocSite;
+
+// Open addressing on the text of the site, the same line can end up as separate strings in separate objects. The last
+// slot is never claimed, it is where sites go once the table is full.
+static AllocSite site_table[ALLOC_MAX_SITES + 1];
+
+static AllocSite *find_site(const char *site)
+{
+	// 32-bit FNV-1a, like intern_hash
+	uint32_t hash = 2166136261u;
+	for (const char *p = site; *p; p++)
+	{
+		hash ^= (unsigned char)*p;
+		hash *= 16777619u;
+	}
+
+	for (uint32_t i = 0; i < ALLOC_MAX_SITES; i++)
+	{
+		AllocSite *slot = &site_table[(hash + i) % ALLOC_MAX_SITES];
+		const char *cur = atomic_load_explicit(&slot->site, memory_order_acquire);
+		if (!cur && atomic_compare_exchange_strong(&slot->site, &cur, site))
+			return slot;
+		if (cur == site || strcmp(cur, site) == 0)
+			return slot;
+	}
+
+	return &site_table[ALLOC_MAX_SITES];
+}
+
+void alloc_count(const char *site, size_t size)
+{
+	AllocSite *slot = find_site(site ? site : "unknown");
+	atomic_fetch_add_explicit(&slot->allocations, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&slot->bytes, size, memory_order_relaxed);
+}
+#endif
+
+int alloc_sites(AllocSiteStats *sites, int max)
+{
+	int count = 0;
+#ifdef ALLOC_TRACK_SITES
+	for (int i = 0; i <= ALLOC_MAX_SITES; i++)
+	{
+		AllocSite *slot = &site_table[i];
+		unsigned long allocations = atomic_load(&slot->allocations);
+		if (!allocations)
+			continue;
+
+		AllocSiteStats s = {i < ALLOC_MAX_SITES ? atomic_load(&slot->site) : "other", allocations,
+		                    atomic_load(&slot->bytes)};
+
+		// insertion sort by bytes, whatever falls off the end is dropped
+		int j = count < max ? count++ : max;
+		while (j > 0 && sites[j - 1].bytes < s.bytes)
+		{
+			if (j < max)
+				sites[j] = sites[j - 1];
+			j--;
+		}
+		if (j < max)
+			sites[j] = s;
+	}
+#else
+	(void)sites;
+	(void)max;
+#endif
+	return count;
+}
+
+void *mem_alloc_at(size_t size, const char *site)
+{
+	alloc_count(site, size);
+	return malloc(size);
+}
+
+void *mem_calloc_at(size_t count, size_t size, const char *site)
+{
+	alloc_count(site, count * size);
+	return calloc(count, size);
+}
+
+void *mem_realloc_at(void *ptr, size_t size, const char *site)
+{
+	alloc_count(site, size);
+	return realloc(ptr, size);
+}
+
+void mem_free(void *ptr)
+{
+	free(ptr);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+
+// Every allocation of the compiler goes through here. Most memory comes from an Arena (arena.h) that is released at
+// once with everything else of the same lifetime, what has a lifetime of its own, like a char buffer or the ring of a
+// token pipe, comes from the heap functions below.
+//
+// With ALLOC_TRACK_SITES defined (the CCOMPILER_TRACK_ALLOCATIONS option in CMake) every allocation is counted along
+// with its size under the file and line it was made at, for --stats to report. Otherwise the site is never looked at.
+
+#ifdef ALLOC_TRACK_SITES
+#define ALLOC_STRINGIFY_(x) #x
+#define ALLOC_STRINGIFY(x) ALLOC_STRINGIFY_(x)
+#define ALLOC_SITE __FILE__ ":" ALLOC_STRINGIFY(__LINE__)
+#else
+#define ALLOC_SITE NULL
+#endif
+
+// Sites beyond this many are counted together under a single "other" site
+#define ALLOC_MAX_SITES 1024
+
+typedef struct AllocSiteStats
+{
+	// "file:line"
+	const char *site;
+	unsigned long allocations;
+	unsigned long bytes;
+} AllocSiteStats;
+
+// Counts an allocation of size bytes at site, safe to call from several threads at once. Compiles to nothing without
+// ALLOC_TRACK_SITES.
+#ifdef ALLOC_TRACK_SITES
+void alloc_count(const char *site, size_t size);
+#else
+static inline void alloc_count(const char *site, size_t size)
+{
+	(void)site;
+	(void)size;
+}
+#endif
+
+// Copies the counts of up to max sites to sites, most bytes first, and returns how many there were. Always 0 without
+// ALLOC_TRACK_SITES.
+int alloc_sites(AllocSiteStats *sites, int max);
+
+void *mem_alloc_at(size_t size, const char *site);
+void *mem_calloc_at(size_t count, size_t size, const char *site);
+
+// Counted as an allocation of size bytes, whether or not ptr could be grown in place
+void *mem_realloc_at(void *ptr, size_t size, const char *site);
+
+void mem_free(void *ptr);
+
+#define mem_alloc(size) mem_alloc_at(size, ALLOC_SITE)
+#define mem_calloc(count, size) mem_calloc_at(count, size, ALLOC_SITE)
+#define mem_realloc(ptr, size) mem_realloc_at(ptr, size, ALLOC_SITE)
@@ -0,0 +1,150 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_MAX_CHUNK_SIZE (64 * 1024 * 1024)
+
+static size_t align_up(size_t size)
+{
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void arena_init(Arena *arena, size_t first_chunk_size)
+{
+	memset(arena, 0, sizeof(Arena));
+	arena->_next_chunk_size = first_chunk_size;
+}
+
+void arena_release(Arena *arena)
+{
+	ArenaChunk *chunk = arena->_head;
+	while (chunk)
+	{
+		ArenaChunk *prev = chunk->prev;
+		free(chunk);
+		chunk = prev;
+	}
+	arena->_head = NULL;
+	arena->_last = NULL;
+}
+
+// Chunks double in size so the number of mallocs is logarithmic in the total size
+static ArenaChunk *new_chunk(Arena *arena, size_t min_size)
+{
+	size_t size = arena->_next_chunk_size;
+	while (size < min_size)
+		size *= 2;
+
+	ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + size);
+	if (!chunk)
+		return NULL;
+
+	chunk->prev = arena->_head;
+	chunk->size = size;
+	chunk->used = 0;
+	arena->_head = chunk;
+
+	if (arena->_next_chunk_size < ARENA_MAX_CHUNK_SIZE)
+		arena->_next_chunk_size *= 2;
+
+	arena->chunks++;
+	arena->bytes_reserved += size;
+	return chunk;
+}
+
+// Chunks come straight from malloc, the allocations made from them are what alloc_count counts
+static void *bump(Arena *arena, size_t size)
+{
+	size_t aligned = align_up(size);
+	ArenaChunk *chunk = arena->_head;
+
+	if (!chunk || chunk->size - chunk->used < aligned)
+	{
+		chunk = new_chunk(arena, aligned);
+		if (!chunk)
+			return NULL;
+	}
+
+	void *res = chunk->data + chunk->used;
+	chunk->used += aligned;
+
+	arena->_last = res;
+	arena->_last_size = aligned;
+	arena->bytes_allocated += aligned;
+	return res;
+}
+
+void *arena_alloc_at(Arena *arena, size_t size, const char *site)
+{
+	alloc_count(site, size);
+	return bump(arena, size);
+}
+
+void *arena_calloc_at(Arena *arena, size_t count, size_t size, const char *site)
+{
+	alloc_count(site, count * size);
+	void *res = bump(arena, count * size);
+	if (res)
+		memset(res, 0, count * size);
+	return res;
+}
+
+void *arena_grow_at(Arena *arena, void *ptr, size_t old_size, size_t new_size, const char *site)
+{
+	alloc_count(site, new_size);
+	if (!ptr)
+		return bump(arena, new_size);
+
+	ArenaChunk *chunk = arena->_head;
+	size_t aligned = align_up(new_size);
+
+	if (ptr == arena->_last && (char *)ptr + arena->_last_size == chunk->data + chunk->used &&
+	    chunk->used - arena->_last_size + aligned <= chunk->size)
+	{
+		chunk->used = chunk->used - arena->_last_size + aligned;
+		arena->bytes_allocated = arena->bytes_allocated - arena->_last_size + aligned;
+		arena->_last_size = aligned;
+		return ptr;
+	}
+
+	void *res = bump(arena, new_size);
+	if (res)
+		memcpy(res, ptr, old_size < new_size ? old_size : new_size);
+	return res;
+}
+
+void *arena_reserve_at(Arena *arena, void *data, uint32_t len, uint32_t *cap, size_t elem_size, const char *site)
+{
+	if (len < *cap)
+		return data;
+
+	uint32_t new_cap = *cap ? *cap * 2 : 16;
+	void *res = arena_grow_at(arena, data, (size_t)*cap * elem_size, (size_t)new_cap * elem_size, site);
+	if (res)
+		*cap = new_cap;
+	return res;
+}
+
+ArenaMark arena_mark(const Arena *arena)
+{
+	return (ArenaMark){arena->_head, arena->_head ? arena->_head->used : 0, arena->bytes_allocated};
+}
+
+void arena_reset(Arena *arena, ArenaMark mark)
+{
+	while (arena->_head != mark.chunk)
+	{
+		ArenaChunk *chunk = arena->_head;
+		arena->_head = chunk->prev;
+		arena->chunks--;
+		arena->bytes_reserved -= chunk->size;
+		free(chunk);
+	}
+
+	if (mark.chunk)
+		mark.chunk->used = mark.used;
+	arena->bytes_allocated = mark.bytes_allocated;
+	arena->_last = NULL;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "alloc.h"
+
+typedef struct ArenaChunk
+{
+	struct ArenaChunk *prev;
+	size_t size;
+	size_t used;
+	_Alignas(16) char data[];
+} ArenaChunk;
+
+// Bump allocator, everything allocated from it is released at once by arena_release. Each lifetime gets an arena of
+// its own: the tokens of a source live in the arena of their TokenData, what the preprocessor keeps for the whole
+// translation unit in its arena, and memory only needed for a moment in a scratch arena that is reset to a mark
+// right after.
+typedef struct Arena
+{
+	ArenaChunk *_head;
+	size_t _next_chunk_size;
+
+	// start and size of the most recent allocation, which arena_grow can extend in place
+	void *_last;
+	size_t _last_size;
+
+	size_t chunks;
+	size_t bytes_reserved;
+	size_t bytes_allocated;
+} Arena;
+
+// Everything allocated up to some point, see arena_reset
+typedef struct ArenaMark
+{
+	ArenaChunk *chunk;
+	size_t used;
+	size_t bytes_allocated;
+} ArenaMark;
+
+void arena_init(Arena *arena, size_t first_chunk_size);
+void arena_release(Arena *arena);
+
+// Returns 16 byte aligned memory, or NULL when out of memory
+void *arena_alloc_at(Arena *arena, size_t size, const char *site);
+void *arena_calloc_at(Arena *arena, size_t count, size_t size, const char *site);
+
+// Resizes ptr, in place if it was the last allocation and fits in its chunk, otherwise by copying.
+// The old memory is not reused until the arena is released.
+void *arena_grow_at(Arena *arena, void *ptr, size_t old_size, size_t new_size, const char *site);
+
+// Makes room for one more element in an arena backed array of len elements, doubling *cap when it is full.
+// Returns the (possibly moved) array, or NULL when out of memory.
+void *arena_reserve_at(Arena *arena, void *data, uint32_t len, uint32_t *cap, size_t elem_size, const char *site);
+
+// allocations are counted under the line they are made at, see alloc.h
+#define arena_alloc(arena, size) arena_alloc_at(arena, size, ALLOC_SITE)
+#define arena_calloc(arena, count, size) arena_calloc_at(arena, count, size, ALLOC_SITE)
+#define arena_grow(arena, ptr, old_size, new_size) arena_grow_at(arena, ptr, old_size, new_size, ALLOC_SITE)
+#define arena_reserve(arena, data, len, cap, elem_size) arena_reserve_at(arena, data, len, cap, elem_size, ALLOC_SITE)
+
+ArenaMark arena_mark(const Arena *arena);
+
+// Frees everything allocated since mark was taken, chunks that were added after it go back to the system
+void arena_reset(Arena *arena, ArenaMark mark);
@@ -0,0 +1,280 @@
+#include "ast.h"
+
+#include <stdio.h>
+
+#include "debug_tokens.h"
+
+#define AST_KIND_NAME(name) #name,
+
+const char *const ast_kind_names[] = {AST_KINDS(AST_KIND_NAME)};
+
+static const char *const storage_names[] = {"typedef", "extern", "static", "_Thread_local", "auto", "register"};
+static const char *const type_names[] = {"void",     "char",     "short",  "int",      "float",     "double",
+                                         "signed",   "unsigned", "_Bool",  "_Complex", "_Imaginary"};
+static const char *const qualifier_names[] = {"const", "restrict", "volatile", "_Atomic"};
+static const char *const function_names[] = {"inline", "_Noreturn"};
+
+static void print_node(const AstNode *node, const TokenData *td, int depth);
+
+static void print_list(const AstNode *node, const TokenData *td, int depth)
+{
+	for (; node; node = node->next)
+		print_node(node, td, depth);
+}
+
+// Prints the names of the bits set in bits, names[i] being the name of bit i
+static void print_bits(unsigned bits, const char *const *names, int count)
+{
+	for (int i = 0; i < count; i++)
+		if (bits & (1u << i))
+			printf(" %s", names[i]);
+}
+
+static void print_specifiers(const AstSpecifiers *specs, const TokenData *td, int depth)
+{
+	printf("%*sSPECIFIERS", depth * 2, "");
+	print_bits(specs->storage, storage_names, sizeof(storage_names) / sizeof(storage_names[0]));
+	print_bits(specs->function, function_names, sizeof(function_names) / sizeof(function_names[0]));
+	print_bits(specs->qualifiers, qualifier_names, sizeof(qualifier_names) / sizeof(qualifier_names[0]));
+	for (int i = 0; i < specs->longs; i++)
+		printf(" long");
+	print_bits(specs->type_specifiers, type_names, sizeof(type_names) / sizeof(type_names[0]));
+	printf("\n");
+
+	if (specs->type)
+		print_node(specs->type, td, depth + 1);
+	print_list(specs->alignas, td, depth + 1);
+}
+
+// What is printed on the line of the node after its kind
+static void print_details(const AstNode *node, const TokenData *td)
+{
+	const LexedToken *tok = &node->tok;
+	switch (node->kind)
+	{
+	case AST_CONSTANT: {
+		const NumConstant *nc = &td->num_constants->constants[tok->payload];
+		if (nc->floating)
+			printf(" %g", nc->float_value);
+		else
+			printf(" %llu", (unsigned long long)nc->int_value);
+		return;
+	}
+
+	case AST_CHAR_CONSTANT:
+		printf(" %u", tok->payload);
+		return;
+
+	case AST_STRING_LITERAL: {
+		// undecoded, the spans are printed as they were written
+		const StringLiteral *lit = &td->string_literals[tok->payload];
+		printf(" \"");
+		for (uint32_t i = 0; i < lit->num_spans; i++)
+		{
+			const StringSpan *span = &td->string_spans[lit->first_span + i];
+			printf("%.*s", (int)span->len, span->ptr);
+		}
+		printf("\"");
+		return;
+	}
+
+	case AST_UNARY:
+	case AST_BINARY:
+	case AST_ASSIGN:
+		printf(" %s", debug_tokens[node->op]);
+		return;
+
+	case AST_POINTER:
+	case AST_ARRAY:
+		print_bits(node->array.qualifiers, qualifier_names, sizeof(qualifier_names) / sizeof(qualifier_names[0]));
+		if (node->flags & AST_FLAG_STATIC)
+			printf(" static");
+		if (node->flags & AST_FLAG_VLA_STAR)
+			printf(" *");
+		return;
+
+	case AST_FUNCTION:
+		if (node->flags & AST_FLAG_PROTOTYPE)
+			printf(" prototype");
+		if (node->flags & AST_FLAG_VARIADIC)
+			printf(" ...");
+		return;
+
+	// the nodes that have a name, the others only point at where they start
+	case AST_IDENTIFIER:
+	case AST_MEMBER:
+	case AST_POINTER_MEMBER:
+	case AST_MEMBER_DESIGNATOR:
+	case AST_DECLARATOR:
+	case AST_STRUCT:
+	case AST_UNION:
+	case AST_ENUM:
+	case AST_ENUMERATOR:
+	case AST_TYPEDEF_NAME:
+	case AST_GOTO:
+	case AST_LABEL:
+		if (tok->kind == TOK_IDENTIFIER)
+			printf(" %s", intern_str(td->identifiers, tok->payload));
+		return;
+
+	default:
+		return;
+	}
+}
+
+static void print_node(const AstNode *node, const TokenData *td, int depth)
+{
+	printf("%*s%s", depth * 2, "", ast_kind_names[node->kind]);
+	print_details(node, td);
+	printf("\n");
+
+	// children in source order, NULL ones are left out
+	const AstNode *children[4] = {0};
+	const AstSpecifiers *specs = NULL;
+	const AstNode *list = NULL;
+	switch (node->kind)
+	{
+	case AST_GENERIC:
+		children[0] = node->generic.controlling;
+		list = node->generic.assocs;
+		break;
+
+	case AST_INDEX:
+	case AST_BINARY:
+	case AST_ASSIGN:
+		children[0] = node->binary.lhs;
+		children[1] = node->binary.rhs;
+		break;
+
+	case AST_CALL:
+		children[0] = node->call.callee;
+		list = node->call.args;
+		break;
+
+	case AST_MEMBER:
+	case AST_POINTER_MEMBER:
+	case AST_POST_INCREMENT:
+	case AST_POST_DECREMENT:
+	case AST_UNARY:
+	case AST_SIZEOF_EXPR:
+	case AST_INDEX_DESIGNATOR:
+	case AST_ENUMERATOR:
+	case AST_EXPRESSION_STATEMENT:
+	case AST_RETURN:
+		children[0] = node->operand;
+		break;
+
+	case AST_ALIGNAS:
+	case AST_GENERIC_ASSOC:
+	case AST_COMPOUND_LITERAL:
+	case AST_SIZEOF_TYPE:
+	case AST_ALIGNOF:
+	case AST_CAST:
+	case AST_ATOMIC_TYPE:
+		children[0] = node->typed.type_name;
+		children[1] = node->typed.operand;
+		break;
+
+	case AST_CONDITIONAL:
+	case AST_IF:
+		children[0] = node->conditional.cond;
+		children[1] = node->conditional.then;
+		children[2] = node->conditional.otherwise;
+		break;
+
+	case AST_INIT_LIST:
+	case AST_TRANSLATION_UNIT:
+	case AST_COMPOUND:
+		list = node->items;
+		break;
+
+	case AST_DESIGNATION:
+		list = node->designation.designators;
+		children[1] = node->designation.value;
+		break;
+
+	case AST_DECLARATION:
+	case AST_PARAMETER:
+	case AST_TYPE_NAME:
+		specs = node->declaration.specs;
+		list = node->declaration.declarators;
+		break;
+
+	case AST_FUNCTION_DEFINITION:
+		specs = node->function.specs;
+		children[0] = node->function.declarator;
+		list = node->function.declarations;
+		children[1] = node->function.body;
+		break;
+
+	case AST_STATIC_ASSERT:
+		children[0] = node->static_assert_.cond;
+		children[1] = node->static_assert_.message;
+		break;
+
+	case AST_DECLARATOR:
+		list = node->declarator.derived;
+		children[1] = node->declarator.bit_width;
+		children[2] = node->declarator.init;
+		break;
+
+	case AST_ARRAY:
+		children[0] = node->array.size;
+		break;
+
+	case AST_FUNCTION:
+		list = node->params;
+		break;
+
+	case AST_STRUCT:
+	case AST_UNION:
+	case AST_ENUM:
+		list = node->members;
+		break;
+
+	case AST_SWITCH:
+	case AST_WHILE:
+		children[0] = node->loop.cond;
+		children[1] = node->loop.body;
+		break;
+
+	case AST_DO_WHILE:
+		children[0] = node->loop.body;
+		children[1] = node->loop.cond;
+		break;
+
+	case AST_FOR:
+		children[0] = node->for_.init;
+		children[1] = node->for_.cond;
+		children[2] = node->for_.step;
+		children[3] = node->for_.body;
+		break;
+
+	case AST_LABEL:
+	case AST_CASE:
+	case AST_DEFAULT:
+		children[0] = node->labeled.value;
+		children[1] = node->labeled.body;
+		break;
+
+	default:
+		break;
+	}
+
+	if (specs)
+		print_specifiers(specs, td, depth + 1);
+
+	// the lists come after the first child, which is what they belong to: the callee of the arguments, the name of
+	// the declarations of an identifier list
+	if (children[0])
+		print_node(children[0], td, depth + 1);
+	print_list(list, td, depth + 1);
+	for (int i = 1; i < 4; i++)
+		if (children[i])
+			print_node(children[i], td, depth + 1);
+}
+
+void ast_print(const AstNode *node, const TokenData *td)
+{
+	print_node(node, td, 0);
+}
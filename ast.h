@@ -0,0 +1,298 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "lexer.h"
+
+// clang-format off
+// X(NAME), every kind of node the parser builds. Expressions come first, then declarations and the types they are
+// made of, then statements.
+#define AST_KINDS(X) \
+	X(IDENTIFIER) \
+	X(CONSTANT) \
+	X(CHAR_CONSTANT) \
+	X(STRING_LITERAL) \
+	X(GENERIC) \
+	X(GENERIC_ASSOC) \
+	X(COMPOUND_LITERAL) \
+	X(INDEX) \
+	X(CALL) \
+	X(MEMBER) \
+	X(POINTER_MEMBER) \
+	X(POST_INCREMENT) \
+	X(POST_DECREMENT) \
+	X(UNARY) \
+	X(SIZEOF_EXPR) \
+	X(SIZEOF_TYPE) \
+	X(ALIGNOF) \
+	X(CAST) \
+	X(BINARY) \
+	X(CONDITIONAL) \
+	X(ASSIGN) \
+	X(INIT_LIST) \
+	X(DESIGNATION) \
+	X(INDEX_DESIGNATOR) \
+	X(MEMBER_DESIGNATOR) \
+	X(TRANSLATION_UNIT) \
+	X(DECLARATION) \
+	X(FUNCTION_DEFINITION) \
+	X(STATIC_ASSERT) \
+	X(DECLARATOR) \
+	X(POINTER) \
+	X(ARRAY) \
+	X(FUNCTION) \
+	X(PARAMETER) \
+	X(TYPE_NAME) \
+	X(STRUCT) \
+	X(UNION) \
+	X(ENUM) \
+	X(ENUMERATOR) \
+	X(TYPEDEF_NAME) \
+	X(ATOMIC_TYPE) \
+	X(ALIGNAS) \
+	X(COMPOUND) \
+	X(EXPRESSION_STATEMENT) \
+	X(IF) \
+	X(SWITCH) \
+	X(WHILE) \
+	X(DO_WHILE) \
+	X(FOR) \
+	X(GOTO) \
+	X(CONTINUE) \
+	X(BREAK) \
+	X(RETURN) \
+	X(LABEL) \
+	X(CASE) \
+	X(DEFAULT)
+// clang-format on
+
+#define AST_KIND_ENUM_NAME(name) AST_##name,
+
+typedef enum AstKind
+{
+	AST_KINDS(AST_KIND_ENUM_NAME)
+	NUM_AST_KINDS
+} AstKind;
+
+_Static_assert(NUM_AST_KINDS <= 256, "node kinds are stored in a single byte");
+
+extern const char *const ast_kind_names[];
+
+// first chunk of an arena a syntax tree is parsed into
+#define AST_FIRST_CHUNK (64 * 1024)
+
+// AstNode.flags
+
+// STRUCT, UNION and ENUM with a member list, not just a tag
+#define AST_FLAG_DEFINITION 1
+
+// FUNCTION declared with parameter types, f(void) included, instead of an identifier list or ()
+#define AST_FLAG_PROTOTYPE 2
+
+// FUNCTION with a trailing ...
+#define AST_FLAG_VARIADIC 4
+
+// ARRAY parameter with static in its brackets
+#define AST_FLAG_STATIC 8
+
+// ARRAY of variable length with [*] as its size
+#define AST_FLAG_VLA_STAR 16
+
+// AstSpecifiers.storage
+#define AST_STORAGE_TYPEDEF 1
+#define AST_STORAGE_EXTERN 2
+#define AST_STORAGE_STATIC 4
+#define AST_STORAGE_THREAD_LOCAL 8
+#define AST_STORAGE_AUTO 16
+#define AST_STORAGE_REGISTER 32
+
+// AstSpecifiers.type_specifiers, long is counted in AstSpecifiers.longs instead
+#define AST_TYPE_VOID 1
+#define AST_TYPE_CHAR 2
+#define AST_TYPE_SHORT 4
+#define AST_TYPE_INT 8
+#define AST_TYPE_FLOAT 16
+#define AST_TYPE_DOUBLE 32
+#define AST_TYPE_SIGNED 64
+#define AST_TYPE_UNSIGNED 128
+#define AST_TYPE_BOOL 256
+#define AST_TYPE_COMPLEX 512
+#define AST_TYPE_IMAGINARY 1024
+
+// AstSpecifiers.qualifiers and the qualifiers of POINTER and ARRAY
+#define AST_QUALIFIER_CONST 1
+#define AST_QUALIFIER_RESTRICT 2
+#define AST_QUALIFIER_VOLATILE 4
+#define AST_QUALIFIER_ATOMIC 8
+
+// AstSpecifiers.function
+#define AST_FUNCTION_INLINE 1
+#define AST_FUNCTION_NORETURN 2
+
+struct AstNode;
+
+// The declaration specifiers shared by all declarators of a declaration
+typedef struct AstSpecifiers
+{
+	uint8_t storage;
+	uint8_t qualifiers;
+	uint8_t function;
+	uint8_t longs;
+	uint16_t type_specifiers;
+
+	// STRUCT, UNION, ENUM, TYPEDEF_NAME or ATOMIC_TYPE, NULL when the type is made of the keywords alone
+	struct AstNode *type;
+
+	// ALIGNAS nodes in order
+	struct AstNode *alignas;
+} AstSpecifiers;
+
+// A node of the syntax tree. Every node lives in the arena it was parsed into, lists are linked through next in
+// source order.
+typedef struct AstNode
+{
+	uint8_t kind;
+
+	// the Token of UNARY, BINARY and ASSIGN nodes
+	uint8_t op;
+
+	// AST_FLAG_* bits
+	uint16_t flags;
+
+	// The token the node stands for, or the one it starts at for diagnostics. IDENTIFIER, DECLARATOR, MEMBER,
+	// POINTER_MEMBER, MEMBER_DESIGNATOR, ENUMERATOR, TYPEDEF_NAME, GOTO and LABEL have their name here, a tag for
+	// STRUCT, UNION and ENUM, the payload of CONSTANT, CHAR_CONSTANT and STRING_LITERAL is their value. Abstract
+	// declarators and untagged types have the token they start at, which is never a TOK_IDENTIFIER.
+	LexedToken tok;
+
+	struct AstNode *next;
+
+	union
+	{
+		// BINARY, ASSIGN and INDEX
+		struct
+		{
+			struct AstNode *lhs;
+			struct AstNode *rhs;
+		} binary;
+
+		// UNARY, POST_INCREMENT, POST_DECREMENT, SIZEOF_EXPR, MEMBER, POINTER_MEMBER, INDEX_DESIGNATOR,
+		// ENUMERATOR, EXPRESSION_STATEMENT and RETURN, NULL for the last three when they have none
+		struct AstNode *operand;
+
+		// CALL
+		struct
+		{
+			struct AstNode *callee;
+			struct AstNode *args;
+		} call;
+
+		// CAST, COMPOUND_LITERAL, SIZEOF_TYPE, ALIGNOF, ATOMIC_TYPE, GENERIC_ASSOC, whose type_name is NULL for
+		// default, and ALIGNAS, which has either a type_name or an operand. operand is NULL for SIZEOF_TYPE, ALIGNOF
+		// and ATOMIC_TYPE.
+		struct
+		{
+			struct AstNode *type_name;
+			struct AstNode *operand;
+		} typed;
+
+		// CONDITIONAL and IF, otherwise is NULL for an if without else
+		struct
+		{
+			struct AstNode *cond;
+			struct AstNode *then;
+			struct AstNode *otherwise;
+		} conditional;
+
+		// GENERIC
+		struct
+		{
+			struct AstNode *controlling;
+			struct AstNode *assocs;
+		} generic;
+
+		// INIT_LIST, TRANSLATION_UNIT and COMPOUND
+		struct AstNode *items;
+
+		// DESIGNATION, value is an expression or an INIT_LIST
+		struct
+		{
+			struct AstNode *designators;
+			struct AstNode *value;
+		} designation;
+
+		// DECLARATION, PARAMETER and TYPE_NAME, which have a single declarator. A declaration of nothing but a
+		// type has no declarators.
+		struct
+		{
+			AstSpecifiers *specs;
+			struct AstNode *declarators;
+		} declaration;
+
+		// FUNCTION_DEFINITION, declarations are those of an identifier list
+		struct
+		{
+			AstSpecifiers *specs;
+			struct AstNode *declarator;
+			struct AstNode *declarations;
+			struct AstNode *body;
+		} function;
+
+		// STATIC_ASSERT, message is a STRING_LITERAL
+		struct
+		{
+			struct AstNode *cond;
+			struct AstNode *message;
+		} static_assert_;
+
+		// DECLARATOR. derived is the list of POINTER, ARRAY and FUNCTION nodes that make its type out of the
+		// specifiers, the one closest to the name first: in int *a[3] a is an ARRAY of POINTER. init is the
+		// initializer, bit_width the width of a bit-field member, each NULL when there is none.
+		struct
+		{
+			struct AstNode *derived;
+			struct AstNode *init;
+			struct AstNode *bit_width;
+		} declarator;
+
+		// POINTER and ARRAY, size is NULL for an array of unknown size
+		struct
+		{
+			uint8_t qualifiers;
+			struct AstNode *size;
+		} array;
+
+		// FUNCTION, PARAMETER nodes or the IDENTIFIER nodes of an identifier list
+		struct AstNode *params;
+
+		// STRUCT and UNION members are DECLARATION and STATIC_ASSERT nodes, ENUM members ENUMERATOR nodes
+		struct AstNode *members;
+
+		// SWITCH, WHILE and DO_WHILE
+		struct
+		{
+			struct AstNode *cond;
+			struct AstNode *body;
+		} loop;
+
+		// FOR, init is a DECLARATION or an expression, each of the first three may be NULL
+		struct
+		{
+			struct AstNode *init;
+			struct AstNode *cond;
+			struct AstNode *step;
+			struct AstNode *body;
+		} for_;
+
+		// LABEL, CASE and DEFAULT, value is the expression of a case
+		struct
+		{
+			struct AstNode *value;
+			struct AstNode *body;
+		} labeled;
+	};
+} AstNode;
+
+// Prints the tree under node with one node per line, indented by depth. td is where the names and literals of the
+// tokens are looked up.
+void ast_print(const AstNode *node, const TokenData *td);
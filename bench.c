@@ -0,0 +1,995 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lexer.h"
+#include "num_constant.h"
+#include "parser.h"
+#include "preprocessor.h"
+
+// Throughput of the front end stages on their own, over synthetic corpora that each stress one part of the lexer and
+// over the sources of the compiler itself as a real world project. Every stage is run a number of times on every
+// corpus and the fastest run is reported, along with what that run allocated.
+//
+// With --scaling the stages are instead timed on inputs of doubling size, from BENCH_SCALING_MIN_ITEMS to
+// BENCH_SCALING_MAX_ITEMS (or --max-items) identifiers, nesting levels, operators, macros, string pieces or
+// constants. How their time grows with the size is fitted to a power of it, and the bench fails when the exponent is
+// clearly above 1. Work that is linear per item, like a lookup that scans everything seen so far, shows up there long
+// before an input in the wild is large enough to notice it.
+
+#define BENCH_DEFAULT_SIZE_MB 8
+#define BENCH_DEFAULT_RUNS 3
+#define BENCH_MAX_CORPORA 16
+#define BENCH_MAX_THREADS 8
+
+#define BENCH_SCALING_MIN_ITEMS 1024u
+#define BENCH_SCALING_MAX_ITEMS (1024u * 1024u)
+#define BENCH_SCALING_MAX_POINTS 11
+
+// runs faster than this are mostly timer resolution and setup, they are left out of the fit
+#define BENCH_SCALING_MIN_SECONDS 0.002
+
+// the exponent is fitted over this many of the largest sizes, where growing faster than linear stands out most
+#define BENCH_SCALING_FIT_POINTS 4
+
+// a run taking longer than this ends the doubling for its input, what was measured so far already shows the growth
+#define BENCH_SCALING_MAX_SECONDS 2.0
+
+// Still taken as linear. Larger inputs miss the caches more often, which together with timing noise pushes linear
+// stages up to about 1.3, quadratic ones end up close to 2.
+#define BENCH_SCALING_MAX_EXPONENT 1.5
+
+// Allocation counters, only kept when the bench is linked with malloc, calloc and realloc wrapped (see CMakeLists.txt)
+static atomic_ulong num_allocations;
+static atomic_ulong allocated_bytes;
+
+#ifdef BENCH_COUNT_ALLOCATIONS
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	atomic_fetch_add_explicit(&num_allocations, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&allocated_bytes, size, memory_order_relaxed);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	atomic_fetch_add_explicit(&num_allocations, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&allocated_bytes, count * size, memory_order_relaxed);
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	atomic_fetch_add_explicit(&num_allocations, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&allocated_bytes, size, memory_order_relaxed);
+	return __real_realloc(ptr, size);
+}
+#endif
+
+typedef struct Corpus
+{
+	const char *name;
+	char *source;
+	unsigned long size;
+
+	// spellings of the identifiers and numeric constants, found by lexing the corpus once up front
+	const char **ident_ptrs;
+	uint32_t *ident_lens;
+	uint32_t num_idents;
+	unsigned long ident_bytes;
+	const char **const_ptrs;
+	uint32_t *const_lens;
+	uint32_t num_consts;
+	unsigned long const_bytes;
+} Corpus;
+
+typedef struct BenchOptions
+{
+	unsigned long size;
+	int runs;
+	int threads;
+	const char *json_path;
+
+	int scaling;
+	double max_exponent;
+
+	// largest input of --scaling, BENCH_SCALING_MAX_ITEMS unless --max-items says otherwise
+	uint32_t max_items;
+} BenchOptions;
+
+typedef struct BenchResult
+{
+	const char *corpus;
+	const char *stage;
+	unsigned long bytes;
+	uint32_t tokens;
+	double seconds;
+	unsigned long allocations;
+	unsigned long allocated_bytes;
+} BenchResult;
+
+// How one stage scaled on one kind of input, points are in order of size
+typedef struct ScalingResult
+{
+	const char *input;
+	const char *stage;
+	int num_points;
+	uint32_t items[BENCH_SCALING_MAX_POINTS];
+	unsigned long bytes[BENCH_SCALING_MAX_POINTS];
+	double seconds[BENCH_SCALING_MAX_POINTS];
+
+	// fitted over the largest points, negative when too few of them took long enough to tell
+	double exponent;
+} ScalingResult;
+
+// A stage runs once over a corpus and returns the number of tokens it went through, or -1 when it failed. The chars
+// those tokens were spelled with go to *bytes.
+typedef long (*BenchStage)(const Corpus *corpus, const BenchOptions *options, unsigned long *bytes);
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// xorshift, the corpora are the same on every run of the bench
+static uint64_t next_random(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+typedef struct TextBuffer
+{
+	char *data;
+	unsigned long len;
+	unsigned long cap;
+} TextBuffer;
+
+static void text_append(TextBuffer *tb, const char *str, unsigned long len)
+{
+	if (tb->len + len + 1 > tb->cap)
+	{
+		unsigned long cap = tb->cap ? tb->cap * 2 : 1024 * 1024;
+		while (cap < tb->len + len + 1)
+			cap *= 2;
+
+		tb->data = realloc(tb->data, cap);
+		if (!tb->data)
+		{
+			printf("Error: ran out of memory while generating a corpus\n");
+			exit(EXIT_FAILURE);
+		}
+		tb->cap = cap;
+	}
+
+	memcpy(tb->data + tb->len, str, len);
+	tb->len += len;
+	tb->data[tb->len] = 0;
+}
+
+#define TEXT_APPEND_LITERAL(tb, str) text_append(tb, str, sizeof(str) - 1)
+
+static void text_printf(TextBuffer *tb, const char *fmt, ...)
+{
+	char buf[512];
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	text_append(tb, buf, n < (int)sizeof(buf) ? n : (int)sizeof(buf) - 1);
+}
+
+// Long declarations of many distinct identifiers, what interning is busy with
+static void gen_identifiers(TextBuffer *tb, unsigned long size)
+{
+	static const char *const words[] = {"buffer", "count", "index", "node", "parent", "value", "offset", "table",
+	                                    "entry", "length", "state", "result", "handle", "context", "flags", "cursor"};
+	uint64_t rng = 0x243F6A8885A308D3ull;
+	while (tb->len < size)
+	{
+		uint64_t r = next_random(&rng);
+		text_printf(tb, "static unsigned long %s_%s_%u = %s_%u + %s_%s_%u;\n", words[r & 15], words[(r >> 4) & 15],
+		            (unsigned)(r >> 8) % 50000, words[(r >> 24) & 15], (unsigned)(r >> 28) % 50000,
+		            words[(r >> 44) & 15], words[(r >> 48) & 15], (unsigned)(r >> 52) % 5000);
+	}
+}
+
+// Mostly block and line comments with a little code in between, what the comment skipping is busy with
+static void gen_comments(TextBuffer *tb, unsigned long size)
+{
+	static const char block[] = "/*\n * Walks the table and returns the entry that matches, the caller owns it.\n"
+	                            " * Entries that are marked as deleted are skipped without being looked at.\n */\n";
+	static const char line[] = "// keep the order of the fields in sync with the initializers further down\n";
+	uint64_t rng = 0x13198A2E03707344ull;
+	while (tb->len < size)
+	{
+		uint64_t r = next_random(&rng);
+		text_append(tb, block, sizeof(block) - 1);
+		for (unsigned i = 0; i < 1 + (r & 3); i++)
+			text_append(tb, line, sizeof(line) - 1);
+		text_printf(tb, "int entry_%u;\n", (unsigned)(r >> 32) % 1000);
+	}
+}
+
+// A table of numeric constants, strings and characters, what the literal lexing is busy with
+static void gen_literals(TextBuffer *tb, unsigned long size)
+{
+	uint64_t rng = 0xA4093822299F31D0ull;
+	TEXT_APPEND_LITERAL(tb, "static const struct row rows[] = {\n");
+	while (tb->len < size)
+	{
+		uint64_t r = next_random(&rng);
+		text_printf(tb, "\t{0x%04X, %uu, %u.%03ue-%u, %lluULL, \"row %u\\t\\\"%c\\\"\\n\", '%c', '\\x%02x'},\n",
+		            (unsigned)(r & 0xFFFF), (unsigned)(r >> 16) % 100000, (unsigned)(r >> 20) % 10,
+		            (unsigned)(r >> 24) % 1000, (unsigned)(r >> 34) % 9, (unsigned long long)(r >> 1),
+		            (unsigned)(r >> 40) % 10000, 'a' + (int)((r >> 50) % 26), 'A' + (int)((r >> 55) % 26),
+		            (unsigned)(r >> 56));
+	}
+	TEXT_APPEND_LITERAL(tb, "};\n");
+}
+
+// Dense expressions of short names and operators, what punctuator lexing is busy with
+static void gen_operators(TextBuffer *tb, unsigned long size)
+{
+	static const char *const ops[] = {"+", "-", "*",  "/",  "%", "<<", ">>", "&",
+	                                  "|", "^", "&&", "||", "<", ">=", "==", "!="};
+	static const char *const assign_ops[] = {"=", "+=", "-=", "*=", "/=", "%=", "<<=", ">>=", "&=", "|=", "^="};
+	uint64_t rng = 0x082EFA98EC4E6C89ull;
+	TEXT_APPEND_LITERAL(tb, "void operators(void)\n{\n");
+	while (tb->len < size)
+	{
+		uint64_t r = next_random(&rng);
+		text_printf(tb, "\ta[i++] %s p->b %s (c[j--] %s ~d) %s !e.f %s *g %s (h ? k : l);\n", assign_ops[r % 11],
+		            ops[(r >> 8) & 15], ops[(r >> 12) & 15], ops[(r >> 16) & 15], ops[(r >> 20) & 15],
+		            ops[(r >> 24) & 15]);
+	}
+	TEXT_APPEND_LITERAL(tb, "}\n");
+}
+
+// The sources of the compiler back to back until size is reached. #include lines are left out, so the corpus can be
+// preprocessed on its own without the system headers. The parse stage fails on it as the typedef names those headers
+// declare are never seen.
+static void gen_project(TextBuffer *tb, unsigned long size)
+{
+	DIR *dir = opendir(CCOMPILER_SOURCE_DIR);
+	if (!dir)
+		return;
+
+	TextBuffer once = {0};
+	struct dirent *ent;
+	while ((ent = readdir(dir)))
+	{
+		size_t len = strlen(ent->d_name);
+		if (len < 3 || ent->d_name[len - 2] != '.' || (ent->d_name[len - 1] != 'c' && ent->d_name[len - 1] != 'h'))
+			continue;
+
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/%s", CCOMPILER_SOURCE_DIR, ent->d_name);
+		FILE *f = fopen(path, "r");
+		if (!f)
+			continue;
+
+		char line[4096];
+		while (fgets(line, sizeof(line), f))
+		{
+			const char *p = line + strspn(line, " \t");
+			if (strncmp(p, "#include", 8) != 0 && strncmp(p, "#pragma once", 12) != 0)
+				text_append(&once, line, strlen(line));
+		}
+		fclose(f);
+	}
+	closedir(dir);
+
+	while (once.len && tb->len < size)
+		text_append(tb, once.data, once.len);
+	free(once.data);
+}
+
+// Inputs of the scaling mode, each made of n items of one kind
+
+// n distinct identifiers, every one of them is interned as a new name
+static void scale_identifiers(TextBuffer *tb, uint32_t n)
+{
+	uint64_t rng = 0x452821E638D01377ull;
+	for (uint32_t i = 0; i < n; i++)
+		text_printf(tb, "int name_%x_%u;\n", (unsigned)next_random(&rng) & 0xFFFF, i);
+}
+
+// n levels of parentheses, nested as deep as the parser takes them: deeper than PARSER_MAX_DEPTH it stops with an
+// error instead of running out of stack
+static void scale_nesting(TextBuffer *tb, uint32_t n)
+{
+	const uint32_t max_depth = PARSER_MAX_DEPTH / 2;
+	for (uint32_t i = 0; n; i++)
+	{
+		uint32_t depth = n < max_depth ? n : max_depth;
+		n -= depth;
+
+		text_printf(tb, "int x_%u = ", i);
+		for (uint32_t d = 0; d < depth; d++)
+			TEXT_APPEND_LITERAL(tb, "(x + ");
+		TEXT_APPEND_LITERAL(tb, "1");
+		for (uint32_t d = 0; d < depth; d++)
+			TEXT_APPEND_LITERAL(tb, ")");
+		TEXT_APPEND_LITERAL(tb, ";\n");
+	}
+}
+
+// A single expression of n binary operators of every precedence, which the parser goes through without nesting
+static void scale_operators(TextBuffer *tb, uint32_t n)
+{
+	static const char *const ops[] = {"+", "*", "<<", "||", "-", "<", "&", "/", "==", "^", "&&", "|", "%", ">="};
+	TEXT_APPEND_LITERAL(tb, "int y = x");
+	for (uint32_t i = 0; i < n; i++)
+		text_printf(tb, " %s x", ops[i % (sizeof(ops) / sizeof(ops[0]))]);
+	TEXT_APPEND_LITERAL(tb, ";\n");
+}
+
+// n #if groups inside each other
+static void scale_conditionals(TextBuffer *tb, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++)
+		text_printf(tb, "#if %u\nint x;\n", i + 1);
+	for (uint32_t i = 0; i < n; i++)
+		TEXT_APPEND_LITERAL(tb, "#endif\n");
+}
+
+// n macros each expanding to the one before, the last one is expanded through all of them
+static void scale_macros(TextBuffer *tb, uint32_t n)
+{
+	TEXT_APPEND_LITERAL(tb, "#define M0 0\n");
+	for (uint32_t i = 1; i < n; i++)
+		text_printf(tb, "#define M%u M%u\n", i, i - 1);
+	text_printf(tb, "int x = M%u;\n", n - 1);
+}
+
+// A single string literal of n pieces of text and escapes
+static void scale_string(TextBuffer *tb, uint32_t n)
+{
+	TEXT_APPEND_LITERAL(tb, "const char *s = \"");
+	for (uint32_t i = 0; i < n; i++)
+		TEXT_APPEND_LITERAL(tb, "some text\\t\\\"\\x41");
+	TEXT_APPEND_LITERAL(tb, "\";\n");
+}
+
+// n string literals in a row, concatenated into one
+static void scale_concatenation(TextBuffer *tb, uint32_t n)
+{
+	TEXT_APPEND_LITERAL(tb, "const char *s =\n");
+	for (uint32_t i = 0; i < n; i++)
+		text_printf(tb, "\t\"piece %u\"\n", i);
+	TEXT_APPEND_LITERAL(tb, ";\n");
+}
+
+// n distinct numeric constants of every kind, every one of them is pooled as a new value
+static void scale_constants(TextBuffer *tb, uint32_t n)
+{
+	TEXT_APPEND_LITERAL(tb, "double c[] = {\n");
+	for (uint32_t i = 0; i < n; i++)
+	{
+		switch (i & 3)
+		{
+		case 0:
+			text_printf(tb, "%u,\n", i);
+			break;
+		case 1:
+			text_printf(tb, "0x%XUL,\n", i);
+			break;
+		case 2:
+			text_printf(tb, "%u.%ue-3,\n", i, i & 7);
+			break;
+		default:
+			text_printf(tb, "%ullu,\n", i);
+			break;
+		}
+	}
+	TEXT_APPEND_LITERAL(tb, "};\n");
+}
+
+// Length of the preprocessing number at p, which ends at end
+static uint32_t pp_number_len(const char *p, const char *end)
+{
+	const char *start = p++;
+	while (p < end && (isalnum((unsigned char)*p) || *p == '_' || *p == '.' ||
+	                   ((*p == '+' || *p == '-') && strchr("eEpP", p[-1]))))
+		p++;
+	return p - start;
+}
+
+// Lexes the corpus once to find the spellings the intern and constant stages work on. Returns !0 on failure.
+static int index_corpus(Corpus *corpus)
+{
+	CharBuffer cb;
+	cb_init_view(&cb, corpus->source, 0, corpus->size);
+	TokenData *td = tokenize(&cb);
+	if (!td)
+		return 1;
+
+	uint32_t num_tokens = td->_tok_idx;
+	corpus->ident_ptrs = malloc((num_tokens + 1) * sizeof(char *));
+	corpus->ident_lens = malloc((num_tokens + 1) * sizeof(uint32_t));
+	corpus->const_ptrs = malloc((num_tokens + 1) * sizeof(char *));
+	corpus->const_lens = malloc((num_tokens + 1) * sizeof(uint32_t));
+	if (!corpus->ident_ptrs || !corpus->ident_lens || !corpus->const_ptrs || !corpus->const_lens)
+	{
+		free_token_data(td);
+		return 1;
+	}
+
+	const char *end = corpus->source + corpus->size;
+	for (uint32_t i = 0; i < num_tokens; i++)
+	{
+		const char *p = corpus->source + td->offsets[i];
+		if (td->kinds[i] == TOK_IDENTIFIER)
+		{
+			corpus->ident_ptrs[corpus->num_idents] = p;
+			corpus->ident_lens[corpus->num_idents] = intern_len(td->identifiers, td->payloads[i]);
+			corpus->ident_bytes += corpus->ident_lens[corpus->num_idents++];
+		}
+		else if (td->kinds[i] == TOK_NUMERICAL_CONSTANT)
+		{
+			corpus->const_ptrs[corpus->num_consts] = p;
+			corpus->const_lens[corpus->num_consts] = pp_number_len(p, end);
+			corpus->const_bytes += corpus->const_lens[corpus->num_consts++];
+		}
+	}
+
+	free_token_data(td);
+	return 0;
+}
+
+static long stage_tokenize(const Corpus *corpus, const BenchOptions *options, unsigned long *bytes)
+{
+	*bytes = corpus->size;
+	CharBuffer cb;
+	cb_init_view(&cb, corpus->source, 0, corpus->size);
+	TokenData *td = tokenize(&cb);
+	if (!td)
+		return -1;
+
+	long tokens = td->_tok_idx;
+	free_token_data(td);
+	return tokens;
+}
+
+static long stage_tokenize_parallel(const Corpus *corpus, const BenchOptions *options, unsigned long *bytes)
+{
+	*bytes = corpus->size;
+	CharBuffer cb;
+	cb_init_view(&cb, corpus->source, 0, corpus->size);
+	TokenData *td = tokenize_parallel(&cb, options->threads, 0);
+	if (!td)
+		return -1;
+
+	long tokens = td->_tok_idx;
+	free_token_data(td);
+	return tokens;
+}
+
+// Interns every identifier of the corpus into a new table, what the lexer does for each of them
+static long stage_intern(const Corpus *corpus, const BenchOptions *options, unsigned long *bytes)
+{
+	*bytes = corpus->ident_bytes;
+	Arena arena;
+	arena_init(&arena, 64 * 1024);
+	InternTable *it = alloc_intern_table(&arena);
+	long res = it ? corpus->num_idents : -1;
+
+	for (uint32_t i = 0; it && i < corpus->num_idents; i++)
+	{
+		if (intern(it, corpus->ident_ptrs[i], corpus->ident_lens[i]) == INTERN_NO_ID)
+		{
+			res = -1;
+			break;
+		}
+	}
+
+	arena_release(&arena);
+	return res;
+}
+
+// Converts and pools every numeric constant of the corpus, what the lexer does for each of them
+static long stage_num_constant(const Corpus *corpus, const BenchOptions *options, unsigned long *bytes)
+{
+	*bytes = corpus->const_bytes;
+	Arena arena;
+	arena_init(&arena, 64 * 1024);
+	NumConstantPool *pool = alloc_num_constant_pool(&arena);
+	long res = pool ? corpus->num_consts : -1;
+
+	for (uint32_t i = 0; pool && i < corpus->num_consts; i++)
+	{
+		NumConstant nc;
+		if (convert_num_constant(corpus->const_ptrs[i], corpus->const_lens[i], &nc) == NULL &&
+		    pool_num_constant(pool, &nc) == NUM_CONSTANT_NO_IDX)
+		{
+			res = -1;
+			break;
+		}
+	}
+
+	arena_release(&arena);
+	return res;
+}
+
+// Lexing, directives, macro expansion and string literal concatenation, everything the parser is handed tokens by
+static long stage_preprocess(const Corpus *corpus, const BenchOptions *options, unsigned long *bytes)
+{
+	*bytes = corpus->size;
+	CharBuffer cb;
+	cb_init_view(&cb, corpus->source, 0, corpus->size);
+
+	PreprocessorOptions pp_options = {0};
+	Preprocessor pp;
+	long tokens = -1;
+	if (pp_init(&pp, &cb, corpus->name, &pp_options) == 0)
+	{
+		LexedToken tok;
+		int res;
+		while ((res = pp_next(&pp, &tok)) > 0)
+			;
+		if (res == 0)
+			tokens = pp.num_tokens;
+	}
+
+	pp_free(&pp);
+	return tokens;
+}
+
+// Preprocessing and parsing into a syntax tree, everything before code generation
+static long stage_parse(const Corpus *corpus, const BenchOptions *options, unsigned long *bytes)
+{
+	*bytes = corpus->size;
+	CharBuffer cb;
+	cb_init_view(&cb, corpus->source, 0, corpus->size);
+
+	PreprocessorOptions pp_options = {0};
+	Preprocessor pp;
+	long tokens = -1;
+	if (pp_init(&pp, &cb, corpus->name, &pp_options) == 0)
+	{
+		Arena ast;
+		arena_init(&ast, AST_FIRST_CHUNK);
+		AstNode *tu;
+		if (parse(&pp, NULL, &ast, &tu) == PARSER_NO_ERROR)
+			tokens = pp.num_tokens;
+		arena_release(&ast);
+	}
+
+	pp_free(&pp);
+	return tokens;
+}
+
+// Stages that go through a whole source on their own are also checked for how they scale, the intern and constant
+// stages are covered by them
+static const struct
+{
+	const char *name;
+	BenchStage run;
+	int scaling;
+} stages[] = {
+	{"tokenize", stage_tokenize, 1},
+	{"tokenize_parallel", stage_tokenize_parallel, 0},
+	{"intern", stage_intern, 0},
+	{"num_constant", stage_num_constant, 0},
+	{"preprocess", stage_preprocess, 1},
+	{"parse", stage_parse, 1},
+};
+
+#define NUM_STAGES (sizeof(stages) / sizeof(stages[0]))
+
+// Runs stage over corpus options->runs times and keeps the fastest run. Returns !0 when the stage failed.
+static int run_stage(const Corpus *corpus, int stage, const BenchOptions *options, BenchResult *result)
+{
+	*result = (BenchResult){corpus->name, stages[stage].name};
+	result->seconds = -1;
+
+	for (int run = 0; run < options->runs; run++)
+	{
+		unsigned long allocations = atomic_load(&num_allocations);
+		unsigned long bytes = atomic_load(&allocated_bytes);
+		double start = now();
+		long tokens = stages[stage].run(corpus, options, &result->bytes);
+		double seconds = now() - start;
+		if (tokens < 0)
+			return 1;
+
+		if (result->seconds < 0 || seconds < result->seconds)
+		{
+			result->seconds = seconds;
+			result->tokens = tokens;
+			result->allocations = atomic_load(&num_allocations) - allocations;
+			result->allocated_bytes = atomic_load(&allocated_bytes) - bytes;
+		}
+	}
+
+	return 0;
+}
+
+static void print_result(const BenchResult *r)
+{
+	double mb = r->bytes / (1024.0 * 1024.0);
+	printf("%-14s %-18s %9.1f %9.2f %8.2f", r->corpus, r->stage, mb / r->seconds, r->tokens / r->seconds * 1e-6,
+	       r->tokens ? r->seconds * 1e9 / r->tokens : 0.0);
+#ifdef BENCH_COUNT_ALLOCATIONS
+	printf(" %9lu %9.1f\n", r->allocations, r->allocated_bytes / (1024.0 * 1024.0));
+#else
+	printf(" %9s %9s\n", "-", "-");
+#endif
+}
+
+static int write_json(const char *path, const BenchResult *results, int num_results, const BenchOptions *options)
+{
+	FILE *f = fopen(path, "w");
+	if (!f)
+	{
+		printf("Error: failed to open %s for writing\n", path);
+		return 1;
+	}
+
+	fprintf(f, "{\n  \"runs\": %d,\n  \"threads\": %d,\n  \"results\": [\n", options->runs, options->threads);
+	for (int i = 0; i < num_results; i++)
+	{
+		const BenchResult *r = &results[i];
+		fprintf(f,
+		        "    {\"corpus\": \"%s\", \"stage\": \"%s\", \"bytes\": %lu, \"tokens\": %u, \"seconds\": %.9f, "
+		        "\"mb_per_s\": %.3f, \"tokens_per_s\": %.1f, \"ns_per_token\": %.3f",
+		        r->corpus, r->stage, r->bytes, r->tokens, r->seconds, r->bytes / (1024.0 * 1024.0) / r->seconds,
+		        r->tokens / r->seconds, r->tokens ? r->seconds * 1e9 / r->tokens : 0.0);
+#ifdef BENCH_COUNT_ALLOCATIONS
+		fprintf(f, ", \"allocations\": %lu, \"allocated_bytes\": %lu", r->allocations, r->allocated_bytes);
+#else
+		fprintf(f, ", \"allocations\": null, \"allocated_bytes\": null");
+#endif
+		fprintf(f, "}%s\n", i + 1 < num_results ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+
+	return fclose(f) != 0;
+}
+
+// Least squares slope of log seconds over log items, which is the exponent of the growth. Only the largest points
+// are fitted, down to the first that ran too short to be measured. Returns -1 when fewer than 3 are left.
+static double fit_exponent(const ScalingResult *sr)
+{
+	int first = sr->num_points;
+	while (first > 0 && sr->num_points - first < BENCH_SCALING_FIT_POINTS &&
+	       sr->seconds[first - 1] >= BENCH_SCALING_MIN_SECONDS)
+		first--;
+
+	int n = sr->num_points - first;
+	if (n < 3)
+		return -1;
+
+	double sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+	for (int i = first; i < sr->num_points; i++)
+	{
+		double x = log(sr->items[i]);
+		double y = log(sr->seconds[i]);
+		sum_x += x;
+		sum_y += y;
+		sum_xx += x * x;
+		sum_xy += x * y;
+	}
+	return (n * sum_xy - sum_x * sum_y) / (n * sum_xx - sum_x * sum_x);
+}
+
+static int write_scaling_json(const char *path, const ScalingResult *results, int num_results,
+                              const BenchOptions *options)
+{
+	FILE *f = fopen(path, "w");
+	if (!f)
+	{
+		printf("Error: failed to open %s for writing\n", path);
+		return 1;
+	}
+
+	fprintf(f, "{\n  \"runs\": %d,\n  \"max_exponent\": %.3f,\n  \"results\": [\n", options->runs,
+	        options->max_exponent);
+	for (int i = 0; i < num_results; i++)
+	{
+		const ScalingResult *sr = &results[i];
+		fprintf(f, "    {\"input\": \"%s\", \"stage\": \"%s\", ", sr->input, sr->stage);
+		if (sr->exponent < 0)
+			fprintf(f, "\"exponent\": null, \"points\": [");
+		else
+			fprintf(f, "\"exponent\": %.3f, \"points\": [", sr->exponent);
+
+		for (int j = 0; j < sr->num_points; j++)
+			fprintf(f, "%s{\"items\": %u, \"bytes\": %lu, \"seconds\": %.9f}", j ? ", " : "", sr->items[j],
+			        sr->bytes[j], sr->seconds[j]);
+		fprintf(f, "]}%s\n", i + 1 < num_results ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+
+	return fclose(f) != 0;
+}
+
+// Times every scaling stage on every input at doubling sizes. Returns !0 when a stage failed or its time grew
+// faster than linear.
+static int run_scaling(const BenchOptions *options)
+{
+	static const struct
+	{
+		const char *name;
+		void (*generate)(TextBuffer *tb, uint32_t n);
+	} inputs[] = {
+		{"identifiers", scale_identifiers},
+		{"nesting", scale_nesting},
+		{"operators", scale_operators},
+		{"conditionals", scale_conditionals},
+		{"macros", scale_macros},
+		{"string", scale_string},
+		{"concatenation", scale_concatenation},
+		{"constants", scale_constants},
+	};
+	const int num_inputs = sizeof(inputs) / sizeof(inputs[0]);
+
+	ScalingResult *results = calloc(num_inputs * NUM_STAGES, sizeof(ScalingResult));
+	int *stage_of = calloc(num_inputs * NUM_STAGES, sizeof(int));
+	int num_results = 0;
+	int failed = !results || !stage_of;
+
+	printf("%-14s %-12s %9s %8s %10s %8s %9s\n", "input", "stage", "items", "MB", "ms", "ns/item", "exponent");
+	for (int i = 0; i < num_inputs && !failed; i++)
+	{
+		ScalingResult *first = &results[num_results];
+		int num_stages = 0;
+		for (size_t s = 0; s < NUM_STAGES; s++)
+		{
+			if (!stages[s].scaling)
+				continue;
+
+			first[num_stages] = (ScalingResult){inputs[i].name, stages[s].name};
+			stage_of[num_results + num_stages++] = s;
+		}
+
+		// a stage drops out of the doubling once it fails or gets too slow
+		int *active = &stage_of[num_results];
+		int num_active = num_stages;
+		for (uint32_t n = BENCH_SCALING_MIN_ITEMS; n <= options->max_items && num_active; n *= 2)
+		{
+			TextBuffer tb = {0};
+			inputs[i].generate(&tb, n);
+			Corpus corpus = {inputs[i].name, tb.data, tb.len};
+
+			for (int k = 0; k < num_stages; k++)
+			{
+				ScalingResult *sr = &first[k];
+				if (active[k] < 0)
+					continue;
+
+				BenchResult r;
+				if (run_stage(&corpus, active[k], options, &r))
+				{
+					printf("%-14s %-12s %9u failed\n", sr->input, sr->stage, n);
+					failed = 1;
+					active[k] = -1;
+					num_active--;
+					continue;
+				}
+
+				sr->items[sr->num_points] = n;
+				sr->bytes[sr->num_points] = tb.len;
+				sr->seconds[sr->num_points++] = r.seconds;
+				if (r.seconds > BENCH_SCALING_MAX_SECONDS)
+				{
+					active[k] = -1;
+					num_active--;
+				}
+			}
+			free(tb.data);
+		}
+
+		for (int k = 0; k < num_stages; k++)
+		{
+			ScalingResult *sr = &first[k];
+			sr->exponent = fit_exponent(sr);
+			if (!sr->num_points)
+				continue;
+
+			int last = sr->num_points - 1;
+			printf("%-14s %-12s %9u %8.1f %10.2f %8.1f", sr->input, sr->stage, sr->items[last],
+			       sr->bytes[last] / (1024.0 * 1024.0), sr->seconds[last] * 1e3,
+			       sr->seconds[last] * 1e9 / sr->items[last]);
+			if (sr->exponent < 0)
+				printf(" %9s\n", "-");
+			else
+				printf(" %9.2f%s\n", sr->exponent, sr->exponent > options->max_exponent ? "  too steep" : "");
+		}
+		num_results += num_stages;
+	}
+
+	for (int i = 0; i < num_results; i++)
+	{
+		if (results[i].exponent > options->max_exponent)
+		{
+			printf("Error: %s grows with the size of the %s input to the power of %.2f, more than %.2f\n",
+			       results[i].stage, results[i].input, results[i].exponent, options->max_exponent);
+			failed = 1;
+		}
+	}
+
+	if (options->json_path && results && write_scaling_json(options->json_path, results, num_results, options))
+		failed = 1;
+
+	free(results);
+	free(stage_of);
+	return failed;
+}
+
+static void usage(void)
+{
+	printf("Usage: ccompiler_bench [--size MB] [--runs N] [--threads N] [--json FILE] [FILE...]\n"
+	       "       ccompiler_bench --scaling [--max-exponent X] [--max-items N] [--runs N] [--json FILE]\n"
+	       "Every FILE is benchmarked as a corpus of its own next to the generated ones. --scaling checks that the\n"
+	       "stages take linear time in the size of their input instead, it fails when one grows with an exponent\n"
+	       "above X (%.1f by default). Inputs double in size up to N items (%u by default).\n",
+	       BENCH_SCALING_MAX_EXPONENT, BENCH_SCALING_MAX_ITEMS);
+}
+
+int main(int argc, char *argv[])
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	BenchOptions options = {BENCH_DEFAULT_SIZE_MB * 1024ul * 1024ul, BENCH_DEFAULT_RUNS,
+	                        cpus > BENCH_MAX_THREADS ? BENCH_MAX_THREADS : cpus > 1 ? (int)cpus : 2};
+	options.max_exponent = BENCH_SCALING_MAX_EXPONENT;
+	options.max_items = BENCH_SCALING_MAX_ITEMS;
+
+	Corpus corpora[BENCH_MAX_CORPORA] = {0};
+	int num_corpora = 0;
+
+	static const struct
+	{
+		const char *name;
+		void (*generate)(TextBuffer *tb, unsigned long size);
+	} generators[] = {
+		{"identifiers", gen_identifiers},
+		{"comments", gen_comments},
+		{"literals", gen_literals},
+		{"operators", gen_operators},
+		{"project", gen_project},
+	};
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+		{
+			options.size = strtoul(argv[++i], NULL, 10) * 1024ul * 1024ul;
+		}
+		else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+		{
+			options.runs = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			options.threads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+		{
+			options.json_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--scaling") == 0)
+		{
+			options.scaling = 1;
+		}
+		else if (strcmp(argv[i], "--max-exponent") == 0 && i + 1 < argc)
+		{
+			options.max_exponent = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--max-items") == 0 && i + 1 < argc)
+		{
+			options.max_items = strtoul(argv[++i], NULL, 10);
+		}
+		else if (argv[i][0] == '-')
+		{
+			usage();
+			return EXIT_FAILURE;
+		}
+		else if (num_corpora < BENCH_MAX_CORPORA - (int)(sizeof(generators) / sizeof(generators[0])))
+		{
+			CharBuffer *cb = open_char_buffer(argv[i], 0);
+			const char *source = cb ? cb_resident_source(cb) : NULL;
+			if (!source)
+			{
+				printf("Error: failed to read %s\n", argv[i]);
+				if (cb)
+					delete_char_buffer(cb);
+				return EXIT_FAILURE;
+			}
+
+			// kept in memory of its own, the stages only ever see a view of it
+			Corpus *c = &corpora[num_corpora++];
+			c->name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+			c->size = cb->_size;
+			c->source = malloc(c->size + 1);
+			if (!c->source)
+				return EXIT_FAILURE;
+			memcpy(c->source, source, c->size);
+			delete_char_buffer(cb);
+		}
+	}
+
+	if (!options.size || options.runs < 1 || options.threads < 1 || options.max_exponent <= 0 ||
+	    options.max_items < BENCH_SCALING_MIN_ITEMS ||
+	    (options.scaling && num_corpora))
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	if (options.scaling)
+		return run_scaling(&options) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	for (size_t i = 0; i < sizeof(generators) / sizeof(generators[0]); i++)
+	{
+		TextBuffer tb = {0};
+		generators[i].generate(&tb, options.size);
+		if (!tb.len)
+			continue;
+
+		Corpus *c = &corpora[num_corpora++];
+		c->name = generators[i].name;
+		c->source = tb.data;
+		c->size = tb.len;
+	}
+
+	BenchResult *results = calloc(num_corpora * NUM_STAGES, sizeof(BenchResult));
+	int num_results = 0;
+	int failed = !results;
+
+	printf("%-14s %-18s %9s %9s %8s %9s %9s\n", "corpus", "stage", "MB/s", "Mtok/s", "ns/tok", "allocs", "alloc MB");
+	for (int i = 0; i < num_corpora && !failed; i++)
+	{
+		if (index_corpus(&corpora[i]))
+		{
+			printf("Error: failed to lex the %s corpus\n", corpora[i].name);
+			failed = 1;
+			break;
+		}
+
+		for (size_t s = 0; s < NUM_STAGES; s++)
+		{
+			// a corpus the stage cannot get through is left out, real world files need not preprocess on their own
+			if (run_stage(&corpora[i], s, &options, &results[num_results]))
+			{
+				printf("%-14s %-18s failed\n", corpora[i].name, stages[s].name);
+				continue;
+			}
+
+			// nothing to measure, a corpus without constants for one
+			if (results[num_results].tokens)
+				print_result(&results[num_results++]);
+		}
+	}
+
+	if (!failed && options.json_path)
+		failed = write_json(options.json_path, results, num_results, &options);
+
+	for (int i = 0; i < num_corpora; i++)
+	{
+		free(corpora[i].source);
+		free(corpora[i].ident_ptrs);
+		free(corpora[i].ident_lens);
+		free(corpora[i].const_ptrs);
+		free(corpora[i].const_lens);
+	}
+	free(results);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,61 +1,313 @@
 #include "char_buffer.h"
 
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-CharBuffer *alloc_char_buffer(unsigned long max_size)
+#include "alloc.h"
+
+static CharBuffer *new_char_buffer(const char *buf, unsigned long size, int mapped)
 {
-	CharBuffer *res = calloc(1, sizeof(CharBuffer));
-	res->_buf = calloc(max_size, sizeof(char));
+	CharBuffer *res = mem_calloc(1, sizeof(CharBuffer));
+	res->_buf = buf;
+	res->_base = 0;
 	res->_cur_idx = -1;
-	res->_max_size = max_size;
+	res->_max_size = size;
+	res->_size = size;
+	res->_mapped = mapped;
+	res->_fd = -1;
 	res->eob = 0;
 	return res;
 }
 
-void delete_char_buffer(CharBuffer *cb)
+// One past the absolute offset of the last valid byte in the window
+static long long cb_end(const CharBuffer *cb)
 {
-	free(cb->_buf);
-	free(cb);
+	return cb->_base + (long long)cb->_size;
 }
 
-int cb_next(CharBuffer *cb)
+// Slides the window so that it starts at most CB_REWIND bytes behind the cursor, then reads until the byte at offset
+// need is in the window or the descriptor hits EOF. With top_up set at least one read is attempted even if that is
+// already the case. Returns non-zero on a read error.
+static int cb_refill(CharBuffer *cb, long long need, int top_up)
 {
-	if (cb->eob)
-		return 0;
+	char *window = (char *)cb->_buf;
 
-	cb->_cur_idx++;
+	long long keep_from = cb->_cur_idx - CB_REWIND;
+	if (keep_from < cb->_base)
+		keep_from = cb->_base;
 
-	if (cb->_cur_idx >= cb->_size || cb->_cur_idx >= cb->_max_size)
+	unsigned long keep = cb_end(cb) - keep_from;
+	if (keep_from > cb->_base)
 	{
-		cb->eob = 1;
+		memmove(window, window + (keep_from - cb->_base), keep);
+		cb->_base = keep_from;
+		cb->_size = keep;
+	}
+
+	while (!cb->_fd_eof && cb->_size < cb->_max_size && (need >= cb_end(cb) || top_up))
+	{
+		ssize_t n = read(cb->_fd, window + cb->_size, cb->_max_size - cb->_size);
+		if (n < 0)
+			return 1;
+		if (n == 0)
+			cb->_fd_eof = 1;
+		cb->_size += n;
+		top_up = 0;
+	}
+
+	return 0;
+}
+
+// Returns the length of the line splice (a backslash right before a new line) starting at offset idx, 0 if there is
+// none. When streaming the window is refilled as far as the splice could reach.
+static unsigned long splice_at(CharBuffer *cb, long long idx)
+{
+	if (idx < cb_end(cb) && cb->_buf[idx - cb->_base] != '\\')
+		return 0;
+
+	if (cb->_fd != -1 && !cb->_fd_eof && idx + 2 >= cb_end(cb) && cb_refill(cb, idx + 2, 0))
+		return 0;
+
+	long long end = cb_end(cb);
+	const char *p = cb->_buf + (idx - cb->_base);
+	if (idx + 1 >= end || p[0] != '\\')
 		return 0;
+	if (p[1] == '\n')
+		return 2;
+	return idx + 2 < end && p[1] == '\r' && p[2] == '\n' ? 3 : 0;
+}
+
+// Returns the length of the line splice ending at offset idx, 0 if there is none
+static unsigned long splice_before(const CharBuffer *cb, long long idx)
+{
+	const char *p = cb->_buf + (idx - cb->_base);
+	if (idx - 1 < cb->_base || p[0] != '\n')
+		return 0;
+	if (p[-1] == '\\')
+		return 2;
+	return idx - 2 >= cb->_base && p[-1] == '\r' && p[-2] == '\\' ? 3 : 0;
+}
+
+// Moves the cursor past the splices right after it, every one of them is reported to on_splice
+static void skip_splices(CharBuffer *cb)
+{
+	unsigned long n;
+	while ((n = splice_at(cb, cb->_cur_idx + 1)))
+	{
+		cb->_cur_idx += n;
+		if (cb->on_splice)
+			cb->on_splice(cb->splice_ctx, cb->_cur_idx + 1);
 	}
+}
 
-	cb->cur_char = cb->_buf[cb->_cur_idx];
+// The char after the cursor once splices are taken out, 0 at the end of the source
+static char spliced_next_char(CharBuffer *cb)
+{
+	long long idx = cb->_cur_idx + 1;
+	unsigned long n;
+	while ((n = splice_at(cb, idx)))
+		idx += n;
 
-	if (cb->_cur_idx + 1 < cb->_size)
+	// the buffer is not NUL terminated, reading past _size could fault on a mapped page boundary
+	return idx < cb_end(cb) ? cb->_buf[idx - cb->_base] : 0;
+}
+
+// Returns the offset of the first line splice at or after offset from, or where the window ends if there is none in
+// it. When streaming, a backslash at the very end of the window could still turn out to be a splice so it is not
+// included either, unless nothing else is left.
+static long long find_splice(const CharBuffer *cb, long long from)
+{
+	long long end = cb_end(cb);
+	const char *p = cb->_buf + (from - cb->_base);
+	const char *stop = cb->_buf + (end - cb->_base);
+	while ((p = memchr(p, '\\', stop - p)))
 	{
-		cb->next_char = cb->_buf[cb->_cur_idx + 1];
+		long long idx = cb->_base + (p - cb->_buf);
+		int unknown = cb->_fd != -1 && !cb->_fd_eof && idx + 2 >= end && idx > from;
+		if (unknown || (idx + 1 < end && p[1] == '\n') || (idx + 2 < end && p[1] == '\r' && p[2] == '\n'))
+			return idx;
+		p++;
 	}
+
+	return end;
+}
+
+CharBuffer *char_buffer_stream_fd(int fd, unsigned long window)
+{
+	// the window has to hold the rewind area plus the current and next char
+	if (window < CB_REWIND + 2)
+		window = CB_REWIND + 2;
+
+	char *buf = mem_alloc(window);
+	if (!buf)
+		return NULL;
+
+	CharBuffer *res = new_char_buffer(buf, 0, 0);
+	res->_max_size = window;
+	res->_fd = fd;
+
+	// prime the window so callers can tell an empty input from _size like with resident buffers
+	res->_cur_idx = 0;
+	if (cb_refill(res, 1, 0))
+	{
+		delete_char_buffer(res);
+		return NULL;
+	}
+	res->_cur_idx = -1;
+
+	return res;
+}
+
+CharBuffer *char_buffer_from_fd(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+		return NULL;
+
+	// mmap refuses zero length mappings so empty files are streamed as well
+	if (!S_ISREG(st.st_mode) || st.st_size <= 0)
+		return char_buffer_stream_fd(fd, CB_STREAM_WINDOW);
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return char_buffer_stream_fd(fd, CB_STREAM_WINDOW);
+
+	// the lexer walks the source front to back exactly once
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	return new_char_buffer(map, st.st_size, 1);
+}
+
+CharBuffer *open_char_buffer(const char *file_name, int stream)
+{
+	if (strcmp(file_name, "-") == 0)
+		return char_buffer_stream_fd(STDIN_FILENO, CB_STREAM_WINDOW);
+
+	int fd = open(file_name, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	CharBuffer *res = stream ? char_buffer_stream_fd(fd, CB_STREAM_WINDOW) : char_buffer_from_fd(fd);
+
+	// a mapping stays valid after the descriptor is closed, a stream keeps reading from it
+	if (res && res->_fd == fd)
+		res->_owns_fd = 1;
 	else
+		close(fd);
+
+	return res;
+}
+
+void delete_char_buffer(CharBuffer *cb)
+{
+	if (cb->_mapped)
+		munmap((void *)cb->_buf, cb->_size);
+	else
+		mem_free((void *)cb->_buf);
+	if (cb->_owns_fd)
+		close(cb->_fd);
+	mem_free(cb);
+}
+
+void cb_init_view(CharBuffer *cb, const char *source, long long start, unsigned long size)
+{
+	memset(cb, 0, sizeof(CharBuffer));
+	cb->_buf = source + start;
+	cb->_base = start;
+	cb->_cur_idx = start - 1;
+	cb->_max_size = size;
+	cb->_size = size;
+	cb->_fd = -1;
+}
+
+int cb_next(CharBuffer *cb)
+{
+	if (cb->eob)
+		return 0;
+
+	// a line splice is skipped as if it was not there (translation phase 2), the cursor only ever lands on a char
+	// that is left once they are taken out
+	skip_splices(cb);
+	cb->_cur_idx++;
+
+	if (cb->_fd != -1 && cb->_cur_idx + 1 >= cb_end(cb) && !cb->_fd_eof)
 	{
-		cb->next_char = 0;
+		if (cb_refill(cb, cb->_cur_idx + 1, 0))
+		{
+			cb->eob = 1;
+			return 0;
+		}
 	}
 
+	if (cb->_cur_idx >= cb_end(cb))
+	{
+		cb->eob = 1;
+		return 0;
+	}
+
+	cb->cur_char = cb->_buf[cb->_cur_idx - cb->_base];
+	cb->next_char = spliced_next_char(cb);
 	return 1;
 }
 
+// Only the last CB_REWIND chars are guaranteed to be reachable when streaming
 int cb_back(CharBuffer *cb)
 {
 	if (cb->eob)
 		return 0;
 
-	if (cb->_cur_idx > 0)
+	if (cb->_cur_idx > cb->_base)
 	{
 		cb->_cur_idx--;
-		cb->cur_char = cb->_buf[cb->_cur_idx];
-		cb->next_char = cb->_buf[cb->_cur_idx + 1];
+
+		// the splices cb_next skipped to get here, they are reported again when it skips them the next time
+		unsigned long n;
+		while ((n = splice_before(cb, cb->_cur_idx)) && cb->_cur_idx - (long long)n >= cb->_base)
+			cb->_cur_idx -= n;
+
+		cb->cur_char = cb->_buf[cb->_cur_idx - cb->_base];
+		cb->next_char = spliced_next_char(cb);
 	}
 
 	return 1;
 }
+
+unsigned long cb_lookahead(CharBuffer *cb, const char **run)
+{
+	if (cb->eob)
+		return 0;
+
+	// top the window up first so that runs are not cut short right before a refill
+	if (cb->_fd != -1 && !cb->_fd_eof && cb_end(cb) - cb->_cur_idx < cb->_max_size / 2)
+	{
+		if (cb_refill(cb, cb->_cur_idx + 1, 1))
+			return 0;
+	}
+
+	// the run starts after any splices and ends before the next one, so the scan kernels only ever see spliced input
+	skip_splices(cb);
+	long long start = cb->_cur_idx + 1;
+	if (cb->_next_splice <= start)
+		cb->_next_splice = find_splice(cb, start);
+
+	*run = cb->_buf + (start - cb->_base);
+	return cb->_next_splice - start;
+}
+
+const char *cb_resident_source(const CharBuffer *cb)
+{
+	return cb->_fd == -1 ? cb->_buf - cb->_base : NULL;
+}
+
+void cb_advance(CharBuffer *cb, unsigned long n)
+{
+	if (n == 0)
+		return;
+
+	cb->_cur_idx += n - 1;
+	cb_next(cb);
+}
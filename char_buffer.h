@@ -1,22 +1,68 @@
 #pragma once
 
+// Size of the window used when streaming from a descriptor
+#define CB_STREAM_WINDOW (64 * 1024)
+
+// Number of bytes behind the cursor that cb_back is guaranteed to reach in streaming mode
+#define CB_REWIND 16
+
 typedef struct CharBuffer
 {
-	char *_buf;
-	int _cur_idx;
+	// Either the whole source (mapped or read into memory) or the current window of a stream
+	const char *_buf;
+
+	// Absolute offset of _buf[0] in the source, always 0 unless streaming
+	long long _base;
+	long long _cur_idx;
 
+	// Capacity of _buf and how many of those bytes are valid
 	unsigned long _max_size;
 	unsigned long _size;
 
+	// non-zero if _buf is a read-only mapping of the source file rather than a heap copy
+	int _mapped;
+
+	// descriptor the window is refilled from, -1 if the whole source is resident
+	int _fd;
+	int _owns_fd;
+	int _fd_eof;
+
 	// end-of-buffer
 	int eob;
 
+	// Line splices are skipped by every function below, cur_char and next_char are never the backslash or new line of
+	// one. on_splice is told the offset of the line each skipped splice joins on, with splice_ctx passed along.
 	char cur_char;
 	char next_char;
+	void (*on_splice)(void *ctx, long long line_start);
+	void *splice_ctx;
+
+	// offset of the next line splice cb_lookahead found, runs it hands out stop there
+	long long _next_splice;
 } CharBuffer;
 
-CharBuffer *alloc_char_buffer(unsigned long max_size);
+// Opens file_name for reading, "-" reads from stdin. Regular files are mapped directly unless stream is set,
+// anything else (pipes, terminals) is streamed through a fixed size window. Returns NULL on failure.
+CharBuffer *open_char_buffer(const char *file_name, int stream);
+CharBuffer *char_buffer_from_fd(int fd);
+CharBuffer *char_buffer_stream_fd(int fd, unsigned long window);
 void delete_char_buffer(CharBuffer *cb);
 
+// Sets cb up to read bytes [start, start + size) of a resident source, offsets are still those of the whole source.
+// The view does not own the source and must not be passed to delete_char_buffer.
+void cb_init_view(CharBuffer *cb, const char *source, long long start, unsigned long size);
+
 int cb_next(CharBuffer *cb);
 int cb_back(CharBuffer *cb);
+
+// Points *run at the chars after the cursor that are already in memory and returns how many there are. When
+// streaming this can be fewer than what is left in the source, 0 means the end of the source. A run never holds a
+// line splice, the cursor is moved onto the new line of the splices right after it and the run ends before the next.
+unsigned long cb_lookahead(CharBuffer *cb, const char **run);
+
+// Returns the whole source if it is resident in memory and NULL when streaming, indexed by source offset even for a
+// view. The source stays valid until the char buffer is deleted, so pointers into it can be kept instead of copies.
+const char *cb_resident_source(const CharBuffer *cb);
+
+// Moves the cursor forward by n chars, n must not be more than cb_lookahead returned
+void cb_advance(CharBuffer *cb, unsigned long n);
@@ -0,0 +1,261 @@
+#include "compile_report.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "debug_tokens.h"
+
+#define COMPILE_PHASE_NAME(name, str) str,
+
+// allocation sites printed by --stats, the ones with the most bytes
+#define STATS_MAX_SITES 24
+
+static const char *const phase_names[] = {COMPILE_PHASES(COMPILE_PHASE_NAME)};
+
+static double read_clock(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void report_mark(const CompileReport *report, PhaseMark *mark)
+{
+	if (!report)
+		return;
+
+	mark->wall = read_clock(CLOCK_MONOTONIC);
+	mark->cpu = read_clock(report->cpu_clock);
+}
+
+void report_phase(CompileReport *report, PhaseMark *mark, CompilePhase phase)
+{
+	if (!report)
+		return;
+
+	PhaseMark now;
+	report_mark(report, &now);
+	report->wall[phase] += now.wall - mark->wall;
+	report->cpu[phase] += now.cpu - mark->cpu;
+	*mark = now;
+}
+
+void report_preprocessing(CompileReport *report, const Preprocessor *pp, CompilePhase phase, int pipelined)
+{
+	if (!report)
+		return;
+
+	double seconds = pp->seconds;
+	double cpu;
+	if (!pipelined)
+	{
+		// the clocks cannot be read per token without slowing it down a lot, so the CPU time of the phase is split in
+		// proportion to the wall time
+		if (seconds > report->wall[phase])
+			seconds = report->wall[phase];
+		cpu = report->wall[phase] > 0 ? report->cpu[phase] * (seconds / report->wall[phase]) : 0;
+		report->wall[phase] -= seconds;
+		report->cpu[phase] -= cpu;
+	}
+	else if (report->cpu_clock == CLOCK_PROCESS_CPUTIME_ID)
+	{
+		// the preprocessor thread was busy the whole time it spent in pp_next, which the phase counted already
+		cpu = seconds < report->cpu[phase] ? seconds : report->cpu[phase];
+		report->cpu[phase] -= cpu;
+	}
+	else
+	{
+		cpu = seconds;
+	}
+
+	report->wall[PHASE_PREPROCESS] += seconds;
+	report->cpu[PHASE_PREPROCESS] += cpu;
+}
+
+void report_collect(CompileReport *report, const Preprocessor *pp)
+{
+	if (!report)
+		return;
+
+	const TokenData *td = pp->td;
+	report->arena_bytes += td->_arena.bytes_allocated + pp->_arena.bytes_allocated + pp->_scratch.bytes_allocated;
+	report->arena_reserved += td->_arena.bytes_reserved + pp->_arena.bytes_reserved + pp->_scratch.bytes_reserved;
+
+	report->tokens += pp->num_tokens;
+	for (int i = 0; i < TOK_COUNT; i++)
+		report->tokens_by_kind[i] += pp->tokens_by_kind[i];
+
+	report->intern_lookups += td->identifiers->lookups;
+	report->intern_probes += td->identifiers->probes;
+	report->identifiers += td->identifiers->count;
+	report->intern_slots += intern_slots(td->identifiers);
+
+	report->whitespace_bytes += td->whitespace_bytes;
+	report->comment_bytes += td->comment_bytes;
+
+	report->constants_pooled += td->num_constants->lookups;
+	report->distinct_constants += td->num_constants->count;
+}
+
+void report_arena(CompileReport *report, const Arena *arena)
+{
+	if (!report)
+		return;
+
+	report->arena_bytes += arena->bytes_allocated;
+	report->arena_reserved += arena->bytes_reserved;
+}
+
+void report_add(CompileReport *total, const CompileReport *report)
+{
+	for (int i = 0; i < NUM_COMPILE_PHASES; i++)
+	{
+		total->wall[i] += report->wall[i];
+		total->cpu[i] += report->cpu[i];
+	}
+
+	total->arena_bytes += report->arena_bytes;
+	total->arena_reserved += report->arena_reserved;
+
+	total->tokens += report->tokens;
+	for (int i = 0; i < TOK_COUNT; i++)
+		total->tokens_by_kind[i] += report->tokens_by_kind[i];
+
+	total->intern_lookups += report->intern_lookups;
+	total->intern_probes += report->intern_probes;
+	total->identifiers += report->identifiers;
+	total->intern_slots += report->intern_slots;
+
+	total->whitespace_bytes += report->whitespace_bytes;
+	total->comment_bytes += report->comment_bytes;
+
+	total->constants_pooled += report->constants_pooled;
+	total->distinct_constants += report->distinct_constants;
+}
+
+static unsigned long peak_rss(void)
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+
+	// bytes on macOS, kilobytes everywhere else
+#ifdef __APPLE__
+	return usage.ru_maxrss;
+#else
+	return usage.ru_maxrss * 1024ul;
+#endif
+}
+
+void print_time_report(const CompileReport *report, double elapsed, int json)
+{
+	double total_wall = 0, total_cpu = 0;
+	for (int i = 0; i < NUM_COMPILE_PHASES; i++)
+	{
+		total_wall += report->wall[i];
+		total_cpu += report->cpu[i];
+	}
+
+	if (json)
+	{
+		printf("{\"phases\": {");
+		for (int i = 0; i < NUM_COMPILE_PHASES; i++)
+			printf("%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}", i ? ", " : "", phase_names[i], report->wall[i],
+			       report->cpu[i]);
+		printf("}, \"total\": {\"wall\": %.6f, \"cpu\": %.6f}, \"elapsed\": %.6f, \"peak_rss_bytes\": %lu, "
+		       "\"arena_bytes\": %lu, \"arena_reserved_bytes\": %lu}\n",
+		       total_wall, total_cpu, elapsed, peak_rss(), report->arena_bytes, report->arena_reserved);
+		return;
+	}
+
+	printf("\n%-12s %10s %10s %7s\n", "phase", "wall ms", "cpu ms", "wall %");
+	for (int i = 0; i < NUM_COMPILE_PHASES; i++)
+		printf("%-12s %10.3f %10.3f %7.1f\n", phase_names[i], report->wall[i] * 1e3, report->cpu[i] * 1e3,
+		       total_wall > 0 ? report->wall[i] * 100 / total_wall : 0.0);
+	printf("%-12s %10.3f %10.3f\n", "total", total_wall * 1e3, total_cpu * 1e3);
+	printf("elapsed: %.3f ms, peak RSS: %.1f MB, arenas: %.1f MB allocated in %.1f MB of chunks\n", elapsed * 1e3,
+	       peak_rss() / (1024.0 * 1024.0), report->arena_bytes / (1024.0 * 1024.0),
+	       report->arena_reserved / (1024.0 * 1024.0));
+}
+
+// file name without its directories, __FILE__ can be a full path
+static const char *site_name(const char *site)
+{
+	const char *slash = strrchr(site, '/');
+	return slash ? slash + 1 : site;
+}
+
+void print_stats(const CompileReport *report, int json)
+{
+	// the sites are counted for the whole process, not per report
+	AllocSiteStats sites[STATS_MAX_SITES];
+	int num_sites = alloc_sites(sites, STATS_MAX_SITES);
+
+	double probes_per_lookup = report->intern_lookups ? (double)report->intern_probes / report->intern_lookups : 0;
+	double load_factor = report->intern_slots ? (double)report->identifiers / report->intern_slots : 0;
+
+	if (json)
+	{
+		printf("{\"tokens\": %lu, \"tokens_by_kind\": {", report->tokens);
+		int first = 1;
+		for (int i = 0; i < TOK_COUNT; i++)
+		{
+			if (!report->tokens_by_kind[i])
+				continue;
+			printf("%s\"%s\": %lu", first ? "" : ", ", debug_tokens[i], report->tokens_by_kind[i]);
+			first = 0;
+		}
+		printf("}, \"intern\": {\"lookups\": %lu, \"probes\": %lu, \"identifiers\": %lu, \"slots\": %lu, "
+		       "\"load_factor\": %.4f}, \"whitespace_bytes\": %lu, \"comment_bytes\": %lu, "
+		       "\"constants\": {\"pooled\": %lu, \"distinct\": %lu}",
+		       report->intern_lookups, report->intern_probes, report->identifiers, report->intern_slots, load_factor,
+		       report->whitespace_bytes, report->comment_bytes, report->constants_pooled,
+		       report->distinct_constants);
+		if (num_sites)
+		{
+			printf(", \"allocation_sites\": [");
+			for (int i = 0; i < num_sites; i++)
+				printf("%s{\"site\": \"%s\", \"allocations\": %lu, \"bytes\": %lu}", i ? ", " : "",
+				       site_name(sites[i].site), sites[i].allocations, sites[i].bytes);
+			printf("]");
+		}
+		printf("}\n");
+		return;
+	}
+
+	// most frequent kinds first
+	int order[TOK_COUNT];
+	int num_kinds = 0;
+	for (int i = 0; i < TOK_COUNT; i++)
+	{
+		if (!report->tokens_by_kind[i])
+			continue;
+
+		int j = num_kinds++;
+		while (j > 0 && report->tokens_by_kind[order[j - 1]] < report->tokens_by_kind[i])
+		{
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = i;
+	}
+
+	printf("\ntokens: %lu\n", report->tokens);
+	for (int i = 0; i < num_kinds; i++)
+		printf("  %-20s %10lu %6.1f%%\n", debug_tokens[order[i]], report->tokens_by_kind[order[i]],
+		       report->tokens_by_kind[order[i]] * 100.0 / report->tokens);
+	printf("identifier lookups: %lu, %.2f probes each, load factor %.2f (%lu identifiers in %lu slots)\n",
+	       report->intern_lookups, probes_per_lookup, load_factor, report->identifiers, report->intern_slots);
+	printf("skipped: %lu bytes of white space, %lu bytes of comments\n", report->whitespace_bytes,
+	       report->comment_bytes);
+	printf("numeric constants: %lu pooled, %lu distinct\n", report->constants_pooled, report->distinct_constants);
+
+	if (!num_sites)
+		return;
+
+	printf("allocations by site:\n");
+	for (int i = 0; i < num_sites; i++)
+		printf("  %-28s %10lu %12lu bytes\n", site_name(sites[i].site), sites[i].allocations, sites[i].bytes);
+}
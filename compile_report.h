@@ -0,0 +1,88 @@
+#pragma once
+
+#include <time.h>
+
+#include "preprocessor.h"
+
+// clang-format off
+// X(NAME, name)
+#define COMPILE_PHASES(X) \
+	X(READ, "read") \
+	X(LEX, "lex") \
+	X(PREPROCESS, "preprocess") \
+	X(PARSE, "parse") \
+	X(IR, "ir")
+// clang-format on
+
+#define COMPILE_PHASE_ENUM_NAME(name, ...) PHASE_##name,
+
+typedef enum CompilePhase
+{
+	COMPILE_PHASES(COMPILE_PHASE_ENUM_NAME)
+	NUM_COMPILE_PHASES
+} CompilePhase;
+
+// Where the time of a compile went (--time-report) and what the hot paths of the front end did (--stats). Reports of
+// separate files add up to the report of all of them.
+typedef struct CompileReport
+{
+	// CPU time is read from this clock. The process clock also counts the threads a file is lexed or preprocessed on,
+	// but only means something while a single file is compiled.
+	clockid_t cpu_clock;
+
+	double wall[NUM_COMPILE_PHASES];
+	double cpu[NUM_COMPILE_PHASES];
+
+	// handed out by the arenas of the token data, the preprocessor and the syntax tree, and the size of the chunks
+	// they took for it
+	unsigned long arena_bytes;
+	unsigned long arena_reserved;
+
+	unsigned long tokens;
+	unsigned long tokens_by_kind[TOK_COUNT];
+
+	unsigned long intern_lookups;
+	unsigned long intern_probes;
+	unsigned long identifiers;
+	unsigned long intern_slots;
+
+	unsigned long whitespace_bytes;
+	unsigned long comment_bytes;
+
+	unsigned long constants_pooled;
+	unsigned long distinct_constants;
+} CompileReport;
+
+// A point in time both clocks were read at, phases are measured from one mark to the next
+typedef struct PhaseMark
+{
+	double wall;
+	double cpu;
+} PhaseMark;
+
+// Reads the clocks into mark, does nothing when report is NULL
+void report_mark(const CompileReport *report, PhaseMark *mark);
+
+// Adds the time since mark to phase and moves mark to now, does nothing when report is NULL
+void report_phase(CompileReport *report, PhaseMark *mark, CompilePhase phase);
+
+// Moves the time pp spent in pp_next, which pp->timed has to be set for, from phase over to PHASE_PREPROCESS. With
+// pipelined set pp ran on a thread of its own next to phase instead of inside it. Does nothing when report is NULL.
+void report_preprocessing(CompileReport *report, const Preprocessor *pp, CompilePhase phase, int pipelined);
+
+// Adds the counters of pp and its token data, and what their arenas hold. pp must not be running on another thread.
+// Does nothing when report is NULL.
+void report_collect(CompileReport *report, const Preprocessor *pp);
+
+// Adds what arena holds to the arena totals, for arenas that are not the preprocessor's. Does nothing when report is
+// NULL.
+void report_arena(CompileReport *report, const Arena *arena);
+
+void report_add(CompileReport *total, const CompileReport *report);
+
+// Prints the phases of report, elapsed being the wall time of the whole run, along with the peak resident set size
+// of the process. json prints a JSON object on a single line instead of a table.
+void print_time_report(const CompileReport *report, double elapsed, int json);
+
+// Prints the counters of report, and with CCOMPILER_TRACK_ALLOCATIONS the call sites that allocated the most bytes
+void print_stats(const CompileReport *report, int json);
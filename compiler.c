@@ -1,13 +1,17 @@
 #include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <llvm-c/Core.h>
+#include <llvm/Config/llvm-config.h>
 
+#include "compile_report.h"
 #include "debug_tokens.h"
-#include "lexer.h"
 #include "parser.h"
+#include "preprocessor.h"
 
 void print_debug_info(TokenData *tok_data)
 {
@@ -15,132 +19,508 @@ void print_debug_info(TokenData *tok_data)
 	printf("Emitted tokens:\n");
 	for (int i = 0; i < tok_data->_tok_idx; i++)
 	{
-		printf("%s ", debug_tokens[tok_data->tokens[i]]);
-		if (tok_data->tokens[i] == TOK_IDENTIFIER || tok_data->tokens[i] == TOK_CHAR_LITERAL ||
-		    tok_data->tokens[i] == TOK_NUMERICAL_CONSTANT || tok_data->tokens[i] == TOK_STRING_LITERAL)
-		{
-			i++;
-		}
+		printf("%s ", debug_tokens[tok_data->kinds[i]]);
 	}
 
 	printf("\n\nEmitted string literals:\n");
 	for (int i = 0; i < tok_data->_str_lit_idx; i++)
 	{
-		printf("\"%s\"\n", tok_data->string_literals[i]);
+		char *str = mem_alloc(string_literal_max_len(tok_data, i) + 1);
+		if (!str)
+			continue;
+
+		uint32_t len = decode_string_literal(tok_data, i, str);
+		printf("\"%.*s\"\n", (int)len, str);
+		mem_free(str);
 	}
 
 	printf("\n\nEmitted char literals:\n");
 	for (int i = 0; i < tok_data->_tok_idx; i++)
 	{
-		if (tok_data->tokens[i] == TOK_CHAR_LITERAL)
+		if (tok_data->kinds[i] == TOK_CHAR_LITERAL)
 		{
-			if (isgraph(tok_data->tokens[i + 1]))
+			char chr = tok_data->payloads[i];
+			if (isgraph(chr))
 			{
 
-				printf("'%c'\n", tok_data->tokens[i + 1]);
+				printf("'%c'\n", chr);
 			}
 			else
 			{
-				printf("%d\n", tok_data->tokens[i + 1]);
+				printf("%d\n", chr);
 			}
-			i++;
 		}
 	}
 
 	printf("\n\nEmitted identifiers:\n");
 	for (int i = 0; i < tok_data->_tok_idx; i++)
 	{
-		if (tok_data->tokens[i] == TOK_IDENTIFIER)
+		if (tok_data->kinds[i] == TOK_IDENTIFIER)
 		{
-			printf("%s\n", tok_data->identifiers[tok_data->tokens[i + 1]]);
-			i++;
+			printf("%s\n", intern_str(tok_data->identifiers, tok_data->payloads[i]));
 		}
 	}
 }
 
-int main(int argc, char *argv[])
+typedef struct CompileOptions
+{
+	// read the source through a bounded window instead of mapping it
+	int stream;
+
+	// run the lexer on a thread of its own ahead of the parser
+	int pipeline;
+
+	// lex the whole source up front on this many threads when above 1
+	int lex_threads;
+
+	// print the syntax tree of every file that parses
+	int dump_ast;
+
+	// -I, -D and -U
+	PreprocessorOptions pp;
+} CompileOptions;
+
+// Preprocesses and parses one file into a syntax tree and a module owned by llvm_context. verbose prints the
+// statistics of the single file mode, otherwise only errors are printed. The time of every phase and the counters of
+// the front end are added to report unless it is NULL. Returns !0 on failure.
+static int compile_file(const char *file_name, const CompileOptions *options, LLVMContextRef llvm_context, int verbose,
+                        CompileReport *report)
 {
-	if (argc < 2)
+	PhaseMark mark;
+	report_mark(report, &mark);
+
+	CharBuffer *cb = open_char_buffer(file_name, options->stream);
+
+	if (!cb)
 	{
-		printf("Error: please supply an input file\n");
-		return EXIT_FAILURE;
+		printf("Error: please supply a valid file name (%s)\n", file_name);
+		return 1;
 	}
 
-	const char *const file_name = argv[1];
-	FILE *source_file = fopen(file_name, "r");
-
-	if (!source_file)
+	if (cb->_size == 0)
 	{
-		printf("Error: please supply a valid file name\n");
-		return EXIT_FAILURE;
+		printf("Error: file is either too large or empty (%s)\n", file_name);
+		delete_char_buffer(cb);
+		return 1;
 	}
 
-	// get file size
-	fseek(source_file, 0L, SEEK_END);
-	long file_size = ftell(source_file);
-	fseek(source_file, 0L, SEEK_SET);
+	report_phase(report, &mark, PHASE_READ);
 
-	if (file_size <= 0)
+	// the parser pulls tokens from the preprocessor as it goes, the tokens of the main source are only stored as a
+	// whole when they are lexed on several threads. A precompiled header has to come before any of them.
+	Preprocessor pp;
+	int pp_err;
+	if (options->lex_threads > 1 && !options->pp.include_pch)
 	{
-		printf("Error: file is either too large or empty\n");
-		return EXIT_FAILURE;
+		TokenData *tok_data = tokenize_parallel(cb, options->lex_threads, 1);
+		if (!tok_data)
+		{
+			delete_char_buffer(cb);
+			return 1;
+		}
+		report_phase(report, &mark, PHASE_LEX);
+		pp_err = pp_init_tokens(&pp, tok_data, cb, file_name, &options->pp);
+	}
+	else
+	{
+		pp_err = pp_init(&pp, cb, file_name, &options->pp);
 	}
 
-	// +1 for the NULL char
-	CharBuffer *cb = alloc_char_buffer(file_size + 1);
+	if (pp_err)
+	{
+		pp_free(&pp);
+		delete_char_buffer(cb);
+		return 1;
+	}
 
-	// -1 to not overwrite the NULL char
-	cb->_size = fread(cb->_buf, sizeof(char), cb->_max_size - 1, source_file);
-	fclose(source_file);
+	report_phase(report, &mark, PHASE_PREPROCESS);
+	pp.timed = report != NULL;
 
-	TokenData *tok_data = tokenize(cb);
-	if (!tok_data)
+	if (verbose)
 	{
-		return EXIT_FAILURE;
+#if LLVM_VERSION_MAJOR >= 16
+		unsigned ma, mi, pa;
+		LLVMGetVersion(&ma, &mi, &pa);
+		printf("Using LLVM version: %d.%d.%d\n", ma, mi, pa);
+#else
+		printf("Using LLVM version: %s\n", LLVM_VERSION_STRING);
+#endif
 	}
 
-	printf("# tokens: %d\n", tok_data->_tok_idx);
-	printf("# string literals: %d\n", tok_data->_str_lit_idx);
-	printf("# identifiers: %d\n", tok_data->_ident_idx);
-	printf("# num constants: %d\n", tok_data->_num_const_idx);
+	// the module is named after the file up to its first '.', leading dots skipped
+	const char *name_start = file_name + strspn(file_name, ".");
+	size_t name_len = strcspn(name_start, ".");
+	char *module_name = mem_calloc(name_len + 1, sizeof(char));
+	memcpy(module_name, name_start, name_len);
 
-	unsigned ma, mi, pa;
-	LLVMGetVersion(&ma, &mi, &pa);
-	printf("\nUsing LLVM version: %d.%d.%d\n", ma, mi, pa);
+	LLVMModuleRef module = LLVMModuleCreateWithNameInContext(module_name, llvm_context);
+	LLVMSetSourceFileName(module, file_name, strlen(file_name));
 
-	char *module_name = calloc(strlen(file_name) + 1, sizeof(char));
-	strcpy(module_name, file_name);
+	mem_free(module_name);
 
-	module_name = strtok(module_name, ".");
+	if (verbose)
+	{
+		size_t module_id_len;
+		const char *module_id = LLVMGetModuleIdentifier(module, &module_id_len);
 
-	LLVMModuleRef module = LLVMModuleCreateWithName(module_name);
-	LLVMSetSourceFileName(module, file_name, strlen(file_name));
+		size_t module_source_file_name_len;
+		const char *module_source_file_name = LLVMGetSourceFileName(module, &module_source_file_name_len);
 
-	free(module_name);
+		printf("LLVM Module Name: %s\n", module_id);
+		printf("LLVM Source File Name: %s\n", module_source_file_name);
+	}
+
+	report_phase(report, &mark, PHASE_IR);
+
+	// a pipe that fails to start just means preprocessing on this thread
+	TokenPipe pipe;
+	TokenPipe *token_pipe = options->pipeline && token_pipe_start(&pipe, &pp) == 0 ? &pipe : NULL;
 
-	size_t module_id_len;
-	const char *module_id = LLVMGetModuleIdentifier(module, &module_id_len);
+	Arena ast;
+	arena_init(&ast, AST_FIRST_CHUNK);
+	AstNode *tu = NULL;
+	ParserErrorCode err = parse(&pp, token_pipe, &ast, &tu);
 
-	size_t module_source_file_name_len;
-	const char *module_source_file_name = LLVMGetSourceFileName(module, &module_source_file_name_len);
+	if (token_pipe)
+		token_pipe_stop(token_pipe);
 
-	printf("LLVM Module Name: %s\n", module_id);
-	printf("LLVM Source File Name: %s\n", module_source_file_name);
+	report_phase(report, &mark, PHASE_PARSE);
+	report_preprocessing(report, &pp, PHASE_PARSE, token_pipe != NULL);
 
-	ParserErrorCode err = parse(module, tok_data);
 	if (err != PARSER_NO_ERROR)
+		printf("Parser encountered a %s error in %s! terminating...\n", ParserErrorStrings[err], file_name);
+	else if (options->dump_ast)
 	{
-		printf("Parser encountered a %s error! terminating...\n", ParserErrorStrings[err]);
+		// whole trees at a time when files are compiled side by side
+		flockfile(stdout);
+		ast_print(tu, pp.td);
+		funlockfile(stdout);
+	}
 
-		return EXIT_FAILURE;
+	if (verbose)
+	{
+		// only as far as the parser got
+		TokenData *tok_data = pp.td;
+		printf("\n# tokens: %u\n", pp.num_tokens);
+		printf("# string literals: %d\n", tok_data->_str_lit_idx);
+		printf("# identifiers: %u\n", tok_data->identifiers->count);
+		printf("# num constants: %u\n", tok_data->num_constants->count);
+		printf("# macros: %u\n", pp.num_macros);
+		printf("# headers: %u\n", pp.num_headers);
+		printf("# skipped includes: %u\n", pp.num_skipped_includes);
+		if (options->pp.include_pch)
+			printf("# precompiled header: %s\n", pp.used_pch ? "used" : "out of date");
 	}
 
+	report_collect(report, &pp);
+	report_arena(report, &ast);
+	report_mark(report, &mark);
 	LLVMDisposeModule(module);
+	report_phase(report, &mark, PHASE_IR);
 
-	free_token_data(tok_data);
+	arena_release(&ast);
+	pp_free(&pp);
 	delete_char_buffer(cb);
 
+	return err != PARSER_NO_ERROR;
+}
+
+typedef struct CompileQueue
+{
+	const char **file_names;
+	int *failed;
+	int num_files;
+	const CompileOptions *options;
+
+	// one per file, NULL when no report was asked for
+	CompileReport *reports;
+
+	// index of the next file to hand out
+	atomic_int next;
+} CompileQueue;
+
+// Each worker owns an LLVMContextRef, nothing in it is shared with the other workers
+static void *compile_worker(void *arg)
+{
+	CompileQueue *queue = arg;
+	LLVMContextRef llvm_context = LLVMContextCreate();
+
+	int idx;
+	while ((idx = atomic_fetch_add(&queue->next, 1)) < queue->num_files)
+		queue->failed[idx] = compile_file(queue->file_names[idx], queue->options, llvm_context, 0,
+		                                  queue->reports ? &queue->reports[idx] : NULL);
+
+	LLVMContextDispose(llvm_context);
+	return NULL;
+}
+
+// Compiles every file on a pool of num_jobs threads, returns the number of files that failed. The reports of all files
+// are added to report unless it is NULL.
+static int compile_files(const char **file_names, int num_files, const CompileOptions *options, int num_jobs,
+                         CompileReport *report)
+{
+	CompileQueue queue = {file_names, mem_calloc(num_files, sizeof(int)), num_files, options};
+	atomic_init(&queue.next, 0);
+
+	if (num_jobs > num_files)
+		num_jobs = num_files;
+
+	pthread_t *workers = mem_calloc(num_jobs, sizeof(pthread_t));
+	if (report)
+		queue.reports = mem_calloc(num_files, sizeof(CompileReport));
+	if (!queue.failed || !workers || (report && !queue.reports))
+	{
+		printf("Error: failed to allocate the job queue\n");
+		mem_free(queue.failed);
+		mem_free(workers);
+		mem_free(queue.reports);
+		return num_files;
+	}
+
+	for (int i = 0; report && i < num_files; i++)
+		queue.reports[i].cpu_clock = report->cpu_clock;
+
+	// the calling thread is a worker as well, a pool that fails to start just means fewer threads
+	int started = 0;
+	while (started < num_jobs - 1 && pthread_create(&workers[started], NULL, compile_worker, &queue) == 0)
+		started++;
+
+	compile_worker(&queue);
+
+	for (int i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+
+	int num_failed = 0;
+	for (int i = 0; i < num_files; i++)
+	{
+		if (queue.failed[i])
+		{
+			printf("Error: failed to compile %s\n", file_names[i]);
+			num_failed++;
+		}
+		if (report)
+			report_add(report, &queue.reports[i]);
+	}
+
+	mem_free(queue.failed);
+	mem_free(workers);
+	mem_free(queue.reports);
+	return num_failed;
+}
+
+int main(int argc, char *argv[])
+{
+	// input files, include directories and macro arguments each get a third, none of them can outnumber argc
+	const char **file_names = mem_calloc(3 * argc, sizeof(char *));
+	if (!file_names)
+	{
+		printf("Error: ran out of memory while reading the arguments\n");
+		return EXIT_FAILURE;
+	}
+
+	const char **include_dirs = file_names + argc;
+	const char **macro_args = include_dirs + argc;
+	int num_files = 0;
+	CompileOptions options = {0};
+	int num_jobs = 1;
+	const char *token_cache_dir = NULL;
+	int token_cache_stats = 0;
+	const char *emit_pch = NULL;
+
+	// 1 for a table and 2 for JSON
+	int time_report = 0;
+	int stats = 0;
+
+	options.pp.include_dirs = include_dirs;
+	options.pp.macro_args = macro_args;
+
+	for (int i = 1; i < argc; i++)
+	{
+		// read the source through a bounded window instead of mapping it
+		if (strcmp(argv[i], "--stream") == 0)
+		{
+			options.stream = 1;
+		}
+		// lex on a separate thread that runs ahead of the parser
+		else if (strcmp(argv[i], "--pipeline") == 0)
+		{
+			options.pipeline = 1;
+		}
+		// print the syntax tree of each file once it is parsed
+		else if (strcmp(argv[i], "--dump-ast") == 0)
+		{
+			options.dump_ast = 1;
+		}
+		// lex each file on N threads, either --lex-threads N or --lex-threads=N
+		else if (strncmp(argv[i], "--lex-threads", 13) == 0 && (argv[i][13] == '=' || !argv[i][13]))
+		{
+			const char *count = argv[i][13] ? argv[i] + 14 : (i + 1 < argc ? argv[++i] : "");
+			options.lex_threads = atoi(count);
+			if (options.lex_threads < 1)
+			{
+				printf("Error: --lex-threads expects a positive number of threads\n");
+				mem_free(file_names);
+				return EXIT_FAILURE;
+			}
+		}
+		// compile the input files on N threads, either -j N or -jN
+		else if (strncmp(argv[i], "-j", 2) == 0)
+		{
+			const char *count = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+			num_jobs = atoi(count);
+			if (num_jobs < 1)
+			{
+				printf("Error: -j expects a positive number of jobs\n");
+				mem_free(file_names);
+				return EXIT_FAILURE;
+			}
+		}
+		// keep lexed headers in DIR across compiles, either --token-cache DIR or --token-cache=DIR
+		else if (strncmp(argv[i], "--token-cache", 13) == 0 && (argv[i][13] == '=' || !argv[i][13]))
+		{
+			token_cache_dir = argv[i][13] ? argv[i] + 14 : (i + 1 < argc ? argv[++i] : "");
+			if (!*token_cache_dir)
+			{
+				printf("Error: --token-cache expects a directory\n");
+				mem_free(file_names);
+				return EXIT_FAILURE;
+			}
+		}
+		// print the hits and misses of the token cache once everything is compiled
+		else if (strcmp(argv[i], "--token-cache-stats") == 0)
+		{
+			token_cache_stats = 1;
+		}
+		// print the wall and CPU time of every phase, either --time-report or --time-report=json
+		else if (strcmp(argv[i], "--time-report") == 0 || strcmp(argv[i], "--time-report=json") == 0)
+		{
+			time_report = argv[i][13] ? 2 : 1;
+		}
+		// print the counters of the lexer, interning and constant pooling, either --stats or --stats=json
+		else if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=json") == 0)
+		{
+			stats = argv[i][7] ? 2 : 1;
+		}
+		// precompile the input header to FILE instead of compiling, either --emit-pch FILE or --emit-pch=FILE
+		else if (strncmp(argv[i], "--emit-pch", 10) == 0 && (argv[i][10] == '=' || !argv[i][10]))
+		{
+			emit_pch = argv[i][10] ? argv[i] + 11 : (i + 1 < argc ? argv[++i] : "");
+			if (!*emit_pch)
+			{
+				printf("Error: --emit-pch expects a file name\n");
+				mem_free(file_names);
+				return EXIT_FAILURE;
+			}
+		}
+		// start every file from a header precompiled with --emit-pch, either --include-pch FILE or --include-pch=FILE
+		else if (strncmp(argv[i], "--include-pch", 13) == 0 && (argv[i][13] == '=' || !argv[i][13]))
+		{
+			options.pp.include_pch = argv[i][13] ? argv[i] + 14 : (i + 1 < argc ? argv[++i] : "");
+			if (!*options.pp.include_pch)
+			{
+				printf("Error: --include-pch expects a file name\n");
+				mem_free(file_names);
+				return EXIT_FAILURE;
+			}
+		}
+		// add a directory to search for headers, either -I dir or -Idir
+		else if (strncmp(argv[i], "-I", 2) == 0)
+		{
+			const char *dir = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+			if (!*dir)
+			{
+				printf("Error: -I expects a directory\n");
+				mem_free(file_names);
+				return EXIT_FAILURE;
+			}
+			include_dirs[options.pp.num_include_dirs++] = dir;
+		}
+		// -DNAME, -DNAME=value and -UNAME, in the order they are given
+		else if (argv[i][0] == '-' && (argv[i][1] == 'D' || argv[i][1] == 'U'))
+		{
+			if (!isalpha((unsigned char)argv[i][2]) && argv[i][2] != '_')
+			{
+				printf("Error: %.2s expects a macro name\n", argv[i]);
+				mem_free(file_names);
+				return EXIT_FAILURE;
+			}
+			macro_args[options.pp.num_macro_args++] = argv[i] + 1;
+		}
+		else
+		{
+			file_names[num_files++] = argv[i];
+		}
+	}
+
+	// the identifiers of a precompiled header have to be interned before any of the main source, which lexing it up
+	// front would do first
+	if (options.lex_threads > 1 && options.pp.include_pch)
+		printf("Warning: --lex-threads has no effect with --include-pch, the source is lexed as it is preprocessed\n");
+
+	if (!num_files)
+	{
+		printf("Error: please supply an input file\n");
+		mem_free(file_names);
+		return EXIT_FAILURE;
+	}
+
+	TokenCache token_cache = {0};
+	if (token_cache_dir)
+	{
+		if (token_cache_init(&token_cache, token_cache_dir))
+		{
+			mem_free(file_names);
+			return EXIT_FAILURE;
+		}
+		options.pp.token_cache = &token_cache;
+	}
+
+	// the process clock would count the other jobs as well when files are compiled side by side
+	CompileReport report = {0};
+	report.cpu_clock = num_files == 1 ? CLOCK_PROCESS_CPUTIME_ID : CLOCK_THREAD_CPUTIME_ID;
+	CompileReport *compile_report = time_report || stats ? &report : NULL;
+	PhaseMark start;
+	report_mark(compile_report, &start);
+
+	// failures from here on still go through the cleanup at the end
+	int failed;
+	if (emit_pch && (num_files != 1 || options.pp.include_pch))
+	{
+		printf("Error: --emit-pch expects a single header and no --include-pch\n");
+		failed = 1;
+	}
+	else if (emit_pch)
+	{
+		failed = pp_emit_pch(file_names[0], emit_pch, &options.pp, parse_pch_header);
+	}
+	else if (num_files == 1)
+	{
+		LLVMContextRef llvm_context = LLVMContextCreate();
+		failed = compile_file(file_names[0], &options, llvm_context, 1, compile_report);
+		LLVMContextDispose(llvm_context);
+	}
+	else
+	{
+		failed = compile_files(file_names, num_files, &options, num_jobs, compile_report);
+	}
+
+	// a precompiled header is not compiled, there is nothing to report
+	if (compile_report && !emit_pch)
+	{
+		PhaseMark end;
+		report_mark(compile_report, &end);
+		if (time_report)
+			print_time_report(&report, end.wall - start.wall, time_report == 2);
+		if (stats)
+			print_stats(&report, stats == 2);
+	}
+
+	if (token_cache_stats)
+		token_cache_print_stats(&token_cache);
+
+	mem_free(file_names);
+
 	LLVMShutdown();
 
-	return EXIT_SUCCESS;
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -1,78 +1,18 @@
 #pragma once
 
+#include "token.h"
+
+#define DEBUG_TOKEN_NAME(name, ...) #name,
+
+// clang-format off
 static const char *const debug_tokens[] = {
 	// KEYWORDS
-	"AUTO",
-	"BREAK",
-	"CASE",
-	"CHAR",
-	"CONST",
-	"CONTINUE",
-	"DEFAULT",
-	"DO",
-	"DOUBLE",
-	"ELSE",
-	"ENUM",
-	"FLOAT",
-	"FOR",
-	"GOTO",
-	"IF",
-	"INLINE",
-	"INT",
-	"LONG",
-	"RETURN",
-	"SHORT",
-	"SIGNED",
-	"SIZEOF",
-	"STATIC",
-	"STRUCT",
-	"SWITCH",
-	"TYPEDEF",
-	"UNION",
-	"UNSIGNED",
-	"VOID",
-	"WHILE",
+	TOKEN_KEYWORDS(DEBUG_TOKEN_NAME)
 
 	// GENERAL
-	"IDENTIFIER",
-	"CHAR_LITERAL",
-	"NUMERICAL_CONSTANT",
-	"STRING_LITERAL",
+	TOKEN_GENERAL(DEBUG_TOKEN_NAME)
 
 	// PUNCTUATORS
-	"OPEN_SQR_BRACK",
-	"CLOSE_SQR_BRACK",
-	"OPEN_PAREN",
-	"CLOSE_PAREN",
-	"OPEN_BRACK",
-	"CLOSE_BRACK",
-	"PERIOD",
-	"RIGHT_ARROW",
-	"INCREMENT",
-	"DECREMENT",
-	"AMPERSAND",
-	"STAR",
-	"PLUS",
-	"MINUS",
-	"TILDE",
-	"BANG",
-	"FORWARD_SLASH",
-	"PERCENT",
-	"BIT_SHIFT_LEFT",
-	"BIT_SHIFT_RIGHT",
-	"LSS",
-	"GTR",
-	"LSS_EQL",
-	"GTR_EQL",
-	"EQUALITY",
-	"EQUALITY_NOT",
-	"CARET",
-	"PIPE",
-	"AND",
-	"OR",
-	"COLON",
-	"SEMI_COLON",
-	"EQUAL",
-	"COMMA",
+	TOKEN_PUNCTUATORS(DEBUG_TOKEN_NAME)
 };
-
+// clang-format on
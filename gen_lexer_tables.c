@@ -0,0 +1,294 @@
+// Build time generator for the lexer's lookup tables, run by CMake to produce lexer_tables.h
+//
+// Keywords are recognised with a gperf style perfect hash:
+//   hash = (len + asso[str[0]] + asso[str[1]] + asso[str[len - 1]]) & (KEYWORD_HASH_SIZE - 1)
+// The asso values are searched for here so that every keyword in TOKEN_KEYWORDS lands in its own slot.
+//
+// Every byte is mapped to a CharClass which the main loop of the lexer switches on, and punctuators (including
+// digraphs) are recognised by walking a DFA built from the spellings in TOKEN_PUNCTUATORS and TOKEN_DIGRAPHS.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "token.h"
+
+#define KEYWORD_HASH_SIZE 128
+#define MAX_ATTEMPTS 10000000
+
+#define MAX_PUNCT_STATES 128
+
+#define KEYWORD_SPELLING(name, spelling) spelling,
+
+// clang-format off
+static const char *const keywords_str[] = {
+	TOKEN_KEYWORDS(KEYWORD_SPELLING)
+};
+// clang-format on
+
+#define NUM_KEYWORDS ((int)(sizeof(keywords_str) / sizeof(char *)))
+
+#define PUNCT_SPELLING(name, spelling) {TOK_##name, spelling},
+
+static const struct
+{
+	Token tok;
+	const char *spelling;
+} punctuators[] = {
+	// clang-format off
+	TOKEN_PUNCTUATORS(PUNCT_SPELLING)
+	TOKEN_DIGRAPHS(PUNCT_SPELLING)
+	// clang-format on
+};
+
+#define NUM_PUNCTUATORS ((int)(sizeof(punctuators) / sizeof(punctuators[0])))
+
+// clang-format off
+static const char *const char_class_names[] = {
+	"CC_OTHER",
+	"CC_SPACE",
+	"CC_NEWLINE",
+	"CC_IDENT",
+	"CC_DIGIT",
+	"CC_PUNCT",
+	"CC_CHAR_QUOTE",
+	"CC_STR_QUOTE",
+	"CC_HASH",
+};
+// clang-format on
+
+enum
+{
+	CC_OTHER,
+	CC_SPACE,
+	CC_NEWLINE,
+	CC_IDENT,
+	CC_DIGIT,
+	CC_PUNCT,
+	CC_CHAR_QUOTE,
+	CC_STR_QUOTE,
+	CC_HASH,
+};
+
+// Deliberately not using ctype.h, the lexer must not depend on the current locale
+static int classify(int c)
+{
+	if (c == ' ' || c == '\t' || c == '\v' || c == '\f' || c == '\r')
+		return CC_SPACE;
+	if (c == '\n')
+		return CC_NEWLINE;
+	if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_')
+		return CC_IDENT;
+	if (c >= '0' && c <= '9')
+		return CC_DIGIT;
+	if (c == '\'')
+		return CC_CHAR_QUOTE;
+	if (c == '"')
+		return CC_STR_QUOTE;
+	if (c == '#')
+		return CC_HASH;
+
+	for (int i = 0; i < NUM_PUNCTUATORS; i++)
+	{
+		if (c && strchr(punctuators[i].spelling, c))
+			return CC_PUNCT;
+	}
+
+	return CC_OTHER;
+}
+
+// Punctuator DFA, state 0 is the start state and never the target of a transition so 0 also means "no transition"
+static int punct_col[256];
+static int num_punct_cols = 1;
+static int punct_next[MAX_PUNCT_STATES][256];
+static int punct_accept[MAX_PUNCT_STATES];
+static int num_punct_states = 1;
+
+// Builds a trie over all punctuator spellings, every node of it is a DFA state
+static int build_punct_dfa()
+{
+	for (int i = 0; i < MAX_PUNCT_STATES; i++)
+		punct_accept[i] = TOK_NO_TOKEN;
+
+	for (int i = 0; i < NUM_PUNCTUATORS; i++)
+	{
+		int state = 0;
+		for (const char *c = punctuators[i].spelling; *c; c++)
+		{
+			unsigned char uc = *c;
+			if (!punct_col[uc])
+				punct_col[uc] = num_punct_cols++;
+
+			int col = punct_col[uc];
+			if (!punct_next[state][col])
+			{
+				if (num_punct_states >= MAX_PUNCT_STATES)
+					return 1;
+				punct_next[state][col] = num_punct_states++;
+			}
+			state = punct_next[state][col];
+		}
+		punct_accept[state] = punctuators[i].tok;
+	}
+
+	return 0;
+}
+
+static unsigned int rng_state = 0x9e3779b9u;
+
+// xorshift, a fixed seed keeps the generated header identical between builds
+static unsigned int next_random()
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static unsigned int keyword_hash(const unsigned char *asso, const char *str)
+{
+	int len = strlen(str);
+	return (len + asso[(unsigned char)str[0]] + asso[(unsigned char)str[1]] + asso[(unsigned char)str[len - 1]]) &
+	       (KEYWORD_HASH_SIZE - 1);
+}
+
+// Returns non-zero if asso maps every keyword to a distinct slot, slots is filled with the keyword index or -1
+static int try_asso(const unsigned char *asso, int *slots)
+{
+	for (int i = 0; i < KEYWORD_HASH_SIZE; i++)
+		slots[i] = -1;
+
+	for (int i = 0; i < NUM_KEYWORDS; i++)
+	{
+		unsigned int h = keyword_hash(asso, keywords_str[i]);
+		if (slots[h] != -1)
+			return 0;
+		slots[h] = i;
+	}
+
+	return 1;
+}
+
+static int find_perfect_hash(unsigned char *asso, int *slots)
+{
+	// only the chars that actually appear in a hashed position get a random value
+	int used[256] = {0};
+	for (int i = 0; i < NUM_KEYWORDS; i++)
+	{
+		const char *str = keywords_str[i];
+		int len = strlen(str);
+		used[(unsigned char)str[0]] = 1;
+		used[(unsigned char)str[1]] = 1;
+		used[(unsigned char)str[len - 1]] = 1;
+	}
+
+	for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++)
+	{
+		for (int c = 0; c < 256; c++)
+			asso[c] = used[c] ? next_random() % KEYWORD_HASH_SIZE : 0;
+
+		if (try_asso(asso, slots))
+			return 0;
+	}
+
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		printf("Error: please supply an output file\n");
+		return EXIT_FAILURE;
+	}
+
+	unsigned char asso[256];
+	int slots[KEYWORD_HASH_SIZE];
+	if (find_perfect_hash(asso, slots))
+	{
+		printf("Error: could not find a perfect hash for the keywords, increase KEYWORD_HASH_SIZE\n");
+		return EXIT_FAILURE;
+	}
+
+	if (build_punct_dfa())
+	{
+		printf("Error: too many punctuator DFA states, increase MAX_PUNCT_STATES\n");
+		return EXIT_FAILURE;
+	}
+
+	int min_len = 255;
+	int max_len = 0;
+	for (int i = 0; i < NUM_KEYWORDS; i++)
+	{
+		int len = strlen(keywords_str[i]);
+		if (len < min_len)
+			min_len = len;
+		if (len > max_len)
+			max_len = len;
+	}
+
+	FILE *out = fopen(argv[1], "w");
+	if (!out)
+	{
+		printf("Error: could not open %s for writing\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(out, "// Generated by gen_lexer_tables.c, do not edit\n");
+	fprintf(out, "#pragma once\n\n");
+	fprintf(out, "#define KEYWORD_HASH_SIZE %d\n", KEYWORD_HASH_SIZE);
+	fprintf(out, "#define KEYWORD_MIN_LEN %d\n", min_len);
+	fprintf(out, "#define KEYWORD_MAX_LEN %d\n\n", max_len);
+
+	fprintf(out, "// clang-format off\n");
+	fprintf(out, "static const unsigned char keyword_asso[256] = {");
+	for (int c = 0; c < 256; c++)
+		fprintf(out, "%s%d,", c % 16 == 0 ? "\n\t" : " ", asso[c]);
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "// Index into keywords_str for each hash slot, -1 if the slot is empty\n");
+	fprintf(out, "static const signed char keyword_slots[KEYWORD_HASH_SIZE] = {");
+	for (int i = 0; i < KEYWORD_HASH_SIZE; i++)
+		fprintf(out, "%s%d,", i % 16 == 0 ? "\n\t" : " ", slots[i]);
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "typedef enum CharClass\n{\n");
+	for (int i = 0; i < (int)(sizeof(char_class_names) / sizeof(char *)); i++)
+		fprintf(out, "\t%s,\n", char_class_names[i]);
+	fprintf(out, "} CharClass;\n\n");
+
+	fprintf(out, "static const unsigned char char_class[256] = {");
+	for (int c = 0; c < 256; c++)
+		fprintf(out, "%s%s,", c % 8 == 0 ? "\n\t" : " ", char_class_names[classify(c)]);
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "#define PUNCT_NUM_STATES %d\n", num_punct_states);
+	fprintf(out, "#define PUNCT_NUM_COLS %d\n\n", num_punct_cols);
+
+	fprintf(out, "// DFA column of each byte, 0 for bytes that never appear in a punctuator\n");
+	fprintf(out, "static const unsigned char punct_col[256] = {");
+	for (int c = 0; c < 256; c++)
+		fprintf(out, "%s%d,", c % 16 == 0 ? "\n\t" : " ", punct_col[c]);
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "// Next state for each state and column, 0 if there is no transition\n");
+	fprintf(out, "static const unsigned char punct_next[PUNCT_NUM_STATES][PUNCT_NUM_COLS] = {\n");
+	for (int state = 0; state < num_punct_states; state++)
+	{
+		fprintf(out, "\t{");
+		for (int col = 0; col < num_punct_cols; col++)
+			fprintf(out, "%s%d", col ? ", " : "", punct_next[state][col]);
+		fprintf(out, "},\n");
+	}
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "// Token accepted in each state, TOK_NO_TOKEN if the state is only a prefix\n");
+	fprintf(out, "static const short punct_accept[PUNCT_NUM_STATES] = {");
+	for (int state = 0; state < num_punct_states; state++)
+		fprintf(out, "%s%d,", state % 16 == 0 ? "\n\t" : " ", punct_accept[state]);
+	fprintf(out, "\n};\n");
+	fprintf(out, "// clang-format on\n");
+
+	fclose(out);
+	return EXIT_SUCCESS;
+}
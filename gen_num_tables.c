@@ -0,0 +1,200 @@
+// Build time generator for the tables of the numeric constant conversion, run by CMake to produce num_tables.h
+//
+// Decimal floating constants are converted with the Eisel-Lemire algorithm, which needs the 128 most significant
+// bits of every power of five that a double can reach. For negative powers the reciprocal is scaled up and
+// rounded up by one before being truncated, as the algorithm expects.
+//
+// The values are computed with a small fixed size bignum so nothing but a C compiler is needed to build them.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SMALLEST_POWER_OF_FIVE -342
+#define LARGEST_POWER_OF_FIVE 308
+
+// enough for 2^(2 * 795 + 128), the largest dividend needed for 5^-342
+#define BIGNUM_LIMBS 64
+
+typedef struct Bignum
+{
+	uint32_t limbs[BIGNUM_LIMBS];
+} Bignum;
+
+static void big_set(Bignum *a, uint32_t value)
+{
+	memset(a, 0, sizeof(Bignum));
+	a->limbs[0] = value;
+}
+
+static void big_mul_small(Bignum *a, uint32_t factor)
+{
+	uint64_t carry = 0;
+	for (int i = 0; i < BIGNUM_LIMBS; i++)
+	{
+		uint64_t v = (uint64_t)a->limbs[i] * factor + carry;
+		a->limbs[i] = (uint32_t)v;
+		carry = v >> 32;
+	}
+}
+
+static int big_bit_length(const Bignum *a)
+{
+	for (int i = BIGNUM_LIMBS - 1; i >= 0; i--)
+	{
+		if (a->limbs[i])
+			return i * 32 + 32 - __builtin_clz(a->limbs[i]);
+	}
+	return 0;
+}
+
+static int big_bit(const Bignum *a, int bit)
+{
+	return (a->limbs[bit / 32] >> (bit % 32)) & 1;
+}
+
+static void big_set_bit(Bignum *a, int bit)
+{
+	a->limbs[bit / 32] |= (uint32_t)1 << (bit % 32);
+}
+
+static void big_shl1(Bignum *a, int low_bit)
+{
+	uint32_t carry = low_bit;
+	for (int i = 0; i < BIGNUM_LIMBS; i++)
+	{
+		uint32_t next = a->limbs[i] >> 31;
+		a->limbs[i] = (a->limbs[i] << 1) | carry;
+		carry = next;
+	}
+}
+
+static int big_cmp(const Bignum *a, const Bignum *b)
+{
+	for (int i = BIGNUM_LIMBS - 1; i >= 0; i--)
+	{
+		if (a->limbs[i] != b->limbs[i])
+			return a->limbs[i] < b->limbs[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+static void big_sub(Bignum *a, const Bignum *b)
+{
+	int64_t borrow = 0;
+	for (int i = 0; i < BIGNUM_LIMBS; i++)
+	{
+		int64_t v = (int64_t)a->limbs[i] - b->limbs[i] - borrow;
+		borrow = v < 0;
+		a->limbs[i] = (uint32_t)v;
+	}
+}
+
+static void big_add_small(Bignum *a, uint32_t value)
+{
+	uint64_t carry = value;
+	for (int i = 0; i < BIGNUM_LIMBS && carry; i++)
+	{
+		uint64_t v = (uint64_t)a->limbs[i] + carry;
+		a->limbs[i] = (uint32_t)v;
+		carry = v >> 32;
+	}
+}
+
+// Writes the 128 most significant bits of a as two 64 bit halves, a shorter a is shifted up first
+static void big_top128(const Bignum *a, uint64_t *hi, uint64_t *lo)
+{
+	int len = big_bit_length(a);
+	*hi = 0;
+	*lo = 0;
+	for (int i = 0; i < 128; i++)
+	{
+		int bit = len - 1 - i;
+		if (bit < 0 || !big_bit(a, bit))
+			continue;
+
+		if (i < 64)
+			*hi |= (uint64_t)1 << (63 - i);
+		else
+			*lo |= (uint64_t)1 << (127 - i);
+	}
+}
+
+// quotient = floor(2^exponent / divisor), using plain binary long division
+static void big_div_pow2(Bignum *quotient, int exponent, const Bignum *divisor)
+{
+	Bignum rem;
+	big_set(&rem, 0);
+	big_set(quotient, 0);
+	for (int bit = exponent; bit >= 0; bit--)
+	{
+		big_shl1(&rem, bit == exponent);
+		if (big_cmp(&rem, divisor) >= 0)
+		{
+			big_sub(&rem, divisor);
+			big_set_bit(quotient, bit);
+		}
+	}
+}
+
+static void power_of_five_128(int q, uint64_t *hi, uint64_t *lo)
+{
+	Bignum power5;
+	big_set(&power5, 1);
+	for (int i = 0; i < abs(q); i++)
+		big_mul_small(&power5, 5);
+
+	if (q >= 0)
+	{
+		big_top128(&power5, hi, lo);
+		return;
+	}
+
+	// smallest z with 2^z >= 5^-q, 5^-q is never a power of two
+	int z = big_bit_length(&power5);
+	int b = q >= -27 ? z + 127 : 2 * z + 128;
+
+	Bignum c;
+	big_div_pow2(&c, b, &power5);
+	big_add_small(&c, 1);
+	big_top128(&c, hi, lo);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		printf("Error: please supply an output file\n");
+		return EXIT_FAILURE;
+	}
+
+	FILE *out = fopen(argv[1], "w");
+	if (!out)
+	{
+		printf("Error: could not open %s for writing\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(out, "// Generated by gen_num_tables.c, do not edit\n");
+	fprintf(out, "#pragma once\n\n");
+	fprintf(out, "#include <stdint.h>\n\n");
+	fprintf(out, "#define SMALLEST_POWER_OF_FIVE %d\n", SMALLEST_POWER_OF_FIVE);
+	fprintf(out, "#define LARGEST_POWER_OF_FIVE %d\n\n", LARGEST_POWER_OF_FIVE);
+
+	fprintf(out, "// clang-format off\n");
+	fprintf(out, "// High and low halves of the 128 bit approximation of 5^q, starting at q = SMALLEST_POWER_OF_FIVE\n");
+	fprintf(out, "static const uint64_t power_of_five_128[] = {\n");
+	for (int q = SMALLEST_POWER_OF_FIVE; q <= LARGEST_POWER_OF_FIVE; q++)
+	{
+		uint64_t hi;
+		uint64_t lo;
+		power_of_five_128(q, &hi, &lo);
+		fprintf(out, "\t0x%016llx, 0x%016llx,\n", (unsigned long long)hi, (unsigned long long)lo);
+	}
+	fprintf(out, "};\n");
+	fprintf(out, "// clang-format on\n");
+
+	fclose(out);
+	return EXIT_SUCCESS;
+}
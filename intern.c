@@ -0,0 +1,171 @@
+#include "intern.h"
+
+#include <string.h>
+
+#define INTERN_INITIAL_SLOTS 1024
+#define INTERN_INITIAL_IDS 512
+#define INTERN_INITIAL_STRINGS (16 * 1024)
+
+InternTable *alloc_intern_table(Arena *arena)
+{
+	InternTable *res = arena_calloc(arena, 1, sizeof(InternTable));
+	if (!res)
+		return NULL;
+
+	res->_arena = arena;
+	res->_slots = arena_calloc(arena, INTERN_INITIAL_SLOTS, sizeof(InternSlot));
+	res->_slot_mask = INTERN_INITIAL_SLOTS - 1;
+	res->_entries = arena_alloc(arena, INTERN_INITIAL_IDS * sizeof(InternEntry));
+	res->_entries_cap = INTERN_INITIAL_IDS;
+	res->_strings = arena_alloc(arena, INTERN_INITIAL_STRINGS);
+	res->_strings_cap = INTERN_INITIAL_STRINGS;
+
+	if (!res->_slots || !res->_entries || !res->_strings)
+		return NULL;
+
+	return res;
+}
+
+// 32-bit FNV-1a
+uint32_t intern_hash(const char *str, uint32_t len)
+{
+	uint32_t hash = 2166136261u;
+	for (uint32_t i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static int slot_matches(const InternTable *it, const InternSlot *slot, uint32_t hash, const char *str, uint32_t len)
+{
+	if (slot->hash != hash)
+		return 0;
+
+	const InternEntry *entry = &it->_entries[slot->id_plus_one - 1];
+	return entry->len == len && memcmp(it->_strings + entry->offset, str, len) == 0;
+}
+
+// Doubles the slot array, the cached hashes mean no string has to be looked at again
+static int grow_slots(InternTable *it)
+{
+	uint32_t new_cap = (it->_slot_mask + 1) * 2;
+	InternSlot *slots = arena_calloc(it->_arena, new_cap, sizeof(InternSlot));
+	if (!slots)
+		return 1;
+
+	uint32_t mask = new_cap - 1;
+	for (uint32_t i = 0; i <= it->_slot_mask; i++)
+	{
+		InternSlot slot = it->_slots[i];
+		if (!slot.id_plus_one)
+			continue;
+
+		uint32_t pos = slot.hash & mask;
+		while (slots[pos].id_plus_one)
+			pos = (pos + 1) & mask;
+		slots[pos] = slot;
+	}
+
+	it->_slots = slots;
+	it->_slot_mask = mask;
+	return 0;
+}
+
+static int reserve_strings(InternTable *it, uint32_t len)
+{
+	unsigned long needed = it->_strings_size + len + 1;
+	if (needed <= it->_strings_cap)
+		return 0;
+
+	unsigned long new_cap = it->_strings_cap;
+	while (new_cap < needed)
+		new_cap *= 2;
+
+	// ids are stored as offsets so moving the string storage is fine
+	char *strings = arena_grow(it->_arena, it->_strings, it->_strings_size, new_cap);
+	if (!strings)
+		return 1;
+	it->_strings = strings;
+	it->_strings_cap = new_cap;
+	return 0;
+}
+
+uint32_t intern_find(const InternTable *it, const char *str, uint32_t len)
+{
+	uint32_t hash = intern_hash(str, len);
+	uint32_t pos = hash & it->_slot_mask;
+
+	while (it->_slots[pos].id_plus_one)
+	{
+		if (slot_matches(it, &it->_slots[pos], hash, str, len))
+			return it->_slots[pos].id_plus_one - 1;
+		pos = (pos + 1) & it->_slot_mask;
+	}
+
+	return INTERN_NO_ID;
+}
+
+uint32_t intern(InternTable *it, const char *str, uint32_t len)
+{
+	uint32_t hash = intern_hash(str, len);
+	uint32_t pos = hash & it->_slot_mask;
+	uint32_t start = pos;
+
+	it->lookups++;
+	while (it->_slots[pos].id_plus_one)
+	{
+		if (slot_matches(it, &it->_slots[pos], hash, str, len))
+		{
+			it->probes += ((pos - start) & it->_slot_mask) + 1;
+			return it->_slots[pos].id_plus_one - 1;
+		}
+		pos = (pos + 1) & it->_slot_mask;
+	}
+	it->probes += ((pos - start) & it->_slot_mask) + 1;
+
+	InternEntry *entries = arena_reserve(it->_arena, it->_entries, it->count, &it->_entries_cap, sizeof(InternEntry));
+	if (!entries || reserve_strings(it, len))
+		return INTERN_NO_ID;
+	it->_entries = entries;
+
+	// Keep the load factor at or below one half so probe sequences stay short. The table grows before the string is
+	// stored, so a failure leaves nothing behind that has no slot.
+	if ((it->count + 1) * 2 > it->_slot_mask + 1)
+	{
+		if (grow_slots(it))
+			return INTERN_NO_ID;
+
+		// the string is not in the table, its slot is the first free one
+		pos = hash & it->_slot_mask;
+		while (it->_slots[pos].id_plus_one)
+			pos = (pos + 1) & it->_slot_mask;
+	}
+
+	uint32_t id = it->count++;
+	it->_entries[id].offset = it->_strings_size;
+	it->_entries[id].len = len;
+	memcpy(it->_strings + it->_strings_size, str, len);
+	it->_strings[it->_strings_size + len] = 0;
+	it->_strings_size += len + 1;
+
+	it->_slots[pos].hash = hash;
+	it->_slots[pos].id_plus_one = id + 1;
+	return id;
+}
+
+uint32_t intern_slots(const InternTable *it)
+{
+	return it->_slot_mask + 1;
+}
+
+const char *intern_str(const InternTable *it, uint32_t id)
+{
+	return it->_strings + it->_entries[id].offset;
+}
+
+uint32_t intern_len(const InternTable *it, uint32_t id)
+{
+	return it->_entries[id].len;
+}
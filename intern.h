@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "arena.h"
+
+#define INTERN_NO_ID UINT32_MAX
+
+typedef struct InternSlot
+{
+	uint32_t hash;
+	// id + 1 so that a zeroed slot is empty
+	uint32_t id_plus_one;
+} InternSlot;
+
+typedef struct InternEntry
+{
+	uint32_t offset;
+	uint32_t len;
+} InternEntry;
+
+// Open addressing string table, every distinct string gets a stable id in order of first appearance.
+// All of its memory comes from the arena it was created with.
+typedef struct InternTable
+{
+	Arena *_arena;
+
+	InternSlot *_slots;
+	uint32_t _slot_mask;
+
+	// indexed by id
+	InternEntry *_entries;
+	uint32_t _entries_cap;
+
+	// all strings back to back, each NUL terminated
+	char *_strings;
+	unsigned long _strings_size;
+	unsigned long _strings_cap;
+
+	uint32_t count;
+
+	// calls to intern and the slots they looked at, for --stats
+	unsigned long lookups;
+	unsigned long probes;
+} InternTable;
+
+InternTable *alloc_intern_table(Arena *arena);
+
+uint32_t intern_hash(const char *str, uint32_t len);
+
+// Returns the id of str, adding it if it has not been seen yet. Returns INTERN_NO_ID if out of memory.
+uint32_t intern(InternTable *it, const char *str, uint32_t len);
+
+// Returns INTERN_NO_ID if str has not been interned
+uint32_t intern_find(const InternTable *it, const char *str, uint32_t len);
+
+// Number of slots the strings are spread over, the load factor is count over it
+uint32_t intern_slots(const InternTable *it);
+
+const char *intern_str(const InternTable *it, uint32_t id);
+uint32_t intern_len(const InternTable *it, uint32_t id);
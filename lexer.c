@@ -1,248 +1,155 @@
-#include <ctype.h>
-#include <signal.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "lexer.h"
+#include "lexer_tables.h"
+#include "scan.h"
+
+// Initial sizes only, everything grows geometrically from here
+#define TOKEN_DATA_FIRST_CHUNK (64 * 1024)
+#define TOKEN_DATA_INITIAL_TOKENS 1024
+#define TOKEN_DATA_INITIAL_LINES 256
+#define TOKEN_DATA_INITIAL_SCRATCH 256
+
+// tokenize_parallel gives every thread at least this much of the source, anything smaller is not worth a thread
+#define PARALLEL_LEX_MIN_CHUNK (256 * 1024)
+
+#define KEYWORD_SPELLING(name, spelling) spelling,
+#define KEYWORD_TOKEN(name, spelling) TOK_##name,
+#define KEYWORD_LENGTH(name, spelling) sizeof(spelling) - 1,
 
 // clang-format off
 // The string representation of keywords
 static const char *const keywords_str[] = 
 {
-	"auto",
-	"break",
-	"case",
-	"char",
-	"const",
-	"continue",
-	"default",
-	"do",
-	"double",
-	"else",
-	"enum",
-	"float",
-	"for",
-	"goto",
-	"if",
-	"inline",
-	"int",
-	"long",
-	"return",
-	"short",
-	"signed",
-	"sizeof",
-	"static",
-	"typedef",
-	"union",
-	"unsigned",
-	"void",
-	"while"
+	TOKEN_KEYWORDS(KEYWORD_SPELLING)
 };
 
 // The token equivalent of each element in keywords_str
 static const enum Token keywords_tok[] = 
 {
-	TOK_AUTO,
-	TOK_BREAK,
-	TOK_CASE,
-	TOK_CHAR,
-	TOK_CONST,
-	TOK_CONTINUE,
-	TOK_DEFAULT,
-	TOK_DO,
-	TOK_DOUBLE,
-	TOK_ELSE,
-	TOK_ENUM,
-	TOK_FLOAT,
-	TOK_FOR,
-	TOK_GOTO,
-	TOK_IF,
-	TOK_INLINE,
-	TOK_INT,
-	TOK_LONG,
-	TOK_RETURN,
-	TOK_SHORT,
-	TOK_SIGNED,
-	TOK_SIZEOF,
-	TOK_STATIC,
-	TOK_TYPEDEF,
-	TOK_UNION,
-	TOK_UNSIGNED,
-	TOK_VOID,
-	TOK_WHILE
+	TOKEN_KEYWORDS(KEYWORD_TOKEN)
 };
 
-static const char single_punctuator_char[] = 
-{
-		'[',
-		']',
-		'(',
-		')',
-		'{',
-		'}',
-		'.',
-		'&',
-		'*',
-		'+',
-		'-',
-		'~',
-		'!',
-		'/',
-		'%',
-		'<',
-		'>',
-		'^',
-		'|',
-		':',
-		';',
-		'=',
-		',',
+static const unsigned char keywords_len[] =
+{
+	TOKEN_KEYWORDS(KEYWORD_LENGTH)
 };
 
-static const enum Token single_punctuator_tok[] =
-{
-		TOK_OPEN_SQR_BRACK,
-		TOK_CLOSE_SQR_BRACK,
-		TOK_OPEN_PAREN,
-		TOK_CLOSE_PAREN,
-		TOK_OPEN_BRACK,
-		TOK_CLOSE_BRACK,
-		TOK_PERIOD,
-		TOK_AMPERSAND,
-		TOK_STAR,
-		TOK_PLUS,
-		TOK_MINUS,
-		TOK_TILDE,
-		TOK_BANG,
-		TOK_FORWARD_SLASH,
-		TOK_PERCENT,
-		TOK_LSS,
-		TOK_GTR,
-		TOK_CARET,
-		TOK_PIPE,
-		TOK_COLON,
-		TOK_SEMI_COLON,
-		TOK_EQUAL,
-		TOK_COMMA
-};
 // clang-format on
 
 // Returns -1 if theres no match, otherwise the token
-static int is_keyword(const char *const str)
+// The generated perfect hash leaves at most one candidate keyword, so a single length check and memcmp decides
+static int is_keyword(const char *const str, int len)
 {
-	for (int i = 0; i < sizeof(keywords_str) / sizeof(char *); i++)
-	{
-		if (strcmp(str, keywords_str[i]) == 0)
-		{
-			return keywords_tok[i];
-		}
-	}
-	return -1;
+	if (len < KEYWORD_MIN_LEN || len > KEYWORD_MAX_LEN)
+		return -1;
+
+	const unsigned char *ustr = (const unsigned char *)str;
+	unsigned int hash =
+		(len + keyword_asso[ustr[0]] + keyword_asso[ustr[1]] + keyword_asso[ustr[len - 1]]) & (KEYWORD_HASH_SIZE - 1);
+
+	int kw = keyword_slots[hash];
+	if (kw == -1 || keywords_len[kw] != len || memcmp(str, keywords_str[kw], len) != 0)
+		return -1;
+
+	return keywords_tok[kw];
 }
 
-// return -1 if no match
-static int is_punctuator(CharBuffer *cb)
+// Walks the generated punctuator DFA with maximal munch, returns -1 if no punctuator starts at the current char.
+// The char buffer is left on the last char of the punctuator.
+static int read_punctuator(CharBuffer *cb)
 {
-	char f = cb->cur_char;
-	char s = cb->next_char;
+	int state = punct_next[0][punct_col[(unsigned char)cb->cur_char]];
+	if (!state)
+		return -1;
 
-	// Shift the char buffer over one in case we return early
-	cb_next(cb);
+	int accepted = punct_accept[state];
+	// chars consumed since the last accepting state
+	int unaccepted = 0;
+
+	int next;
+	while ((next = punct_next[state][punct_col[(unsigned char)cb->next_char]]))
+	{
+		cb_next(cb);
+		state = next;
 
-	// double char tokens
-	if (f == '-' && s == '>')
-		return TOK_RIGHT_ARROW;
-	if (f == '+' && s == '+')
-		return TOK_INCREMENT;
-	if (f == '-' && s == '-')
-		return TOK_DECREMENT;
-	if (f == '<' && s == '<')
-		return TOK_BIT_SHIFT_LEFT;
-	if (f == '>' && s == '>')
-		return TOK_BIT_SHIFT_RIGHT;
-	if (f == '<' && s == '=')
-		return TOK_LSS_EQL;
-	if (f == '>' && s == '=')
-		return TOK_GTR_EQL;
-	if (f == '=' && s == '=')
-		return TOK_EQUALITY;
-	if (f == '!' && s == '=')
-		return TOK_EQUALITY_NOT;
-	if (f == '&' && s == '&')
-		return TOK_AND;
-	if (f == '|' && s == '|')
-		return TOK_OR;
-
-	// If we didnt detect a double char punctuator we shift back
-	cb_back(cb);
-
-	// single char tokens
-	for (int i = 0; i < sizeof(single_punctuator_char) / sizeof(char); i++)
-	{
-		if (f == single_punctuator_char[i])
-		{
-			return single_punctuator_tok[i];
+		if (punct_accept[state] != TOK_NO_TOKEN)
+		{
+			accepted = punct_accept[state];
+			unaccepted = 0;
+		}
+		else
+		{
+			unaccepted++;
 		}
 	}
 
-	return -1;
+	// ".." and "%:%" are only prefixes, give back whatever did not end up in a longer punctuator
+	while (unaccepted--)
+		cb_back(cb);
+
+	return accepted;
 }
 
-static TokenData *alloc_token_data(int buf_max_size, int str_max_size, int str_lit_max_len, int ident_max_len)
+static TokenData *alloc_token_data()
 {
-	TokenData *res = calloc(1, sizeof(TokenData));
-	res->_buf_max_size = buf_max_size;
-	res->_str_buf_max_size = str_max_size;
-	res->_str_lit_max_len = str_lit_max_len;
-	res->_ident_max_len = ident_max_len;
-	res->tokens = malloc(buf_max_size * sizeof(Token));
-	memset(res->tokens, TOK_NO_TOKEN, buf_max_size);
-	res->identifiers = calloc(buf_max_size, sizeof(char *));
-	res->string_literals = calloc(str_max_size, sizeof(char *));
-	res->num_constants = calloc(buf_max_size, sizeof(NumConstant *));
-	res->line_numbers = calloc(buf_max_size, sizeof(int));
-	for (int i = 0; i < buf_max_size; i++)
+	// the TokenData lives in its own arena so that freeing it is a single release
+	Arena arena;
+	arena_init(&arena, TOKEN_DATA_FIRST_CHUNK);
+
+	TokenData *res = arena_calloc(&arena, 1, sizeof(TokenData));
+	if (!res)
 	{
-		res->identifiers[i] = calloc(ident_max_len, sizeof(char));
+		arena_release(&arena);
+		return NULL;
 	}
-	for (int i = 0; i < str_max_size; i++)
+	res->_arena = arena;
+
+	res->lines._cap = TOKEN_DATA_INITIAL_LINES;
+	res->lines.starts = arena_alloc(&res->_arena, res->lines._cap * sizeof(uint32_t));
+	res->identifiers = alloc_intern_table(&res->_arena);
+	res->num_constants = alloc_num_constant_pool(&res->_arena);
+	res->_scratch_cap = TOKEN_DATA_INITIAL_SCRATCH;
+	res->_scratch = arena_alloc(&res->_arena, res->_scratch_cap);
+
+	if (!res->lines.starts || !res->identifiers || !res->num_constants || !res->_scratch)
 	{
-		res->string_literals[i] = calloc(str_lit_max_len, sizeof(char));
+		free_token_data(res);
+		return NULL;
 	}
+
 	return res;
 }
 
-// Returns -1 if no match, otherwise the index of the identifier
-static int check_identifier(TokenData *token_data, const char *const ident)
+void free_token_data(TokenData *td)
 {
-	for (int i = 0; i < token_data->_ident_idx; i++)
-	{
-		if (strcmp(ident, token_data->identifiers[i]) == 0)
-		{
-			return i;
-		}
-	}
-	return -1;
+	Arena arena = td->_arena;
+	arena_release(&arena);
 }
 
-void free_token_data(TokenData *td)
+// Makes sure the scratch buffer can hold at least size chars, keeping its contents. Returns !0 when out of memory
+static int reserve_scratch(TokenData *td, uint32_t size)
 {
-	for (int i = 0; i < td->_buf_max_size; i++)
-	{
-		free(td->identifiers[i]);
-		free(td->num_constants[i]);
-	}
-	for (int i = 0; i < td->_str_buf_max_size; i++)
+	if (size <= td->_scratch_cap)
+		return 0;
+
+	uint32_t new_cap = td->_scratch_cap * 2;
+	while (new_cap < size)
+		new_cap *= 2;
+
+	char *scratch = arena_grow(&td->_arena, td->_scratch, td->_scratch_cap, new_cap);
+	if (!scratch)
 	{
-		free(td->string_literals[i]);
+		td->_out_of_memory = 1;
+		return 1;
 	}
-	free(td->line_numbers);
-	free(td->tokens);
-	free(td->identifiers);
-	free(td->string_literals);
-	free(td->num_constants);
-	free(td);
+
+	td->_scratch = scratch;
+	td->_scratch_cap = new_cap;
+	return 0;
 }
 
 static char get_escaped_char(char chr)
@@ -278,726 +185,1632 @@ static char get_escaped_char(char chr)
 	}
 }
 
-static void emit_token(TokenData *buf, int tok)
+static int hex_digit_value(char chr)
+{
+	if (chr >= '0' && chr <= '9')
+		return chr - '0';
+	if (chr >= 'a' && chr <= 'f')
+		return chr - 'a' + 10;
+	if (chr >= 'A' && chr <= 'F')
+		return chr - 'A' + 10;
+	return -1;
+}
+
+// Decodes the escape sequence starting at the backslash *p points to, never reading at or past end. On success *p
+// is moved past the sequence and NULL is returned, otherwise the returned string describes the error.
+static const char *decode_escape(const char **p, const char *end, char *res)
 {
-	if (buf->_tok_idx >= buf->_buf_max_size)
+	const char *c = *p + 1;
+	if (c == end)
+		return "not a valid escape character.";
+
+	if (*c == 'x')
 	{
-		buf->_overflow = 1;
-		return;
+		int final_val = 0;
+		int num_digits = 0;
+		for (c++; num_digits < 2 && c != end && hex_digit_value(*c) != -1; c++, num_digits++)
+			final_val = final_val * 16 + hex_digit_value(*c);
+
+		if (num_digits == 0)
+			return "hex escape character not followed by hex digits";
+
+		*res = final_val;
 	}
+	else if (*c >= '0' && *c <= '9')
+	{
+		int final_val = 0;
+		int num_digits = 0;
+		for (; num_digits < 3 && c != end && *c >= '0' && *c <= '7'; c++, num_digits++)
+			final_val = final_val * 8 + *c - '0';
 
-	buf->tokens[buf->_tok_idx] = tok;
-	buf->_tok_idx++;
+		if (num_digits == 0)
+			return "oct escape character not followed by any octal digits";
+
+		if (final_val > 255)
+			return "oct escape sequence out of range.";
+
+		*res = final_val;
+	}
+	else
+	{
+		char escaped_char = get_escaped_char(*c);
+		if (!escaped_char)
+			return "not a valid escape character.";
+
+		*res = escaped_char;
+		c++;
+	}
+
+	*p = c;
+	return NULL;
 }
 
-static void emit_char_literal(TokenData *buf, char chr)
+static void emit_token(LexerState *ls, int tok, uint32_t payload)
 {
-	emit_token(buf, TOK_CHAR_LITERAL);
-	emit_token(buf, chr);
+	ls->_cur.kind = tok;
+	ls->_cur.offset = ls->token_start;
+	ls->_cur.payload = payload;
+	ls->_cur.flags = ls->_flags;
+	ls->_cur.file = ls->file;
+	ls->_flags = 0;
+	ls->_produced = 1;
 }
 
-// The string buffer supplied should already have a null terminator
-static void emit_str_literal(TokenData *buf, const char *str)
+static void emit_char_literal(LexerState *ls, char chr)
 {
-	// sanity check the length of the string
-	if (strlen(str) >= buf->_str_lit_max_len)
+	emit_token(ls, TOK_CHAR_LITERAL, (unsigned char)chr);
+}
+
+// Adds the raw body of a string literal. While lexer_next is concatenating adjacent literals the body extends the
+// literal being built instead of starting a new one, its spans are always the last ones added so that only needs the
+// span count bumped.
+static void emit_string_span(LexerState *ls, const char *raw, uint32_t len)
+{
+	TokenData *buf = ls->td;
+	StringSpan *string_spans = arena_reserve(&buf->_arena, buf->string_spans, buf->_str_span_idx,
+	                                         &buf->_str_span_cap, sizeof(StringSpan));
+	if (!string_spans)
+	{
+		buf->_out_of_memory = 1;
+		return;
+	}
+
+	buf->string_spans = string_spans;
+	buf->string_spans[buf->_str_span_idx] = (StringSpan){raw, len};
+
+	if (ls->_merge_literal)
 	{
-		buf->_overflow = 1;
+		buf->string_literals[ls->_merge_literal - 1].num_spans++;
+		buf->_str_span_idx++;
+		emit_token(ls, TOK_STRING_LITERAL, ls->_merge_literal - 1);
 		return;
 	}
 
-	// check for overflows
-	if (buf->_str_lit_idx >= buf->_str_buf_max_size)
+	StringLiteral *string_literals = arena_reserve(&buf->_arena, buf->string_literals, buf->_str_lit_idx,
+	                                               &buf->_str_lit_cap, sizeof(StringLiteral));
+	if (!string_literals)
 	{
-		buf->_overflow = 1;
+		buf->_out_of_memory = 1;
 		return;
 	}
 
-	strcpy(buf->string_literals[buf->_str_lit_idx], str);
+	buf->string_literals = string_literals;
+	buf->string_literals[buf->_str_lit_idx] = (StringLiteral){buf->_str_span_idx, 1};
+	buf->_str_span_idx++;
 
-	emit_token(buf, TOK_STRING_LITERAL);
-	emit_token(buf, buf->_str_lit_idx);
+	emit_token(ls, TOK_STRING_LITERAL, buf->_str_lit_idx);
 
 	buf->_str_lit_idx++;
 }
 
-// Returns a value other than zero if theres an error or overflow
-static void emit_ident(TokenData *token_data, const char *const ident)
+// The identifier is emitted as its interned id, equal names always get the same id
+static void emit_ident(LexerState *ls, const char *const ident, int len)
 {
-	emit_token(token_data, TOK_IDENTIFIER);
-
-	int idnt_idx = check_identifier(token_data, ident);
-	if (idnt_idx != -1)
+	uint32_t id = intern(ls->td->identifiers, ident, len);
+	if (id == INTERN_NO_ID)
 	{
-		emit_token(token_data, idnt_idx);
+		ls->td->_out_of_memory = 1;
+		return;
 	}
-	else
-	{
-		// check for overflows
-		if (strlen(ident) >= token_data->_ident_max_len || token_data->_ident_idx >= token_data->_buf_max_size)
-		{
-			token_data->_overflow = 1;
-			return;
-		}
 
-		strcpy(token_data->identifiers[token_data->_ident_idx], ident);
-		emit_token(token_data, token_data->_ident_idx);
-		token_data->_ident_idx++;
-	}
+	emit_token(ls, TOK_IDENTIFIER, id);
 }
 
-static int current_line = 1;
+// Appends a line start to lines, which are allocated from td. Returns !0 when out of memory
+static int append_line_start(TokenData *td, LineTable *lines, uint32_t offset)
+{
+	uint32_t *starts = arena_reserve(&td->_arena, lines->starts, lines->count, &lines->_cap, sizeof(uint32_t));
+	if (!starts)
+	{
+		td->_out_of_memory = 1;
+		return 1;
+	}
 
-static void print_error(const char *message)
+	lines->starts = starts;
+	lines->starts[lines->count++] = offset;
+	return 0;
+}
+
+// Records that a line starts at offset, which is one past a new line char
+static void add_line(LexerState *ls, long long offset)
 {
-	printf("[Line %d] Error: %s\n", current_line, message);
-	raise(SIGTRAP);
+	if (!append_line_start(ls->td, ls->lines, offset))
+		ls->current_line = ls->lines->count;
 }
 
-// returns anything other than zero if an error is present
-// function assumes the current char is the backslash that enters the escape sequence
-// function will return with the charbuffer being on the last char in the escape sequence
-static int process_escape_sequence(char *res, CharBuffer *cb, TokenData *token_data)
+// Adds a line for every new line char in [run, end), run being at source offset run_offset
+static void add_lines_in(LexerState *ls, const char *run, const char *end, long long run_offset)
 {
-	if (cb->next_char == 'x')
+	const char *nl = run;
+	while ((nl = ls->scan->find_newline(nl, end)) != end)
 	{
-		int hex_digits[2];
-		int num_digits = 0;
-
-		for (int i = 0; i < 2; i++)
-		{
-			cb_next(cb);
-			if (isxdigit(cb->next_char))
-			{
-				if (isalpha(cb->next_char))
-					hex_digits[i] = tolower(cb->next_char) - 'a' + 10;
-				else
-					hex_digits[i] = cb->next_char - '0';
-				num_digits++;
-			}
-			else
-			{
-				cb_back(cb);
-			}
-		}
-
-		if (num_digits == 0)
-		{
-			print_error("hex escape character not followed by hex digits");
-			return 1;
-		}
+		add_line(ls, run_offset + (nl - run) + 1);
+		nl++;
+	}
+}
 
-		int final_val = 0;
-		int powers_of_16[] = {1, 16};
-		int powers_idx = 0;
-		for (int i = num_digits - 1; i >= 0; i--)
-		{
-			final_val += hex_digits[i] * powers_of_16[powers_idx];
-			powers_idx++;
-		}
+static void report_error(int line, const char *message)
+{
+	printf("[Line %d] Error: %s\n", line, message);
 
-		if (final_val > 255 || final_val < 0)
-		{
-			print_error("hex escape sequence out of range.");
-			return 1;
-		}
+	// errors are returned to the caller, other sources being compiled alongside this one carry on
+	fflush(stdout);
+}
 
-		*res = final_val;
-	}
-	else if (isdigit(cb->next_char))
+static void print_error(LexerState *ls, const char *message)
+{
+	if (ls->defer_errors)
 	{
-		int oct_digits[3];
-		int num_digits = 0;
-
-		for (int i = 0; i < 3; i++)
-		{
-			if (i != 0)
-				cb_next(cb);
-			oct_digits[i] = cb->next_char - '0';
-			if (oct_digits[i] < 0 || oct_digits[i] > 7)
-			{
-				cb_back(cb);
-				break;
-			}
-			num_digits++;
-		}
+		ls->error = message;
+		ls->error_line = ls->current_line;
+		return;
+	}
 
-		if (num_digits == 0)
-		{
-			print_error("oct escape character not followed by any octal digits");
-			return 1;
-		}
+	report_error(ls->current_line, message);
+}
 
-		int final_val = 0;
-		int powers_of_8[] = {1, 8, 64};
-		int powers_idx = 0;
-		for (int i = num_digits - 1; i >= 0; i--)
-		{
-			final_val += oct_digits[i] * powers_of_8[powers_idx];
-			powers_idx++;
-		}
+// For errors in the text of a single token. When lexing preprocessing tokens the error is kept for the TOK_INVALID
+// token that lex_token makes of the text instead.
+static void token_error(LexerState *ls, const char *message)
+{
+	if (ls->raw)
+	{
+		ls->_invalid = message;
+		return;
+	}
 
-		if (final_val > 255 || final_val < 0)
-		{
-			print_error("oct escape sequence out of range.");
-			return 1;
-		}
+	print_error(ls, message);
+}
 
-		*res = final_val;
-	}
-	else
+// Returns !0 if error
+static int emit_num_constant(LexerState *ls, const NumConstant *nc)
+{
+	uint32_t idx = pool_num_constant(ls->td->num_constants, nc);
+	if (idx == NUM_CONSTANT_NO_IDX)
 	{
-		char escaped_char = get_escaped_char(cb->next_char);
-		if (!escaped_char)
-		{
-			print_error("not a valid escape character.");
-			return 1;
-		}
-
-		*res = escaped_char;
+		ls->td->_out_of_memory = 1;
+		return 1;
 	}
 
-	cb_next(cb);
+	emit_token(ls, TOK_NUMERICAL_CONSTANT, idx);
 	return 0;
 }
 
-#define NUM_INTEGER_SUFFIXES 22
-#define NUM_FLOATING_SUFFIXES 4
-
-// clang-format off
-static const char *integer_suffixes[NUM_INTEGER_SUFFIXES] = {
-	"llu",
-	"llU",
-	"LLu",
-	"LLU",
-
-	"lu",
-	"lU",
-	"Lu",
-	"LU",
-	
-	"ull",
-	"Ull",
-	"uLL",
-	"ULL",
-
-	"ul",
-	"Ul",
-	"uL",
-	"UL",
-
-	"u",
-	"U",
-
-	"ll",
-	"LL",
-	
-	"l",
-	"L"
-};
-
-static const int_types integer_suffix_types[NUM_INTEGER_SUFFIXES] = {
-	INT_TYPE_UNSIGNED_LLONG,
-	INT_TYPE_UNSIGNED_LLONG,
-	INT_TYPE_UNSIGNED_LLONG,
-	INT_TYPE_UNSIGNED_LLONG,
+// returns !0 if an error was encountered
+// the current char is either a digit or a '.' followed by one
+// The whole preprocessing number is read before converting it, so 0x1e+1 or 1.2.3 are a single invalid constant
+// rather than being split into several tokens.
+static int num_constant(LexerState *ls)
+{
+	CharBuffer *cb = ls->cb;
+	TokenData *token_data = ls->td;
 
-	INT_TYPE_UNSIGNED_LONG,
-	INT_TYPE_UNSIGNED_LONG,
-	INT_TYPE_UNSIGNED_LONG,
-	INT_TYPE_UNSIGNED_LONG,
+	uint32_t len = 0;
+	token_data->_scratch[len++] = cb->cur_char;
+	for (;;)
+	{
+		char prev = cb->cur_char;
+		CharClass cls = char_class[(unsigned char)cb->next_char];
+		int sign = (cb->next_char == '+' || cb->next_char == '-') &&
+		           (prev == 'e' || prev == 'E' || prev == 'p' || prev == 'P');
+		if (cls != CC_IDENT && cls != CC_DIGIT && cb->next_char != '.' && !sign)
+			break;
+
+		if (reserve_scratch(token_data, len + 1))
+			return 1;
 
-	INT_TYPE_UNSIGNED_LLONG,
-	INT_TYPE_UNSIGNED_LLONG,
-	INT_TYPE_UNSIGNED_LLONG,
-	INT_TYPE_UNSIGNED_LLONG,
+		cb_next(cb);
+		token_data->_scratch[len++] = cb->cur_char;
+	}
 
-	INT_TYPE_UNSIGNED_LONG,
-	INT_TYPE_UNSIGNED_LONG,
-	INT_TYPE_UNSIGNED_LONG,
-	INT_TYPE_UNSIGNED_LONG,
+	NumConstant nc;
+	const char *err = convert_num_constant(token_data->_scratch, len, &nc);
+	if (err)
+	{
+		token_error(ls, err);
+		return 1;
+	}
 
-	INT_TYPE_UNSIGNED_INT,
-	INT_TYPE_UNSIGNED_INT,
+	return emit_num_constant(ls, &nc);
+}
 
-	INT_TYPE_SIGNED_LLONG,
-	INT_TYPE_SIGNED_LLONG,
+// Consumes the rest of a preprocessor directive, leaving the char buffer before the new line or at the end of the
+// source when the directive is on the last line. Lines ending in a backslash are spliced by the char buffer.
+static void skip_directive(LexerState *ls)
+{
+	CharBuffer *cb = ls->cb;
+	while (!cb->eob && cb->next_char != '\n' && cb_next(cb))
+		;
+}
 
-	INT_TYPE_SIGNED_LONG,
-	INT_TYPE_SIGNED_LONG,
-};
+// The char buffer skips line splices as it goes (translation phase 2), this counts the new line of each as starting a
+// line all the same
+static void splice_line(void *ctx, long long line_start)
+{
+	LexerState *ls = ctx;
+	ls->_splices++;
 
-static const char *floating_suffixes[NUM_FLOATING_SUFFIXES] = {
-	"f",
-	"F",
-	"l",
-	"L",
-};
+	// a splice stepped back over by cb_back is reported again when it is skipped the next time
+	if (ls->lines->count && ls->lines->starts[ls->lines->count - 1] >= line_start)
+		return;
 
-static const floating_types floating_suffix_types[NUM_FLOATING_SUFFIXES] = {
-	FLOATING_TYPE_FLOAT,
-	FLOATING_TYPE_FLOAT,
-	FLOATING_TYPE_LDOUBLE,
-	FLOATING_TYPE_LDOUBLE,
-};
-// clang-format on
+	add_line(ls, line_start);
+}
 
-static int is_digit_in_base(char chr, int base)
+uint32_t remove_line_splices(char *dst, const char *src, uint32_t len)
 {
-	if (base == 16)
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < len; i++)
 	{
-		if (isxdigit(chr))
-			return 1;
-	}
-	else if (base == 8)
-	{
-		int digit = chr - '0';
-		if (digit >= 0 && digit <= 7)
-			return 1;
-	}
-	else
-	{
-		if (isdigit(chr))
-			return 1;
+		if (src[i] == '\\' && i + 1 < len && src[i + 1] == '\n')
+		{
+			i++;
+			continue;
+		}
+		if (src[i] == '\\' && i + 2 < len && src[i + 1] == '\r' && src[i + 2] == '\n')
+		{
+			i += 2;
+			continue;
+		}
+		dst[n++] = src[i];
 	}
-	return 0;
+
+	return n;
 }
 
-static int digits(CharBuffer *cb, int base, int *res, int *digits_read)
+// Consumes a run of whitespace after the current char, leaving the char buffer on the last whitespace char
+static void skip_whitespace(LexerState *ls)
 {
-	static const int MAX_DIGIT_LENGTH = 100;
-	char digit_buffer[MAX_DIGIT_LENGTH];
-	memset(digit_buffer, 0, MAX_DIGIT_LENGTH);
-	int digit_idx = 0;
-	int found_digit = 0;
-	if (cb->cur_char == '+' || cb->cur_char == '-')
-	{
-		digit_buffer[digit_idx++] = cb->cur_char;
-		cb_next(cb);
-	}
-	while (is_digit_in_base(cb->cur_char, base))
+	CharBuffer *cb = ls->cb;
+
+	const char *run;
+	unsigned long len;
+	while ((len = cb_lookahead(cb, &run)))
 	{
-		if (digit_idx >= MAX_DIGIT_LENGTH)
+		int newlines = 0;
+		const char *stop = ls->scan->skip_whitespace(run, run + len, &newlines);
+		if (newlines)
 		{
-			print_error("numerical constant too long");
-			return 1;
+			add_lines_in(ls, run, stop, cb->_cur_idx + 1);
+			ls->_flags |= TOKEN_FLAG_BOL;
 		}
-		digit_buffer[digit_idx] = cb->cur_char;
-		digit_idx += 1;
-		cb_next(cb);
-		found_digit = 1;
+
+		cb_advance(cb, stop - run);
+		if (stop != run + len)
+			return;
 	}
-	*res = strtol(digit_buffer, NULL, base);
-	if (digits_read && found_digit)
-		*digits_read = 1;
-	return 0;
 }
 
-static int read_constant(CharBuffer *cb, NumConstant *nc)
+// Leaves the char buffer before the new line that ends the comment
+static void skip_line_comment(LexerState *ls)
 {
-	int res;
-	int err = digits(cb, nc->base, &res, NULL);
-	if (err)
-		return err;
+	CharBuffer *cb = ls->cb;
+
+	const char *run;
+	unsigned long len;
+	while ((len = cb_lookahead(cb, &run)))
+	{
+		const char *stop = ls->scan->find_newline(run, run + len);
+		cb_advance(cb, stop - run);
+		if (stop != run + len)
+			return;
+	}
+}
 
-	nc->before_point = res;
+// Assumes the current char is the '/' that starts the comment, returns !0 if the comment is never closed
+static int skip_block_comment(LexerState *ls)
+{
+	CharBuffer *cb = ls->cb;
+
+	// skip the '*' so that /*/ does not close the comment
+	cb_next(cb);
 
-	if (cb->cur_char == '.')
+	const char *run;
+	unsigned long len;
+	while ((len = cb_lookahead(cb, &run)))
 	{
-		nc->floating = 1;
-		cb_next(cb);
-		int err = digits(cb, nc->base, &res, NULL);
-		if (err)
-			return err;
+		int newlines = 0;
+		const char *stop = ls->scan->find_comment_end(run, run + len, &newlines);
+		if (newlines)
+			add_lines_in(ls, run, stop, cb->_cur_idx + 1);
+
+		if (stop != run + len)
+		{
+			// land on the '/'
+			cb_advance(cb, stop - run + 2);
+			return 0;
+		}
 
-		nc->after_point = res;
+		cb_advance(cb, len);
 
-		if (nc->base == 16 && tolower(cb->cur_char) != 'p')
+		// a "*/" split by the end of a streaming window
+		if (cb->cur_char == '*' && cb->next_char == '/')
 		{
-			print_error("hex floating constant requires exponent");
-			return 1;
+			cb_next(cb);
+			return 0;
 		}
 	}
 
-	// consume the exponent
-	if ((nc->base == 10 && tolower(cb->cur_char == 'e')) ||
-	    (nc->base == 16 && (tolower(cb->cur_char == 'p') || tolower(cb->cur_char == 'e'))))
+	print_error(ls, "unterminated block comment");
+	return 1;
+}
+
+// Checks every escape sequence of a raw string literal body, returns !0 on error
+static int validate_escapes(LexerState *ls, const char *raw, uint32_t len)
+{
+	const char *end = raw + len;
+	const char *backslash;
+	while ((backslash = memchr(raw, '\\', end - raw)))
 	{
-		// consume the char
-		cb_next(cb);
-		int digits_read = 0;
-		err = digits(cb, 10, &res, &digits_read);
+		char chr;
+		const char *err = decode_escape(&backslash, end, &chr);
 		if (err)
-			return err;
-
-		if (!digits_read)
 		{
-			print_error("hex floating constant requires exponent");
+			token_error(ls, err);
 			return 1;
 		}
-
-		nc->exponent = res;
+		raw = backslash;
 	}
 
-	// read suffix
-	static const int MAX_LEN_SUFFIX_BUFFER = 50;
-	char suffix_buffer[MAX_LEN_SUFFIX_BUFFER];
-	memset(suffix_buffer, 0, MAX_LEN_SUFFIX_BUFFER);
-	int suffix_buffer_idx = 0;
-	while (isalpha(cb->cur_char))
+	return 0;
+}
+
+// Assumes the current char is the opening quote, returns !0 on error
+// The body is not copied when the source is resident, the literal points straight into it and escape sequences are
+// only decoded by decode_string_literal once something needs the value.
+static int read_string_literal(LexerState *ls)
+{
+	CharBuffer *cb = ls->cb;
+	TokenData *token_data = ls->td;
+
+	const char *source = cb_resident_source(cb);
+	long long body_start = cb->_cur_idx + 1;
+	uint32_t splices = ls->_splices;
+
+	// only used when streaming, the window can move on before the literal ends
+	uint32_t spilled = 0;
+
+	for (;;)
 	{
-		if (suffix_buffer_idx >= MAX_LEN_SUFFIX_BUFFER - 1)
+		// step over everything up to the next quote, backslash or new line in one go
+		const char *run;
+		unsigned long len = cb_lookahead(cb, &run);
+		unsigned long plain = ls->scan->find_string_special(run, run + len) - run;
+
+		if (!source)
 		{
-			print_error("suffix is too long");
-			return 1;
+			// +2 for a backslash and the char it escapes
+			if (reserve_scratch(token_data, spilled + plain + 2))
+				return 1;
+
+			memcpy(token_data->_scratch + spilled, run, plain);
+			spilled += plain;
 		}
-		suffix_buffer[suffix_buffer_idx++] = cb->cur_char;
-		cb_next(cb);
-	}
+		cb_advance(cb, plain);
 
-	// We make sure we dont accidentally consume the next char
-	cb_back(cb);
+		if (!cb_next(cb))
+			break;
 
-	// check suffixes
-	int found_suffix = 0;
-	if (strlen(suffix_buffer) > 0)
-	{
-		if (nc->floating)
+		// end the string literal and emit
+		if (cb->cur_char == '\"')
 		{
-			for (int i = 0; i < NUM_FLOATING_SUFFIXES; i++)
+			uint32_t body_len = source ? cb->_cur_idx - body_start : spilled;
+			const char *raw = source ? source + body_start : token_data->_scratch;
+
+			// a literal continued on the next line cannot point into the source, the splices have to be taken out
+			int copied = !source || ls->_splices != splices;
+			if (source && copied)
 			{
-				if (strcmp(suffix_buffer, floating_suffixes[i]) == 0)
-				{
-					nc->floating_type = floating_suffix_types[i];
-					found_suffix = 1;
-				}
+				if (reserve_scratch(token_data, body_len))
+					return 1;
+				body_len = remove_line_splices(token_data->_scratch, raw, body_len);
+				raw = token_data->_scratch;
 			}
-		}
-		else
-		{
-			for (int i = 0; i < NUM_INTEGER_SUFFIXES; i++)
+
+			if (validate_escapes(ls, raw, body_len))
+				return 1;
+
+			if (copied)
 			{
-				if (strcmp(suffix_buffer, integer_suffixes[i]) == 0)
+				char *copy = arena_alloc(&token_data->_arena, body_len);
+				if (!copy)
 				{
-					nc->int_type = integer_suffix_types[i];
-					found_suffix = 1;
+					token_data->_out_of_memory = 1;
+					return 0;
 				}
+				memcpy(copy, raw, body_len);
+				raw = copy;
 			}
+
+			emit_string_span(ls, raw, body_len);
+			return 0;
 		}
-	}
-	else
-	{
-		if (nc->floating)
+
+		// error if a new line is encountered before the exit char
+		if (cb->cur_char == '\n')
 		{
-			nc->floating_type = FLOATING_TYPE_DOUBLE;
+			token_error(ls, "string literals must be ended before a new line");
+			return 1;
 		}
-		else
+
+		if (!source)
+			token_data->_scratch[spilled++] = cb->cur_char;
+
+		// a plain char when the run stopped at the end of the streaming window
+		if (cb->cur_char != '\\')
+			continue;
+
+		// the escaped char can be a quote so it is stepped over here
+		if (!cb_next(cb))
+			break;
+
+		if (cb->cur_char == '\n')
 		{
-			nc->int_type = INT_TYPE_SIGNED_INT;
+			token_error(ls, "not a valid escape character.");
+			return 1;
 		}
-		found_suffix = 1;
-	}
 
-	if (!found_suffix && strlen(suffix_buffer) > 0)
-	{
-		print_error("invalid suffix");
-		return 1;
+		if (!source)
+			token_data->_scratch[spilled++] = cb->cur_char;
 	}
 
-	return 0;
+	token_error(ls, "unterminated string literal");
+	return 1;
 }
 
-// Returns !0 if error
-static int emit_num_constant(NumConstant *nc, TokenData *token_data)
+// TODO: implement char literal prefixes
+// Assumes the current char is the opening quote, returns !0 on error
+static int read_char_literal(LexerState *ls)
 {
-	if (token_data->_num_const_idx >= token_data->_buf_max_size)
+	CharBuffer *cb = ls->cb;
+	TokenData *token_data = ls->td;
+
+	uint32_t len = 0;
+	for (;;)
 	{
-		token_data->_overflow = 1;
+		if (!cb_next(cb))
+		{
+			token_error(ls, "unterminated char literal");
+			return 1;
+		}
+
+		if (cb->cur_char == '\'')
+			break;
+
+		if (cb->cur_char == '\n')
+		{
+			token_error(ls, "char literals must be ended before a new line");
+			return 1;
+		}
+
+		if (reserve_scratch(token_data, len + 2))
+			return 1;
+
+		token_data->_scratch[len++] = cb->cur_char;
+
+		// step over the escaped char, it can be a quote
+		if (cb->cur_char == '\\' && cb->next_char != '\n' && cb_next(cb))
+			token_data->_scratch[len++] = cb->cur_char;
+	}
+
+	const char *p = token_data->_scratch;
+	const char *end = p + len;
+	char chr = 0;
+	if (p == end)
+	{
+		token_error(ls, "empty char literal");
 		return 1;
 	}
 
-	emit_token(token_data, TOK_NUMERICAL_CONSTANT);
+	if (*p == '\\')
+	{
+		const char *err = decode_escape(&p, end, &chr);
+		if (err)
+		{
+			token_error(ls, err);
+			return 1;
+		}
+	}
+	else
+	{
+		chr = *p++;
+	}
 
-	token_data->num_constants[token_data->_num_const_idx] = nc;
-	emit_token(token_data, token_data->_num_const_idx);
-	token_data->_num_const_idx++;
+	if (p != end)
+	{
+		token_error(ls, "char literals cannot be longer than one character.");
+		return 1;
+	}
 
+	emit_char_literal(ls, chr);
 	return 0;
 }
 
-// returns !0 if an error was encountered
-static int num_constant(CharBuffer *cb, TokenData *token_data)
+// Assumes the current char starts an identifier, emits either a keyword or an identifier. Returns !0 on error
+static int read_identifier(LexerState *ls)
 {
-	if (isdigit(cb->cur_char))
+	CharBuffer *cb = ls->cb;
+	TokenData *token_data = ls->td;
+
+	uint32_t identifier_buf_idx = 0;
+
+	token_data->_scratch[identifier_buf_idx++] = cb->cur_char;
+	for (;;)
 	{
-		NumConstant *nc = calloc(1, sizeof(NumConstant));
-		if (cb->cur_char == '0' && tolower(cb->next_char) == 'x')
-		{
-			cb_next(cb);
-			cb_next(cb);
+		CharClass cls = char_class[(unsigned char)cb->next_char];
+		if (cls != CC_IDENT && cls != CC_DIGIT)
+			break;
 
-			nc->base = 16;
-		}
-		else if (cb->cur_char == '0')
-		{
-			cb_next(cb);
+		if (reserve_scratch(token_data, identifier_buf_idx + 1))
+			return 1;
 
-			nc->base = 8;
-		}
-		else
-		{
-			nc->base = 10;
-		}
-		int err = read_constant(cb, nc);
-		if (err)
-			return err;
+		cb_next(cb);
+		token_data->_scratch[identifier_buf_idx++] = cb->cur_char;
+	}
 
-		err = emit_num_constant(nc, token_data);
-		if (err)
-			return err;
+	int kwd = is_keyword(token_data->_scratch, identifier_buf_idx);
+	if (kwd != -1)
+	{
+		emit_token(ls, kwd, identifier_buf_idx);
 	}
+	else
+	{
+		emit_ident(ls, token_data->_scratch, identifier_buf_idx);
+	}
+
 	return 0;
 }
 
-TokenData *tokenize(CharBuffer *cb)
+// Makes a TOK_INVALID token of the chars read since the token started, its error is in ls->_invalid
+static void emit_invalid(LexerState *ls)
 {
-	current_line = 1;
+	CharBuffer *cb = ls->cb;
+	TokenData *buf = ls->td;
 
-	const int BUFFERS_MAX_NUM = 50000;
-	const int STRING_LITERAL_MAX_NUM = 5000;
-	const int IDENTIFIER_MAX_LEN = 249;
-	const int STRING_LITERAL_MAX_LEN = 4999;
-	TokenData *token_data =
-		alloc_token_data(BUFFERS_MAX_NUM, STRING_LITERAL_MAX_NUM, STRING_LITERAL_MAX_LEN + 1, IDENTIFIER_MAX_LEN + 1);
+	// a literal cut short by a new line leaves it to be lexed as one, so the line is still counted
+	if (!cb->eob && cb->cur_char == '\n')
+		cb_back(cb);
 
-	if (!token_data)
+	InvalidToken *invalid_tokens = arena_reserve(&buf->_arena, buf->invalid_tokens, buf->num_invalid_tokens,
+	                                             &buf->_invalid_cap, sizeof(InvalidToken));
+	if (!invalid_tokens)
 	{
-		print_error("failed to allocate token data struct");
-		return NULL;
+		buf->_out_of_memory = 1;
+		return;
 	}
 
-	int comment_line_mode = 0;
-	int comment_block_mode = 0;
-	int string_literal_mode = 0;
+	// at the end of the source the cursor is already one past the last char
+	buf->invalid_tokens = invalid_tokens;
+	buf->invalid_tokens[buf->num_invalid_tokens] =
+		(InvalidToken){ls->_invalid, cb->_cur_idx - ls->token_start + !cb->eob};
+	ls->_invalid = NULL;
 
-	int last_token_idx = 0;
-
-	char string_literal_buffer[STRING_LITERAL_MAX_LEN + 1];
-	memset(string_literal_buffer, 0, STRING_LITERAL_MAX_LEN + 1);
-	int string_literal_idx = 0;
+	emit_token(ls, TOK_INVALID, buf->num_invalid_tokens++);
+}
 
-	char identifier_buffer[IDENTIFIER_MAX_LEN + 1];
-	memset(identifier_buffer, 0, IDENTIFIER_MAX_LEN + 1);
-	int identifier_buf_idx = 0;
+// Lexes until the next token has been produced into ls->_cur, string literals are not concatenated yet.
+// Returns 1 for a token, 0 at the end of the source and -1 after an error was reported.
+static int lex_token(LexerState *ls)
+{
+	CharBuffer *cb = ls->cb;
+	TokenData *token_data = ls->td;
 
-	while (cb_next(cb))
+	ls->_produced = 0;
+	while (!ls->_produced)
 	{
-		// Make sure we dont overflow the token buffer
-		if (token_data->_overflow)
+		if (!cb_next(cb))
+			return 0;
+
+		ls->token_start = cb->_cur_idx;
+
+		// offsets are stored in 32 bits
+		if (ls->token_start > UINT32_MAX)
 		{
-			print_error("encountered an overflow in the TokenData struct");
-			return NULL;
+			print_error(ls, "source files larger than 4 GiB are not supported");
+			return -1;
 		}
 
-		// detect if a new line is encountered
-		if (cb->cur_char == '\n' || cb->cur_char == '\r')
+		int err = 0;
+
+		// every byte is dispatched on its class, comments and literals are consumed whole by their readers
+		switch (char_class[(unsigned char)cb->cur_char])
 		{
-			for (int i = last_token_idx; i < token_data->_tok_idx; i++)
+		case CC_NEWLINE:
+			add_line(ls, cb->_cur_idx + 1);
+			ls->_flags |= TOKEN_FLAG_BOL | TOKEN_FLAG_SPACE;
+			skip_whitespace(ls);
+			ls->td->whitespace_bytes += cb->_cur_idx - ls->token_start + 1;
+			break;
+
+		case CC_SPACE:
+			ls->_flags |= TOKEN_FLAG_SPACE;
+			skip_whitespace(ls);
+			ls->td->whitespace_bytes += cb->_cur_idx - ls->token_start + 1;
+			break;
+
+		case CC_IDENT:
+			err = read_identifier(ls);
+			break;
+
+		case CC_DIGIT:
+			err = num_constant(ls);
+			break;
+
+		case CC_CHAR_QUOTE:
+			err = read_char_literal(ls);
+			break;
+
+		case CC_STR_QUOTE:
+			err = read_string_literal(ls);
+			break;
+
+		case CC_HASH:
+			// directives are consumed whole unless the preprocessor is going to handle them
+			if (!ls->raw)
 			{
-				token_data->line_numbers[i] = current_line;
+				skip_directive(ls);
+				break;
 			}
-			last_token_idx = token_data->_tok_idx;
-
-			current_line++;
-		}
+			// fallthrough
 
-		// check string literal mode
-		if (string_literal_mode)
-		{
-			// error if a new line is encountered before the exit char
-			if (cb->cur_char == '\n' || cb->cur_char == '\r')
+		case CC_PUNCT:
+			if (cb->cur_char == '/' && cb->next_char == '/')
 			{
-				print_error("string literals must be ended before a new line");
-				return NULL;
+				ls->_flags |= TOKEN_FLAG_SPACE;
+				skip_line_comment(ls);
+				ls->td->comment_bytes += cb->_cur_idx - ls->token_start + 1;
+				break;
 			}
 
-			// end the string literal and emit
-			if (cb->cur_char == '\"')
+			// a comment is a single space even when it spans lines, so it never makes the next token start a line
+			if (cb->cur_char == '/' && cb->next_char == '*')
 			{
-				emit_str_literal(token_data, string_literal_buffer);
-				memset(string_literal_buffer, 0, STRING_LITERAL_MAX_LEN + 1);
-				string_literal_idx = 0;
-				string_literal_mode = 0;
-				continue;
+				ls->_flags |= TOKEN_FLAG_SPACE;
+				if (skip_block_comment(ls))
+					return -1;
+				ls->td->comment_bytes += cb->_cur_idx - ls->token_start + 1;
+				break;
 			}
 
-			// check if we are gonna overflow the string literal
-			if (string_literal_idx >= STRING_LITERAL_MAX_LEN)
+			// floating constants like .5
+			if (cb->cur_char == '.' && char_class[(unsigned char)cb->next_char] == CC_DIGIT)
 			{
-				print_error("string literal is too long");
-				return NULL;
+				err = num_constant(ls);
+				break;
 			}
 
-			char cur_char = cb->cur_char;
+			int pctr = read_punctuator(cb);
+			uint32_t pctr_len = cb->_cur_idx - ls->token_start + 1;
 
-			// check for an escape char
-			if (cb->cur_char == '\\')
-			{
-				int err = process_escape_sequence(&cur_char, cb, token_data);
-				if (err)
-					return NULL;
-			}
+			// %: is the digraph spelling of #
+			if ((pctr == TOK_HASH || pctr == TOK_DOUBLE_HASH) && !ls->raw)
+				skip_directive(ls);
+			else if (pctr != -1)
+				emit_token(ls, pctr, pctr_len);
+			break;
 
-			string_literal_buffer[string_literal_idx] = cur_char;
-			string_literal_idx++;
-			continue;
+		default:
+			token_error(ls, "stray character in program");
+			err = 1;
+			break;
 		}
 
-		// Check if we are exiting comment modes
-		if (comment_line_mode)
+		if (token_data->_out_of_memory)
 		{
-			if (cb->cur_char == '\n')
-				comment_line_mode = 0;
-			continue;
+			print_error(ls, "ran out of memory while lexing");
+			return -1;
 		}
 
-		if (comment_block_mode)
+		if (err)
 		{
-			if (cb->cur_char == '*' && cb->next_char == '/')
-			{
-				comment_block_mode = 0;
-				// To make sure we shift an additional char
-				cb_next(cb);
-			}
-			continue;
+			if (!ls->_invalid)
+				return -1;
+
+			emit_invalid(ls);
 		}
+	}
 
-		// skip white space and new lines
-		if (isspace(cb->cur_char))
-			continue;
+	return 1;
+}
+
+static void init_lexer_state(LexerState *ls, CharBuffer *cb, TokenData *td)
+{
+	memset(ls, 0, sizeof(LexerState));
+	ls->cb = cb;
+	ls->td = td;
+	ls->lines = td ? &td->lines : NULL;
+	ls->scan = select_scan_kernels();
+	ls->current_line = 1;
+	cb->on_splice = splice_line;
+	cb->splice_ctx = ls;
+
+	// a view other than the whole source starts right after a new line
+	ls->_flags = TOKEN_FLAG_BOL | (cb->_cur_idx >= 0 ? TOKEN_FLAG_SPACE : 0);
+}
 
-		// for now lets just consume all the preprocessor directives
-		// must be after all comment checks and string literal checks or else we will parse out any strings with # in
-		// them or mess up the comment block mode
-		if (cb->cur_char == '#')
+int lexer_init(LexerState *ls, CharBuffer *cb)
+{
+	init_lexer_state(ls, cb, alloc_token_data());
+	if (!ls->td)
+	{
+		print_error(ls, "failed to allocate token data struct");
+		return 1;
+	}
+	ls->td->_source = cb_resident_source(cb);
+
+	// the first line starts where the buffer does, which is only not the beginning of the source for a view
+	add_line(ls, cb->_cur_idx + 1);
+	return ls->td->_out_of_memory;
+}
+
+int lexer_init_source(LexerState *ls, CharBuffer *cb, TokenData *td, LineTable *lines)
+{
+	init_lexer_state(ls, cb, td);
+	ls->lines = lines;
+	add_line(ls, cb->_cur_idx + 1);
+	return td->_out_of_memory;
+}
+
+void lexer_init_replay(LexerState *ls, TokenData *td)
+{
+	memset(ls, 0, sizeof(LexerState));
+	ls->td = td;
+	ls->lines = &td->lines;
+	ls->current_line = 1;
+	ls->_replay = 1;
+}
+
+int lexer_next(LexerState *ls, LexedToken *tok)
+{
+	if (ls->_replay)
+	{
+		uint32_t idx = ls->num_tokens;
+		if (idx >= (uint32_t)ls->td->_tok_idx)
+			return 0;
+
+		*tok = (LexedToken){ls->td->offsets[idx], ls->td->payloads[idx], ls->td->kinds[idx], ls->td->flags[idx], ls->file};
+		ls->num_tokens++;
+		return 1;
+	}
+
+	if (ls->_has_peeked)
+	{
+		*tok = ls->_peeked;
+		ls->_has_peeked = 0;
+	}
+	else
+	{
+		int res = lex_token(ls);
+		if (res <= 0)
+			return res;
+		*tok = ls->_cur;
+	}
+
+	ls->num_tokens++;
+	if (tok->kind != TOK_STRING_LITERAL || ls->raw)
+		return 1;
+
+	// adjacent string literals are a single literal, which takes one token of lookahead to find out
+	ls->_merge_literal = tok->payload + 1;
+	int res;
+	while ((res = lex_token(ls)) > 0 && ls->_cur.kind == TOK_STRING_LITERAL)
+		;
+	ls->_merge_literal = 0;
+
+	if (res < 0)
+		return res;
+
+	if (res > 0)
+	{
+		ls->_peeked = ls->_cur;
+		ls->_has_peeked = 1;
+	}
+
+	return 1;
+}
+
+static void *grow_token_array(TokenData *buf, void *data, size_t elem_size, uint32_t new_cap)
+{
+	return arena_grow(&buf->_arena, data, buf->_tok_cap * elem_size, new_cap * elem_size);
+}
+
+// Makes room for at least count tokens, returns !0 when out of memory
+static int reserve_tokens(TokenData *buf, uint32_t count)
+{
+	// all token arrays are parallel so they always grow together
+	while (count > buf->_tok_cap)
+	{
+		uint32_t new_cap = buf->_tok_cap ? buf->_tok_cap * 2 : TOKEN_DATA_INITIAL_TOKENS;
+		uint8_t *kinds = grow_token_array(buf, buf->kinds, sizeof(uint8_t), new_cap);
+		uint32_t *offsets = grow_token_array(buf, buf->offsets, sizeof(uint32_t), new_cap);
+		uint32_t *payloads = grow_token_array(buf, buf->payloads, sizeof(uint32_t), new_cap);
+		uint8_t *flags = grow_token_array(buf, buf->flags, sizeof(uint8_t), new_cap);
+		if (!kinds || !offsets || !payloads || !flags)
 		{
-			while (cb->next_char != '\n')
-			{
-				cb_next(cb);
-			}
-			continue;
+			buf->_out_of_memory = 1;
+			return 1;
 		}
 
-		// TODO: implement char literal prefixes
+		buf->kinds = kinds;
+		buf->offsets = offsets;
+		buf->payloads = payloads;
+		buf->flags = flags;
+		buf->_tok_cap = new_cap;
+	}
 
-		// char literal mode
-		if (cb->cur_char == '\'')
+	return 0;
+}
+
+static void append_token(TokenData *buf, const LexedToken *tok)
+{
+	if (reserve_tokens(buf, buf->_tok_idx + 1))
+		return;
+
+	buf->kinds[buf->_tok_idx] = tok->kind;
+	buf->offsets[buf->_tok_idx] = tok->offset;
+	buf->payloads[buf->_tok_idx] = tok->payload;
+	buf->flags[buf->_tok_idx] = tok->flags;
+	buf->_tok_idx++;
+}
+
+static TokenData *tokenize_source(CharBuffer *cb, int raw)
+{
+	LexerState ls;
+	if (lexer_init(&ls, cb))
+	{
+		if (ls.td)
+			free_token_data(ls.td);
+		return NULL;
+	}
+	ls.raw = raw;
+	ls.td->_raw = raw;
+
+	LexedToken tok;
+	int res;
+	while ((res = lexer_next(&ls, &tok)) > 0 && !ls.td->_out_of_memory)
+		append_token(ls.td, &tok);
+
+	if (res >= 0 && ls.td->_out_of_memory)
+	{
+		print_error(&ls, "ran out of memory while lexing");
+		res = -1;
+	}
+
+	if (res < 0)
+	{
+		free_token_data(ls.td);
+		return NULL;
+	}
+
+	return ls.td;
+}
+
+TokenData *tokenize(CharBuffer *cb)
+{
+	return tokenize_source(cb, 0);
+}
+
+typedef struct LexChunk
+{
+	// the chunk is bytes [start, end) of source
+	const char *source;
+	unsigned long start;
+	unsigned long end;
+
+	CharBuffer cb;
+	LexerState ls;
+	int raw;
+
+	pthread_t thread;
+	int started;
+
+	// set when the whole chunk was lexed without an error
+	int clean;
+} LexChunk;
+
+// Lexes the chunk into a TokenData of its own, errors are only recorded since the chunk may have been guessed wrong
+static void lex_chunk(LexChunk *chunk)
+{
+	chunk->clean = 0;
+	cb_init_view(&chunk->cb, chunk->source, chunk->start, chunk->end - chunk->start);
+	if (lexer_init(&chunk->ls, &chunk->cb))
+		return;
+
+	LexerState *ls = &chunk->ls;
+	ls->defer_errors = 1;
+	ls->raw = chunk->raw;
+
+	LexedToken tok;
+	int res;
+	while ((res = lexer_next(ls, &tok)) > 0 && !ls->td->_out_of_memory)
+		append_token(ls->td, &tok);
+
+	if (res >= 0 && ls->td->_out_of_memory)
+	{
+		print_error(ls, "ran out of memory while lexing");
+		res = -1;
+	}
+
+	chunk->clean = res == 0;
+}
+
+static void *lex_chunk_thread(void *arg)
+{
+	lex_chunk(arg);
+	return NULL;
+}
+
+// Appends everything chunk lexed to res, renumbering identifiers, string literals, numeric constants and invalid tokens
+// as if they had been lexed into res directly. size is that of the source both were lexed from. Returns !0 when out of
+// memory.
+static int stitch_chunk(TokenData *res, TokenData *chunk, unsigned long size, int raw)
+{
+	// ids are handed out in order of first appearance in both tables, so going through the chunk's in order gives
+	// every identifier and constant the id the sequential lexer would have
+	uint32_t *ident_ids = arena_alloc(&chunk->_arena, chunk->identifiers->count * sizeof(uint32_t));
+	uint32_t *constant_ids = arena_alloc(&chunk->_arena, chunk->num_constants->count * sizeof(uint32_t));
+	if (!ident_ids || !constant_ids)
+		return 1;
+
+	for (uint32_t i = 0; i < chunk->identifiers->count; i++)
+	{
+		ident_ids[i] =
+			intern(res->identifiers, intern_str(chunk->identifiers, i), intern_len(chunk->identifiers, i));
+		if (ident_ids[i] == INTERN_NO_ID)
+			return 1;
+	}
+
+	for (uint32_t i = 0; i < chunk->num_constants->count; i++)
+	{
+		constant_ids[i] = pool_num_constant(res->num_constants, &chunk->num_constants->constants[i]);
+		if (constant_ids[i] == NUM_CONSTANT_NO_IDX)
+			return 1;
+	}
+
+	// the lookups the chunk made count as well, on top of the ones made here
+	res->identifiers->lookups += chunk->identifiers->lookups;
+	res->identifiers->probes += chunk->identifiers->probes;
+	res->num_constants->lookups += chunk->num_constants->lookups;
+	res->whitespace_bytes += chunk->whitespace_bytes;
+	res->comment_bytes += chunk->comment_bytes;
+
+	// a string literal at the start of the chunk continues one at the end of res, its spans directly follow the ones
+	// of that literal so only its span count grows
+	int continues = !raw && res->_tok_idx > 0 && res->kinds[res->_tok_idx - 1] == TOK_STRING_LITERAL &&
+	                chunk->_tok_idx > 0 && chunk->kinds[0] == TOK_STRING_LITERAL;
+	uint32_t span_base = res->_str_span_idx;
+	uint32_t literal_base = res->_str_lit_idx - continues;
+
+	for (int i = 0; i < chunk->_str_span_idx; i++)
+	{
+		StringSpan *string_spans = arena_reserve(&res->_arena, res->string_spans, res->_str_span_idx,
+		                                         &res->_str_span_cap, sizeof(StringSpan));
+		if (!string_spans)
+			return 1;
+
+		// a literal continued on the next line is a copy in the arena of the chunk, which is released afterwards
+		StringSpan span = chunk->string_spans[i];
+		if (span.ptr < res->_source || span.ptr >= res->_source + size)
 		{
-			// check if the char is an escape character
-			if (cb->next_char == '\\')
-			{
-				cb_next(cb);
-				char chr;
-				int err = process_escape_sequence(&chr, cb, token_data);
-				if (err)
-					return NULL;
-				cb_next(cb);
-				emit_char_literal(token_data, chr);
-			}
-			else
-			{
-				cb_next(cb);
-				emit_char_literal(token_data, cb->cur_char);
-				cb_next(cb);
-			}
+			char *copy = arena_alloc(&res->_arena, span.len);
+			if (!copy)
+				return 1;
+			memcpy(copy, span.ptr, span.len);
+			span.ptr = copy;
+		}
 
-			if (cb->cur_char != '\'')
-			{
-				print_error("char literals cannot be longer than one character.");
-				return NULL;
-			}
+		res->string_spans = string_spans;
+		res->string_spans[res->_str_span_idx++] = span;
+	}
 
+	for (int i = 0; i < chunk->_str_lit_idx; i++)
+	{
+		StringLiteral lit = chunk->string_literals[i];
+		if (i == 0 && continues)
+		{
+			res->string_literals[res->_str_lit_idx - 1].num_spans += lit.num_spans;
 			continue;
 		}
 
-		// string literals
-		if (cb->cur_char == '\"')
+		StringLiteral *string_literals = arena_reserve(&res->_arena, res->string_literals, res->_str_lit_idx,
+		                                               &res->_str_lit_cap, sizeof(StringLiteral));
+		if (!string_literals)
+			return 1;
+
+		res->string_literals = string_literals;
+		res->string_literals[res->_str_lit_idx++] = (StringLiteral){span_base + lit.first_span, lit.num_spans};
+	}
+
+	uint32_t invalid_base = res->num_invalid_tokens;
+	for (uint32_t i = 0; i < chunk->num_invalid_tokens; i++)
+	{
+		InvalidToken *invalid_tokens = arena_reserve(&res->_arena, res->invalid_tokens, res->num_invalid_tokens,
+		                                             &res->_invalid_cap, sizeof(InvalidToken));
+		if (!invalid_tokens)
+			return 1;
+
+		res->invalid_tokens = invalid_tokens;
+		res->invalid_tokens[res->num_invalid_tokens++] = chunk->invalid_tokens[i];
+	}
+
+	for (int i = continues; i < chunk->_tok_idx; i++)
+	{
+		LexedToken tok = {chunk->offsets[i], chunk->payloads[i], chunk->kinds[i], chunk->flags[i]};
+		if (tok.kind == TOK_IDENTIFIER)
+			tok.payload = ident_ids[tok.payload];
+		else if (tok.kind == TOK_STRING_LITERAL)
+			tok.payload += literal_base;
+		else if (tok.kind == TOK_NUMERICAL_CONSTANT)
+			tok.payload = constant_ids[tok.payload];
+		else if (tok.kind == TOK_INVALID)
+			tok.payload += invalid_base;
+
+		append_token(res, &tok);
+	}
+
+	// the first line of the chunk started with the new line that ended the previous one
+	for (uint32_t i = res->lines.count ? 1 : 0; i < chunk->lines.count; i++)
+		append_line_start(res, &res->lines, chunk->lines.starts[i]);
+
+	return res->_out_of_memory;
+}
+
+TokenData *tokenize_parallel(CharBuffer *cb, int num_threads, int raw)
+{
+	const char *source = cb_resident_source(cb);
+	unsigned long size = cb->_size;
+
+	int num_chunks = num_threads;
+	if (size / PARALLEL_LEX_MIN_CHUNK < (unsigned long)num_chunks)
+		num_chunks = size / PARALLEL_LEX_MIN_CHUNK;
+
+	if (!source || num_chunks < 2)
+		return tokenize_source(cb, raw);
+
+	LexChunk *chunks = mem_calloc(num_chunks, sizeof(LexChunk));
+	if (!chunks)
+		return tokenize_source(cb, raw);
+
+	// Chunks start right after a new line that is not spliced away. Tokens never span one, so the sequential lexer is
+	// between two tokens there unless it is inside a block comment. Every chunk guesses that it is not.
+	int n = 0;
+	for (unsigned long start = 0; start < size && n < num_chunks; n++)
+	{
+		unsigned long end = start + size / num_chunks;
+		if (n == num_chunks - 1 || end >= size)
 		{
-			string_literal_mode = 1;
-			continue;
+			end = size;
 		}
+		else
+		{
+			const char *nl = source + end - 1;
+			do
+				nl = memchr(nl + 1, '\n', size - (nl + 1 - source));
+			while (nl && (nl[-1] == '\\' || (nl[-1] == '\r' && nl - 1 > source && nl[-2] == '\\')));
+			end = nl ? (unsigned long)(nl - source) + 1 : size;
+		}
+
+		chunks[n].start = start;
+		chunks[n].end = end;
+		chunks[n].source = source;
+		chunks[n].raw = raw;
+		start = end;
+	}
+	num_chunks = n;
+
+	// the calling thread takes the first chunk, chunks without a thread are lexed by it afterwards
+	for (int i = 1; i < num_chunks; i++)
+		chunks[i].started = pthread_create(&chunks[i].thread, NULL, lex_chunk_thread, &chunks[i]) == 0;
+
+	lex_chunk(&chunks[0]);
 
-		// parse out comments
-		if (cb->cur_char == '/' && cb->next_char == '/')
+	for (int i = 1; i < num_chunks; i++)
+	{
+		if (chunks[i].started)
+			pthread_join(chunks[i].thread, NULL);
+		else
+			lex_chunk(&chunks[i]);
+	}
+
+	TokenData *res = alloc_token_data();
+	int failed = !res;
+	if (res)
+	{
+		res->_source = source;
+		res->_raw = raw;
+	}
+	else
+	{
+		report_error(1, "failed to allocate token data struct");
+	}
+
+	for (int k = 0; k < num_chunks && !failed; k++)
+	{
+		LexChunk *chunk = &chunks[k];
+
+		// A chunk that started where it should only fails because of its end if a block comment ran past it, in
+		// which case the next chunk guessed wrong. Lexing it again together with the following chunks finds where
+		// the sequential lexer is back between tokens, anything else is an error in the source.
+		int last = k;
+		while (!chunk->clean && last + 1 < num_chunks && chunk->cb._cur_idx + 1 >= (long long)chunk->end)
 		{
-			comment_line_mode = 1;
-			continue;
+			if (chunk->ls.td)
+				free_token_data(chunk->ls.td);
+
+			chunk->end = chunks[++last].end;
+			lex_chunk(chunk);
 		}
 
-		// block comments
-		if (cb->cur_char == '/' && cb->next_char == '*')
+		if (!chunk->clean)
 		{
-			comment_block_mode = 1;
-			// This is in order to avoid allowing this type of comment: /*/
-			cb_next(cb);
-			continue;
+			// the error is reported at its line in the whole source, the chunk counted from its first line
+			if (res->lines.count)
+				chunk->ls.error_line += res->lines.count - 1;
+			lexer_report_deferred_error(&chunk->ls);
+			failed = 1;
+			break;
 		}
 
-		// punctuators
-		int pctr = is_punctuator(cb);
-		if (pctr != -1)
+		if (stitch_chunk(res, chunk->ls.td, size, raw))
 		{
-			emit_token(token_data, pctr);
-			continue;
+			report_error(res->lines.count, "ran out of memory while lexing");
+			failed = 1;
+		}
+
+		free_token_data(chunk->ls.td);
+		chunk->ls.td = NULL;
+		k = last;
+	}
+
+	for (int i = 0; i < num_chunks; i++)
+	{
+		if (chunks[i].ls.td)
+			free_token_data(chunks[i].ls.td);
+	}
+	mem_free(chunks);
+
+	if (failed)
+	{
+		if (res)
+			free_token_data(res);
+		return NULL;
+	}
+
+	return res;
+}
+
+// Offset right after the char at offset idx of source and the line splices after it. Whether there are any is told
+// by the two bytes after that.
+static unsigned long past_char(const char *source, unsigned long size, unsigned long idx)
+{
+	idx++;
+	while (idx + 1 < size && source[idx] == '\\')
+	{
+		if (source[idx + 1] == '\n')
+			idx += 2;
+		else if (idx + 2 < size && source[idx + 1] == '\r' && source[idx + 2] == '\n')
+			idx += 3;
+		else
+			break;
+	}
+	return idx;
+}
+
+// Index of the first of the count sorted offsets that is at least offset
+static uint32_t lower_bound(const uint32_t *offsets, uint32_t count, uint32_t offset)
+{
+	uint32_t lo = 0;
+	uint32_t hi = count;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (offsets[mid] < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int retokenize(TokenData *td, CharBuffer *cb, uint32_t edit_start, uint32_t old_edit_end, uint32_t new_edit_end)
+{
+	const char *source = cb_resident_source(cb);
+	if (!source)
+	{
+		report_error(1, "only sources that are resident in memory can be lexed again incrementally");
+		return 1;
+	}
+
+	if (cb->_size > UINT32_MAX)
+	{
+		report_error(1, "source files larger than 4 GiB are not supported");
+		return 1;
+	}
+
+	long long delta = (long long)new_edit_end - old_edit_end;
+	uint32_t num_old = td->_tok_idx;
+
+	// Lexing restarts at a token that starts before the edit and whose predecessor was lexed without looking at it.
+	// Maximal munch looks up to two chars past the end of a punctuator (..x is two periods), which reaches the char
+	// after the first one of the next token, so that char and the bytes telling whether a splice follows it have to
+	// come before the edit. A string literal looks at the whole token after it to find out whether it continues, so
+	// lexing restarts at the literal itself.
+	uint32_t restart = lower_bound(td->offsets, num_old, edit_start);
+	if (restart)
+		restart--;
+	while (restart && (past_char(source, cb->_size, td->offsets[restart]) + 2 >= edit_start ||
+	                   (!td->_raw && td->kinds[restart - 1] == TOK_STRING_LITERAL)))
+		restart--;
+	uint32_t restart_offset = restart < num_old ? td->offsets[restart] : 0;
+	if (restart_offset > edit_start)
+		restart_offset = 0;
+
+	// the line table is rebuilt from the restart on, the old lines past it are put back after the resync
+	uint32_t kept_lines = lower_bound(td->lines.starts, td->lines.count, restart_offset + 1);
+	uint32_t num_old_lines = td->lines.count - kept_lines;
+	uint32_t *old_lines = mem_alloc((num_old_lines + 1) * sizeof(uint32_t));
+	LexedToken *fresh = mem_alloc(TOKEN_DATA_INITIAL_TOKENS * sizeof(LexedToken));
+	uint32_t fresh_cap = TOKEN_DATA_INITIAL_TOKENS;
+	uint32_t num_fresh = 0;
+	if (!old_lines || !fresh)
+	{
+		report_error(1, "ran out of memory while lexing");
+		mem_free(old_lines);
+		mem_free(fresh);
+		return 1;
+	}
+
+	memcpy(old_lines, td->lines.starts + kept_lines, num_old_lines * sizeof(uint32_t));
+	td->lines.count = kept_lines;
+	uint32_t num_old_spans = td->_str_span_idx;
+
+	CharBuffer view;
+	cb_init_view(&view, source, restart_offset, cb->_size - restart_offset);
+
+	LexerState ls;
+	init_lexer_state(&ls, &view, td);
+	ls.current_line = kept_lines;
+	ls.raw = td->_raw;
+
+	// whatever came before the restart token is unchanged, so it starts out the way it did before
+	if (restart < num_old && restart_offset == td->offsets[restart])
+		ls._flags = td->flags[restart];
+
+	// The new stream is back in step with the old one at the first token that starts at the shifted offset of an
+	// old token past the edit, everything from there on is the same. A string literal could still be continued by
+	// one before it, so only other tokens count.
+	uint32_t resync = lower_bound(td->offsets, num_old, old_edit_end);
+	int resynced = 0;
+
+	LexedToken tok;
+	int res;
+	while ((res = lexer_next(&ls, &tok)) > 0 && !td->_out_of_memory)
+	{
+		while (resync < num_old && td->offsets[resync] + delta < tok.offset)
+			resync++;
+
+		if (resync < num_old && td->offsets[resync] + delta == tok.offset && td->kinds[resync] == tok.kind &&
+		    td->flags[resync] == tok.flags && tok.kind != TOK_STRING_LITERAL)
+		{
+			resynced = 1;
+			break;
 		}
 
-		// check for identifiers or keywords
-		if (isalpha(cb->cur_char) || cb->cur_char == '_')
+		if (num_fresh == fresh_cap)
 		{
-			identifier_buffer[identifier_buf_idx] = cb->cur_char;
-			identifier_buf_idx++;
-			while (isalnum(cb->next_char) || cb->next_char == '_')
+			LexedToken *grown = mem_realloc(fresh, fresh_cap * 2 * sizeof(LexedToken));
+			if (!grown)
 			{
-				if (identifier_buf_idx >= IDENTIFIER_MAX_LEN)
-				{
-					print_error("identifier name too long");
-					return NULL;
-				}
-				cb_next(cb);
-				identifier_buffer[identifier_buf_idx] = cb->cur_char;
-				identifier_buf_idx++;
+				td->_out_of_memory = 1;
+				break;
 			}
+			fresh = grown;
+			fresh_cap *= 2;
+		}
+		fresh[num_fresh++] = tok;
+	}
 
-			int kwd = is_keyword(identifier_buffer);
-			if (kwd != -1)
-			{
-				emit_token(token_data, kwd);
-			}
-			else
-			{
-				emit_ident(token_data, identifier_buffer);
-			}
+	uint32_t num_tail = resynced ? num_old - resync : 0;
+	if (res >= 0 && !td->_out_of_memory)
+		reserve_tokens(td, restart + num_fresh + num_tail);
 
-			// finally reset the buffer
-			memset(identifier_buffer, 0, IDENTIFIER_MAX_LEN + 1);
-			identifier_buf_idx = 0;
-			continue;
+	if (res < 0 || td->_out_of_memory)
+	{
+		if (td->_out_of_memory)
+			print_error(&ls, "ran out of memory while lexing");
+
+		// identifiers, constants and literals added in the meantime are simply unused, only the lines need undoing
+		td->_out_of_memory = 0;
+		td->lines.count = kept_lines;
+		memcpy(td->lines.starts + kept_lines, old_lines, num_old_lines * sizeof(uint32_t));
+		td->lines.count += num_old_lines;
+		mem_free(old_lines);
+		mem_free(fresh);
+		return 1;
+	}
+
+	// the old lines from the first unchanged token on, minus those of line splices in it that were lexed again
+	if (resynced)
+	{
+		uint32_t tail_lines = lower_bound(old_lines, num_old_lines, td->offsets[resync] + 1);
+		uint32_t lexed_to = td->lines.count ? td->lines.starts[td->lines.count - 1] : 0;
+		for (uint32_t i = tail_lines; i < num_old_lines; i++)
+		{
+			if (old_lines[i] + delta > lexed_to)
+				append_line_start(td, &td->lines, old_lines[i] + delta);
 		}
+	}
 
-		// Numerical constants
-		int err = num_constant(cb, token_data);
-		if (err)
-			return NULL;
+	uint32_t tail_start = restart + num_fresh;
+	memmove(td->kinds + tail_start, td->kinds + resync, num_tail * sizeof(uint8_t));
+	memmove(td->offsets + tail_start, td->offsets + resync, num_tail * sizeof(uint32_t));
+	memmove(td->payloads + tail_start, td->payloads + resync, num_tail * sizeof(uint32_t));
+	memmove(td->flags + tail_start, td->flags + resync, num_tail * sizeof(uint8_t));
+	for (uint32_t i = tail_start; i < tail_start + num_tail; i++)
+		td->offsets[i] += delta;
+
+	for (uint32_t i = 0; i < num_fresh; i++)
+	{
+		td->kinds[restart + i] = fresh[i].kind;
+		td->offsets[restart + i] = fresh[i].offset;
+		td->payloads[restart + i] = fresh[i].payload;
+		td->flags[restart + i] = fresh[i].flags;
+	}
+	td->_tok_idx = tail_start + num_tail;
+
+	// spans of the old literals point into the old source, the ones past the edit moved along with their tokens. Those
+	// of literals continued on the next line are copies that stay where they are.
+	if (td->_source)
+	{
+		for (uint32_t i = 0; i < num_old_spans; i++)
+		{
+			long long offset = td->string_spans[i].ptr - td->_source;
+			if (offset < 0 || offset > (long long)cb->_size - delta)
+				continue;
+			if (offset >= old_edit_end)
+				offset += delta;
+			td->string_spans[i].ptr = source + offset;
+		}
+	}
+	td->_source = source;
+
+	mem_free(old_lines);
+	mem_free(fresh);
+	return td->_out_of_memory;
+}
+
+void lexer_report_deferred_error(const LexerState *ls)
+{
+	if (ls->error)
+		report_error(ls->error_line, ls->error);
+}
+
+void line_location(const LineTable *lines, uint32_t offset, int *line, int *col)
+{
+	// last line that starts at or before offset
+	uint32_t lo = 0;
+	uint32_t hi = lines->count;
+	while (hi - lo > 1)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (lines->starts[mid] <= offset)
+			lo = mid;
 		else
-			continue;
+			hi = mid;
+	}
+
+	*line = lo + 1;
+	*col = lines->count ? offset - lines->starts[lo] + 1 : 1;
+}
+
+void source_location(const TokenData *td, uint32_t offset, int *line, int *col)
+{
+	line_location(&td->lines, offset, line, col);
+}
 
-		printf("%c", cb->cur_char);
+uint32_t string_literal_max_len(const TokenData *td, uint32_t idx)
+{
+	const StringLiteral *lit = &td->string_literals[idx];
+	uint32_t len = 0;
+	for (uint32_t i = 0; i < lit->num_spans; i++)
+		len += td->string_spans[lit->first_span + i].len;
+	return len;
+}
+
+uint32_t decode_string_literal(const TokenData *td, uint32_t idx, char *out)
+{
+	const StringLiteral *lit = &td->string_literals[idx];
+	char *res = out;
+	for (uint32_t i = 0; i < lit->num_spans; i++)
+	{
+		const StringSpan *span = &td->string_spans[lit->first_span + i];
+		const char *raw = span->ptr;
+		const char *end = raw + span->len;
+
+		// runs without escapes are copied as is, the escapes were validated while lexing
+		const char *backslash;
+		while ((backslash = memchr(raw, '\\', end - raw)))
+		{
+			memcpy(res, raw, backslash - raw);
+			res += backslash - raw;
+			decode_escape(&backslash, end, res++);
+			raw = backslash;
+		}
+
+		memcpy(res, raw, end - raw);
+		res += end - raw;
+	}
+
+	return res - out;
+}
+
+// Whether all of the len chars at str make a single pp-number (C11 6.4.8), a digit or a period and a digit followed by
+// digits, identifier chars, periods and signed exponents
+static int is_pp_number(const char *str, uint32_t len)
+{
+	// chars are classified like num_constant does it, not by the current locale
+	if (!len || (char_class[(unsigned char)str[0]] != CC_DIGIT &&
+	             (str[0] != '.' || len < 2 || char_class[(unsigned char)str[1]] != CC_DIGIT)))
+		return 0;
+
+	for (uint32_t i = 1; i < len; i++)
+	{
+		unsigned char c = str[i];
+		CharClass cls = char_class[c];
+		int sign = (c == '+' || c == '-') && strchr("eEpP", str[i - 1]);
+		if (cls != CC_IDENT && cls != CC_DIGIT && c != '.' && c < 0x80 && !sign)
+			return 0;
+	}
+	return 1;
+}
+
+int lex_spelling(TokenData *td, const char *str, uint32_t len, LexedToken *tok)
+{
+	CharBuffer view;
+	cb_init_view(&view, str, 0, len);
+
+	// a spelling never holds a new line, so nothing is added to the line table
+	LineTable lines = {0};
+	LexerState ls;
+	init_lexer_state(&ls, &view, td);
+	ls.lines = &lines;
+	ls.raw = 1;
+	ls.defer_errors = 1;
+
+	int res = lex_token(&ls);
+	if (td->_out_of_memory)
+		return -1;
+
+	// A pp-number is a valid preprocessing token even when it is not a valid constant, like 1e. It stays a TOK_INVALID
+	// that is only reported if it gets past the preprocessor, its text kept since it is in no source.
+	if (res > 0 && ls._cur.kind == TOK_INVALID && is_pp_number(str, len))
+	{
+		InvalidToken *inv = &td->invalid_tokens[ls._cur.payload];
+		char *text = arena_alloc(&td->_arena, len);
+		if (!text)
+		{
+			td->_out_of_memory = 1;
+			return -1;
+		}
+		memcpy(text, str, len);
+		inv->text = text;
+		inv->len = len;
+		*tok = ls._cur;
+		return 1;
 	}
 
-	for (int i = last_token_idx; i < token_data->_tok_idx; i++)
+	if (res <= 0 || ls._cur.kind == TOK_INVALID)
+		return 0;
+
+	*tok = ls._cur;
+	if (lex_token(&ls) != 0)
+		return td->_out_of_memory ? -1 : 0;
+
+	// the literal points into str, which goes away
+	if (tok->kind == TOK_STRING_LITERAL)
 	{
-		token_data->line_numbers[i] = current_line;
+		StringSpan *span = &td->string_spans[td->string_literals[tok->payload].first_span];
+		char *copy = arena_alloc(&td->_arena, span->len ? span->len : 1);
+		if (!copy)
+		{
+			td->_out_of_memory = 1;
+			return -1;
+		}
+		memcpy(copy, span->ptr, span->len);
+		span->ptr = copy;
 	}
 
-	return token_data;
+	return 1;
+}
+
+uint32_t join_string_literals(TokenData *td, uint32_t first, uint32_t second)
+{
+	// both may be used elsewhere, by a macro body for one, so the joined literal is always a new one
+	StringLiteral *string_literals = arena_reserve(&td->_arena, td->string_literals, td->_str_lit_idx,
+	                                               &td->_str_lit_cap, sizeof(StringLiteral));
+	if (!string_literals)
+		return UINT32_MAX;
+	td->string_literals = string_literals;
+
+	StringLiteral a = td->string_literals[first];
+	StringLiteral b = td->string_literals[second];
+
+	// literals lexed one after the other already have their spans next to each other, which is the common case
+	if (a.first_span + a.num_spans == b.first_span)
+	{
+		td->string_literals[td->_str_lit_idx] = (StringLiteral){a.first_span, a.num_spans + b.num_spans};
+		return td->_str_lit_idx++;
+	}
+
+	uint32_t first_span = td->_str_span_idx;
+	for (uint32_t i = 0; i < a.num_spans + b.num_spans; i++)
+	{
+		StringSpan *string_spans = arena_reserve(&td->_arena, td->string_spans, td->_str_span_idx,
+		                                         &td->_str_span_cap, sizeof(StringSpan));
+		if (!string_spans)
+			return UINT32_MAX;
+
+		td->string_spans = string_spans;
+		uint32_t src = i < a.num_spans ? a.first_span + i : b.first_span + i - a.num_spans;
+		td->string_spans[td->_str_span_idx++] = td->string_spans[src];
+	}
+
+	td->string_literals[td->_str_lit_idx] = (StringLiteral){first_span, a.num_spans + b.num_spans};
+	return td->_str_lit_idx++;
+}
+
+uint32_t append_string_literal(TokenData *td, const StringSpan *spans, uint32_t num_spans)
+{
+	uint32_t first_span = td->_str_span_idx;
+	for (uint32_t i = 0; i < num_spans; i++)
+	{
+		StringSpan *string_spans = arena_reserve(&td->_arena, td->string_spans, td->_str_span_idx,
+		                                         &td->_str_span_cap, sizeof(StringSpan));
+		if (!string_spans)
+			return UINT32_MAX;
+
+		td->string_spans = string_spans;
+		td->string_spans[td->_str_span_idx++] = spans[i];
+	}
+
+	StringLiteral *string_literals = arena_reserve(&td->_arena, td->string_literals, td->_str_lit_idx,
+	                                               &td->_str_lit_cap, sizeof(StringLiteral));
+	if (!string_literals)
+		return UINT32_MAX;
+	td->string_literals = string_literals;
+
+	td->string_literals[td->_str_lit_idx] = (StringLiteral){first_span, num_spans};
+	return td->_str_lit_idx++;
+}
+
+uint32_t append_invalid_token(TokenData *td, const char *error, uint32_t len)
+{
+	InvalidToken *invalid_tokens = arena_reserve(&td->_arena, td->invalid_tokens, td->num_invalid_tokens,
+	                                             &td->_invalid_cap, sizeof(InvalidToken));
+	if (!invalid_tokens)
+		return UINT32_MAX;
+
+	td->invalid_tokens = invalid_tokens;
+	td->invalid_tokens[td->num_invalid_tokens] = (InvalidToken){error, len};
+	return td->num_invalid_tokens++;
 }
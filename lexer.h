@@ -1,7 +1,156 @@
 #pragma once
 
 #include "char_buffer.h"
+#include "scan.h"
 #include "token.h"
 
+// the token is the first one on its line, which is what makes a '#' start a directive
+#define TOKEN_FLAG_BOL 1
+
+// white space, a comment or a new line comes right before the token
+#define TOKEN_FLAG_SPACE 2
+
+// A single token as handed out by lexer_next, the fields mean the same as the token arrays of TokenData
+typedef struct LexedToken
+{
+	uint32_t offset;
+	uint32_t payload;
+	uint8_t kind;
+	uint8_t flags;
+
+	// source the offset is in, copied from LexerState.file
+	uint16_t file;
+} LexedToken;
+
+// Everything the lexer needs while running. There is one per source and no state outside of it, so separate
+// sources can be lexed on separate threads.
+typedef struct LexerState
+{
+	CharBuffer *cb;
+
+	// identifiers and literals of the source, the token arrays are only filled by tokenize
+	TokenData *td;
+	const ScanKernels *scan;
+
+	// where the line starts of the source go, td->lines unless set up by lexer_init_source
+	LineTable *lines;
+
+	// Set for preprocessing tokens: '#' and '##' become tokens instead of directives being skipped, string literals
+	// are not concatenated, and text that is not a valid token becomes a TOK_INVALID token instead of an error
+	int raw;
+
+	// stamped on every token
+	uint16_t file;
+
+	// source offset of the first char of the token being lexed
+	long long token_start;
+
+	// line of the current char, only kept up to date for diagnostics
+	int current_line;
+
+	// tokens handed out by lexer_next so far
+	uint32_t num_tokens;
+
+	// When set, an error is only recorded in error and error_line instead of being printed, for callers that run
+	// the lexer ahead and only report the error once it is actually reached
+	int defer_errors;
+	const char *error;
+	int error_line;
+
+	// the token produced by the last lexing step
+	LexedToken _cur;
+	int _produced;
+
+	// TOKEN_FLAG_* bits for the next token, gathered from what was skipped before it
+	uint8_t _flags;
+
+	// error of the token being lexed when it is going to be a TOK_INVALID token
+	const char *_invalid;
+
+	// string literal that adjacent literals are being appended to plus one, 0 when not concatenating
+	uint32_t _merge_literal;
+
+	// the token lexed after a string literal to find out whether it continues
+	LexedToken _peeked;
+	int _has_peeked;
+
+	// set by lexer_init_replay, tokens come from the token arrays of td instead of the source
+	int _replay;
+
+	// line splices the char buffer skipped so far
+	uint32_t _splices;
+} LexerState;
+
 void free_token_data(TokenData *td);
+
+// Prepares ls for pulling tokens out of cb with lexer_next. Returns !0 on failure, ls->td has to be freed with
+// free_token_data by the caller either way once it is not NULL.
+int lexer_init(LexerState *ls, CharBuffer *cb);
+
+// Prepares ls for lexing another source of a translation unit into td, which is shared with the other sources and
+// stays owned by the caller. The line starts of cb go into lines. Returns !0 when out of memory.
+int lexer_init_source(LexerState *ls, CharBuffer *cb, TokenData *td, LineTable *lines);
+
+// Prepares ls for handing out the tokens that are already in the token arrays of td through lexer_next, td stays
+// owned by the caller
+void lexer_init_replay(LexerState *ls, TokenData *td);
+
+// Lexes the next token into tok, adjacent string literals are already concatenated unless ls->raw is set.
+// Returns 1 for a token, 0 at the end of the source and -1 after an error was reported.
+int lexer_next(LexerState *ls, LexedToken *tok);
+
+// Prints the error recorded while defer_errors was set, if there is one
+void lexer_report_deferred_error(const LexerState *ls);
+
+// Lexes all of cb into the token arrays of the returned TokenData.
+// String literals point into the source when it is resident, so the char buffer must outlive the token data
 TokenData *tokenize(CharBuffer *cb);
+
+// Same result as tokenize, but the source is split into chunks at new lines that are lexed on up to num_threads
+// threads and then stitched together. A chunk that started inside a block comment is lexed again along with the
+// chunks after it. Falls back to lexing on the calling thread for streamed or small sources. With raw set the tokens
+// are preprocessing tokens, as if every LexerState had raw set.
+TokenData *tokenize_parallel(CharBuffer *cb, int num_threads, int raw);
+
+// Brings td, the tokens of a source, up to date with cb after bytes [edit_start, old_edit_end) of that source were
+// replaced by bytes [edit_start, new_edit_end) of cb. Lexing restarts at the last token before the edit that could
+// not have looked into it and stops as soon as the tokens are the same as before, the rest is shifted over. The
+// tokens are raw again when tokenize_parallel made raw ones. Identifiers keep their ids and td no longer refers to
+// the old source afterwards. cb has to be resident in memory.
+// Returns !0 after an error was reported, td then still describes the old source.
+int retokenize(TokenData *td, CharBuffer *cb, uint32_t edit_start, uint32_t old_edit_end, uint32_t new_edit_end);
+
+// Resolves a source offset to a 1 based line and column using a line table built while lexing
+void line_location(const LineTable *lines, uint32_t offset, int *line, int *col);
+
+// line_location with the lines of the source lexed into td
+void source_location(const TokenData *td, uint32_t offset, int *line, int *col);
+
+// Copies len chars of src to dst leaving out the line splices, for the text of a token spelled from the source.
+// Returns how many chars were copied.
+uint32_t remove_line_splices(char *dst, const char *src, uint32_t len);
+
+// Lexes len chars of str as preprocessing tokens into td, for spellings the preprocessor puts together. str does not
+// have to outlive the call. Returns 1 when it is exactly one valid token, which goes to tok, 0 when it is not and -1
+// when out of memory. A pp-number that is not a valid constant counts as valid, it goes to tok as a TOK_INVALID that
+// keeps its text.
+int lex_spelling(TokenData *td, const char *str, uint32_t len, LexedToken *tok);
+
+// Returns a new string literal made of the spans of literal first followed by those of literal second, both are left
+// as they are. Returns UINT32_MAX when out of memory.
+uint32_t join_string_literals(TokenData *td, uint32_t first, uint32_t second);
+
+// Adds a string literal made of num_spans spans of raw chars, which have to outlive td. Returns its index, or
+// UINT32_MAX when out of memory.
+uint32_t append_string_literal(TokenData *td, const StringSpan *spans, uint32_t num_spans);
+
+// Adds an entry to the invalid tokens of td, error has to outlive td. Returns its index, or UINT32_MAX when out of
+// memory.
+uint32_t append_invalid_token(TokenData *td, const char *error, uint32_t len);
+
+// Upper bound on the decoded length of string literal idx, escape sequences only ever shrink when decoded
+uint32_t string_literal_max_len(const TokenData *td, uint32_t idx);
+
+// Decodes the escape sequences of all spans of string literal idx into out, which must hold at least
+// string_literal_max_len chars. Returns the decoded length, out is not null terminated.
+uint32_t decode_string_literal(const TokenData *td, uint32_t idx, char *out);
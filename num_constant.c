@@ -0,0 +1,861 @@
+// Conversion of numeric constants to their final binary value
+//
+// Integers are accumulated eight digits at a time with SWAR arithmetic and get the first type of their C11 6.4.4.1
+// candidate list that can represent them. Decimal floating constants take the Clinger fast path when both the
+// significand and the power of ten are exact, and the Eisel-Lemire algorithm otherwise. Both are correctly rounded,
+// only a significand that had to be truncated to 19 digits and lands on a rounding boundary falls back to strtod.
+// Hex floating constants are exact in binary and are rounded by hand.
+//
+// Converted constants are pooled by value, equal constants are deduplicated through a hash of their type and bits.
+
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "num_constant.h"
+#include "num_tables.h"
+
+// a uint64_t always holds 19 decimal digits, once the significand reaches this it has all of them
+#define MIN_NINETEEN_DIGITS 1000000000000000000ULL
+
+#define POOL_INITIAL_SLOTS 256
+#define POOL_INITIAL_CONSTANTS 128
+
+// exponents are clamped here, this is far outside of what any format can reach
+#define EXPONENT_LIMIT 0x10000000
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SWAR_DIGITS 1
+#endif
+
+typedef struct FloatFormat
+{
+	int mantissa_bits;
+	int minimum_exponent;
+	int infinite_power;
+	int smallest_power_of_ten;
+	int largest_power_of_ten;
+	int min_exponent_round_to_even;
+	int max_exponent_round_to_even;
+	int max_exponent_fast_path;
+} FloatFormat;
+
+static const FloatFormat double_format = {52, -1023, 0x7FF, -342, 308, -4, 23, 22};
+static const FloatFormat float_format = {23, -127, 0xFF, -64, 38, -17, 10, 10};
+
+// clang-format off
+static const double double_powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static const float float_powers_of_ten[] = {
+	1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f,
+};
+
+#define NUM_INTEGER_SUFFIXES 22
+#define NUM_FLOATING_SUFFIXES 4
+
+static const char *integer_suffixes[NUM_INTEGER_SUFFIXES] = {
+	"llu",
+	"llU",
+	"LLu",
+	"LLU",
+
+	"lu",
+	"lU",
+	"Lu",
+	"LU",
+
+	"ull",
+	"uLL",
+	"Ull",
+	"ULL",
+
+	"ul",
+	"uL",
+	"Ul",
+	"UL",
+
+	"u",
+	"U",
+
+	"ll",
+	"LL",
+
+	"l",
+	"L"
+};
+
+// the first type of the candidate list each suffix selects
+static const int_types integer_suffix_types[NUM_INTEGER_SUFFIXES] = {
+	INT_TYPE_UNSIGNED_LLONG,
+	INT_TYPE_UNSIGNED_LLONG,
+	INT_TYPE_UNSIGNED_LLONG,
+	INT_TYPE_UNSIGNED_LLONG,
+
+	INT_TYPE_UNSIGNED_LONG,
+	INT_TYPE_UNSIGNED_LONG,
+	INT_TYPE_UNSIGNED_LONG,
+	INT_TYPE_UNSIGNED_LONG,
+
+	INT_TYPE_UNSIGNED_LLONG,
+	INT_TYPE_UNSIGNED_LLONG,
+	INT_TYPE_UNSIGNED_LLONG,
+	INT_TYPE_UNSIGNED_LLONG,
+
+	INT_TYPE_UNSIGNED_LONG,
+	INT_TYPE_UNSIGNED_LONG,
+	INT_TYPE_UNSIGNED_LONG,
+	INT_TYPE_UNSIGNED_LONG,
+
+	INT_TYPE_UNSIGNED_INT,
+	INT_TYPE_UNSIGNED_INT,
+
+	INT_TYPE_SIGNED_LLONG,
+	INT_TYPE_SIGNED_LLONG,
+
+	INT_TYPE_SIGNED_LONG,
+	INT_TYPE_SIGNED_LONG,
+};
+
+static const char *floating_suffixes[NUM_FLOATING_SUFFIXES] = {
+	"f",
+	"F",
+	"l",
+	"L",
+};
+
+static const floating_types floating_suffix_types[NUM_FLOATING_SUFFIXES] = {
+	FLOATING_TYPE_FLOAT,
+	FLOATING_TYPE_FLOAT,
+	FLOATING_TYPE_LDOUBLE,
+	FLOATING_TYPE_LDOUBLE,
+};
+
+// Every integer type by rank, int is 32 bits and long and long long are 64 bits (LP64)
+static const struct
+{
+	int_types type;
+	uint64_t max;
+	int is_unsigned;
+} int_candidates[] = {
+	{INT_TYPE_SIGNED_INT, INT32_MAX, 0},
+	{INT_TYPE_UNSIGNED_INT, UINT32_MAX, 1},
+	{INT_TYPE_SIGNED_LONG, INT64_MAX, 0},
+	{INT_TYPE_UNSIGNED_LONG, UINT64_MAX, 1},
+	{INT_TYPE_SIGNED_LLONG, INT64_MAX, 0},
+	{INT_TYPE_UNSIGNED_LLONG, UINT64_MAX, 1},
+};
+// clang-format on
+
+#define NUM_INT_CANDIDATES ((int)(sizeof(int_candidates) / sizeof(int_candidates[0])))
+
+static int is_digit(char chr)
+{
+	return chr >= '0' && chr <= '9';
+}
+
+static int hex_value(char chr)
+{
+	if (chr >= '0' && chr <= '9')
+		return chr - '0';
+	if (chr >= 'a' && chr <= 'f')
+		return chr - 'a' + 10;
+	if (chr >= 'A' && chr <= 'F')
+		return chr - 'A' + 10;
+	return -1;
+}
+
+#ifdef SWAR_DIGITS
+static uint64_t read_eight(const char *p)
+{
+	uint64_t val;
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static int is_eight_digits(uint64_t val)
+{
+	return !(((val + 0x4646464646464646) | (val - 0x3030303030303030)) & 0x8080808080808080);
+}
+
+// Converts eight ASCII digits at once, combining neighbouring digits, then pairs, then quads
+static uint64_t parse_eight_digits(uint64_t val)
+{
+	const uint64_t mask = 0x000000FF000000FF;
+	const uint64_t mul1 = 0x000F424000000064; // 100 + (1000000 << 32)
+	const uint64_t mul2 = 0x0000271000000001; // 1 + (10000 << 32)
+	val -= 0x3030303030303030;
+	val = (val * 10) + (val >> 8);
+	val = (((val & mask) * mul1) + (((val >> 16) & mask) * mul2)) >> 32;
+	return val;
+}
+#endif
+
+// Adds the run of decimal digits at p to *w and returns the end of the run. *w wraps around once it has taken more
+// than 19 digits, callers go by the digit count.
+static const char *decimal_digits(const char *p, const char *end, uint64_t *w)
+{
+#ifdef SWAR_DIGITS
+	while (end - p >= 8 && is_eight_digits(read_eight(p)))
+	{
+		*w = *w * 100000000 + parse_eight_digits(read_eight(p));
+		p += 8;
+	}
+#endif
+	while (p != end && is_digit(*p))
+		*w = *w * 10 + (*p++ - '0');
+	return p;
+}
+
+// Reads the optionally signed decimal exponent after an 'e' or 'p', clamping huge values. Returns NULL on error
+static const char *exponent_digits(const char *p, const char *end, int64_t *res)
+{
+	int negative = 0;
+	if (p != end && (*p == '+' || *p == '-'))
+		negative = *p++ == '-';
+
+	if (p == end || !is_digit(*p))
+		return NULL;
+
+	int64_t exp = 0;
+	for (; p != end && is_digit(*p); p++)
+	{
+		if (exp < EXPONENT_LIMIT)
+			exp = exp * 10 + (*p - '0');
+	}
+
+	*res = negative ? -exp : exp;
+	return p;
+}
+
+static const char *integer_suffix(const char *suffix, const char *end, int_types *res)
+{
+	if (suffix == end)
+	{
+		*res = INT_TYPE_SIGNED_INT;
+		return NULL;
+	}
+
+	for (int i = 0; i < NUM_INTEGER_SUFFIXES; i++)
+	{
+		size_t len = strlen(integer_suffixes[i]);
+		if ((size_t)(end - suffix) == len && memcmp(suffix, integer_suffixes[i], len) == 0)
+		{
+			*res = integer_suffix_types[i];
+			return NULL;
+		}
+	}
+
+	return "invalid suffix";
+}
+
+static const char *floating_suffix(const char *suffix, const char *end, floating_types *res)
+{
+	if (suffix == end)
+	{
+		*res = FLOATING_TYPE_DOUBLE;
+		return NULL;
+	}
+
+	if (end - suffix == 1)
+	{
+		for (int i = 0; i < NUM_FLOATING_SUFFIXES; i++)
+		{
+			if (*suffix == floating_suffixes[i][0])
+			{
+				*res = floating_suffix_types[i];
+				return NULL;
+			}
+		}
+	}
+
+	return "invalid suffix";
+}
+
+// Walks the candidate list starting at the type the suffix selects. Decimal constants only widen within their
+// signedness, octal and hex ones may also become unsigned unless the suffix already made them unsigned.
+static const char *select_int_type(NumConstant *nc, int_types suffix_type, int decimal)
+{
+	int first = 0;
+	while (int_candidates[first].type != suffix_type)
+		first++;
+
+	int is_unsigned = int_candidates[first].is_unsigned;
+	for (int i = first; i < NUM_INT_CANDIDATES; i++)
+	{
+		if (int_candidates[i].is_unsigned != is_unsigned && (decimal || is_unsigned))
+			continue;
+
+		if (nc->int_value <= int_candidates[i].max)
+		{
+			nc->int_type = int_candidates[i].type;
+			return NULL;
+		}
+	}
+
+	return "integer constant is too large for its type";
+}
+
+static const char *convert_integer(uint64_t value, const char *suffix, const char *end, int decimal, NumConstant *nc)
+{
+	int_types suffix_type;
+	const char *err = integer_suffix(suffix, end, &suffix_type);
+	if (err)
+		return err;
+
+	nc->int_value = value;
+	return select_int_type(nc, suffix_type, decimal);
+}
+
+static const char *convert_decimal_integer(const char *str, const char *end, NumConstant *nc)
+{
+	uint64_t w = 0;
+	const char *digits_end = decimal_digits(str, end, &w);
+	long digit_count = digits_end - str;
+
+	// UINT64_MAX has 20 digits, only the 20th digit can overflow so it is added in 128 bits
+	if (digit_count > 20)
+		return "integer constant is too large";
+
+	if (digit_count == 20)
+	{
+		w = 0;
+		decimal_digits(str, str + 19, &w);
+
+		unsigned __int128 wide = (unsigned __int128)w * 10 + (str[19] - '0');
+		if (wide > UINT64_MAX)
+			return "integer constant is too large";
+		w = wide;
+	}
+
+	return convert_integer(w, digits_end, end, 1, nc);
+}
+
+// str is the leading 0
+static const char *convert_octal(const char *str, const char *end, NumConstant *nc)
+{
+	uint64_t value = 0;
+	const char *p = str + 1;
+	for (; p != end && is_digit(*p); p++)
+	{
+		if (*p > '7')
+			return "invalid digit in octal constant";
+
+		if (value >> 61)
+			return "integer constant is too large";
+
+		value = value << 3 | (*p - '0');
+	}
+
+	return convert_integer(value, p, end, 0, nc);
+}
+
+// Rounds (m + a sticky fraction below it) * 2^e2 to the nearest value of fmt with ties to even, returns its bits
+static uint64_t round_binary(uint64_t m, int64_t e2, int sticky, const FloatFormat *fmt)
+{
+	if (m == 0)
+		return 0;
+
+	int lz = __builtin_clzll(m);
+	m <<= lz;
+	e2 -= lz;
+
+	int64_t biased = e2 + 63 - fmt->minimum_exponent;
+	int shift = 63 - fmt->mantissa_bits;
+	if (biased >= fmt->infinite_power)
+		return (uint64_t)fmt->infinite_power << fmt->mantissa_bits;
+
+	// subnormals have fewer significant bits the smaller they get
+	if (biased <= 0)
+	{
+		if (1 - biased > 64 - shift)
+			return 0;
+		shift += 1 - biased;
+		biased = 0;
+	}
+
+	uint64_t kept = shift == 64 ? 0 : m >> shift;
+	uint64_t rem = shift == 64 ? m : m & (((uint64_t)1 << shift) - 1);
+	uint64_t half = (uint64_t)1 << (shift - 1);
+	if (rem > half || (rem == half && (sticky || (kept & 1))))
+		kept++;
+
+	// kept still has the implicit bit which moves it up into the exponent field, as does a carry out of rounding
+	return (biased ? (uint64_t)(biased - 1) << fmt->mantissa_bits : 0) + kept;
+}
+
+typedef struct AdjustedMantissa
+{
+	uint64_t mantissa;
+	int power2;
+} AdjustedMantissa;
+
+static uint64_t full_multiplication(uint64_t a, uint64_t b, uint64_t *lo)
+{
+	unsigned __int128 res = (unsigned __int128)a * b;
+	*lo = (uint64_t)res;
+	return res >> 64;
+}
+
+// Eisel-Lemire, rounds w * 10^q to the nearest value of fmt with ties to even
+static AdjustedMantissa compute_float(int64_t q, uint64_t w, const FloatFormat *fmt)
+{
+	AdjustedMantissa answer = {0, 0};
+	if (w == 0 || q < fmt->smallest_power_of_ten)
+		return answer;
+
+	if (q > fmt->largest_power_of_ten)
+	{
+		answer.power2 = fmt->infinite_power;
+		return answer;
+	}
+
+	int lz = __builtin_clzll(w);
+	w <<= lz;
+
+	// the low half of the power of five is only needed when the product could carry into the bits we keep
+	int index = 2 * (int)(q - SMALLEST_POWER_OF_FIVE);
+	uint64_t lo;
+	uint64_t hi = full_multiplication(w, power_of_five_128[index], &lo);
+	uint64_t precision_mask = UINT64_MAX >> (fmt->mantissa_bits + 3);
+	if ((hi & precision_mask) == precision_mask)
+	{
+		uint64_t second_lo;
+		uint64_t second_hi = full_multiplication(w, power_of_five_128[index + 1], &second_lo);
+		lo += second_hi;
+		if (second_hi > lo)
+			hi++;
+	}
+
+	int upperbit = hi >> 63;
+	int shift = upperbit + 64 - fmt->mantissa_bits - 3;
+	answer.mantissa = hi >> shift;
+
+	// floor(q * log2(10)) + 63
+	answer.power2 = (((152170 + 65536) * (int)q) >> 16) + 63 + upperbit - lz - fmt->minimum_exponent;
+
+	if (answer.power2 <= 0)
+	{
+		if (-answer.power2 + 1 >= 64)
+		{
+			answer.mantissa = 0;
+			answer.power2 = 0;
+			return answer;
+		}
+
+		answer.mantissa >>= -answer.power2 + 1;
+		answer.mantissa += answer.mantissa & 1;
+		answer.mantissa >>= 1;
+
+		// rounding can carry a subnormal up to the smallest normal
+		answer.power2 = answer.mantissa < ((uint64_t)1 << fmt->mantissa_bits) ? 0 : 1;
+		return answer;
+	}
+
+	// an exact halfway case, which can only happen for small powers, rounds to even instead of up
+	if (lo <= 1 && q >= fmt->min_exponent_round_to_even && q <= fmt->max_exponent_round_to_even &&
+	    (answer.mantissa & 3) == 1)
+	{
+		if ((answer.mantissa << shift) == hi)
+			answer.mantissa &= ~(uint64_t)1;
+	}
+
+	answer.mantissa += answer.mantissa & 1;
+	answer.mantissa >>= 1;
+	if (answer.mantissa >= ((uint64_t)2 << fmt->mantissa_bits))
+	{
+		answer.mantissa = (uint64_t)1 << fmt->mantissa_bits;
+		answer.power2++;
+	}
+
+	answer.mantissa &= ~((uint64_t)1 << fmt->mantissa_bits);
+	if (answer.power2 >= fmt->infinite_power)
+	{
+		answer.power2 = fmt->infinite_power;
+		answer.mantissa = 0;
+	}
+
+	return answer;
+}
+
+static uint64_t adjusted_bits(AdjustedMantissa am, const FloatFormat *fmt)
+{
+	return am.mantissa | (uint64_t)am.power2 << fmt->mantissa_bits;
+}
+
+static const char *set_float_bits(NumConstant *nc, uint64_t bits, const FloatFormat *fmt)
+{
+	if (bits >= (uint64_t)fmt->infinite_power << fmt->mantissa_bits)
+		return "floating constant is out of range";
+
+	if (fmt == &float_format)
+	{
+		uint32_t word = bits;
+		float value;
+		memcpy(&value, &word, sizeof(value));
+		nc->float_value = value;
+	}
+	else
+	{
+		memcpy(&nc->float_value, &bits, sizeof(bits));
+	}
+
+	return NULL;
+}
+
+// Only reached when truncating the significand to 19 digits left the rounding undecided, strtod is correctly
+// rounded and the compiler never changes the locale away from "C"
+static const char *convert_slow(const char *str, const char *num_end, NumConstant *nc, const FloatFormat *fmt)
+{
+	size_t len = num_end - str;
+	char *buf = mem_alloc(len + 1);
+	if (!buf)
+		return "ran out of memory converting a floating constant";
+
+	memcpy(buf, str, len);
+	buf[len] = 0;
+
+	double value = fmt == &float_format ? strtof(buf, NULL) : strtod(buf, NULL);
+	mem_free(buf);
+
+	uint64_t bits;
+	if (fmt == &float_format)
+	{
+		float narrow = value;
+		uint32_t word;
+		memcpy(&word, &narrow, sizeof(word));
+		bits = word;
+	}
+	else
+	{
+		memcpy(&bits, &value, sizeof(bits));
+	}
+
+	return set_float_bits(nc, bits, fmt);
+}
+
+// Exact when both w and 10^|q| are exactly representable, a single correctly rounded operation then gives the
+// correctly rounded result. Returns !0 if the fast path applies.
+static int convert_fast_path(uint64_t w, int64_t q, NumConstant *nc, const FloatFormat *fmt)
+{
+#if FLT_EVAL_METHOD == 0
+	if (q < -fmt->max_exponent_fast_path || q > fmt->max_exponent_fast_path ||
+	    w > (uint64_t)2 << fmt->mantissa_bits)
+		return 0;
+
+	if (fmt == &float_format)
+	{
+		float value = w;
+		value = q < 0 ? value / float_powers_of_ten[-q] : value * float_powers_of_ten[q];
+		nc->float_value = value;
+	}
+	else
+	{
+		double value = w;
+		value = q < 0 ? value / double_powers_of_ten[-q] : value * double_powers_of_ten[q];
+		nc->float_value = value;
+	}
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+static const FloatFormat *format_of(floating_types type)
+{
+	// LLVMConstReal takes a double, so long double constants are converted at double precision
+	return type == FLOATING_TYPE_FLOAT ? &float_format : &double_format;
+}
+
+static const char *convert_decimal_float(const char *str, const char *end, NumConstant *nc)
+{
+	const char *int_start = str;
+	uint64_t w = 0;
+	const char *int_end = decimal_digits(int_start, end, &w);
+	const char *frac_start = int_end;
+	const char *frac_end = int_end;
+	const char *p = int_end;
+
+	if (p != end && *p == '.')
+	{
+		frac_start = p + 1;
+		frac_end = decimal_digits(frac_start, end, &w);
+		p = frac_end;
+	}
+
+	int64_t exponent = frac_start - frac_end;
+	long digit_count = (int_end - int_start) + (frac_end - frac_start);
+
+	int64_t exp_number = 0;
+	if (p != end && (*p == 'e' || *p == 'E'))
+	{
+		p = exponent_digits(p + 1, end, &exp_number);
+		if (!p)
+			return "exponent has no digits";
+	}
+	const char *num_end = p;
+
+	nc->floating = 1;
+	const char *err = floating_suffix(p, end, &nc->floating_type);
+	if (err)
+		return err;
+
+	const FloatFormat *fmt = format_of(nc->floating_type);
+
+	// more digits than fit in w, keep the first 19 significant ones and scale by the ones dropped
+	int truncated = 0;
+	if (digit_count > 19)
+	{
+		for (const char *s = int_start; s != frac_end && (*s == '0' || *s == '.'); s++)
+		{
+			if (*s == '0')
+				digit_count--;
+		}
+
+		if (digit_count > 19)
+		{
+			truncated = 1;
+			w = 0;
+			const char *d = int_start;
+			while (w < MIN_NINETEEN_DIGITS && d != int_end)
+				w = w * 10 + (*d++ - '0');
+
+			if (w >= MIN_NINETEEN_DIGITS)
+			{
+				exponent = int_end - d;
+			}
+			else
+			{
+				d = frac_start;
+				while (w < MIN_NINETEEN_DIGITS && d != frac_end)
+					w = w * 10 + (*d++ - '0');
+				exponent = frac_start - d;
+			}
+		}
+	}
+
+	exponent += exp_number;
+
+	if (!truncated && convert_fast_path(w, exponent, nc, fmt))
+		return NULL;
+
+	AdjustedMantissa am = compute_float(exponent, w, fmt);
+
+	// the dropped digits lie between w and w + 1, if both round the same way so does the real value
+	if (truncated)
+	{
+		AdjustedMantissa upper = compute_float(exponent, w + 1, fmt);
+		if (upper.mantissa != am.mantissa || upper.power2 != am.power2)
+			return convert_slow(str, num_end, nc, fmt);
+	}
+
+	return set_float_bits(nc, adjusted_bits(am, fmt), fmt);
+}
+
+// str is just past the 0x, covers both hex integers and hex floating constants
+static const char *convert_hex(const char *str, const char *end, NumConstant *nc)
+{
+	// the first 16 significant digits are kept in m, later ones only scale the exponent or set sticky
+	uint64_t m = 0;
+	int64_t e2 = 0;
+	int sticky = 0;
+	int num_digits = 0;
+
+	const char *p = str;
+	for (; p != end && hex_value(*p) != -1; p++, num_digits++)
+	{
+		int digit = hex_value(*p);
+		if (m >> 60)
+		{
+			sticky |= digit != 0;
+			e2 += 4;
+		}
+		else
+		{
+			m = m << 4 | digit;
+		}
+	}
+
+	if (p == end || (*p != '.' && *p != 'p' && *p != 'P'))
+	{
+		if (!num_digits)
+			return "hex constant has no digits";
+
+		if (e2)
+			return "integer constant is too large";
+
+		return convert_integer(m, p, end, 0, nc);
+	}
+
+	if (*p == '.')
+	{
+		for (p++; p != end && hex_value(*p) != -1; p++, num_digits++)
+		{
+			int digit = hex_value(*p);
+			if (m >> 60)
+			{
+				sticky |= digit != 0;
+			}
+			else
+			{
+				m = m << 4 | digit;
+				e2 -= 4;
+			}
+		}
+	}
+
+	if (!num_digits)
+		return "hex floating constant has no digits";
+
+	if (p == end || (*p != 'p' && *p != 'P'))
+		return "hex floating constant requires exponent";
+
+	int64_t exp_number;
+	p = exponent_digits(p + 1, end, &exp_number);
+	if (!p)
+		return "exponent has no digits";
+
+	nc->floating = 1;
+	const char *err = floating_suffix(p, end, &nc->floating_type);
+	if (err)
+		return err;
+
+	const FloatFormat *fmt = format_of(nc->floating_type);
+	return set_float_bits(nc, round_binary(m, e2 + exp_number, sticky, fmt), fmt);
+}
+
+const char *convert_num_constant(const char *str, uint32_t len, NumConstant *nc)
+{
+	const char *end = str + len;
+	memset(nc, 0, sizeof(NumConstant));
+
+	if (len >= 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+		return convert_hex(str + 2, end, nc);
+
+	// a '.' or an exponent after the leading digits makes a decimal floating constant, even with a leading 0
+	const char *p = str;
+	while (p != end && is_digit(*p))
+		p++;
+	if (p != end && (*p == '.' || *p == 'e' || *p == 'E'))
+		return convert_decimal_float(str, end, nc);
+
+	if (str[0] == '0')
+		return convert_octal(str, end, nc);
+
+	return convert_decimal_integer(str, end, nc);
+}
+
+NumConstantPool *alloc_num_constant_pool(Arena *arena)
+{
+	NumConstantPool *res = arena_calloc(arena, 1, sizeof(NumConstantPool));
+	if (!res)
+		return NULL;
+
+	res->_arena = arena;
+	res->_slots = arena_calloc(arena, POOL_INITIAL_SLOTS, sizeof(NumConstantSlot));
+	res->_slot_mask = POOL_INITIAL_SLOTS - 1;
+	res->constants = arena_alloc(arena, POOL_INITIAL_CONSTANTS * sizeof(NumConstant));
+	res->_constants_cap = POOL_INITIAL_CONSTANTS;
+
+	if (!res->_slots || !res->constants)
+		return NULL;
+
+	return res;
+}
+
+// Floating constants are keyed on their bits, so 0.0 and -0.0 stay apart
+static uint64_t value_bits(const NumConstant *nc)
+{
+	uint64_t bits = nc->int_value;
+	if (nc->floating)
+		memcpy(&bits, &nc->float_value, sizeof(bits));
+	return bits;
+}
+
+static int same_constant(const NumConstant *a, const NumConstant *b)
+{
+	if (a->floating != b->floating)
+		return 0;
+
+	if (a->floating ? a->floating_type != b->floating_type : a->int_type != b->int_type)
+		return 0;
+
+	return value_bits(a) == value_bits(b);
+}
+
+// splitmix64 finaliser over the value bits and the type
+static uint32_t num_constant_hash(const NumConstant *nc)
+{
+	uint64_t tag = nc->floating ? 8 + nc->floating_type : nc->int_type;
+	uint64_t hash = value_bits(nc) * 0x9E3779B97F4A7C15 + tag;
+	hash ^= hash >> 30;
+	hash *= 0xBF58476D1CE4E5B9;
+	hash ^= hash >> 27;
+	hash *= 0x94D049BB133111EB;
+	hash ^= hash >> 31;
+	return (uint32_t)hash;
+}
+
+static int grow_pool_slots(NumConstantPool *pool)
+{
+	uint32_t new_cap = (pool->_slot_mask + 1) * 2;
+	NumConstantSlot *slots = arena_calloc(pool->_arena, new_cap, sizeof(NumConstantSlot));
+	if (!slots)
+		return 1;
+
+	uint32_t mask = new_cap - 1;
+	for (uint32_t i = 0; i <= pool->_slot_mask; i++)
+	{
+		NumConstantSlot slot = pool->_slots[i];
+		if (!slot.idx_plus_one)
+			continue;
+
+		uint32_t pos = slot.hash & mask;
+		while (slots[pos].idx_plus_one)
+			pos = (pos + 1) & mask;
+		slots[pos] = slot;
+	}
+
+	pool->_slots = slots;
+	pool->_slot_mask = mask;
+	return 0;
+}
+
+uint32_t pool_num_constant(NumConstantPool *pool, const NumConstant *nc)
+{
+	uint32_t hash = num_constant_hash(nc);
+	uint32_t pos = hash & pool->_slot_mask;
+	pool->lookups++;
+
+	while (pool->_slots[pos].idx_plus_one)
+	{
+		NumConstantSlot slot = pool->_slots[pos];
+		if (slot.hash == hash && same_constant(&pool->constants[slot.idx_plus_one - 1], nc))
+			return slot.idx_plus_one - 1;
+		pos = (pos + 1) & pool->_slot_mask;
+	}
+
+	NumConstant *constants =
+		arena_reserve(pool->_arena, pool->constants, pool->count, &pool->_constants_cap, sizeof(NumConstant));
+	if (!constants)
+		return NUM_CONSTANT_NO_IDX;
+	pool->constants = constants;
+
+	uint32_t idx = pool->count++;
+	pool->constants[idx] = *nc;
+
+	pool->_slots[pos].hash = hash;
+	pool->_slots[pos].idx_plus_one = idx + 1;
+
+	// same load factor as the intern table
+	if (pool->count * 2 > pool->_slot_mask + 1)
+	{
+		if (grow_pool_slots(pool))
+			return NUM_CONSTANT_NO_IDX;
+	}
+
+	return idx;
+}
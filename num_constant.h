@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "arena.h"
+
+typedef enum int_types
+{
+	INT_TYPE_SIGNED_LLONG,
+	INT_TYPE_UNSIGNED_LLONG,
+	INT_TYPE_SIGNED_LONG,
+	INT_TYPE_UNSIGNED_LONG,
+	INT_TYPE_SIGNED_INT,
+	INT_TYPE_UNSIGNED_INT
+} int_types;
+
+typedef enum floating_types
+{
+	FLOATING_TYPE_DOUBLE,
+	FLOATING_TYPE_FLOAT,
+	FLOATING_TYPE_LDOUBLE
+} floating_types;
+
+// A numeric constant after conversion, the value is final and can be handed to LLVMConstInt or LLVMConstReal as is.
+// float constants are exactly representable as a float, long double ones are rounded to double precision.
+typedef struct NumConstant
+{
+	uint64_t int_value;
+	double float_value;
+	int floating;
+	floating_types floating_type;
+	int_types int_type;
+} NumConstant;
+
+#define NUM_CONSTANT_NO_IDX UINT32_MAX
+
+typedef struct NumConstantSlot
+{
+	uint32_t hash;
+	uint32_t idx_plus_one;
+} NumConstantSlot;
+
+// Every distinct numeric constant of a translation unit stored by value. Equal constants share an index, so codegen
+// only has to create one value for each of them.
+typedef struct NumConstantPool
+{
+	Arena *_arena;
+
+	// open addressing, idx_plus_one is 0 for empty slots
+	NumConstantSlot *_slots;
+	uint32_t _slot_mask;
+
+	NumConstant *constants;
+	uint32_t _constants_cap;
+	uint32_t count;
+
+	// calls to pool_num_constant, count of them were new constants, for --stats
+	unsigned long lookups;
+} NumConstantPool;
+
+// Converts the spelling of a preprocessing number into its C11 type and final binary value, str does not need to be
+// null terminated. Returns NULL on success, otherwise a description of why the spelling is not a valid constant.
+const char *convert_num_constant(const char *str, uint32_t len, NumConstant *nc);
+
+NumConstantPool *alloc_num_constant_pool(Arena *arena);
+
+// Returns the index of the pooled constant equal to nc, adding a copy of nc if there is none yet.
+// Returns NUM_CONSTANT_NO_IDX when out of memory.
+uint32_t pool_num_constant(NumConstantPool *pool, const NumConstant *nc);
@@ -1,113 +1,1725 @@
 #include "parser.h"
+#include "preprocessor.h"
 
-#ifndef NDEBUG
-#include <signal.h>
-#endif
-
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#define PARSER_ERROR_STRING(name, description) description,
+
+const char *const ParserErrorStrings[] = {PARSER_ERRORS(PARSER_ERROR_STRING)};
+
+// Tokens are pulled from the preprocessor into a ring as the parser looks at them, this bounds both the lookahead of
+// peek_token_n and how long a pointer from peek_lexed stays valid. Must be a power of two.
+#define TOKEN_RING_SIZE 16
+#define TOKEN_RING_MASK (TOKEN_RING_SIZE - 1)
+
+// first chunk of the arena the scopes are kept in
+#define PARSER_SCRATCH_CHUNK (4 * 1024)
+
+// How tight the binary operators bind, loosest first. The comma operator is left to expression.
+typedef enum Precedence
+{
+	PREC_NONE,
+	PREC_ASSIGNMENT,
+	PREC_CONDITIONAL,
+	PREC_LOGICAL_OR,
+	PREC_LOGICAL_AND,
+	PREC_BIT_OR,
+	PREC_BIT_XOR,
+	PREC_BIT_AND,
+	PREC_EQUALITY,
+	PREC_RELATIONAL,
+	PREC_SHIFT,
+	PREC_ADDITIVE,
+	PREC_MULTIPLICATIVE
+} Precedence;
+
+// PREC_NONE for every token that is not a binary operator
+static const uint8_t binary_precedence[TOK_COUNT] = {
+	[TOK_EQUAL] = PREC_ASSIGNMENT,
+	[TOK_STAR_EQL] = PREC_ASSIGNMENT,
+	[TOK_FORWARD_SLASH_EQL] = PREC_ASSIGNMENT,
+	[TOK_PERCENT_EQL] = PREC_ASSIGNMENT,
+	[TOK_PLUS_EQL] = PREC_ASSIGNMENT,
+	[TOK_MINUS_EQL] = PREC_ASSIGNMENT,
+	[TOK_BIT_SHIFT_LEFT_EQL] = PREC_ASSIGNMENT,
+	[TOK_BIT_SHIFT_RIGHT_EQL] = PREC_ASSIGNMENT,
+	[TOK_AMPERSAND_EQL] = PREC_ASSIGNMENT,
+	[TOK_CARET_EQL] = PREC_ASSIGNMENT,
+	[TOK_PIPE_EQL] = PREC_ASSIGNMENT,
+	[TOK_QUESTION] = PREC_CONDITIONAL,
+	[TOK_OR] = PREC_LOGICAL_OR,
+	[TOK_AND] = PREC_LOGICAL_AND,
+	[TOK_PIPE] = PREC_BIT_OR,
+	[TOK_CARET] = PREC_BIT_XOR,
+	[TOK_AMPERSAND] = PREC_BIT_AND,
+	[TOK_EQUALITY] = PREC_EQUALITY,
+	[TOK_EQUALITY_NOT] = PREC_EQUALITY,
+	[TOK_LSS] = PREC_RELATIONAL,
+	[TOK_GTR] = PREC_RELATIONAL,
+	[TOK_LSS_EQL] = PREC_RELATIONAL,
+	[TOK_GTR_EQL] = PREC_RELATIONAL,
+	[TOK_BIT_SHIFT_LEFT] = PREC_SHIFT,
+	[TOK_BIT_SHIFT_RIGHT] = PREC_SHIFT,
+	[TOK_PLUS] = PREC_ADDITIVE,
+	[TOK_MINUS] = PREC_ADDITIVE,
+	[TOK_STAR] = PREC_MULTIPLICATIVE,
+	[TOK_FORWARD_SLASH] = PREC_MULTIPLICATIVE,
+	[TOK_PERCENT] = PREC_MULTIPLICATIVE,
+};
+
+// An identifier declared in one of the open scopes. Only what is needed to tell typedef names from other identifiers
+// is kept, types are not looked at before code generation.
+typedef struct ParserBinding
+{
+	uint32_t id;
+
+	// the binding of the same identifier in an outer scope + 1, 0 when there is none
+	uint32_t hidden;
+
+	int typedef_name;
+} ParserBinding;
+
+// Which specifiers a list may have
+typedef enum SpecifierContext
+{
+	// all of them
+	SPECIFIERS_DECLARATION,
+
+	// type specifiers, qualifiers and _Alignas (C17, DR 444)
+	SPECIFIERS_MEMBER,
+
+	// type specifiers and qualifiers
+	SPECIFIERS_TYPE_NAME
+} SpecifierContext;
+
+// What a declarator may be named
+typedef enum DeclaratorKind
+{
+	// declarations and members
+	DECLARATOR_NAMED,
+
+	// parameters
+	DECLARATOR_MAYBE_NAMED,
+
+	// type names
+	DECLARATOR_ABSTRACT
+} DeclaratorKind;
+
+// Everything the parser needs while running, there is one per parse call
+typedef struct Parser
+{
+	Preprocessor *pp;
+	TokenPipe *pipe;
+
+	// where the syntax tree goes
+	Arena *arena;
+
+	// Positions are counted from the start of the token stream, token i lives in token_ring[i & TOKEN_RING_MASK]
+	// for as long as it is one of the last TOKEN_RING_SIZE tokens lexed
+	LexedToken token_ring[TOKEN_RING_SIZE];
+	int current_token;
+	int lexed_tokens;
+	int lexer_done;
+
+	// levels of nesting the current token is in, see PARSER_MAX_DEPTH
+	int depth;
+
+	// The identifiers declared in the open scopes, innermost last, and where each scope starts among them.
+	// binding_of has the innermost binding + 1 of every identifier id, 0 for the ones no open scope declares. All of
+	// it lives in scratch, which is released once the parse is done.
+	Arena scratch;
+	ParserBinding *bindings;
+	uint32_t num_bindings;
+	uint32_t bindings_cap;
+	uint32_t *scopes;
+	uint32_t num_scopes;
+	uint32_t scopes_cap;
+	uint32_t *binding_of;
+	uint32_t binding_of_cap;
 
-static TokenData *token_data_internal;
-static LLVMModuleRef llvm_module_internal;
-static int current_token = 0;
+	// print_error unwinds back to parse through this, which then returns err
+	jmp_buf bail;
+	volatile ParserErrorCode err;
+} Parser;
 
 /**
- * Will print error and exit
+ * Will print error and return err from parse
  */
-static void print_error(const char *msg)
+static void print_error(Parser *p, ParserErrorCode err, const char *msg)
+{
+	// errors are reported at the current token, or the last one once the stream is exhausted
+	int idx = p->current_token < p->lexed_tokens ? p->current_token : p->lexed_tokens - 1;
+	int in_ring = idx >= 0 && idx >= p->lexed_tokens - TOKEN_RING_SIZE;
+	LexedToken at = {0};
+	if (in_ring)
+		at = p->token_ring[idx & TOKEN_RING_MASK];
+
+	// the line tables are still being written while the preprocessor runs on its own thread
+	if (p->pipe)
+		token_pipe_stop(p->pipe);
+
+	const char *file_name;
+	int line, col;
+	pp_source_location(p->pp, &at, &file_name, &line, &col);
+	printf("[%s Line %d:%d] Error: %s\n", file_name, line, col, msg);
+
+	// errors are returned to the caller, other sources being compiled alongside this one carry on
+	fflush(stdout);
+
+	p->err = err;
+	longjmp(p->bail, 1);
+}
+
+static void out_of_memory(Parser *p)
+{
+	print_error(p, PARSER_INTERNAL_ERROR, "ran out of memory while parsing");
+}
+
+// Preprocesses until token idx is in the ring, returns 0 if the stream ends before it
+static int fill_token_ring(Parser *p, int idx)
+{
+	if (idx < 0 || idx < p->lexed_tokens - TOKEN_RING_SIZE || idx >= p->current_token + TOKEN_RING_SIZE)
+		print_error(p, PARSER_INTERNAL_ERROR, "FATAL ERROR: token index is outside of the token ring!");
+
+	while (p->lexed_tokens <= idx && !p->lexer_done)
+	{
+		LexedToken *slot = &p->token_ring[p->lexed_tokens & TOKEN_RING_MASK];
+		int res = p->pipe ? token_pipe_next(p->pipe, slot) : pp_next(p->pp, slot);
+		if (res < 0)
+		{
+			// the preprocessor has already reported the error
+			p->err = PARSER_LEX_ERROR;
+			longjmp(p->bail, 1);
+		}
+
+		if (res == 0)
+			p->lexer_done = 1;
+		else
+			p->lexed_tokens++;
+	}
+
+	return idx < p->lexed_tokens;
+}
+
+// The current token, valid until the parser is TOKEN_RING_SIZE tokens further
+static const LexedToken *peek_lexed(Parser *p)
+{
+	if (!fill_token_ring(p, p->current_token))
+		print_error(p, PARSER_SYNTAX_ERROR, "unexpected end of input");
+
+	return &p->token_ring[p->current_token & TOKEN_RING_MASK];
+}
+
+// Looks n tokens past the current one, returns NULL past the end of the stream
+static const LexedToken *peek_lexed_n(Parser *p, int n)
+{
+	if (!fill_token_ring(p, p->current_token + n))
+		return NULL;
+
+	return &p->token_ring[(p->current_token + n) & TOKEN_RING_MASK];
+}
+
+static Token peek_token(Parser *p)
+{
+	return peek_lexed(p)->kind;
+}
+
+// Looks n tokens past the current one, returns TOK_NO_TOKEN past the end of the stream
+static Token peek_token_n(Parser *p, int n)
+{
+	const LexedToken *tok = peek_lexed_n(p, n);
+	return tok ? (Token)tok->kind : TOK_NO_TOKEN;
+}
+
+static LexedToken get_token(Parser *p)
+{
+	LexedToken tok = *peek_lexed(p);
+	p->current_token++;
+	return tok;
+}
+
+// Skips the current token if it is kind, returns whether it was
+static int accept(Parser *p, Token kind)
+{
+	if (peek_token(p) != kind)
+		return 0;
+
+	p->current_token++;
+	return 1;
+}
+
+// Returns the current token and moves past it, reports msg unless it is kind
+static LexedToken expect(Parser *p, Token kind, const char *msg)
+{
+	if (peek_token(p) != kind)
+		print_error(p, PARSER_SYNTAX_ERROR, msg);
+
+	return get_token(p);
+}
+
+static AstNode *new_node(Parser *p, AstKind kind, const LexedToken *tok)
+{
+	AstNode *node = arena_calloc(p->arena, 1, sizeof(AstNode));
+	if (!node)
+		out_of_memory(p);
+
+	node->kind = kind;
+	node->tok = *tok;
+	return node;
+}
+
+// A node for the current token, which is moved past
+static AstNode *take_node(Parser *p, AstKind kind)
+{
+	AstNode *node = new_node(p, kind, peek_lexed(p));
+	p->current_token++;
+	return node;
+}
+
+// Counts a level of nesting, see PARSER_MAX_DEPTH
+static void enter(Parser *p)
+{
+	if (++p->depth > PARSER_MAX_DEPTH)
+		print_error(p, PARSER_SYNTAX_ERROR, "nested too deeply");
+}
+
+static void leave(Parser *p)
+{
+	p->depth--;
+}
+
+static void push_scope(Parser *p)
+{
+	uint32_t *scopes = arena_reserve(&p->scratch, p->scopes, p->num_scopes, &p->scopes_cap, sizeof(uint32_t));
+	if (!scopes)
+		out_of_memory(p);
+
+	p->scopes = scopes;
+	p->scopes[p->num_scopes++] = p->num_bindings;
+}
+
+// Forgets what the innermost scope declared, which uncovers what it hid
+static void pop_scope(Parser *p)
+{
+	uint32_t start = p->scopes[--p->num_scopes];
+	while (p->num_bindings > start)
+	{
+		const ParserBinding *b = &p->bindings[--p->num_bindings];
+		p->binding_of[b->id] = b->hidden;
+	}
+}
+
+// Declares name in the innermost scope, as a typedef name or as anything else. Nothing happens for a declarator
+// without a name.
+static void declare(Parser *p, const LexedToken *name, int typedef_name)
+{
+	if (name->kind != TOK_IDENTIFIER)
+		return;
+
+	// identifier ids are dense, they index the table directly
+	uint32_t id = name->payload;
+	if (id >= p->binding_of_cap)
+	{
+		uint32_t cap = p->binding_of_cap ? p->binding_of_cap : 256;
+		while (cap <= id)
+			cap *= 2;
+
+		uint32_t *grown =
+			arena_grow(&p->scratch, p->binding_of, p->binding_of_cap * sizeof(uint32_t), cap * sizeof(uint32_t));
+		if (!grown)
+			out_of_memory(p);
+		memset(grown + p->binding_of_cap, 0, (cap - p->binding_of_cap) * sizeof(uint32_t));
+		p->binding_of = grown;
+		p->binding_of_cap = cap;
+	}
+
+	// declared again in the same scope
+	uint32_t cur = p->binding_of[id];
+	if (cur > p->scopes[p->num_scopes - 1])
+	{
+		p->bindings[cur - 1].typedef_name = typedef_name;
+		return;
+	}
+
+	ParserBinding *bindings =
+		arena_reserve(&p->scratch, p->bindings, p->num_bindings, &p->bindings_cap, sizeof(ParserBinding));
+	if (!bindings)
+		out_of_memory(p);
+
+	p->bindings = bindings;
+	p->bindings[p->num_bindings++] = (ParserBinding){id, cur, typedef_name};
+	p->binding_of[id] = p->num_bindings;
+}
+
+static int is_typedef_name(const Parser *p, const LexedToken *tok)
+{
+	if (tok->kind != TOK_IDENTIFIER || tok->payload >= p->binding_of_cap)
+		return 0;
+
+	uint32_t b = p->binding_of[tok->payload];
+	return b && p->bindings[b - 1].typedef_name;
+}
+
+// Whether tok starts a type name, false for NULL
+static int starts_type_name(const Parser *p, const LexedToken *tok)
+{
+	if (!tok)
+		return 0;
+
+	switch (tok->kind)
+	{
+	case TOK_VOID:
+	case TOK_CHAR:
+	case TOK_SHORT:
+	case TOK_INT:
+	case TOK_LONG:
+	case TOK_FLOAT:
+	case TOK_DOUBLE:
+	case TOK_SIGNED:
+	case TOK_UNSIGNED:
+	case TOK_BOOL:
+	case TOK_COMPLEX:
+	case TOK_IMAGINARY:
+	case TOK_STRUCT:
+	case TOK_UNION:
+	case TOK_ENUM:
+	case TOK_CONST:
+	case TOK_RESTRICT:
+	case TOK_VOLATILE:
+	case TOK_ATOMIC:
+		return 1;
+
+	case TOK_IDENTIFIER:
+		return is_typedef_name(p, tok);
+
+	default:
+		return 0;
+	}
+}
+
+// Whether tok starts a declaration, _Static_assert included
+static int starts_declaration(const Parser *p, const LexedToken *tok)
+{
+	switch (tok->kind)
+	{
+	case TOK_TYPEDEF:
+	case TOK_EXTERN:
+	case TOK_STATIC:
+	case TOK_THREAD_LOCAL:
+	case TOK_AUTO:
+	case TOK_REGISTER:
+	case TOK_INLINE:
+	case TOK_NORETURN:
+	case TOK_ALIGNAS:
+	case TOK_STATIC_ASSERT:
+		return 1;
+
+	default:
+		return starts_type_name(p, tok);
+	}
+}
+
+static AstNode *expression(Parser *p);
+static AstNode *assignment_expression(Parser *p);
+static AstNode *conditional_expression(Parser *p);
+static AstNode *cast_expression(Parser *p);
+static AstNode *type_name(Parser *p);
+static AstNode *initializer(Parser *p);
+static AstNode *declaration(Parser *p, int file_scope);
+static AstNode *statement(Parser *p);
+static AstNode *compound_statement(Parser *p, int new_scope);
+static void declarator(Parser *p, AstNode *decl, DeclaratorKind kind);
+
+// _Generic ( assignment-expression , generic-assoc-list )
+static AstNode *generic_selection(Parser *p)
+{
+	AstNode *node = take_node(p, AST_GENERIC);
+	expect(p, TOK_OPEN_PAREN, "expected '(' after _Generic");
+	enter(p);
+	node->generic.controlling = assignment_expression(p);
+	expect(p, TOK_COMMA, "expected ',' after the controlling expression");
+
+	AstNode **tail = &node->generic.assocs;
+	do
+	{
+		AstNode *assoc = new_node(p, AST_GENERIC_ASSOC, peek_lexed(p));
+		if (!accept(p, TOK_DEFAULT))
+			assoc->typed.type_name = type_name(p);
+		expect(p, TOK_COLON, "expected ':' after the type of a generic association");
+		assoc->typed.operand = assignment_expression(p);
+
+		*tail = assoc;
+		tail = &assoc->next;
+	} while (accept(p, TOK_COMMA));
+
+	leave(p);
+	expect(p, TOK_CLOSE_PAREN, "expected ')' after the generic associations");
+	return node;
+}
+
+static AstNode *primary_expression(Parser *p)
+{
+	const LexedToken *tok = peek_lexed(p);
+	switch (tok->kind)
+	{
+	case TOK_IDENTIFIER:
+		if (is_typedef_name(p, tok))
+			print_error(p, PARSER_SYNTAX_ERROR, "expected an expression, not a type");
+		return take_node(p, AST_IDENTIFIER);
+
+	case TOK_NUMERICAL_CONSTANT:
+		return take_node(p, AST_CONSTANT);
+
+	case TOK_CHAR_LITERAL:
+		return take_node(p, AST_CHAR_CONSTANT);
+
+	// adjacent literals are already concatenated into one
+	case TOK_STRING_LITERAL:
+		return take_node(p, AST_STRING_LITERAL);
+
+	case TOK_GENERIC:
+		return generic_selection(p);
+
+	case TOK_OPEN_PAREN: {
+		p->current_token++;
+		enter(p);
+		AstNode *node = expression(p);
+		leave(p);
+		expect(p, TOK_CLOSE_PAREN, "expected ')' after the expression");
+		return node;
+	}
+
+	default:
+		print_error(p, PARSER_SYNTAX_ERROR, "expected an expression");
+		return NULL;
+	}
+}
+
+// ( type-name ) { initializer-list }, the type name is already parsed and open is its '('
+static AstNode *compound_literal(Parser *p, AstNode *type, const LexedToken *open)
+{
+	AstNode *node = new_node(p, AST_COMPOUND_LITERAL, open);
+	node->typed.type_name = type;
+	node->typed.operand = initializer(p);
+	return node;
+}
+
+// The postfix operators applied to node, which is parsed as a primary expression first when NULL
+static AstNode *postfix_expression(Parser *p, AstNode *node)
+{
+	if (!node)
+		node = primary_expression(p);
+
+	for (;;)
+	{
+		AstNode *op;
+		switch (peek_token(p))
+		{
+		case TOK_OPEN_SQR_BRACK:
+			op = take_node(p, AST_INDEX);
+			op->binary.lhs = node;
+			enter(p);
+			op->binary.rhs = expression(p);
+			leave(p);
+			expect(p, TOK_CLOSE_SQR_BRACK, "expected ']' after the index");
+			break;
+
+		case TOK_OPEN_PAREN: {
+			op = take_node(p, AST_CALL);
+			op->call.callee = node;
+			enter(p);
+			AstNode **tail = &op->call.args;
+			if (peek_token(p) != TOK_CLOSE_PAREN)
+			{
+				do
+				{
+					*tail = assignment_expression(p);
+					tail = &(*tail)->next;
+				} while (accept(p, TOK_COMMA));
+			}
+			leave(p);
+			expect(p, TOK_CLOSE_PAREN, "expected ')' after the arguments");
+			break;
+		}
+
+		case TOK_PERIOD:
+		case TOK_RIGHT_ARROW: {
+			AstKind kind = get_token(p).kind == TOK_PERIOD ? AST_MEMBER : AST_POINTER_MEMBER;
+			LexedToken name = expect(p, TOK_IDENTIFIER, "expected a member name");
+			op = new_node(p, kind, &name);
+			op->operand = node;
+			break;
+		}
+
+		case TOK_INCREMENT:
+			op = take_node(p, AST_POST_INCREMENT);
+			op->operand = node;
+			break;
+
+		case TOK_DECREMENT:
+			op = take_node(p, AST_POST_DECREMENT);
+			op->operand = node;
+			break;
+
+		default:
+			return node;
+		}
+
+		node = op;
+	}
+}
+
+// Unary operators and casts in front of a postfix expression are parsed in a loop, each one going into the operand of
+// the one before it, so a long run of them does not nest
+static AstNode *cast_expression(Parser *p)
+{
+	AstNode *root = NULL;
+	AstNode **slot = &root;
+
+	// set after ++, -- and sizeof, whose operand is a unary expression and so cannot be a cast
+	int unary_only = 0;
+	for (;;)
+	{
+		LexedToken tok = *peek_lexed(p);
+		AstNode *node;
+		switch (tok.kind)
+		{
+		case TOK_AMPERSAND:
+		case TOK_STAR:
+		case TOK_PLUS:
+		case TOK_MINUS:
+		case TOK_TILDE:
+		case TOK_BANG:
+			node = take_node(p, AST_UNARY);
+			node->op = tok.kind;
+			unary_only = 0;
+			break;
+
+		case TOK_INCREMENT:
+		case TOK_DECREMENT:
+			node = take_node(p, AST_UNARY);
+			node->op = tok.kind;
+			unary_only = 1;
+			break;
+
+		case TOK_SIZEOF:
+			if (peek_token_n(p, 1) == TOK_OPEN_PAREN && starts_type_name(p, peek_lexed_n(p, 2)))
+			{
+				node = take_node(p, AST_SIZEOF_TYPE);
+				LexedToken open = get_token(p);
+				enter(p);
+				AstNode *type = type_name(p);
+				leave(p);
+				expect(p, TOK_CLOSE_PAREN, "expected ')' after the type name");
+
+				// sizeof (int){1} is the size of a compound literal
+				if (peek_token(p) == TOK_OPEN_BRACK)
+				{
+					node->kind = AST_SIZEOF_EXPR;
+					node->operand = postfix_expression(p, compound_literal(p, type, &open));
+				}
+				else
+				{
+					node->typed.type_name = type;
+				}
+
+				*slot = node;
+				return root;
+			}
+
+			node = take_node(p, AST_SIZEOF_EXPR);
+			unary_only = 1;
+			break;
+
+		case TOK_ALIGNOF:
+			node = take_node(p, AST_ALIGNOF);
+			expect(p, TOK_OPEN_PAREN, "expected '(' after _Alignof");
+			enter(p);
+			node->typed.type_name = type_name(p);
+			leave(p);
+			expect(p, TOK_CLOSE_PAREN, "expected ')' after the type name");
+			*slot = node;
+			return root;
+
+		case TOK_OPEN_PAREN: {
+			if (!starts_type_name(p, peek_lexed_n(p, 1)))
+			{
+				*slot = postfix_expression(p, NULL);
+				return root;
+			}
+
+			p->current_token++;
+			AstNode *type = type_name(p);
+			expect(p, TOK_CLOSE_PAREN, "expected ')' after the type name");
+			if (peek_token(p) == TOK_OPEN_BRACK)
+			{
+				*slot = postfix_expression(p, compound_literal(p, type, &tok));
+				return root;
+			}
+
+			if (unary_only)
+				print_error(p, PARSER_SYNTAX_ERROR, "expected '{' after the type name of a compound literal");
+
+			node = new_node(p, AST_CAST, &tok);
+			node->typed.type_name = type;
+			*slot = node;
+			slot = &node->typed.operand;
+			continue;
+		}
+
+		default:
+			*slot = postfix_expression(p, NULL);
+			return root;
+		}
+
+		*slot = node;
+		slot = &node->operand;
+	}
+}
+
+// Precedence climbing over the binary operators that bind at least as tight as min. A left associative operator
+// takes only tighter ones into its right operand and loops for the rest, so a chain of them never nests deeper than
+// there are levels of precedence. Assignments and conditionals are right associative, their last operand is a slot
+// the loop goes on to fill instead of a call of its own, so a = b = c and a ? b : c ? d : e do not nest either.
+static AstNode *binary_expression(Parser *p, int min)
+{
+	AstNode *root = NULL;
+	AstNode **slot = &root;
+	AstNode *lhs = cast_expression(p);
+	for (;;)
+	{
+		Token op = peek_token(p);
+		int prec = binary_precedence[op];
+		if (prec == PREC_NONE || prec < min)
+			break;
+
+		AstKind kind = prec == PREC_ASSIGNMENT ? AST_ASSIGN : prec == PREC_CONDITIONAL ? AST_CONDITIONAL : AST_BINARY;
+		AstNode *node = take_node(p, kind);
+		node->op = op;
+		if (prec == PREC_CONDITIONAL)
+		{
+			// the operand in the middle is a whole expression of its own, which nests
+			node->conditional.cond = lhs;
+			enter(p);
+			node->conditional.then = expression(p);
+			leave(p);
+			expect(p, TOK_COLON, "expected ':' in the conditional expression");
+			*slot = node;
+			slot = &node->conditional.otherwise;
+		}
+		else if (prec == PREC_ASSIGNMENT)
+		{
+			node->binary.lhs = lhs;
+			*slot = node;
+			slot = &node->binary.rhs;
+		}
+		else
+		{
+			node->binary.lhs = lhs;
+			node->binary.rhs = binary_expression(p, prec + 1);
+			lhs = node;
+			continue;
+		}
+
+		// the right operand of an assignment is an assignment expression, the last one of a conditional a
+		// conditional expression
+		min = prec;
+		lhs = cast_expression(p);
+	}
+
+	*slot = lhs;
+	return root;
+}
+
+static AstNode *assignment_expression(Parser *p)
+{
+	return binary_expression(p, PREC_ASSIGNMENT);
+}
+
+// also what constant expressions are parsed as
+static AstNode *conditional_expression(Parser *p)
+{
+	return binary_expression(p, PREC_CONDITIONAL);
+}
+
+// Assignment expressions separated by the comma operator
+static AstNode *expression(Parser *p)
+{
+	AstNode *node = assignment_expression(p);
+	while (peek_token(p) == TOK_COMMA)
+	{
+		AstNode *comma = take_node(p, AST_BINARY);
+		comma->op = TOK_COMMA;
+		comma->binary.lhs = node;
+		comma->binary.rhs = assignment_expression(p);
+		node = comma;
+	}
+
+	return node;
+}
+
+// { initializer-list }, or an assignment expression
+static AstNode *initializer(Parser *p)
+{
+	if (peek_token(p) != TOK_OPEN_BRACK)
+		return assignment_expression(p);
+
+	AstNode *node = take_node(p, AST_INIT_LIST);
+	enter(p);
+
+	AstNode **tail = &node->items;
+	do
+	{
+		AstNode *item;
+		if (peek_token(p) == TOK_OPEN_SQR_BRACK || peek_token(p) == TOK_PERIOD)
+		{
+			item = new_node(p, AST_DESIGNATION, peek_lexed(p));
+			AstNode **designator = &item->designation.designators;
+			do
+			{
+				if (peek_token(p) == TOK_OPEN_SQR_BRACK)
+				{
+					*designator = take_node(p, AST_INDEX_DESIGNATOR);
+					(*designator)->operand = conditional_expression(p);
+					expect(p, TOK_CLOSE_SQR_BRACK, "expected ']' after the index of a designator");
+				}
+				else
+				{
+					p->current_token++;
+					LexedToken name = expect(p, TOK_IDENTIFIER, "expected a member name after '.'");
+					*designator = new_node(p, AST_MEMBER_DESIGNATOR, &name);
+				}
+				designator = &(*designator)->next;
+			} while (peek_token(p) == TOK_OPEN_SQR_BRACK || peek_token(p) == TOK_PERIOD);
+
+			expect(p, TOK_EQUAL, "expected '=' after the designators");
+			item->designation.value = initializer(p);
+		}
+		else
+		{
+			item = initializer(p);
+		}
+
+		*tail = item;
+		tail = &item->next;
+	} while (accept(p, TOK_COMMA) && peek_token(p) != TOK_CLOSE_BRACK);
+
+	leave(p);
+	expect(p, TOK_CLOSE_BRACK, "expected '}' after the initializers");
+	return node;
+}
+
+// C11 6.7.2p2, the type specifiers have to be one of the listed combinations
+static int valid_type_specifiers(const AstSpecifiers *specs)
+{
+	unsigned sign = specs->type_specifiers & (AST_TYPE_SIGNED | AST_TYPE_UNSIGNED);
+	unsigned rest = specs->type_specifiers & ~sign;
+	unsigned complex = rest & (AST_TYPE_COMPLEX | AST_TYPE_IMAGINARY);
+	if (sign == (AST_TYPE_SIGNED | AST_TYPE_UNSIGNED) || complex == (AST_TYPE_COMPLEX | AST_TYPE_IMAGINARY))
+		return 0;
+
+	if (specs->type)
+		return !specs->type_specifiers && !specs->longs;
+
+	if (rest & (AST_TYPE_VOID | AST_TYPE_BOOL))
+		return !sign && !specs->longs && (rest == AST_TYPE_VOID || rest == AST_TYPE_BOOL);
+
+	if (rest & AST_TYPE_CHAR)
+		return !specs->longs && rest == AST_TYPE_CHAR;
+
+	if (rest & AST_TYPE_FLOAT)
+		return !sign && !specs->longs && rest == (AST_TYPE_FLOAT | complex);
+
+	if (rest & AST_TYPE_DOUBLE)
+		return !sign && specs->longs <= 1 && rest == (AST_TYPE_DOUBLE | complex);
+
+	if (rest & AST_TYPE_SHORT)
+		return !specs->longs && (rest & ~AST_TYPE_INT) == AST_TYPE_SHORT;
+
+	// int, long and long long, signed or not
+	return (rest & ~AST_TYPE_INT) == 0 && (specs->type_specifiers || specs->longs);
+}
+
+// Parses type qualifiers into AST_QUALIFIER_* bits
+static int qualifiers(Parser *p)
+{
+	int bits = 0;
+	for (;;)
+	{
+		switch (peek_token(p))
+		{
+		case TOK_CONST:
+			bits |= AST_QUALIFIER_CONST;
+			break;
+		case TOK_RESTRICT:
+			bits |= AST_QUALIFIER_RESTRICT;
+			break;
+		case TOK_VOLATILE:
+			bits |= AST_QUALIFIER_VOLATILE;
+			break;
+		case TOK_ATOMIC:
+			bits |= AST_QUALIFIER_ATOMIC;
+			break;
+		default:
+			return bits;
+		}
+
+		p->current_token++;
+	}
+}
+
+// The member declarations of a struct or union, or a _Static_assert between them
+static AstNode *member_declaration(Parser *p);
+
+// struct or union, the tag and the members
+static AstNode *struct_or_union_specifier(Parser *p)
+{
+	AstNode *node = take_node(p, peek_token(p) == TOK_STRUCT ? AST_STRUCT : AST_UNION);
+	if (peek_token(p) == TOK_IDENTIFIER)
+		node->tok = get_token(p);
+	else if (peek_token(p) != TOK_OPEN_BRACK)
+		print_error(p, PARSER_SYNTAX_ERROR, "expected a tag or '{' after struct or union");
+
+	if (!accept(p, TOK_OPEN_BRACK))
+		return node;
+
+	node->flags |= AST_FLAG_DEFINITION;
+	enter(p);
+
+	AstNode **tail = &node->members;
+	do
+	{
+		*tail = member_declaration(p);
+		tail = &(*tail)->next;
+	} while (!accept(p, TOK_CLOSE_BRACK));
+
+	leave(p);
+	return node;
+}
+
+// enum, the tag and the enumerators
+static AstNode *enum_specifier(Parser *p)
+{
+	AstNode *node = take_node(p, AST_ENUM);
+	if (peek_token(p) == TOK_IDENTIFIER)
+		node->tok = get_token(p);
+	else if (peek_token(p) != TOK_OPEN_BRACK)
+		print_error(p, PARSER_SYNTAX_ERROR, "expected a tag or '{' after enum");
+
+	if (!accept(p, TOK_OPEN_BRACK))
+		return node;
+
+	node->flags |= AST_FLAG_DEFINITION;
+	AstNode **tail = &node->members;
+	do
+	{
+		if (peek_token(p) != TOK_IDENTIFIER)
+			print_error(p, PARSER_SYNTAX_ERROR, "expected an enumerator");
+
+		AstNode *enumerator = take_node(p, AST_ENUMERATOR);
+		if (accept(p, TOK_EQUAL))
+			enumerator->operand = conditional_expression(p);
+
+		// in scope from the end of the enumerator on, the value of the next one can use it
+		declare(p, &enumerator->tok, 0);
+
+		*tail = enumerator;
+		tail = &enumerator->next;
+	} while (accept(p, TOK_COMMA) && peek_token(p) != TOK_CLOSE_BRACK);
+
+	expect(p, TOK_CLOSE_BRACK, "expected '}' after the enumerators");
+	return node;
+}
+
+// Makes node the type of specs, which cannot have one already
+static void set_specifier_type(Parser *p, AstSpecifiers *specs, AstNode *node)
+{
+	if (specs->type)
+		print_error(p, PARSER_SYNTAX_ERROR, "invalid combination of type specifiers");
+
+	specs->type = node;
+}
+
+// Parses one specifier into specs, returns 0 when the current token is none. Specifiers context does not allow are
+// reported.
+static int specifier(Parser *p, AstSpecifiers *specs, SpecifierContext context)
+{
+	const LexedToken *tok = peek_lexed(p);
+	int storage = 0, function = 0, type = 0;
+	switch (tok->kind)
+	{
+	case TOK_TYPEDEF:
+		storage = AST_STORAGE_TYPEDEF;
+		break;
+	case TOK_EXTERN:
+		storage = AST_STORAGE_EXTERN;
+		break;
+	case TOK_STATIC:
+		storage = AST_STORAGE_STATIC;
+		break;
+	case TOK_THREAD_LOCAL:
+		storage = AST_STORAGE_THREAD_LOCAL;
+		break;
+	case TOK_AUTO:
+		storage = AST_STORAGE_AUTO;
+		break;
+	case TOK_REGISTER:
+		storage = AST_STORAGE_REGISTER;
+		break;
+
+	case TOK_INLINE:
+		function = AST_FUNCTION_INLINE;
+		break;
+	case TOK_NORETURN:
+		function = AST_FUNCTION_NORETURN;
+		break;
+
+	case TOK_VOID:
+		type = AST_TYPE_VOID;
+		break;
+	case TOK_CHAR:
+		type = AST_TYPE_CHAR;
+		break;
+	case TOK_SHORT:
+		type = AST_TYPE_SHORT;
+		break;
+	case TOK_INT:
+		type = AST_TYPE_INT;
+		break;
+	case TOK_FLOAT:
+		type = AST_TYPE_FLOAT;
+		break;
+	case TOK_DOUBLE:
+		type = AST_TYPE_DOUBLE;
+		break;
+	case TOK_SIGNED:
+		type = AST_TYPE_SIGNED;
+		break;
+	case TOK_UNSIGNED:
+		type = AST_TYPE_UNSIGNED;
+		break;
+	case TOK_BOOL:
+		type = AST_TYPE_BOOL;
+		break;
+	case TOK_COMPLEX:
+		type = AST_TYPE_COMPLEX;
+		break;
+	case TOK_IMAGINARY:
+		type = AST_TYPE_IMAGINARY;
+		break;
+
+	case TOK_LONG:
+		if (++specs->longs > 2)
+			print_error(p, PARSER_SYNTAX_ERROR, "too many longs in the type");
+		p->current_token++;
+		return 1;
+
+	case TOK_CONST:
+	case TOK_RESTRICT:
+	case TOK_VOLATILE:
+		specs->qualifiers |= qualifiers(p);
+		return 1;
+
+	case TOK_ATOMIC:
+		if (peek_token_n(p, 1) != TOK_OPEN_PAREN)
+		{
+			specs->qualifiers |= qualifiers(p);
+			return 1;
+		}
+
+		// _Atomic ( type-name ) is a type specifier
+		{
+			AstNode *atomic = take_node(p, AST_ATOMIC_TYPE);
+			p->current_token++;
+			atomic->typed.type_name = type_name(p);
+			expect(p, TOK_CLOSE_PAREN, "expected ')' after the type name");
+			set_specifier_type(p, specs, atomic);
+		}
+		return 1;
+
+	case TOK_STRUCT:
+	case TOK_UNION:
+		set_specifier_type(p, specs, struct_or_union_specifier(p));
+		return 1;
+
+	case TOK_ENUM:
+		set_specifier_type(p, specs, enum_specifier(p));
+		return 1;
+
+	case TOK_ALIGNAS: {
+		if (context == SPECIFIERS_TYPE_NAME)
+			print_error(p, PARSER_SYNTAX_ERROR, "_Alignas is not allowed here");
+
+		AstNode *alignas = take_node(p, AST_ALIGNAS);
+		expect(p, TOK_OPEN_PAREN, "expected '(' after _Alignas");
+		if (starts_type_name(p, peek_lexed(p)))
+			alignas->typed.type_name = type_name(p);
+		else
+			alignas->typed.operand = conditional_expression(p);
+		expect(p, TOK_CLOSE_PAREN, "expected ')' after the alignment");
+
+		AstNode **tail = &specs->alignas;
+		while (*tail)
+			tail = &(*tail)->next;
+		*tail = alignas;
+		return 1;
+	}
+
+	case TOK_IDENTIFIER:
+		// only while there is no other type specifier, T in unsigned T is the name being declared
+		if (specs->type || specs->type_specifiers || specs->longs || !is_typedef_name(p, tok))
+			return 0;
+		specs->type = take_node(p, AST_TYPEDEF_NAME);
+		return 1;
+
+	default:
+		return 0;
+	}
+
+	if (storage)
+	{
+		// _Thread_local goes with static or extern, every other storage class stands alone
+		int combined = specs->storage | storage;
+		if (context != SPECIFIERS_DECLARATION)
+			print_error(p, PARSER_SYNTAX_ERROR, "storage class specifiers are not allowed here");
+		if (specs->storage && combined != (AST_STORAGE_THREAD_LOCAL | AST_STORAGE_STATIC) &&
+		    combined != (AST_STORAGE_THREAD_LOCAL | AST_STORAGE_EXTERN))
+			print_error(p, PARSER_SYNTAX_ERROR, "conflicting storage class specifiers");
+		specs->storage = combined;
+	}
+
+	if (function)
+	{
+		if (context != SPECIFIERS_DECLARATION)
+			print_error(p, PARSER_SYNTAX_ERROR, "function specifiers are not allowed here");
+		specs->function |= function;
+	}
+
+	if (type)
+	{
+		if (specs->type_specifiers & type)
+			print_error(p, PARSER_SYNTAX_ERROR, "duplicate type specifier");
+		specs->type_specifiers |= type;
+	}
+
+	p->current_token++;
+	return 1;
+}
+
+// Declaration specifiers, or a specifier qualifier list outside of declarations
+static AstSpecifiers *specifiers(Parser *p, SpecifierContext context)
+{
+	AstSpecifiers *specs = arena_calloc(p->arena, 1, sizeof(AstSpecifiers));
+	if (!specs)
+		out_of_memory(p);
+
+	while (specifier(p, specs, context))
+		;
+
+	if (!specs->type && !specs->type_specifiers && !specs->longs)
+		print_error(p, PARSER_SYNTAX_ERROR, "expected a type specifier");
+	if (!valid_type_specifiers(specs))
+		print_error(p, PARSER_SYNTAX_ERROR, "invalid combination of type specifiers");
+
+	return specs;
+}
+
+// specifier-qualifier-list abstract-declarator(opt)
+static AstNode *type_name(Parser *p)
+{
+	AstNode *node = new_node(p, AST_TYPE_NAME, peek_lexed(p));
+	node->declaration.specs = specifiers(p, SPECIFIERS_TYPE_NAME);
+
+	AstNode *decl = new_node(p, AST_DECLARATOR, peek_lexed(p));
+	declarator(p, decl, DECLARATOR_ABSTRACT);
+	node->declaration.declarators = decl;
+	return node;
+}
+
+static AstNode *member_declaration(Parser *p)
+{
+	if (peek_token(p) == TOK_STATIC_ASSERT)
+		return declaration(p, 0);
+
+	AstNode *node = new_node(p, AST_DECLARATION, peek_lexed(p));
+	node->declaration.specs = specifiers(p, SPECIFIERS_MEMBER);
+
+	// an anonymous struct or union
+	if (accept(p, TOK_SEMI_COLON))
+		return node;
+
+	AstNode **tail = &node->declaration.declarators;
+	do
+	{
+		AstNode *decl = new_node(p, AST_DECLARATOR, peek_lexed(p));
+
+		// an unnamed bit-field only has its width
+		if (peek_token(p) != TOK_COLON)
+			declarator(p, decl, DECLARATOR_NAMED);
+		if (accept(p, TOK_COLON))
+			decl->declarator.bit_width = conditional_expression(p);
+
+		*tail = decl;
+		tail = &decl->next;
+	} while (accept(p, TOK_COMMA));
+
+	expect(p, TOK_SEMI_COLON, "expected ';' after the member");
+	return node;
+}
+
+static AstNode *parameter_declaration(Parser *p)
+{
+	AstNode *node = new_node(p, AST_PARAMETER, peek_lexed(p));
+	AstSpecifiers *specs = specifiers(p, SPECIFIERS_DECLARATION);
+	if ((specs->storage & ~AST_STORAGE_REGISTER) || specs->function || specs->alignas)
+		print_error(p, PARSER_SYNTAX_ERROR, "parameters can only have register as a specifier besides their type");
+
+	AstNode *decl = new_node(p, AST_DECLARATOR, peek_lexed(p));
+	declarator(p, decl, DECLARATOR_MAYBE_NAMED);
+	declare(p, &decl->tok, 0);
+
+	node->declaration.specs = specs;
+	node->declaration.declarators = decl;
+	return node;
+}
+
+// A parameter that is just void, what f(void) is written with
+static int is_void_parameter(const AstNode *param)
+{
+	const AstSpecifiers *specs = param->declaration.specs;
+	const AstNode *decl = param->declaration.declarators;
+	return specs->type_specifiers == AST_TYPE_VOID && !specs->type && !specs->qualifiers && !specs->storage &&
+	       decl->tok.kind != TOK_IDENTIFIER && !decl->declarator.derived;
+}
+
+// ( parameter-type-list ), ( identifier-list ) or ()
+static AstNode *function_declarator(Parser *p)
+{
+	AstNode *node = take_node(p, AST_FUNCTION);
+	if (accept(p, TOK_CLOSE_PAREN))
+		return node;
+
+	// the parameters have a scope of their own, a definition declares them again in that of its body
+	enter(p);
+	push_scope(p);
+
+	AstNode **tail = &node->params;
+	if (peek_token(p) == TOK_IDENTIFIER && !is_typedef_name(p, peek_lexed(p)))
+	{
+		// an identifier list, the types come in declarations before the body
+		do
+		{
+			if (peek_token(p) != TOK_IDENTIFIER)
+				print_error(p, PARSER_SYNTAX_ERROR, "expected a parameter name");
+			*tail = take_node(p, AST_IDENTIFIER);
+			tail = &(*tail)->next;
+		} while (accept(p, TOK_COMMA));
+	}
+	else
+	{
+		node->flags |= AST_FLAG_PROTOTYPE;
+		do
+		{
+			if (node->params && accept(p, TOK_ELLIPSIS))
+			{
+				node->flags |= AST_FLAG_VARIADIC;
+				break;
+			}
+
+			*tail = parameter_declaration(p);
+			tail = &(*tail)->next;
+		} while (accept(p, TOK_COMMA));
+
+		if (!node->params->next && is_void_parameter(node->params))
+			node->params = NULL;
+	}
+
+	pop_scope(p);
+	leave(p);
+	expect(p, TOK_CLOSE_PAREN, "expected ')' after the parameters");
+	return node;
+}
+
+// [ static(opt) type-qualifier-list(opt) assignment-expression(opt) ] and the other forms of an array declarator
+static AstNode *array_declarator(Parser *p)
 {
-	printf("[Line %d] Error: %s\n", token_data_internal->line_numbers[current_token], msg);
+	AstNode *node = take_node(p, AST_ARRAY);
+	enter(p);
+	if (accept(p, TOK_STATIC))
+		node->flags |= AST_FLAG_STATIC;
+	node->array.qualifiers = qualifiers(p);
+	if (!(node->flags & AST_FLAG_STATIC) && accept(p, TOK_STATIC))
+		node->flags |= AST_FLAG_STATIC;
 
-	// Only execute if compiling in debug
-#ifndef NDEBUG
-	raise(SIGTRAP);
-#endif
+	if (peek_token(p) == TOK_STAR && peek_token_n(p, 1) == TOK_CLOSE_SQR_BRACK)
+	{
+		p->current_token++;
+		node->flags |= AST_FLAG_VLA_STAR;
+	}
+	else if (peek_token(p) != TOK_CLOSE_SQR_BRACK)
+	{
+		node->array.size = assignment_expression(p);
+	}
+	else if (node->flags & AST_FLAG_STATIC)
+	{
+		print_error(p, PARSER_SYNTAX_ERROR, "expected the size of the array after static");
+	}
 
-	exit(EXIT_FAILURE);
+	leave(p);
+	expect(p, TOK_CLOSE_SQR_BRACK, "expected ']' after the array size");
+	return node;
 }
 
-static void check_token_idx_bounds()
+// Whether the '(' at the current token opens a declarator in parentheses rather than the parameters of a function.
+// Without a name to go by, (T) with T a typedef name and () are parameters (C11 6.7.6.3p11).
+static int nested_declarator(Parser *p, DeclaratorKind kind)
 {
-	if (current_token < 0 || current_token >= token_data_internal->_buf_max_size)
+	if (kind == DECLARATOR_NAMED)
+		return 1;
+
+	const LexedToken *next = peek_lexed_n(p, 1);
+	if (!next)
+		return 0;
+
+	switch (next->kind)
 	{
-		printf("FATAL ERROR: current token index is out of bounds!\n");
-#ifndef NDEBUG
-		raise(SIGTRAP);
-#endif
-		exit(EXIT_FAILURE);
+	case TOK_STAR:
+	case TOK_OPEN_PAREN:
+	case TOK_OPEN_SQR_BRACK:
+		return 1;
+	case TOK_IDENTIFIER:
+		return kind == DECLARATOR_MAYBE_NAMED && !is_typedef_name(p, next);
+	default:
+		return 0;
 	}
 }
 
-static Token peek_token()
+// The derivations of a declarator, the one closest to the name first. Its name goes to decl->tok.
+static AstNode *derivations(Parser *p, AstNode *decl, DeclaratorKind kind)
 {
-	check_token_idx_bounds();
+	// the last pointer is the closest to the name, and all of them are further from it than the suffixes
+	AstNode *pointers = NULL;
+	while (peek_token(p) == TOK_STAR)
+	{
+		AstNode *pointer = take_node(p, AST_POINTER);
+		pointer->array.qualifiers = qualifiers(p);
+		pointer->next = pointers;
+		pointers = pointer;
+	}
+
+	AstNode *head = NULL;
+	AstNode **tail = &head;
+	if (peek_token(p) == TOK_IDENTIFIER && kind != DECLARATOR_ABSTRACT)
+	{
+		decl->tok = get_token(p);
+	}
+	else if (peek_token(p) == TOK_OPEN_PAREN && nested_declarator(p, kind))
+	{
+		p->current_token++;
+		enter(p);
+		head = derivations(p, decl, kind);
+		leave(p);
+		expect(p, TOK_CLOSE_PAREN, "expected ')' after the declarator");
+		while (*tail)
+			tail = &(*tail)->next;
+	}
+
+	for (;;)
+	{
+		if (peek_token(p) == TOK_OPEN_SQR_BRACK)
+			*tail = array_declarator(p);
+		else if (peek_token(p) == TOK_OPEN_PAREN)
+			*tail = function_declarator(p);
+		else
+			break;
+		tail = &(*tail)->next;
+	}
 
-	return token_data_internal->tokens[current_token];
+	*tail = pointers;
+	return head;
 }
 
-static Token get_token()
+// Parses a declarator into decl, its name goes to decl->tok
+static void declarator(Parser *p, AstNode *decl, DeclaratorKind kind)
 {
-	check_token_idx_bounds();
+	decl->declarator.derived = derivations(p, decl, kind);
+	if (kind == DECLARATOR_NAMED && decl->tok.kind != TOK_IDENTIFIER)
+		print_error(p, PARSER_SYNTAX_ERROR, "expected a name to declare");
+}
 
-	return token_data_internal->tokens[current_token++];
+// _Static_assert ( constant-expression , string-literal ) ;
+static AstNode *static_assert_declaration(Parser *p)
+{
+	AstNode *node = take_node(p, AST_STATIC_ASSERT);
+	expect(p, TOK_OPEN_PAREN, "expected '(' after _Static_assert");
+	node->static_assert_.cond = conditional_expression(p);
+	expect(p, TOK_COMMA, "expected ',' after the condition");
+	if (peek_token(p) != TOK_STRING_LITERAL)
+		print_error(p, PARSER_SYNTAX_ERROR, "expected a string literal");
+	node->static_assert_.message = take_node(p, AST_STRING_LITERAL);
+	expect(p, TOK_CLOSE_PAREN, "expected ')' after the message");
+	expect(p, TOK_SEMI_COLON, "expected ';' after _Static_assert");
+	return node;
 }
 
-static void put_token()
+// decl is the declarator of a function being defined, node its declaration up to there
+static AstNode *function_definition(Parser *p, AstNode *node, AstNode *decl)
 {
-	current_token--;
+	AstSpecifiers *specs = node->declaration.specs;
+	if (specs->storage & ~(AST_STORAGE_EXTERN | AST_STORAGE_STATIC))
+		print_error(p, PARSER_SYNTAX_ERROR, "a function definition can only be extern or static");
+
+	node->kind = AST_FUNCTION_DEFINITION;
+	node->function.specs = specs;
+	node->function.declarator = decl;
+
+	// the parameters are in the scope of the outermost block of the body
+	push_scope(p);
+	for (const AstNode *param = decl->declarator.derived->params; param; param = param->next)
+		declare(p, param->kind == AST_PARAMETER ? &param->declaration.declarators->tok : &param->tok, 0);
+
+	AstNode **tail = &node->function.declarations;
+	while (peek_token(p) != TOK_OPEN_BRACK)
+	{
+		*tail = declaration(p, 0);
+		tail = &(*tail)->next;
+	}
+
+	node->function.body = compound_statement(p, 0);
+	pop_scope(p);
+	return node;
 }
 
-static struct
+// Whether decl, the first declarator of a declaration at file scope, is followed by the body of a function
+static int is_function_definition(Parser *p, const AstNode *decl)
 {
-	Token storage_class;
-} decleration;
+	const AstNode *func = decl->declarator.derived;
+	if (!func || func->kind != AST_FUNCTION)
+		return 0;
+
+	// the declarations of an identifier list come before the body
+	return peek_token(p) == TOK_OPEN_BRACK ||
+	       (!(func->flags & AST_FLAG_PROTOTYPE) && func->params && starts_declaration(p, peek_lexed(p)));
+}
 
-static void storage_class_specifier()
+// A declaration, a _Static_assert or, at file scope, a function definition
+static AstNode *declaration(Parser *p, int file_scope)
 {
+	if (peek_token(p) == TOK_STATIC_ASSERT)
+		return static_assert_declaration(p);
+
+	AstNode *node = new_node(p, AST_DECLARATION, peek_lexed(p));
+	AstSpecifiers *specs = specifiers(p, SPECIFIERS_DECLARATION);
+	node->declaration.specs = specs;
+	if (file_scope && (specs->storage & (AST_STORAGE_AUTO | AST_STORAGE_REGISTER)))
+		print_error(p, PARSER_SYNTAX_ERROR, "auto and register are not allowed at file scope");
+
+	// nothing but a type, a struct being declared for one
+	if (accept(p, TOK_SEMI_COLON))
+		return node;
+
+	AstNode **tail = &node->declaration.declarators;
+	do
+	{
+		AstNode *decl = new_node(p, AST_DECLARATOR, peek_lexed(p));
+		declarator(p, decl, DECLARATOR_NAMED);
+
+		// in scope from the end of its declarator on, its own initializer included
+		declare(p, &decl->tok, specs->storage & AST_STORAGE_TYPEDEF);
+
+		if (file_scope && !node->declaration.declarators && is_function_definition(p, decl))
+			return function_definition(p, node, decl);
+
+		if (accept(p, TOK_EQUAL))
+		{
+			if (specs->storage & AST_STORAGE_TYPEDEF)
+				print_error(p, PARSER_SYNTAX_ERROR, "a typedef cannot have an initializer");
+			decl->declarator.init = initializer(p);
+		}
+
+		*tail = decl;
+		tail = &decl->next;
+	} while (accept(p, TOK_COMMA));
+
+	expect(p, TOK_SEMI_COLON, "expected ';' after the declaration");
+	return node;
 }
 
-static void type_specifier()
+// A declaration or a statement
+static AstNode *block_item(Parser *p)
 {
+	// labels are names of their own, T: is one even where T is a typedef name
+	if (starts_declaration(p, peek_lexed(p)) &&
+	    !(peek_token(p) == TOK_IDENTIFIER && peek_token_n(p, 1) == TOK_COLON))
+		return declaration(p, 0);
+
+	return statement(p);
 }
 
-static void type_qualifier()
+// With new_scope unset the block is in the scope that is already open, that of the parameters for a function body
+static AstNode *compound_statement(Parser *p, int new_scope)
 {
+	if (peek_token(p) != TOK_OPEN_BRACK)
+		print_error(p, PARSER_SYNTAX_ERROR, "expected '{'");
+
+	AstNode *node = take_node(p, AST_COMPOUND);
+	if (new_scope)
+		push_scope(p);
+
+	AstNode **tail = &node->items;
+	while (!accept(p, TOK_CLOSE_BRACK))
+	{
+		*tail = block_item(p);
+		tail = &(*tail)->next;
+	}
+
+	if (new_scope)
+		pop_scope(p);
+	return node;
 }
 
-static void function_specifier()
+// ( expression ) of if, switch, while and do
+static AstNode *paren_expression(Parser *p)
 {
+	expect(p, TOK_OPEN_PAREN, "expected '('");
+	AstNode *node = expression(p);
+	expect(p, TOK_CLOSE_PAREN, "expected ')' after the condition");
+	return node;
 }
 
-static void decl_specifiers()
+// Else if chains are followed in a loop, each if going into the else of the one before, however long they get
+static AstNode *if_statement(Parser *p)
 {
-	storage_class_specifier();
-	type_specifier();
-	type_qualifier();
-	function_specifier();
-	// TODO: alignment specifier?
+	AstNode *root = NULL;
+	AstNode **slot = &root;
+	for (;;)
+	{
+		AstNode *node = take_node(p, AST_IF);
+		node->conditional.cond = paren_expression(p);
+		node->conditional.then = statement(p);
+		*slot = node;
+		slot = &node->conditional.otherwise;
+
+		if (!accept(p, TOK_ELSE))
+			return root;
+		if (peek_token(p) != TOK_IF)
+		{
+			*slot = statement(p);
+			return root;
+		}
+	}
+}
+
+static AstNode *for_statement(Parser *p)
+{
+	AstNode *node = take_node(p, AST_FOR);
+	expect(p, TOK_OPEN_PAREN, "expected '(' after for");
+
+	// what the first clause declares is only in scope in the loop
+	push_scope(p);
+	if (starts_declaration(p, peek_lexed(p)))
+	{
+		node->for_.init = declaration(p, 0);
+		if (node->for_.init->kind == AST_DECLARATION &&
+		    (node->for_.init->declaration.specs->storage & ~(AST_STORAGE_AUTO | AST_STORAGE_REGISTER)))
+			print_error(p, PARSER_SYNTAX_ERROR, "the declarations of a for loop can only be auto or register");
+	}
+	else if (!accept(p, TOK_SEMI_COLON))
+	{
+		node->for_.init = expression(p);
+		expect(p, TOK_SEMI_COLON, "expected ';' after the first clause of the for loop");
+	}
+
+	if (peek_token(p) != TOK_SEMI_COLON)
+		node->for_.cond = expression(p);
+	expect(p, TOK_SEMI_COLON, "expected ';' after the condition of the for loop");
+	if (peek_token(p) != TOK_CLOSE_PAREN)
+		node->for_.step = expression(p);
+	expect(p, TOK_CLOSE_PAREN, "expected ')' after the for loop clauses");
+
+	node->for_.body = statement(p);
+	pop_scope(p);
+	return node;
+}
+
+static AstNode *statement(Parser *p)
+{
+	enter(p);
+
+	AstNode *node;
+	switch (peek_token(p))
+	{
+	case TOK_OPEN_BRACK:
+		node = compound_statement(p, 1);
+		break;
+
+	case TOK_IF:
+		node = if_statement(p);
+		break;
+
+	case TOK_SWITCH:
+	case TOK_WHILE:
+		node = take_node(p, peek_token(p) == TOK_SWITCH ? AST_SWITCH : AST_WHILE);
+		node->loop.cond = paren_expression(p);
+		node->loop.body = statement(p);
+		break;
+
+	case TOK_DO:
+		node = take_node(p, AST_DO_WHILE);
+		node->loop.body = statement(p);
+		expect(p, TOK_WHILE, "expected while after the body of the do loop");
+		node->loop.cond = paren_expression(p);
+		expect(p, TOK_SEMI_COLON, "expected ';' after do while");
+		break;
+
+	case TOK_FOR:
+		node = for_statement(p);
+		break;
+
+	case TOK_GOTO: {
+		p->current_token++;
+		LexedToken label = expect(p, TOK_IDENTIFIER, "expected a label after goto");
+		node = new_node(p, AST_GOTO, &label);
+		expect(p, TOK_SEMI_COLON, "expected ';' after goto");
+		break;
+	}
+
+	case TOK_CONTINUE:
+	case TOK_BREAK:
+		node = take_node(p, peek_token(p) == TOK_CONTINUE ? AST_CONTINUE : AST_BREAK);
+		expect(p, TOK_SEMI_COLON, "expected ';' after continue or break");
+		break;
+
+	case TOK_RETURN:
+		node = take_node(p, AST_RETURN);
+		if (!accept(p, TOK_SEMI_COLON))
+		{
+			node->operand = expression(p);
+			expect(p, TOK_SEMI_COLON, "expected ';' after return");
+		}
+		break;
+
+	case TOK_CASE:
+		node = take_node(p, AST_CASE);
+		node->labeled.value = conditional_expression(p);
+		expect(p, TOK_COLON, "expected ':' after case");
+		node->labeled.body = statement(p);
+		break;
+
+	case TOK_DEFAULT:
+		node = take_node(p, AST_DEFAULT);
+		expect(p, TOK_COLON, "expected ':' after default");
+		node->labeled.body = statement(p);
+		break;
+
+	case TOK_SEMI_COLON:
+		node = take_node(p, AST_EXPRESSION_STATEMENT);
+		break;
+
+	default:
+		if (peek_token(p) == TOK_IDENTIFIER && peek_token_n(p, 1) == TOK_COLON)
+		{
+			node = take_node(p, AST_LABEL);
+			p->current_token++;
+			node->labeled.body = statement(p);
+			break;
+		}
+
+		node = new_node(p, AST_EXPRESSION_STATEMENT, peek_lexed(p));
+		node->operand = expression(p);
+		expect(p, TOK_SEMI_COLON, "expected ';' after the expression");
+		break;
+	}
+
+	leave(p);
+	return node;
 }
 
-static void top_level_decl()
+static AstNode *translation_unit(Parser *p)
 {
-	// while we havent reached 
-	while (peek_token() != TOK_SEMI_COLON || peek_token() != TOK_COMMA || peek_token() != TOK_IDENTIFIER)
+	// there is no token to point at in an empty translation unit
+	LexedToken start = {0};
+	if (fill_token_ring(p, p->current_token))
+		start = *peek_lexed(p);
+
+	AstNode *node = new_node(p, AST_TRANSLATION_UNIT, &start);
+	push_scope(p);
+
+	// the tokens of a precompiled header are not handed out, its typedef names are all that is left of them
+	for (uint32_t i = 0; i < p->pp->num_typedef_names; i++)
+		declare(p, &(LexedToken){0, p->pp->typedef_names[i], TOK_IDENTIFIER, 0, 0}, 1);
+
+	AstNode **tail = &node->items;
+	while (fill_token_ring(p, p->current_token))
 	{
-		decl_specifiers();
+		*tail = declaration(p, 1);
+		tail = &(*tail)->next;
 	}
 
-	// TODO: OPT init declerator list
-	// TODO: emit the decleration
+	// the file scope is left open for parse_pch_header
+	return node;
+}
 
-	if (get_token() != TOK_SEMI_COLON)
+ParserErrorCode parse(Preprocessor *pp, TokenPipe *pipe, Arena *arena, AstNode **tu)
+{
+	Parser parser = {0};
+	parser.pp = pp;
+	parser.pipe = pipe;
+	parser.arena = arena;
+	arena_init(&parser.scratch, PARSER_SCRATCH_CHUNK);
+
+	if (setjmp(parser.bail))
 	{
-		print_error("declerations must end with a semicolon");
+		arena_release(&parser.scratch);
+		return parser.err;
 	}
+
+	*tu = translation_unit(&parser);
+
+	arena_release(&parser.scratch);
+	return PARSER_NO_ERROR;
 }
 
-void parse(LLVMModuleRef llvm_module, TokenData *token_data)
+int parse_pch_header(Preprocessor *pp, Arena *arena, uint32_t **typedef_names, uint32_t *num_typedef_names)
 {
-	token_data_internal = token_data;
-	llvm_module_internal = llvm_module;
+	Arena ast;
+	arena_init(&ast, AST_FIRST_CHUNK);
+	Parser parser = {0};
+	parser.pp = pp;
+	parser.arena = &ast;
+	arena_init(&parser.scratch, PARSER_SCRATCH_CHUNK);
+
+	if (setjmp(parser.bail))
+	{
+		arena_release(&parser.scratch);
+		arena_release(&ast);
+		return 1;
+	}
+
+	translation_unit(&parser);
+
+	// what is still bound is what the file scope declared
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < parser.num_bindings; i++)
+		count += parser.bindings[i].typedef_name != 0;
+
+	uint32_t *names = arena_alloc(arena, (count + 1) * sizeof(uint32_t));
+	if (!names)
+		out_of_memory(&parser);
+
+	count = 0;
+	for (uint32_t i = 0; i < parser.num_bindings; i++)
+	{
+		if (parser.bindings[i].typedef_name)
+			names[count++] = parser.bindings[i].id;
+	}
 
-	top_level_decl();
+	*typedef_names = names;
+	*num_typedef_names = count;
+	arena_release(&parser.scratch);
+	arena_release(&ast);
+	return 0;
 }
@@ -1,8 +1,39 @@
 #pragma once
 
-#include <llvm-c/Object.h>
+#include "ast.h"
+#include "preprocessor.h"
+#include "token_pipe.h"
 
-#include "token.h"
+// clang-format off
+// X(NAME, description)
+#define PARSER_ERRORS(X) \
+	X(NO_ERROR, "no") \
+	X(SYNTAX_ERROR, "syntax") \
+	X(LEX_ERROR, "lexical") \
+	X(INTERNAL_ERROR, "internal")
+// clang-format on
 
-void parse(LLVMModuleRef llvm_module, TokenData *token_data);
+#define PARSER_ERROR_ENUM_NAME(name, ...) PARSER_##name,
 
+typedef enum ParserErrorCode
+{
+	PARSER_ERRORS(PARSER_ERROR_ENUM_NAME)
+} ParserErrorCode;
+
+extern const char *const ParserErrorStrings[];
+
+// Parentheses, brackets, braces, statements, declarators, the type names of sizeof and _Alignof and the middle
+// operands of conditionals nested deeper than this are reported instead of running out of stack. Chains of binary
+// operators, assignments, conditionals (through their last operand), unary operators, casts and else if are parsed in
+// loops and do not nest.
+#define PARSER_MAX_DEPTH 1024
+
+// Parses the translation unit of pp into a syntax tree allocated from arena, stored in *tu on success. With pipe NULL
+// tokens are pulled from pp directly, which then only runs as far ahead as the parser looks, otherwise they come from
+// pipe which must have been started on pp. All state lives in a context local to the call, so separate translation
+// units can be parsed on separate threads.
+ParserErrorCode parse(Preprocessor *pp, TokenPipe *pipe, Arena *arena, AstNode **tu);
+
+// Parses the header pp_emit_pch precompiles, a PPPchParser. Its syntax tree is not kept, only the ids of the typedef
+// names it declares at file scope, which parse declares again for a translation unit that uses the precompiled header.
+int parse_pch_header(Preprocessor *pp, Arena *arena, uint32_t **typedef_names, uint32_t *num_typedef_names);
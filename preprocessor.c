@@ -0,0 +1,3282 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "preprocessor.h"
+
+#define PP_FIRST_CHUNK (16 * 1024)
+#define PP_SCRATCH_CHUNK (4 * 1024)
+#define PP_INITIAL_VEC 64
+
+// C11 5.2.4.1 minimum, the arguments of an invocation are kept on the stack
+#define PP_MAX_MACRO_PARAMS 127
+
+// longest path an include is looked up under
+#define PP_MAX_PATH 4096
+
+// Marks on tokens that only mean something to the preprocessor, above the TOKEN_FLAG_* bits of the lexer.
+// The identifier named a macro that was being expanded when it was read, it is never expanded (C11 6.10.3.4p2).
+#define PP_FLAG_NO_EXPAND 0x10
+// in a macro body, the token is a parameter and its payload the parameter index
+#define PP_FLAG_PARAM 0x20
+// made by ##, # or a builtin macro, there is no source text it was lexed from
+#define PP_FLAG_MADE 0x40
+
+#define TOK_FIRST_PUNCTUATOR TOK_OPEN_SQR_BRACK
+
+// clang-format off
+// X(NAME, spelling), identifiers with a meaning to the preprocessor. The directives come first, in the order of
+// PPDirective.
+#define PP_IDENTS(X) \
+	X(DEFINE, "define") \
+	X(UNDEF, "undef") \
+	X(INCLUDE, "include") \
+	X(IFDEF, "ifdef") \
+	X(IFNDEF, "ifndef") \
+	X(ELIF, "elif") \
+	X(ENDIF, "endif") \
+	X(LINE, "line") \
+	X(ERROR, "error") \
+	X(PRAGMA, "pragma") \
+	X(DEFINED, "defined") \
+	X(VA_ARGS, "__VA_ARGS__") \
+	X(ONCE, "once") \
+	X(PRAGMA_OPERATOR, "_Pragma") \
+	X(FILE_MACRO, "__FILE__") \
+	X(LINE_MACRO, "__LINE__")
+
+#define PP_IDENT_ENUM(name, spelling) PP_ID_##name,
+#define PP_SPELLING(name, spelling) spelling,
+
+typedef enum PPIdent
+{
+	PP_IDENTS(PP_IDENT_ENUM)
+	PP_ID_COUNT
+} PPIdent;
+
+static const char *const pp_ident_spelling[] = {PP_IDENTS(PP_SPELLING)};
+static const char *const keyword_spelling[] = {TOKEN_KEYWORDS(PP_SPELLING)};
+static const char *const punctuator_spelling[] = {TOKEN_PUNCTUATORS(PP_SPELLING)};
+
+#define NUM_KEYWORDS (TOK_LAST_KEYWORD - TOK_FIRST_KEYWORD + 1)
+// clang-format on
+
+typedef enum PPDirective
+{
+	PP_DIR_DEFINE,
+	PP_DIR_UNDEF,
+	PP_DIR_INCLUDE,
+	PP_DIR_IFDEF,
+	PP_DIR_IFNDEF,
+	PP_DIR_ELIF,
+	PP_DIR_ENDIF,
+	PP_DIR_LINE,
+	PP_DIR_ERROR,
+	PP_DIR_PRAGMA,
+	PP_DIR_IF,
+	PP_DIR_ELSE,
+	PP_DIR_UNKNOWN
+} PPDirective;
+
+typedef enum PPBuiltin
+{
+	PP_BUILTIN_NONE,
+	PP_BUILTIN_FILE,
+	PP_BUILTIN_LINE
+} PPBuiltin;
+
+typedef enum PPCondState
+{
+	// the group being read is taken
+	PP_COND_ACTIVE,
+	// no group of the #if was taken yet, an #elif or #else still can be
+	PP_COND_SEEKING,
+	// a group of the #if was taken, the rest are skipped
+	PP_COND_DONE,
+	// the whole #if is inside a skipped group
+	PP_COND_SKIPPED
+} PPCondState;
+
+// How far the frame got in matching the #ifndef X ... #endif shape of a guarded header
+typedef enum PPGuardState
+{
+	PP_GUARD_START,
+	PP_GUARD_IN,
+	PP_GUARD_AFTER,
+	PP_GUARD_NONE
+} PPGuardState;
+
+typedef struct PPFile
+{
+	// path the file was opened with, or a name in angle brackets for sources that are not files
+	const char *name;
+
+	// length of the directory part of name including its '/', "..." includes are looked up there first
+	uint32_t dir_len;
+
+	// the whole source when it is resident in memory, kept so the file is never opened again
+	CharBuffer *cb;
+	int owns_cb;
+	const char *source;
+	unsigned long size;
+
+	// tokens of the file are resolved to lines through this, which is filled by the first lexing of the file
+	LineTable *lines;
+	LineTable _lines;
+	int lines_started;
+
+	// identity of the file, so it is found again under another path
+	int has_identity;
+	dev_t dev;
+	ino_t ino;
+
+	// macro that guards everything in the file, INTERN_NO_ID if there is none
+	uint32_t guard;
+
+	// set by #pragma once
+	int once;
+
+	// the tokens of the file when they came from the token cache, bound to td on the first #include
+	CachedTokens *cached;
+	TokenCacheBinding binding;
+	int bound;
+
+	// content hash of a file that was not in the token cache, it is stored there once it was lexed
+	uint64_t hash;
+	int store;
+} PPFile;
+
+typedef struct PPFrame
+{
+	PPFile *file;
+	uint16_t file_id;
+
+	LexerState lexer;
+	CharBuffer view;
+
+	// a stream opened only for this frame, for files that are not resident
+	CharBuffer *stream;
+
+	// set when the tokens come from the token cache instead of the lexer, the next one being cached_pos
+	const CachedTokens *cached;
+	uint32_t cached_pos;
+
+	// the tokens lexed so far, when they are going to be stored in the token cache
+	struct PPTokenVec *record;
+
+	// a token read ahead of a directive line end or the '(' of an invocation, returned first
+	LexedToken pending;
+	int has_pending;
+
+	// number of open #if groups when the file was entered
+	uint32_t cond_base;
+
+	PPGuardState guard_state;
+	uint32_t guard;
+
+	// source offset of the last token read, where __LINE__ is
+	uint32_t last_offset;
+
+	// set by #line, the line and file name given replace the real ones for __LINE__ and __FILE__
+	int line_delta;
+	const char *presumed_name;
+} PPFrame;
+
+typedef struct PPCond
+{
+	PPCondState state;
+	int seen_else;
+
+	// the directive that opened it, for the error when it is never closed
+	LexedToken at;
+} PPCond;
+
+typedef struct PPTokenVec
+{
+	LexedToken *tokens;
+	uint32_t len;
+	uint32_t cap;
+
+	// the preprocessor's, tokens grows in it
+	Arena *arena;
+} PPTokenVec;
+
+typedef struct PPContext
+{
+	const LexedToken *tokens;
+	uint32_t pos;
+	uint32_t len;
+
+	// macro this is the expansion of, it can be expanded again once the context is left
+	struct PPMacro *macro;
+
+	// pooled list the tokens are in, given back when the context is left
+	PPTokenVec *vec;
+} PPContext;
+
+typedef struct PPMacro
+{
+	LexedToken *body;
+	uint32_t body_len;
+
+	// __VA_ARGS__ counts as the last parameter of a variadic macro
+	uint32_t num_params;
+	uint8_t function_like;
+	uint8_t variadic;
+
+	// set while the macro is being expanded
+	uint8_t disabled;
+
+	PPBuiltin builtin;
+} PPMacro;
+
+typedef struct PPArgs
+{
+	// raw tokens of all arguments back to back, argument i is [starts[i], starts[i + 1])
+	PPTokenVec *raw;
+	uint32_t starts[PP_MAX_MACRO_PARAMS + 2];
+	uint32_t count;
+
+	// fully expanded arguments, only made once something needs them
+	PPTokenVec *expanded[PP_MAX_MACRO_PARAMS + 1];
+} PPArgs;
+
+typedef struct PPValue
+{
+	uint64_t value;
+	int is_unsigned;
+} PPValue;
+
+// An #if expression being evaluated
+typedef struct PPExpr
+{
+	Preprocessor *pp;
+	const LexedToken *tokens;
+	uint32_t pos;
+	uint32_t len;
+
+	// the directive, errors at the end of the line are reported there
+	const LexedToken *at;
+} PPExpr;
+
+static int next_raw(Preprocessor *pp, LexedToken *tok);
+static int expand_next(Preprocessor *pp, LexedToken *tok);
+
+static void report(const Preprocessor *pp)
+{
+	printf("[%s Line %d] Error: %s\n", pp->error_file, pp->error_line, pp->error);
+
+	// errors are returned to the caller, other sources being compiled alongside this one carry on
+	fflush(stdout);
+}
+
+// Reports an error at tok and returns -1, so callers can return it right away. The preprocessor can only be freed
+// afterwards, which also takes care of anything that was in use.
+static int pp_error(Preprocessor *pp, const LexedToken *at, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(pp->error, PP_MAX_ERROR_LEN, fmt, args);
+	va_end(args);
+
+	int col;
+	LexedToken start = {0};
+	pp_source_location(pp, at ? at : &start, &pp->error_file, &pp->error_line, &col);
+	pp->has_error = 1;
+
+	if (!pp->defer_errors)
+		report(pp);
+	return -1;
+}
+
+static int out_of_memory(Preprocessor *pp)
+{
+	return pp_error(pp, NULL, "ran out of memory while preprocessing");
+}
+
+void pp_report_deferred_error(const Preprocessor *pp)
+{
+	if (pp->has_error)
+		report(pp);
+}
+
+void pp_source_location(const Preprocessor *pp, const LexedToken *tok, const char **file_name, int *line, int *col)
+{
+	const PPFile *file = pp->_files[tok->file];
+	*file_name = file->name;
+	line_location(file->lines, tok->offset, line, col);
+}
+
+// Returns an empty pooled token list, NULL when out of memory
+static PPTokenVec *get_vec(Preprocessor *pp)
+{
+	if (pp->_num_free_vecs)
+	{
+		PPTokenVec *vec = pp->_free_vecs[--pp->_num_free_vecs];
+		vec->len = 0;
+		return vec;
+	}
+
+	// every list can end up free at the same time, so both arrays always have room for all of them
+	if (pp->_num_vecs == pp->_vecs_cap)
+	{
+		uint32_t cap = pp->_vecs_cap ? pp->_vecs_cap * 2 : 16;
+		PPTokenVec **vecs =
+			arena_grow(&pp->_arena, pp->_vecs, pp->_vecs_cap * sizeof(PPTokenVec *), cap * sizeof(PPTokenVec *));
+		if (!vecs)
+			return NULL;
+		pp->_vecs = vecs;
+
+		PPTokenVec **free_vecs = arena_grow(&pp->_arena, pp->_free_vecs, pp->_vecs_cap * sizeof(PPTokenVec *),
+		                                    cap * sizeof(PPTokenVec *));
+		if (!free_vecs)
+			return NULL;
+		pp->_free_vecs = free_vecs;
+		pp->_vecs_cap = cap;
+	}
+
+	PPTokenVec *vec = arena_calloc(&pp->_arena, 1, sizeof(PPTokenVec));
+	if (!vec)
+		return NULL;
+	vec->arena = &pp->_arena;
+
+	pp->_vecs[pp->_num_vecs++] = vec;
+	return vec;
+}
+
+static void put_vec(Preprocessor *pp, PPTokenVec *vec)
+{
+	pp->_free_vecs[pp->_num_free_vecs++] = vec;
+}
+
+// Returns !0 when out of memory
+static int vec_push(PPTokenVec *vec, const LexedToken *tok)
+{
+	if (vec->len == vec->cap)
+	{
+		uint32_t cap = vec->cap ? vec->cap * 2 : PP_INITIAL_VEC;
+		LexedToken *tokens =
+			arena_grow(vec->arena, vec->tokens, vec->cap * sizeof(LexedToken), cap * sizeof(LexedToken));
+		if (!tokens)
+			return 1;
+		vec->tokens = tokens;
+		vec->cap = cap;
+	}
+
+	vec->tokens[vec->len++] = *tok;
+	return 0;
+}
+
+// Makes room for size chars in pp->_spell
+static int spell_reserve(Preprocessor *pp, uint32_t size)
+{
+	if (size <= pp->_spell_cap)
+		return 0;
+
+	uint32_t cap = pp->_spell_cap ? pp->_spell_cap * 2 : 256;
+	while (cap < size)
+		cap *= 2;
+
+	char *spell = arena_grow(&pp->_arena, pp->_spell, pp->_spell_cap, cap);
+	if (!spell)
+		return out_of_memory(pp);
+	pp->_spell = spell;
+	pp->_spell_cap = cap;
+	return 0;
+}
+
+// Appends n chars to the spelling being put together in pp->_spell, which is *len chars long so far
+static int spell_append(Preprocessor *pp, uint32_t *len, const char *str, uint32_t n)
+{
+	if (spell_reserve(pp, *len + n))
+		return -1;
+
+	memcpy(pp->_spell + *len, str, n);
+	*len += n;
+	return 0;
+}
+
+// spell_append for n chars of a source, without the line splices in them
+static int spell_append_source(Preprocessor *pp, uint32_t *len, const char *str, uint32_t n)
+{
+	if (spell_reserve(pp, *len + n))
+		return -1;
+
+	*len += remove_line_splices(pp->_spell + *len, str, n);
+	return 0;
+}
+
+// Returns p moved past the line splices it is at
+static const char *skip_source_splices(const char *p, const char *end)
+{
+	for (;;)
+	{
+		if (end - p >= 2 && p[0] == '\\' && p[1] == '\n')
+			p += 2;
+		else if (end - p >= 3 && p[0] == '\\' && p[1] == '\r' && p[2] == '\n')
+			p += 3;
+		else
+			return p;
+	}
+}
+
+// Interned id of an identifier or keyword token, INTERN_NO_ID for anything else
+static uint32_t name_id(const Preprocessor *pp, const LexedToken *tok)
+{
+	if (tok->kind == TOK_IDENTIFIER)
+		return tok->payload;
+	if (tok->kind <= TOK_LAST_KEYWORD)
+		return pp->_ids[PP_ID_COUNT + tok->kind - TOK_FIRST_KEYWORD];
+	return INTERN_NO_ID;
+}
+
+static const char *name_str(const Preprocessor *pp, const LexedToken *tok)
+{
+	return intern_str(pp->td->identifiers, name_id(pp, tok));
+}
+
+static PPMacro *find_macro(const Preprocessor *pp, uint32_t id)
+{
+	return id < pp->_macros_cap ? pp->_macros[id] : NULL;
+}
+
+// Identifier ids are handed out densely from 0, so the id itself is the hash and the table is a plain array.
+// Keywords are only looked at while one of them is defined as a macro.
+static PPMacro *macro_of(const Preprocessor *pp, const LexedToken *tok)
+{
+	if (tok->kind == TOK_IDENTIFIER)
+		return find_macro(pp, tok->payload);
+	if (pp->_keyword_macros && tok->kind <= TOK_LAST_KEYWORD)
+		return find_macro(pp, name_id(pp, tok));
+	return NULL;
+}
+
+// Defines or, with macro NULL, undefines the macro named by tok. Returns !0 when out of memory
+static int set_macro(Preprocessor *pp, const LexedToken *tok, PPMacro *macro)
+{
+	uint32_t id = name_id(pp, tok);
+	if (id >= pp->_macros_cap)
+	{
+		uint32_t cap = pp->_macros_cap ? pp->_macros_cap : 256;
+		while (cap <= id)
+			cap *= 2;
+
+		PPMacro **macros =
+			arena_grow(&pp->_arena, pp->_macros, pp->_macros_cap * sizeof(PPMacro *), cap * sizeof(PPMacro *));
+		if (!macros)
+			return 1;
+		memset(macros + pp->_macros_cap, 0, (cap - pp->_macros_cap) * sizeof(PPMacro *));
+		pp->_macros = macros;
+		pp->_macros_cap = cap;
+	}
+
+	int delta = (macro != NULL) - (pp->_macros[id] != NULL);
+	pp->num_macros += delta;
+	if (tok->kind != TOK_IDENTIFIER)
+		pp->_keyword_macros += delta;
+
+	pp->_macros[id] = macro;
+	return 0;
+}
+
+static int push_context(Preprocessor *pp, const LexedToken *tokens, uint32_t len, PPMacro *macro, PPTokenVec *vec)
+{
+	if (pp->_num_contexts == pp->_contexts_cap)
+	{
+		uint32_t cap = pp->_contexts_cap ? pp->_contexts_cap * 2 : 16;
+		PPContext *contexts =
+			arena_grow(&pp->_arena, pp->_contexts, pp->_contexts_cap * sizeof(PPContext), cap * sizeof(PPContext));
+		if (!contexts)
+			return out_of_memory(pp);
+		pp->_contexts = contexts;
+		pp->_contexts_cap = cap;
+	}
+
+	pp->_contexts[pp->_num_contexts++] = (PPContext){tokens, 0, len, macro, vec};
+	if (macro)
+		macro->disabled = 1;
+	return 0;
+}
+
+static void pop_context(Preprocessor *pp)
+{
+	PPContext *ctx = &pp->_contexts[--pp->_num_contexts];
+	if (ctx->macro)
+		ctx->macro->disabled = 0;
+	if (ctx->vec)
+		put_vec(pp, ctx->vec);
+}
+
+static int skipping(const Preprocessor *pp)
+{
+	return pp->_num_conds && pp->_conds[pp->_num_conds - 1].state != PP_COND_ACTIVE;
+}
+
+// Reads the next token of the innermost source, 0 at its end
+static int lex_frame(Preprocessor *pp, PPFrame *f, LexedToken *tok)
+{
+	if (f->has_pending)
+	{
+		*tok = f->pending;
+		f->has_pending = 0;
+		return 1;
+	}
+
+	if (f->cached)
+	{
+		if (f->cached_pos == f->cached->num_tokens)
+			return 0;
+		if (token_cache_token(f->cached, &f->file->binding, f->cached_pos++, tok))
+			return pp_error(pp, NULL, "the token cache of %s is corrupt", f->file->name);
+		tok->file = f->file_id;
+		return 1;
+	}
+
+	int res = lexer_next(&f->lexer, tok);
+	if (res < 0)
+	{
+		LexedToken at = {f->lexer.token_start, 0, 0, 0, f->file_id};
+		return pp_error(pp, &at, "%s", f->lexer.error ? f->lexer.error : "failed to lex the source");
+	}
+
+	if (res > 0 && f->record && vec_push(f->record, tok))
+		return out_of_memory(pp);
+	return res;
+}
+
+static void set_pending(PPFrame *f, const LexedToken *tok)
+{
+	f->pending = *tok;
+	f->has_pending = 1;
+}
+
+// Reads the rest of a directive line into a pooled list, NULL after an error was reported
+static PPTokenVec *read_line(Preprocessor *pp, PPFrame *f)
+{
+	PPTokenVec *line = get_vec(pp);
+	if (!line)
+	{
+		out_of_memory(pp);
+		return NULL;
+	}
+
+	LexedToken tok;
+	int res;
+	while ((res = lex_frame(pp, f, &tok)) > 0)
+	{
+		// the first token of the next line is left for whoever reads on
+		if (tok.flags & TOKEN_FLAG_BOL)
+		{
+			set_pending(f, &tok);
+			break;
+		}
+
+		if (vec_push(line, &tok))
+		{
+			out_of_memory(pp);
+			return NULL;
+		}
+	}
+
+	return res < 0 ? NULL : line;
+}
+
+static int skip_line(Preprocessor *pp, PPFrame *f)
+{
+	LexedToken tok;
+	int res;
+	while ((res = lex_frame(pp, f, &tok)) > 0)
+	{
+		if (tok.flags & TOKEN_FLAG_BOL)
+		{
+			set_pending(f, &tok);
+			return 0;
+		}
+	}
+	return res;
+}
+
+// Opens the file at path for the first time, returning its id or -1 after an error was reported
+static int add_file(Preprocessor *pp, const char *path, uint32_t path_len, const struct stat *st)
+{
+	if (pp->_num_files > UINT16_MAX)
+		return pp_error(pp, NULL, "too many source files");
+
+	if (pp->_num_files == pp->_files_cap)
+	{
+		uint32_t cap = pp->_files_cap ? pp->_files_cap * 2 : 16;
+		PPFile **files = arena_grow(&pp->_arena, pp->_files, pp->_files_cap * sizeof(PPFile *), cap * sizeof(PPFile *));
+		if (!files)
+			return out_of_memory(pp);
+		pp->_files = files;
+		pp->_files_cap = cap;
+	}
+
+	PPFile *file = arena_calloc(&pp->_arena, 1, sizeof(PPFile));
+	if (!file)
+		return out_of_memory(pp);
+
+	file->name = path;
+	file->lines = &file->_lines;
+	file->guard = INTERN_NO_ID;
+	for (uint32_t i = 0; i < path_len; i++)
+	{
+		if (path[i] == '/')
+			file->dir_len = i + 1;
+	}
+
+	if (st)
+	{
+		file->has_identity = 1;
+		file->dev = st->st_dev;
+		file->ino = st->st_ino;
+	}
+
+	pp->_files[pp->_num_files] = file;
+	return pp->_num_files++;
+}
+
+// Looks the file at path up, opening it if it was not seen before. Returns its id, -1 if there is no such file and -2
+// after an error was reported.
+static int find_file(Preprocessor *pp, const char *path, uint32_t path_len)
+{
+	uint32_t id = intern(pp->_paths, path, path_len);
+	if (id == INTERN_NO_ID)
+		return out_of_memory(pp) - 1;
+
+	// 0 when the path was not looked up yet, -1 when there is nothing there and the file id plus one otherwise
+	if (id >= pp->_path_files_cap)
+	{
+		uint32_t cap = pp->_path_files_cap ? pp->_path_files_cap * 2 : 64;
+		while (cap <= id)
+			cap *= 2;
+
+		int32_t *path_files =
+			arena_grow(&pp->_arena, pp->_path_files, pp->_path_files_cap * sizeof(int32_t), cap * sizeof(int32_t));
+		if (!path_files)
+			return out_of_memory(pp) - 1;
+		memset(path_files + pp->_path_files_cap, 0, (cap - pp->_path_files_cap) * sizeof(int32_t));
+		pp->_path_files = path_files;
+		pp->_path_files_cap = cap;
+	}
+
+	if (pp->_path_files[id])
+		return pp->_path_files[id] - (pp->_path_files[id] > 0);
+
+	struct stat st;
+	if (stat(path, &st) != 0 || S_ISDIR(st.st_mode))
+	{
+		pp->_path_files[id] = -1;
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < pp->_num_files; i++)
+	{
+		PPFile *file = pp->_files[i];
+		if (file->has_identity && file->dev == st.st_dev && file->ino == st.st_ino)
+		{
+			pp->_path_files[id] = i + 1;
+			return i;
+		}
+	}
+
+	int file_id = add_file(pp, intern_str(pp->_paths, id), path_len, &st);
+	if (file_id < 0)
+		return -2;
+
+	PPFile *file = pp->_files[file_id];
+	file->cb = open_char_buffer(file->name, 0);
+	if (!file->cb)
+	{
+		pp_error(pp, NULL, "failed to open %s", file->name);
+		return -2;
+	}
+
+	// anything that is not resident is opened again for every include, which only happens for special files
+	file->source = cb_resident_source(file->cb);
+	file->size = file->cb->_size;
+	if (file->source)
+	{
+		file->owns_cb = 1;
+
+		// only a file that is there as a whole can be hashed, and only then do cached literal spans have a source
+		TokenCache *tc = pp->options ? pp->options->token_cache : NULL;
+		if (tc && file->size)
+		{
+			file->hash = token_cache_hash(file->source, file->size);
+			file->cached = token_cache_load(tc, file->hash, file->size);
+			file->store = !file->cached;
+			if (file->cached)
+				file->lines = &file->cached->lines;
+		}
+	}
+	else
+	{
+		delete_char_buffer(file->cb);
+		file->cb = NULL;
+	}
+
+	pp->num_headers++;
+	pp->_path_files[id] = file_id + 1;
+	return file_id;
+}
+
+// Looks for name in the directory given by the first dir_len chars of dir, same returns as find_file
+static int find_in_dir(Preprocessor *pp, const char *dir, uint32_t dir_len, const char *name, uint32_t len)
+{
+	char path[PP_MAX_PATH];
+	int slash = dir_len && dir[dir_len - 1] != '/';
+	if (dir_len + slash + len >= PP_MAX_PATH)
+		return -1;
+
+	memcpy(path, dir, dir_len);
+	if (slash)
+		path[dir_len] = '/';
+	memcpy(path + dir_len + slash, name, len);
+	path[dir_len + slash + len] = 0;
+
+	return find_file(pp, path, dir_len + slash + len);
+}
+
+// Pushes a frame that lexes file_id from its start
+static int enter_file(Preprocessor *pp, int file_id, const LexedToken *at)
+{
+	if (pp->_num_frames == PP_MAX_INCLUDE_DEPTH)
+		return pp_error(pp, at, "#include nested too deeply");
+
+	PPFile *file = pp->_files[file_id];
+	PPFrame *f = &pp->_frames[pp->_num_frames];
+	memset(f, 0, sizeof(PPFrame));
+	f->file = file;
+	f->file_id = file_id;
+	f->cond_base = pp->_num_conds;
+	f->guard = INTERN_NO_ID;
+
+	// a cache file that does not hold up is dropped and the header lexed after all, which also writes it again
+	int bind_err = file->cached && !file->bound
+	                   ? token_cache_bind(file->cached, pp->td, file->source, &pp->_arena, &file->binding)
+	                   : 0;
+	if (bind_err < 0)
+		return out_of_memory(pp);
+
+	if (bind_err)
+	{
+		token_cache_unmap(file->cached);
+		file->cached = NULL;
+		file->lines = &file->_lines;
+		file->store = 1;
+	}
+
+	if (file->cached)
+	{
+		file->bound = 1;
+		f->cached = file->cached;
+		pp->_num_frames++;
+		return 0;
+	}
+
+	CharBuffer *cb = &f->view;
+	if (file->source)
+	{
+		cb_init_view(cb, file->source, 0, file->size);
+	}
+	else
+	{
+		cb = f->stream = open_char_buffer(file->name, 0);
+		if (!cb)
+			return pp_error(pp, at, "failed to open %s", file->name);
+	}
+
+	// the lines of a file are the same every time it is lexed, later lexings only need somewhere to put them
+	LineTable *lines = &pp->_scratch_lines;
+	if (!file->lines_started)
+	{
+		lines = file->lines;
+		file->lines_started = 1;
+
+		// the first lexing of a file is the one that goes to the token cache
+		if (file->store)
+		{
+			f->record = get_vec(pp);
+			if (!f->record)
+				return out_of_memory(pp);
+		}
+	}
+	else
+	{
+		lines->count = 0;
+	}
+
+	pp->_num_frames++;
+	if (lexer_init_source(&f->lexer, cb, pp->td, lines))
+		return out_of_memory(pp);
+
+	f->lexer.raw = 1;
+	f->lexer.defer_errors = 1;
+	f->lexer.file = file_id;
+	return 0;
+}
+
+static int leave_frame(Preprocessor *pp)
+{
+	PPFrame *f = &pp->_frames[pp->_num_frames - 1];
+	if (pp->_num_conds > f->cond_base)
+		return pp_error(pp, &pp->_conds[pp->_num_conds - 1].at, "unterminated conditional directive");
+
+	if (f->guard_state == PP_GUARD_AFTER)
+		f->file->guard = f->guard;
+
+	if (f->record)
+	{
+		PPFile *file = f->file;
+		token_cache_store(pp->options->token_cache, file->hash, file->source, file->size, pp->td, f->record->tokens,
+		                  f->record->len, file->lines);
+		file->store = 0;
+		put_vec(pp, f->record);
+	}
+
+	if (f->stream)
+		delete_char_buffer(f->stream);
+
+	pp->_num_frames--;
+	return 0;
+}
+
+static int push_cond(Preprocessor *pp, PPCondState state, const LexedToken *at)
+{
+	if (pp->_num_conds == pp->_conds_cap)
+	{
+		uint32_t cap = pp->_conds_cap ? pp->_conds_cap * 2 : 16;
+		PPCond *conds = arena_grow(&pp->_arena, pp->_conds, pp->_conds_cap * sizeof(PPCond), cap * sizeof(PPCond));
+		if (!conds)
+			return out_of_memory(pp);
+		pp->_conds = conds;
+		pp->_conds_cap = cap;
+	}
+
+	pp->_conds[pp->_num_conds++] = (PPCond){state, 0, *at};
+	return 0;
+}
+
+// Appends the spelling of tok to pp->_spell
+static int spell_token(Preprocessor *pp, const LexedToken *tok, uint32_t *len)
+{
+	TokenData *td = pp->td;
+	const PPFile *file = pp->_files[tok->file];
+	const char *source = tok->flags & PP_FLAG_MADE ? NULL : file->source;
+	char buf[64];
+	int n;
+
+	switch (tok->kind)
+	{
+	case TOK_IDENTIFIER:
+		return spell_append(pp, len, intern_str(td->identifiers, tok->payload), intern_len(td->identifiers, tok->payload));
+
+	case TOK_STRING_LITERAL: {
+		if (spell_append(pp, len, "\"", 1))
+			return -1;
+
+		const StringLiteral *lit = &td->string_literals[tok->payload];
+		for (uint32_t i = 0; i < lit->num_spans; i++)
+		{
+			const StringSpan *span = &td->string_spans[lit->first_span + i];
+			if (spell_append(pp, len, span->ptr, span->len))
+				return -1;
+		}
+		return spell_append(pp, len, "\"", 1);
+	}
+
+	case TOK_CHAR_LITERAL: {
+		// as written, escapes and all (C11 6.10.3.2p2), up to the closing quote the lexer found
+		if (source)
+		{
+			const char *end = source + file->size;
+			const char *p = skip_source_splices(source + tok->offset + 1, end);
+			while (p < end && *p != '\'' && *p != '\n')
+			{
+				int escape = *p == '\\';
+				p = skip_source_splices(p + 1, end);
+				if (escape && p < end && *p != '\n')
+					p = skip_source_splices(p + 1, end);
+			}
+			return spell_append_source(pp, len, source + tok->offset, (p < end ? p + 1 : p) - (source + tok->offset));
+		}
+
+		// a literal made by ## has no source, its value is spelled without depending on the locale
+		unsigned char chr = tok->payload;
+		if (chr == '\'' || chr == '\\')
+			n = snprintf(buf, sizeof(buf), "'\\%c'", chr);
+		else if (chr >= 0x20 && chr < 0x7f)
+			n = snprintf(buf, sizeof(buf), "'%c'", chr);
+		else
+			n = snprintf(buf, sizeof(buf), "'\\%03o'", chr);
+		return spell_append(pp, len, buf, n);
+	}
+
+	case TOK_NUMERICAL_CONSTANT: {
+		// the source has the spelling as written, which the value only has to stand in for when there is none
+		if (source)
+		{
+			const char *end = source + file->size;
+			char prev = source[tok->offset];
+			const char *p = skip_source_splices(source + tok->offset + 1, end);
+			while (p < end && (isalnum((unsigned char)*p) || *p == '_' || *p == '.' || (unsigned char)*p >= 0x80 ||
+			                   ((*p == '+' || *p == '-') && strchr("eEpP", prev))))
+			{
+				prev = *p;
+				p = skip_source_splices(p + 1, end);
+			}
+			return spell_append_source(pp, len, source + tok->offset, p - (source + tok->offset));
+		}
+
+		static const char *const int_suffixes[] = {"ll", "ull", "l", "ul", "", "u"};
+		const NumConstant *nc = &td->num_constants->constants[tok->payload];
+		if (nc->floating)
+			n = snprintf(buf, sizeof(buf), "%a%s", nc->float_value,
+			             nc->floating_type == FLOATING_TYPE_FLOAT    ? "f"
+			             : nc->floating_type == FLOATING_TYPE_LDOUBLE ? "l"
+			                                                          : "");
+		else
+			n = snprintf(buf, sizeof(buf), "%llu%s", (unsigned long long)nc->int_value, int_suffixes[nc->int_type]);
+		return spell_append(pp, len, buf, n);
+	}
+
+	case TOK_INVALID:
+		if (td->invalid_tokens[tok->payload].text)
+			return spell_append(pp, len, td->invalid_tokens[tok->payload].text, td->invalid_tokens[tok->payload].len);
+		if (!source)
+			return spell_append(pp, len, "?", 1);
+		return spell_append_source(pp, len, source + tok->offset, td->invalid_tokens[tok->payload].len);
+
+	default:
+		if (tok->kind <= TOK_LAST_KEYWORD)
+		{
+			const char *kw = keyword_spelling[tok->kind - TOK_FIRST_KEYWORD];
+			return spell_append(pp, len, kw, strlen(kw));
+		}
+
+		const char *punct = punctuator_spelling[tok->kind - TOK_FIRST_PUNCTUATOR];
+		return spell_append(pp, len, punct, strlen(punct));
+	}
+}
+
+// Lexes pp->_spell[0, len) into the single token it has to be, made at the location of at
+static int make_token(Preprocessor *pp, uint32_t len, const LexedToken *at, LexedToken *res)
+{
+	int lexed = lex_spelling(pp->td, pp->_spell, len, res);
+	if (lexed < 0)
+		return out_of_memory(pp);
+	if (!lexed)
+		return pp_error(pp, at, "\"%.*s\" is not a valid preprocessing token", (int)len, pp->_spell);
+
+	res->offset = at->offset;
+	res->file = at->file;
+	res->flags = (at->flags & TOKEN_FLAG_SPACE) | PP_FLAG_MADE;
+	return 0;
+}
+
+// Appends str as the body of a string literal, escaping what needs it
+static int spell_escaped(Preprocessor *pp, uint32_t *len, const char *str, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++)
+	{
+		if ((str[i] == '"' || str[i] == '\\') && spell_append(pp, len, "\\", 1))
+			return -1;
+		if (spell_append(pp, len, str + i, 1))
+			return -1;
+	}
+	return 0;
+}
+
+// The # operator (C11 6.10.3.2), makes a string literal of the spelling of argument idx
+static int stringize(Preprocessor *pp, const PPArgs *args, uint32_t idx, const LexedToken *at, LexedToken *res)
+{
+	uint32_t len = 0;
+	if (spell_append(pp, &len, "\"", 1))
+		return -1;
+
+	for (uint32_t i = args->starts[idx]; i < args->starts[idx + 1]; i++)
+	{
+		const LexedToken *tok = &args->raw->tokens[i];
+		if (i > args->starts[idx] && (tok->flags & TOKEN_FLAG_SPACE) && spell_append(pp, &len, " ", 1))
+			return -1;
+
+		uint32_t start = len;
+		if (spell_token(pp, tok, &len))
+			return -1;
+
+		// quotes and backslashes inside literals get escaped, the spelling is copied since the buffer may move
+		if (tok->kind == TOK_STRING_LITERAL || tok->kind == TOK_CHAR_LITERAL)
+		{
+			uint32_t n = len - start;
+			ArenaMark mark = arena_mark(&pp->_scratch);
+			char *copy = arena_alloc(&pp->_scratch, n);
+			if (!copy)
+				return out_of_memory(pp);
+			memcpy(copy, pp->_spell + start, n);
+
+			len = start;
+			int err = spell_escaped(pp, &len, copy, n);
+			arena_reset(&pp->_scratch, mark);
+			if (err)
+				return -1;
+		}
+	}
+
+	if (spell_append(pp, &len, "\"", 1))
+		return -1;
+
+	return make_token(pp, len, at, res);
+}
+
+// The ## operator, replaces lhs by the token made of its spelling followed by that of rhs
+static int paste(Preprocessor *pp, LexedToken *lhs, const LexedToken *rhs)
+{
+	uint32_t len = 0;
+	if (spell_token(pp, lhs, &len))
+		return -1;
+	uint32_t lhs_len = len;
+	if (spell_token(pp, rhs, &len))
+		return -1;
+
+	LexedToken res;
+	int lexed = lex_spelling(pp->td, pp->_spell, len, &res);
+	if (lexed < 0)
+		return out_of_memory(pp);
+	if (!lexed)
+		return pp_error(pp, lhs, "pasting \"%.*s\" and \"%.*s\" does not give a valid preprocessing token",
+		                (int)lhs_len, pp->_spell, (int)(len - lhs_len), pp->_spell + lhs_len);
+
+	res.offset = lhs->offset;
+	res.file = lhs->file;
+	res.flags = (lhs->flags & TOKEN_FLAG_SPACE) | PP_FLAG_MADE;
+	*lhs = res;
+	return 0;
+}
+
+// Fully macro expands tokens[0, len) on their own into out, as for a macro argument or the line of an #if
+static int expand_list(Preprocessor *pp, const LexedToken *tokens, uint32_t len, PPTokenVec *out)
+{
+	if (push_context(pp, tokens, len, NULL, NULL))
+		return -1;
+
+	uint32_t floor = pp->_floor;
+	pp->_floor = pp->_num_contexts;
+
+	LexedToken tok;
+	int res;
+	while ((res = expand_next(pp, &tok)) > 0)
+	{
+		if (vec_push(out, &tok))
+			return out_of_memory(pp);
+	}
+
+	pp->_floor = floor;
+	if (res < 0)
+		return -1;
+
+	pop_context(pp);
+	return 0;
+}
+
+// Appends argument idx to out, the first token taking over the spacing of the parameter it replaces
+static int append_arg(Preprocessor *pp, PPArgs *args, uint32_t idx, int expanded, const LexedToken *param,
+                      PPTokenVec *out)
+{
+	const LexedToken *tokens = args->raw->tokens + args->starts[idx];
+	uint32_t len = args->starts[idx + 1] - args->starts[idx];
+
+	if (expanded)
+	{
+		if (!args->expanded[idx])
+		{
+			args->expanded[idx] = get_vec(pp);
+			if (!args->expanded[idx])
+				return out_of_memory(pp);
+			if (expand_list(pp, tokens, len, args->expanded[idx]))
+				return -1;
+		}
+
+		tokens = args->expanded[idx]->tokens;
+		len = args->expanded[idx]->len;
+	}
+
+	for (uint32_t i = 0; i < len; i++)
+	{
+		LexedToken tok = tokens[i];
+		if (i == 0)
+			tok.flags = (tok.flags & ~TOKEN_FLAG_SPACE) | (param->flags & TOKEN_FLAG_SPACE);
+		if (vec_push(out, &tok))
+			return out_of_memory(pp);
+	}
+
+	return 0;
+}
+
+// Builds the replacement list of an invocation of m into out (C11 6.10.3.1 to 6.10.3.3), args is NULL for
+// object-like macros
+static int substitute(Preprocessor *pp, PPMacro *m, PPArgs *args, PPTokenVec *out)
+{
+	const LexedToken *body = m->body;
+
+	// set when the last operand added was an empty argument, a placemarker that ## leaves the other operand alone for
+	int placemarker = 0;
+
+	for (uint32_t i = 0; i < m->body_len; i++)
+	{
+		const LexedToken *tok = &body[i];
+
+		if (args && tok->kind == TOK_HASH)
+		{
+			LexedToken str;
+			if (stringize(pp, args, body[i + 1].payload, tok, &str))
+				return -1;
+			if (vec_push(out, &str))
+				return out_of_memory(pp);
+			placemarker = 0;
+			i++;
+			continue;
+		}
+
+		if (tok->kind == TOK_DOUBLE_HASH)
+		{
+			const LexedToken *rhs = &body[++i];
+			uint32_t rhs_len = 1;
+			const LexedToken *rhs_tokens = rhs;
+			if (rhs->flags & PP_FLAG_PARAM)
+			{
+				rhs_tokens = args->raw->tokens + args->starts[rhs->payload];
+				rhs_len = args->starts[rhs->payload + 1] - args->starts[rhs->payload];
+			}
+
+			// GNU C's , ## __VA_ARGS__ drops the comma when there are no variable arguments and pastes nothing otherwise
+			int gnu_comma = (rhs->flags & PP_FLAG_PARAM) && m->variadic && rhs->payload == m->num_params - 1 &&
+			                !placemarker && out->len && out->tokens[out->len - 1].kind == TOK_COMMA;
+
+			if (!rhs_len)
+			{
+				if (gnu_comma)
+					out->len--;
+				continue;
+			}
+
+			if (placemarker || gnu_comma)
+			{
+				for (uint32_t k = 0; k < rhs_len; k++)
+				{
+					if (vec_push(out, &rhs_tokens[k]))
+						return out_of_memory(pp);
+				}
+				placemarker = 0;
+				continue;
+			}
+
+			if (paste(pp, &out->tokens[out->len - 1], &rhs_tokens[0]))
+				return -1;
+			for (uint32_t k = 1; k < rhs_len; k++)
+			{
+				if (vec_push(out, &rhs_tokens[k]))
+					return out_of_memory(pp);
+			}
+			continue;
+		}
+
+		if (tok->flags & PP_FLAG_PARAM)
+		{
+			// operands of ## are not expanded first
+			int pasted = i + 1 < m->body_len && body[i + 1].kind == TOK_DOUBLE_HASH;
+			uint32_t before = out->len;
+			if (append_arg(pp, args, tok->payload, !pasted, tok, out))
+				return -1;
+			placemarker = out->len == before;
+			continue;
+		}
+
+		if (vec_push(out, tok))
+			return out_of_memory(pp);
+		placemarker = 0;
+	}
+
+	return 0;
+}
+
+// Reads the arguments of an invocation of m up to its closing parenthesis, the '(' was already read
+static int collect_args(Preprocessor *pp, PPMacro *m, const LexedToken *name, PPArgs *args)
+{
+	args->raw = get_vec(pp);
+	if (!args->raw)
+		return out_of_memory(pp);
+
+	args->count = 0;
+	args->starts[0] = 0;
+	memset(args->expanded, 0, sizeof(args->expanded));
+
+	int depth = 0;
+	for (;;)
+	{
+		LexedToken tok;
+		int res = next_raw(pp, &tok);
+		if (res < 0)
+			return -1;
+		if (res == 0)
+			return pp_error(pp, name, "unterminated argument list invoking macro \"%s\"", name_str(pp, name));
+
+		if (tok.kind == TOK_OPEN_PAREN)
+		{
+			depth++;
+		}
+		else if (tok.kind == TOK_CLOSE_PAREN)
+		{
+			if (!depth)
+				break;
+			depth--;
+		}
+		else if (tok.kind == TOK_COMMA && !depth && !(m->variadic && args->count + 1 >= m->num_params))
+		{
+			if (args->count == PP_MAX_MACRO_PARAMS)
+				return pp_error(pp, name, "too many arguments for macro \"%s\"", name_str(pp, name));
+
+			args->starts[++args->count] = args->raw->len;
+			continue;
+		}
+
+		// a new line inside the arguments is just white space
+		tok.flags &= ~TOKEN_FLAG_BOL;
+		if (vec_push(args->raw, &tok))
+			return out_of_memory(pp);
+	}
+	args->starts[++args->count] = args->raw->len;
+
+	// m() is no arguments rather than one empty one for a macro without parameters
+	if (!m->num_params && args->count == 1 && !args->raw->len)
+		args->count = 0;
+
+	// the variable arguments may be left out altogether
+	if (m->variadic && args->count + 1 == m->num_params)
+	{
+		args->starts[args->count + 1] = args->starts[args->count];
+		args->count++;
+	}
+
+	if (args->count != m->num_params)
+		return pp_error(pp, name, "macro \"%s\" passed %u arguments, but takes %u", name_str(pp, name), args->count,
+		                m->num_params);
+	return 0;
+}
+
+// Puts back the token next_raw just returned
+static void unread(Preprocessor *pp, const LexedToken *tok)
+{
+	// nothing is pushed or popped after a token is read, so it came from the innermost context if there is one
+	if (pp->_num_contexts)
+		pp->_contexts[pp->_num_contexts - 1].pos--;
+	else
+		set_pending(&pp->_frames[pp->_num_frames - 1], tok);
+}
+
+static int directive(Preprocessor *pp, PPFrame *f);
+
+// Reads the next token of the sources, carrying out directives and leaving out skipped groups on the way
+static int next_from_source(Preprocessor *pp, LexedToken *tok)
+{
+	while (pp->_num_frames)
+	{
+		PPFrame *f = &pp->_frames[pp->_num_frames - 1];
+		int res = lex_frame(pp, f, tok);
+		if (res < 0)
+			return -1;
+
+		if (res == 0)
+		{
+			if (leave_frame(pp))
+				return -1;
+			continue;
+		}
+
+		if (tok->kind == TOK_HASH && (tok->flags & TOKEN_FLAG_BOL))
+		{
+			if (directive(pp, f))
+				return -1;
+			continue;
+		}
+
+		if (skipping(pp))
+			continue;
+
+		// anything outside of the #ifndef means the file is not guarded by it
+		if (pp->_num_conds == f->cond_base)
+			f->guard_state = PP_GUARD_NONE;
+
+		f->last_offset = tok->offset;
+		return 1;
+	}
+
+	return 0;
+}
+
+// Reads the next token without expanding it, from the innermost macro expansion or otherwise from the sources.
+// Returns 1 for a token, 0 at the end and -1 after an error was reported.
+static int next_raw(Preprocessor *pp, LexedToken *tok)
+{
+	while (pp->_num_contexts)
+	{
+		PPContext *ctx = &pp->_contexts[pp->_num_contexts - 1];
+		if (ctx->pos < ctx->len)
+		{
+			*tok = ctx->tokens[ctx->pos++];
+			return 1;
+		}
+
+		if (pp->_num_contexts == pp->_floor)
+			return 0;
+		pop_context(pp);
+	}
+
+	return next_from_source(pp, tok);
+}
+
+// Expands __FILE__ or __LINE__ named by tok in place
+static int expand_builtin(Preprocessor *pp, PPMacro *m, LexedToken *tok)
+{
+	PPFrame *f = &pp->_frames[pp->_num_frames - 1];
+	uint32_t len = 0;
+
+	if (m->builtin == PP_BUILTIN_LINE)
+	{
+		int line, col;
+		line_location(f->file->lines, f->last_offset, &line, &col);
+
+		char buf[16];
+		int n = snprintf(buf, sizeof(buf), "%d", line + f->line_delta);
+		if (spell_append(pp, &len, buf, n))
+			return -1;
+	}
+	else
+	{
+		const char *name = f->presumed_name ? f->presumed_name : f->file->name;
+		if (spell_append(pp, &len, "\"", 1) || spell_escaped(pp, &len, name, strlen(name)) ||
+		    spell_append(pp, &len, "\"", 1))
+			return -1;
+	}
+
+	LexedToken at = *tok;
+	return make_token(pp, len, &at, tok);
+}
+
+// _Pragma("...") (C11 6.10.9), which only does something for once like #pragma
+static int pragma_operator(Preprocessor *pp, const LexedToken *name)
+{
+	LexedToken open, str, close;
+	if (next_raw(pp, &open) <= 0 || open.kind != TOK_OPEN_PAREN || next_raw(pp, &str) <= 0 ||
+	    str.kind != TOK_STRING_LITERAL || next_raw(pp, &close) <= 0 || close.kind != TOK_CLOSE_PAREN)
+		return pp->has_error ? -1 : pp_error(pp, name, "_Pragma takes a parenthesized string literal");
+
+	if (spell_reserve(pp, string_literal_max_len(pp->td, str.payload)))
+		return -1;
+
+	uint32_t len = decode_string_literal(pp->td, str.payload, pp->_spell);
+	uint32_t start = 0;
+	while (start < len && isspace((unsigned char)pp->_spell[start]))
+		start++;
+	while (len > start && isspace((unsigned char)pp->_spell[len - 1]))
+		len--;
+
+	if (len - start == 4 && memcmp(pp->_spell + start, "once", 4) == 0)
+		pp->_frames[pp->_num_frames - 1].file->once = 1;
+	return 0;
+}
+
+// Expands an invocation of m if a '(' follows its name. Returns 0 when there is none and name is a plain identifier.
+static int expand_function_like(Preprocessor *pp, PPMacro *m, const LexedToken *name)
+{
+	LexedToken paren;
+	int res = next_raw(pp, &paren);
+	if (res <= 0)
+		return res;
+
+	if (paren.kind != TOK_OPEN_PAREN)
+	{
+		unread(pp, &paren);
+		return 0;
+	}
+
+	PPArgs args;
+	if (collect_args(pp, m, name, &args))
+		return -1;
+
+	PPTokenVec *out = get_vec(pp);
+	if (!out)
+		return out_of_memory(pp);
+	if (substitute(pp, m, &args, out))
+		return -1;
+
+	put_vec(pp, args.raw);
+	for (uint32_t i = 0; i < args.count; i++)
+	{
+		if (args.expanded[i])
+			put_vec(pp, args.expanded[i]);
+	}
+
+	if (out->len)
+		out->tokens[0].flags = (out->tokens[0].flags & ~TOKEN_FLAG_SPACE) | (name->flags & TOKEN_FLAG_SPACE);
+	if (push_context(pp, out->tokens, out->len, m, out))
+		return -1;
+	return 1;
+}
+
+static int expand_object_like(Preprocessor *pp, PPMacro *m, const LexedToken *name)
+{
+	if (!m->body_len)
+		return 0;
+
+	PPTokenVec *out = get_vec(pp);
+	if (!out)
+		return out_of_memory(pp);
+	if (substitute(pp, m, NULL, out))
+		return -1;
+
+	out->tokens[0].flags = (out->tokens[0].flags & ~TOKEN_FLAG_SPACE) | (name->flags & TOKEN_FLAG_SPACE);
+	return push_context(pp, out->tokens, out->len, m, out);
+}
+
+// Reads the next token, expanding macros until one comes up that is not the name of a macro to expand
+static int expand_next(Preprocessor *pp, LexedToken *tok)
+{
+	for (;;)
+	{
+		int res = next_raw(pp, tok);
+		if (res <= 0 || (tok->flags & PP_FLAG_NO_EXPAND))
+			return res;
+
+		PPMacro *m = macro_of(pp, tok);
+		if (!m)
+		{
+			if (tok->kind != TOK_IDENTIFIER || tok->payload != pp->_ids[PP_ID_PRAGMA_OPERATOR])
+				return 1;
+			if (pragma_operator(pp, tok))
+				return -1;
+			continue;
+		}
+
+		// a name read during its own expansion stays as it is, even if it is rescanned later on
+		if (m->disabled)
+		{
+			tok->flags |= PP_FLAG_NO_EXPAND;
+			return 1;
+		}
+
+		if (m->builtin)
+			return expand_builtin(pp, m, tok) ? -1 : 1;
+
+		if (m->function_like)
+		{
+			res = expand_function_like(pp, m, tok);
+			if (res < 0)
+				return -1;
+			if (res == 0)
+				return 1;
+		}
+		else if (expand_object_like(pp, m, tok))
+		{
+			return -1;
+		}
+	}
+}
+
+static int do_define(Preprocessor *pp, PPFrame *f, const LexedToken *directive_name)
+{
+	PPTokenVec *line = read_line(pp, f);
+	if (!line)
+		return -1;
+
+	LexedToken *tokens = line->tokens;
+	if (!line->len || name_id(pp, &tokens[0]) == INTERN_NO_ID)
+		return pp_error(pp, line->len ? &tokens[0] : directive_name, "macro names must be identifiers");
+	if (tokens[0].kind == TOK_IDENTIFIER && tokens[0].payload == pp->_ids[PP_ID_DEFINED])
+		return pp_error(pp, &tokens[0], "\"defined\" cannot be used as a macro name");
+
+	PPMacro *m = arena_calloc(&pp->_arena, 1, sizeof(PPMacro));
+	if (!m)
+		return out_of_memory(pp);
+
+	uint32_t params[PP_MAX_MACRO_PARAMS + 1];
+	uint32_t i = 1;
+
+	// only a '(' right after the name makes the macro function-like
+	if (i < line->len && tokens[i].kind == TOK_OPEN_PAREN && !(tokens[i].flags & TOKEN_FLAG_SPACE))
+	{
+		m->function_like = 1;
+		i++;
+
+		if (i < line->len && tokens[i].kind == TOK_CLOSE_PAREN)
+		{
+			i++;
+		}
+		else
+		{
+			for (;;)
+			{
+				if (i == line->len)
+					return pp_error(pp, &tokens[i - 1], "missing ')' in macro parameter list");
+
+				uint32_t id = name_id(pp, &tokens[i]);
+				if (tokens[i].kind == TOK_ELLIPSIS)
+				{
+					m->variadic = 1;
+					id = pp->_ids[PP_ID_VA_ARGS];
+				}
+				else if (id == INTERN_NO_ID || id == pp->_ids[PP_ID_VA_ARGS])
+				{
+					return pp_error(pp, &tokens[i], "expected a parameter name");
+				}
+
+				for (uint32_t k = 0; k < m->num_params; k++)
+				{
+					if (params[k] == id)
+						return pp_error(pp, &tokens[i], "duplicate macro parameter \"%s\"", name_str(pp, &tokens[i]));
+				}
+
+				if (m->num_params == PP_MAX_MACRO_PARAMS)
+					return pp_error(pp, &tokens[i], "too many macro parameters");
+				params[m->num_params++] = id;
+				i++;
+
+				if (i < line->len && tokens[i].kind == TOK_CLOSE_PAREN)
+				{
+					i++;
+					break;
+				}
+
+				if (m->variadic || i == line->len || tokens[i].kind != TOK_COMMA)
+					return pp_error(pp, &tokens[i < line->len ? i : i - 1], "expected ',' or ')' in macro parameter list");
+				i++;
+			}
+		}
+	}
+
+	m->body_len = line->len - i;
+	m->body = arena_alloc(&pp->_arena, (m->body_len ? m->body_len : 1) * sizeof(LexedToken));
+	if (!m->body)
+		return out_of_memory(pp);
+
+	for (uint32_t k = 0; k < m->body_len; k++)
+	{
+		LexedToken tok = tokens[i + k];
+		tok.flags &= k ? ~TOKEN_FLAG_BOL : 0;
+
+		uint32_t id = name_id(pp, &tok);
+		if (id != INTERN_NO_ID)
+		{
+			for (uint32_t p = 0; p < m->num_params; p++)
+			{
+				if (params[p] == id)
+				{
+					tok.kind = TOK_IDENTIFIER;
+					tok.payload = p;
+					tok.flags |= PP_FLAG_PARAM;
+					break;
+				}
+			}
+
+			if (id == pp->_ids[PP_ID_VA_ARGS] && !(tok.flags & PP_FLAG_PARAM))
+				return pp_error(pp, &tok, "__VA_ARGS__ can only appear in the expansion of a variadic macro");
+		}
+
+		m->body[k] = tok;
+	}
+
+	for (uint32_t k = 0; k < m->body_len; k++)
+	{
+		if (m->body[k].kind == TOK_DOUBLE_HASH && (k == 0 || k + 1 == m->body_len))
+			return pp_error(pp, &m->body[k], "'##' cannot appear at either end of a macro expansion");
+
+		if (m->function_like && m->body[k].kind == TOK_HASH &&
+		    (k + 1 == m->body_len || !(m->body[k + 1].flags & PP_FLAG_PARAM)))
+			return pp_error(pp, &m->body[k], "'#' is not followed by a macro parameter");
+	}
+
+	if (set_macro(pp, &tokens[0], m))
+		return out_of_memory(pp);
+
+	put_vec(pp, line);
+	return 0;
+}
+
+static int do_undef(Preprocessor *pp, PPFrame *f, const LexedToken *directive_name)
+{
+	PPTokenVec *line = read_line(pp, f);
+	if (!line)
+		return -1;
+
+	if (!line->len || name_id(pp, &line->tokens[0]) == INTERN_NO_ID)
+		return pp_error(pp, line->len ? &line->tokens[0] : directive_name, "macro names must be identifiers");
+
+	if (find_macro(pp, name_id(pp, &line->tokens[0])) && set_macro(pp, &line->tokens[0], NULL))
+		return out_of_memory(pp);
+
+	put_vec(pp, line);
+	return 0;
+}
+
+static int do_include(Preprocessor *pp, PPFrame *f, const LexedToken *directive_name)
+{
+	PPTokenVec *line = read_line(pp, f);
+	if (!line)
+		return -1;
+
+	// any other form is macro expanded first and has to end up as one of the two
+	PPTokenVec *tokens = line;
+	if (line->len && line->tokens[0].kind != TOK_STRING_LITERAL && line->tokens[0].kind != TOK_LSS)
+	{
+		tokens = get_vec(pp);
+		if (!tokens)
+			return out_of_memory(pp);
+		if (expand_list(pp, line->tokens, line->len, tokens))
+			return -1;
+	}
+
+	uint32_t len = 0;
+	int system = 0;
+	if (tokens->len && tokens->tokens[0].kind == TOK_STRING_LITERAL)
+	{
+		// escape sequences are not a thing in header names, the chars are taken as they are
+		const TokenData *td = pp->td;
+		const StringLiteral *lit = &td->string_literals[tokens->tokens[0].payload];
+		for (uint32_t i = 0; i < lit->num_spans; i++)
+		{
+			const StringSpan *span = &td->string_spans[lit->first_span + i];
+			if (spell_append(pp, &len, span->ptr, span->len))
+				return -1;
+		}
+	}
+	else if (tokens->len && tokens->tokens[0].kind == TOK_LSS)
+	{
+		system = 1;
+		uint32_t i = 1;
+		for (; i < tokens->len && tokens->tokens[i].kind != TOK_GTR; i++)
+		{
+			if (i > 1 && (tokens->tokens[i].flags & TOKEN_FLAG_SPACE) && spell_append(pp, &len, " ", 1))
+				return -1;
+			if (spell_token(pp, &tokens->tokens[i], &len))
+				return -1;
+		}
+
+		if (i == tokens->len)
+			return pp_error(pp, &tokens->tokens[0], "missing terminating > character");
+	}
+	else
+	{
+		return pp_error(pp, directive_name, "#include expects \"FILENAME\" or <FILENAME>");
+	}
+
+	if (!len)
+		return pp_error(pp, directive_name, "empty file name in #include");
+	if (memchr(pp->_spell, 0, len))
+		return pp_error(pp, directive_name, "file names cannot contain null characters");
+
+	// the name stays in the spell buffer, which nothing below touches
+	const char *name = pp->_spell;
+	const PreprocessorOptions *options = pp->options;
+	int file_id = -1;
+
+	if (name[0] == '/')
+	{
+		file_id = find_in_dir(pp, "", 0, name, len);
+	}
+	else
+	{
+		if (!system)
+			file_id = find_in_dir(pp, f->file->name, f->file->dir_len, name, len);
+
+		for (int i = 0; file_id == -1 && options && i < options->num_include_dirs; i++)
+		{
+			const char *dir = options->include_dirs[i];
+			file_id = find_in_dir(pp, dir, strlen(dir), name, len);
+		}
+	}
+
+	if (file_id == -2)
+		return -1;
+	if (file_id == -1)
+		return pp_error(pp, directive_name, "%.*s: no such file in the include paths", (int)len, name);
+
+	if (tokens != line)
+		put_vec(pp, tokens);
+	put_vec(pp, line);
+
+	// the multiple include optimization, the file does not have to be looked at again at all
+	PPFile *file = pp->_files[file_id];
+	if (file->once || (file->guard != INTERN_NO_ID && find_macro(pp, file->guard)))
+	{
+		pp->num_skipped_includes++;
+		return 0;
+	}
+
+	return enter_file(pp, file_id, directive_name);
+}
+
+// Replaces every defined X and defined(X) of line by 0 or 1 into out, before macro expansion could change X
+static int resolve_defined(Preprocessor *pp, const PPTokenVec *line, PPTokenVec *out)
+{
+	for (uint32_t i = 0; i < line->len; i++)
+	{
+		LexedToken tok = line->tokens[i];
+		if (tok.kind != TOK_IDENTIFIER || tok.payload != pp->_ids[PP_ID_DEFINED])
+		{
+			if (vec_push(out, &tok))
+				return out_of_memory(pp);
+			continue;
+		}
+
+		int paren = i + 1 < line->len && line->tokens[i + 1].kind == TOK_OPEN_PAREN;
+		uint32_t name = i + 1 + paren;
+		if (name >= line->len || name_id(pp, &line->tokens[name]) == INTERN_NO_ID)
+			return pp_error(pp, &tok, "operator \"defined\" requires an identifier");
+		if (paren && (name + 1 >= line->len || line->tokens[name + 1].kind != TOK_CLOSE_PAREN))
+			return pp_error(pp, &tok, "missing ')' after \"defined\"");
+
+		int defined = find_macro(pp, name_id(pp, &line->tokens[name])) != NULL;
+		tok.kind = TOK_NUMERICAL_CONSTANT;
+		tok.payload = defined ? pp->_one : pp->_zero;
+		tok.flags |= PP_FLAG_MADE;
+		if (vec_push(out, &tok))
+			return out_of_memory(pp);
+
+		i = name + paren;
+	}
+
+	return 0;
+}
+
+static int eval_conditional(PPExpr *e, PPValue *v, int evaluated);
+
+static int eval_unary(PPExpr *e, PPValue *v, int evaluated)
+{
+	if (e->pos == e->len)
+		return pp_error(e->pp, e->len ? &e->tokens[e->len - 1] : e->at, "expected a value in the expression");
+
+	const LexedToken *tok = &e->tokens[e->pos++];
+	switch (tok->kind)
+	{
+	case TOK_PLUS:
+		return eval_unary(e, v, evaluated);
+
+	case TOK_MINUS:
+		if (eval_unary(e, v, evaluated))
+			return -1;
+		v->value = -v->value;
+		return 0;
+
+	case TOK_TILDE:
+		if (eval_unary(e, v, evaluated))
+			return -1;
+		v->value = ~v->value;
+		return 0;
+
+	case TOK_BANG:
+		if (eval_unary(e, v, evaluated))
+			return -1;
+		*v = (PPValue){!v->value, 0};
+		return 0;
+
+	case TOK_OPEN_PAREN:
+		if (eval_conditional(e, v, evaluated))
+			return -1;
+		if (e->pos == e->len || e->tokens[e->pos].kind != TOK_CLOSE_PAREN)
+			return pp_error(e->pp, tok, "missing ')' in expression");
+		e->pos++;
+		return 0;
+
+	case TOK_NUMERICAL_CONSTANT: {
+		const NumConstant *nc = &e->pp->td->num_constants->constants[tok->payload];
+		if (nc->floating)
+			return pp_error(e->pp, tok, "floating constant in preprocessor expression");
+
+		int is_unsigned = nc->int_type == INT_TYPE_UNSIGNED_LLONG || nc->int_type == INT_TYPE_UNSIGNED_LONG ||
+		                  nc->int_type == INT_TYPE_UNSIGNED_INT;
+		*v = (PPValue){nc->int_value, is_unsigned};
+		return 0;
+	}
+
+	case TOK_CHAR_LITERAL:
+		// plain char is signed
+		*v = (PPValue){(uint64_t)(int64_t)(signed char)tok->payload, 0};
+		return 0;
+
+	default:
+		// identifiers that are left after macro expansion are 0, keywords included
+		if (name_id(e->pp, tok) != INTERN_NO_ID)
+		{
+			*v = (PPValue){0, 0};
+			return 0;
+		}
+
+		return pp_error(e->pp, tok, "token is not valid in preprocessor expressions");
+	}
+}
+
+static int binary_precedence(int kind)
+{
+	switch (kind)
+	{
+	case TOK_STAR:
+	case TOK_FORWARD_SLASH:
+	case TOK_PERCENT:
+		return 10;
+	case TOK_PLUS:
+	case TOK_MINUS:
+		return 9;
+	case TOK_BIT_SHIFT_LEFT:
+	case TOK_BIT_SHIFT_RIGHT:
+		return 8;
+	case TOK_LSS:
+	case TOK_GTR:
+	case TOK_LSS_EQL:
+	case TOK_GTR_EQL:
+		return 7;
+	case TOK_EQUALITY:
+	case TOK_EQUALITY_NOT:
+		return 6;
+	case TOK_AMPERSAND:
+		return 5;
+	case TOK_CARET:
+		return 4;
+	case TOK_PIPE:
+		return 3;
+	case TOK_AND:
+		return 2;
+	case TOK_OR:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Shifts left by count, or right by -count, in the type of value (C11 6.5.7, with what is undefined made defined)
+static uint64_t shift(PPValue value, int64_t count)
+{
+	if (count >= 64 || count <= -64)
+		return count < 0 && !value.is_unsigned && (int64_t)value.value < 0 ? UINT64_MAX : 0;
+	if (count >= 0)
+		return value.value << count;
+	if (value.is_unsigned)
+		return value.value >> -count;
+	return (uint64_t)((int64_t)value.value >> -count);
+}
+
+// Applies op to lhs and rhs in the type both are converted to, into lhs
+static int apply_binary(PPExpr *e, const LexedToken *op, PPValue *lhs, PPValue rhs, int evaluated)
+{
+	int is_unsigned = lhs->is_unsigned || rhs.is_unsigned;
+	uint64_t a = lhs->value;
+	uint64_t b = rhs.value;
+	int64_t sa = (int64_t)a;
+	int64_t sb = (int64_t)b;
+
+	switch (op->kind)
+	{
+	case TOK_STAR:
+		*lhs = (PPValue){a * b, is_unsigned};
+		return 0;
+
+	case TOK_FORWARD_SLASH:
+	case TOK_PERCENT: {
+		if (!b)
+		{
+			if (evaluated)
+				return pp_error(e->pp, op, "division by zero in preprocessor expression");
+			*lhs = (PPValue){0, is_unsigned};
+			return 0;
+		}
+
+		int div = op->kind == TOK_FORWARD_SLASH;
+		uint64_t res;
+		if (is_unsigned)
+			res = div ? a / b : a % b;
+		else if (sa == INT64_MIN && sb == -1)
+			res = div ? a : 0;
+		else
+			res = div ? (uint64_t)(sa / sb) : (uint64_t)(sa % sb);
+		*lhs = (PPValue){res, is_unsigned};
+		return 0;
+	}
+
+	case TOK_PLUS:
+		*lhs = (PPValue){a + b, is_unsigned};
+		return 0;
+
+	case TOK_MINUS:
+		*lhs = (PPValue){a - b, is_unsigned};
+		return 0;
+
+	case TOK_BIT_SHIFT_LEFT:
+	case TOK_BIT_SHIFT_RIGHT: {
+		// the result has the type of the left operand, a negative count shifts the other way
+		int64_t count = rhs.is_unsigned && b > INT64_MAX ? INT64_MAX : sb;
+		lhs->value = shift(*lhs, op->kind == TOK_BIT_SHIFT_LEFT ? count : -count);
+		return 0;
+	}
+
+	case TOK_LSS:
+		*lhs = (PPValue){is_unsigned ? a < b : sa < sb, 0};
+		return 0;
+	case TOK_GTR:
+		*lhs = (PPValue){is_unsigned ? a > b : sa > sb, 0};
+		return 0;
+	case TOK_LSS_EQL:
+		*lhs = (PPValue){is_unsigned ? a <= b : sa <= sb, 0};
+		return 0;
+	case TOK_GTR_EQL:
+		*lhs = (PPValue){is_unsigned ? a >= b : sa >= sb, 0};
+		return 0;
+	case TOK_EQUALITY:
+		*lhs = (PPValue){a == b, 0};
+		return 0;
+	case TOK_EQUALITY_NOT:
+		*lhs = (PPValue){a != b, 0};
+		return 0;
+	case TOK_AMPERSAND:
+		*lhs = (PPValue){a & b, is_unsigned};
+		return 0;
+	case TOK_CARET:
+		*lhs = (PPValue){a ^ b, is_unsigned};
+		return 0;
+	case TOK_PIPE:
+		*lhs = (PPValue){a | b, is_unsigned};
+		return 0;
+	case TOK_AND:
+		*lhs = (PPValue){a && b, 0};
+		return 0;
+	default:
+		*lhs = (PPValue){a || b, 0};
+		return 0;
+	}
+}
+
+// Precedence climbing over the binary operators binding at least as tight as min_precedence
+static int eval_binary(PPExpr *e, int min_precedence, PPValue *lhs, int evaluated)
+{
+	if (eval_unary(e, lhs, evaluated))
+		return -1;
+
+	while (e->pos < e->len)
+	{
+		const LexedToken *op = &e->tokens[e->pos];
+		int precedence = binary_precedence(op->kind);
+		if (!precedence || precedence < min_precedence)
+			return 0;
+		e->pos++;
+
+		// the right side of && and || is not evaluated once the left side decides, 1 || 1 / 0 is fine
+		int rhs_evaluated = evaluated;
+		if (op->kind == TOK_AND)
+			rhs_evaluated = evaluated && lhs->value;
+		else if (op->kind == TOK_OR)
+			rhs_evaluated = evaluated && !lhs->value;
+
+		PPValue rhs;
+		if (eval_binary(e, precedence + 1, &rhs, rhs_evaluated) || apply_binary(e, op, lhs, rhs, evaluated))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int eval_conditional(PPExpr *e, PPValue *v, int evaluated)
+{
+	if (eval_binary(e, 1, v, evaluated))
+		return -1;
+
+	if (e->pos == e->len || e->tokens[e->pos].kind != TOK_QUESTION)
+		return 0;
+	const LexedToken *question = &e->tokens[e->pos++];
+
+	int cond = v->value != 0;
+	PPValue a, b;
+	if (eval_conditional(e, &a, evaluated && cond))
+		return -1;
+	if (e->pos == e->len || e->tokens[e->pos].kind != TOK_COLON)
+		return pp_error(e->pp, question, "expected ':' in expression");
+	e->pos++;
+	if (eval_conditional(e, &b, evaluated && !cond))
+		return -1;
+
+	*v = (PPValue){cond ? a.value : b.value, a.is_unsigned || b.is_unsigned};
+	return 0;
+}
+
+// Evaluates the controlling expression of an #if or #elif (C11 6.10.1)
+static int eval_line(Preprocessor *pp, const PPTokenVec *line, const LexedToken *directive_name, int *result)
+{
+	PPTokenVec *resolved = get_vec(pp);
+	PPTokenVec *expanded = get_vec(pp);
+	if (!resolved || !expanded)
+		return out_of_memory(pp);
+
+	if (resolve_defined(pp, line, resolved) || expand_list(pp, resolved->tokens, resolved->len, expanded))
+		return -1;
+
+	if (!expanded->len)
+		return pp_error(pp, directive_name, "#%s with no expression", name_str(pp, directive_name));
+
+	PPExpr e = {pp, expanded->tokens, 0, expanded->len, directive_name};
+	PPValue v;
+	if (eval_conditional(&e, &v, 1))
+		return -1;
+	if (e.pos != e.len)
+		return pp_error(pp, &e.tokens[e.pos], "missing binary operator before token");
+
+	*result = v.value != 0;
+	put_vec(pp, resolved);
+	put_vec(pp, expanded);
+	return 0;
+}
+
+// Returns X for a line that is exactly !defined X or !defined(X), the other way to write an include guard
+static uint32_t guard_of_if(const Preprocessor *pp, const PPTokenVec *line)
+{
+	const LexedToken *t = line->tokens;
+	if (line->len < 3 || t[0].kind != TOK_BANG || t[1].kind != TOK_IDENTIFIER ||
+	    t[1].payload != pp->_ids[PP_ID_DEFINED])
+		return INTERN_NO_ID;
+
+	if (line->len == 3)
+		return name_id(pp, &t[2]);
+	if (line->len == 5 && t[2].kind == TOK_OPEN_PAREN && t[4].kind == TOK_CLOSE_PAREN)
+		return name_id(pp, &t[3]);
+	return INTERN_NO_ID;
+}
+
+static int do_if(Preprocessor *pp, PPFrame *f, const LexedToken *directive_name, int guard_candidate)
+{
+	PPTokenVec *line = read_line(pp, f);
+	if (!line)
+		return -1;
+
+	int value;
+	if (eval_line(pp, line, directive_name, &value) || push_cond(pp, value ? PP_COND_ACTIVE : PP_COND_SEEKING, directive_name))
+		return -1;
+
+	uint32_t guard = guard_candidate ? guard_of_if(pp, line) : INTERN_NO_ID;
+	if (guard != INTERN_NO_ID)
+	{
+		f->guard_state = PP_GUARD_IN;
+		f->guard = guard;
+	}
+
+	put_vec(pp, line);
+	return 0;
+}
+
+static int do_ifdef(Preprocessor *pp, PPFrame *f, const LexedToken *directive_name, int negate, int guard_candidate)
+{
+	PPTokenVec *line = read_line(pp, f);
+	if (!line)
+		return -1;
+
+	if (!line->len)
+		return pp_error(pp, directive_name, "no macro name given in #%s directive", name_str(pp, directive_name));
+
+	uint32_t id = name_id(pp, &line->tokens[0]);
+	if (id == INTERN_NO_ID)
+		return pp_error(pp, &line->tokens[0], "macro names must be identifiers");
+
+	int taken = (find_macro(pp, id) != NULL) != negate;
+	if (push_cond(pp, taken ? PP_COND_ACTIVE : PP_COND_SEEKING, directive_name))
+		return -1;
+
+	if (negate && guard_candidate)
+	{
+		f->guard_state = PP_GUARD_IN;
+		f->guard = id;
+	}
+
+	put_vec(pp, line);
+	return 0;
+}
+
+// #elif, #else and #endif end a group of the innermost #if of the frame, which they have to be in
+static PPCond *current_cond(Preprocessor *pp, PPFrame *f, const LexedToken *directive_name)
+{
+	if (pp->_num_conds == f->cond_base)
+	{
+		pp_error(pp, directive_name, "#%s without #if", name_str(pp, directive_name));
+		return NULL;
+	}
+
+	return &pp->_conds[pp->_num_conds - 1];
+}
+
+static int do_elif(Preprocessor *pp, PPFrame *f, const LexedToken *directive_name)
+{
+	PPCond *cond = current_cond(pp, f, directive_name);
+	if (!cond)
+		return -1;
+	if (cond->seen_else)
+		return pp_error(pp, directive_name, "#elif after #else");
+
+	// another group at the top level of the file means the #ifndef is not all of it
+	if (f->guard_state == PP_GUARD_IN && pp->_num_conds == f->cond_base + 1)
+		f->guard_state = PP_GUARD_NONE;
+
+	if (cond->state != PP_COND_SEEKING)
+	{
+		if (cond->state == PP_COND_ACTIVE)
+			cond->state = PP_COND_DONE;
+		return skip_line(pp, f);
+	}
+
+	PPTokenVec *line = read_line(pp, f);
+	if (!line)
+		return -1;
+
+	int value;
+	if (eval_line(pp, line, directive_name, &value))
+		return -1;
+
+	// eval_line may have moved the conditions
+	if (value)
+		pp->_conds[pp->_num_conds - 1].state = PP_COND_ACTIVE;
+
+	put_vec(pp, line);
+	return 0;
+}
+
+static int do_else(Preprocessor *pp, PPFrame *f, const LexedToken *directive_name)
+{
+	PPCond *cond = current_cond(pp, f, directive_name);
+	if (!cond)
+		return -1;
+	if (cond->seen_else)
+		return pp_error(pp, directive_name, "#else after #else");
+	cond->seen_else = 1;
+
+	if (f->guard_state == PP_GUARD_IN && pp->_num_conds == f->cond_base + 1)
+		f->guard_state = PP_GUARD_NONE;
+
+	if (cond->state == PP_COND_ACTIVE)
+		cond->state = PP_COND_DONE;
+	else if (cond->state == PP_COND_SEEKING)
+		cond->state = PP_COND_ACTIVE;
+
+	return skip_line(pp, f);
+}
+
+static int do_endif(Preprocessor *pp, PPFrame *f, const LexedToken *directive_name)
+{
+	if (!current_cond(pp, f, directive_name))
+		return -1;
+
+	// the guard only counts if nothing but white space follows this
+	if (f->guard_state == PP_GUARD_IN && pp->_num_conds == f->cond_base + 1)
+		f->guard_state = PP_GUARD_AFTER;
+
+	pp->_num_conds--;
+	return skip_line(pp, f);
+}
+
+static int do_line(Preprocessor *pp, PPFrame *f, const LexedToken *directive_name)
+{
+	PPTokenVec *line = read_line(pp, f);
+	PPTokenVec *tokens = get_vec(pp);
+	if (!line)
+		return -1;
+	if (!tokens)
+		return out_of_memory(pp);
+	if (expand_list(pp, line->tokens, line->len, tokens))
+		return -1;
+
+	const LexedToken *t = tokens->tokens;
+	const NumConstant *nc = tokens->len && t[0].kind == TOK_NUMERICAL_CONSTANT
+	                            ? &pp->td->num_constants->constants[t[0].payload]
+	                            : NULL;
+	if (!nc || nc->floating || nc->int_value < 1 || nc->int_value > INT32_MAX)
+		return pp_error(pp, directive_name, "#line expects a line number between 1 and 2147483647");
+
+	if (tokens->len > 1)
+	{
+		if (t[1].kind != TOK_STRING_LITERAL || tokens->len > 2)
+			return pp_error(pp, &t[1], "invalid file name in #line directive");
+
+		char *name = arena_alloc(&pp->_arena, string_literal_max_len(pp->td, t[1].payload) + 1);
+		if (!name)
+			return out_of_memory(pp);
+		name[decode_string_literal(pp->td, t[1].payload, name)] = 0;
+		f->presumed_name = name;
+	}
+
+	// the line after the directive is the one that gets the number
+	int line_num, col;
+	line_location(f->file->lines, directive_name->offset, &line_num, &col);
+	f->line_delta = (int)nc->int_value - (line_num + 1);
+
+	put_vec(pp, line);
+	put_vec(pp, tokens);
+	return 0;
+}
+
+static int do_error(Preprocessor *pp, PPFrame *f, const LexedToken *directive_name)
+{
+	PPTokenVec *line = read_line(pp, f);
+	if (!line)
+		return -1;
+
+	uint32_t len = 0;
+	for (uint32_t i = 0; i < line->len; i++)
+	{
+		if (i && (line->tokens[i].flags & TOKEN_FLAG_SPACE) && spell_append(pp, &len, " ", 1))
+			return -1;
+		if (spell_token(pp, &line->tokens[i], &len))
+			return -1;
+	}
+
+	return pp_error(pp, directive_name, "#error %.*s", (int)len, pp->_spell);
+}
+
+static int do_pragma(Preprocessor *pp, PPFrame *f)
+{
+	PPTokenVec *line = read_line(pp, f);
+	if (!line)
+		return -1;
+
+	// everything else is implementation defined, and left alone here
+	if (line->len && line->tokens[0].kind == TOK_IDENTIFIER && line->tokens[0].payload == pp->_ids[PP_ID_ONCE])
+		f->file->once = 1;
+
+	put_vec(pp, line);
+	return 0;
+}
+
+static PPDirective directive_kind(const Preprocessor *pp, const LexedToken *name)
+{
+	if (name->kind == TOK_IF)
+		return PP_DIR_IF;
+	if (name->kind == TOK_ELSE)
+		return PP_DIR_ELSE;
+	if (name->kind != TOK_IDENTIFIER)
+		return PP_DIR_UNKNOWN;
+
+	for (int i = PP_ID_DEFINE; i <= PP_ID_PRAGMA; i++)
+	{
+		if (pp->_ids[i] == name->payload)
+			return (PPDirective)i;
+	}
+	return PP_DIR_UNKNOWN;
+}
+
+// Carries out the directive whose '#' was just read from f (C11 6.10)
+static int directive(Preprocessor *pp, PPFrame *f)
+{
+	LexedToken name;
+	int res = lex_frame(pp, f, &name);
+	if (res <= 0)
+		return res;
+
+	// a '#' on its own is the null directive
+	if (name.flags & TOKEN_FLAG_BOL)
+	{
+		set_pending(f, &name);
+		return 0;
+	}
+
+	PPDirective kind = directive_kind(pp, &name);
+
+	// skipped groups are only looked at for where they end, the nested #if groups in them included
+	if (skipping(pp))
+	{
+		switch (kind)
+		{
+		case PP_DIR_IF:
+		case PP_DIR_IFDEF:
+		case PP_DIR_IFNDEF:
+			return push_cond(pp, PP_COND_SKIPPED, &name) ? -1 : skip_line(pp, f);
+		case PP_DIR_ELIF:
+			return do_elif(pp, f, &name);
+		case PP_DIR_ELSE:
+			return do_else(pp, f, &name);
+		case PP_DIR_ENDIF:
+			return do_endif(pp, f, &name);
+		default:
+			return skip_line(pp, f);
+		}
+	}
+
+	// only an #ifndef or #if !defined that comes before anything else in the file can be its guard
+	int guard_candidate = 0;
+	if (pp->_num_conds == f->cond_base)
+	{
+		guard_candidate = f->guard_state == PP_GUARD_START;
+		f->guard_state = PP_GUARD_NONE;
+	}
+
+	switch (kind)
+	{
+	case PP_DIR_DEFINE:
+		return do_define(pp, f, &name);
+	case PP_DIR_UNDEF:
+		return do_undef(pp, f, &name);
+	case PP_DIR_INCLUDE:
+		return do_include(pp, f, &name);
+	case PP_DIR_IF:
+		return do_if(pp, f, &name, guard_candidate);
+	case PP_DIR_IFDEF:
+		return do_ifdef(pp, f, &name, 0, 0);
+	case PP_DIR_IFNDEF:
+		return do_ifdef(pp, f, &name, 1, guard_candidate);
+	case PP_DIR_ELIF:
+		return do_elif(pp, f, &name);
+	case PP_DIR_ELSE:
+		return do_else(pp, f, &name);
+	case PP_DIR_ENDIF:
+		return do_endif(pp, f, &name);
+	case PP_DIR_LINE:
+		return do_line(pp, f, &name);
+	case PP_DIR_ERROR:
+		return do_error(pp, f, &name);
+	case PP_DIR_PRAGMA:
+		return do_pragma(pp, f);
+	default: {
+		uint32_t len = 0;
+		if (spell_token(pp, &name, &len))
+			return -1;
+		return pp_error(pp, &name, "invalid preprocessing directive #%.*s", (int)len, pp->_spell);
+	}
+	}
+}
+
+// pp_next apart from the timing
+static int next_token(Preprocessor *pp, LexedToken *tok)
+{
+	if (pp->has_error)
+		return -1;
+
+	int res;
+	if (pp->_has_peeked)
+	{
+		*tok = pp->_peeked;
+		pp->_has_peeked = 0;
+	}
+	else if ((res = expand_next(pp, tok)) <= 0)
+	{
+		return res;
+	}
+
+	if (tok->kind == TOK_INVALID)
+		return pp_error(pp, tok, "%s", pp->td->invalid_tokens[tok->payload].error);
+
+	pp->num_tokens++;
+	pp->tokens_by_kind[tok->kind]++;
+	if (tok->kind != TOK_STRING_LITERAL)
+		return 1;
+
+	// adjacent string literals are a single literal (translation phase 6), which takes one token of lookahead
+	LexedToken next;
+	while ((res = expand_next(pp, &next)) > 0 && next.kind == TOK_STRING_LITERAL)
+	{
+		tok->payload = join_string_literals(pp->td, tok->payload, next.payload);
+		if (tok->payload == UINT32_MAX)
+			return out_of_memory(pp);
+	}
+
+	if (res < 0)
+		return -1;
+
+	if (res > 0)
+	{
+		pp->_peeked = next;
+		pp->_has_peeked = 1;
+	}
+
+	return 1;
+}
+
+int pp_next(Preprocessor *pp, LexedToken *tok)
+{
+	if (!pp->timed)
+		return next_token(pp, tok);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int res = next_token(pp, tok);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pp->seconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	return res;
+}
+
+static int define_builtin(Preprocessor *pp, PPIdent id, PPBuiltin builtin)
+{
+	PPMacro *m = arena_calloc(&pp->_arena, 1, sizeof(PPMacro));
+	if (!m)
+		return 1;
+	m->builtin = builtin;
+
+	LexedToken name = {0, pp->_ids[id], TOK_IDENTIFIER, 0, 0};
+	if (set_macro(pp, &name, m))
+		return 1;
+
+	// they are not counted as defined by the translation unit
+	pp->num_macros--;
+	return 0;
+}
+
+// The predefined macros and the -D and -U options, as a source of #define and #undef lines that is preprocessed before
+// the main one. Returns !0 after an error was reported.
+static int push_predefined(Preprocessor *pp)
+{
+	char date[32] = "\"??? ?? ????\"";
+	char time_str[32] = "\"??:??:??\"";
+	time_t now = time(NULL);
+	struct tm tm;
+	if (now != (time_t)-1 && localtime_r(&now, &tm))
+	{
+		strftime(date, sizeof(date), "\"%b %e %Y\"", &tm);
+		strftime(time_str, sizeof(time_str), "\"%H:%M:%S\"", &tm);
+	}
+
+	char buf[256];
+	int n = snprintf(buf, sizeof(buf),
+	                 "#define __STDC__ 1\n#define __STDC_VERSION__ 201112L\n#define __STDC_HOSTED__ 1\n"
+	                 "#define __DATE__ %s\n#define __TIME__ %s\n",
+	                 date, time_str);
+
+	uint32_t len = 0;
+	if (spell_append(pp, &len, buf, n))
+		return 1;
+
+	const PreprocessorOptions *options = pp->options;
+	for (int i = 0; options && i < options->num_macro_args; i++)
+	{
+		const char *arg = options->macro_args[i];
+		const char *value = strchr(arg, '=');
+		uint32_t name_len = value ? (uint32_t)(value - arg - 1) : (uint32_t)strlen(arg + 1);
+
+		if (arg[0] == 'U')
+		{
+			if (spell_append(pp, &len, "#undef ", 7) || spell_append(pp, &len, arg + 1, name_len) ||
+			    spell_append(pp, &len, "\n", 1))
+				return 1;
+			continue;
+		}
+
+		// -DNAME defines NAME as 1
+		if (spell_append(pp, &len, "#define ", 8) || spell_append(pp, &len, arg + 1, name_len) ||
+		    spell_append(pp, &len, " ", 1) || spell_append(pp, &len, value ? value + 1 : "1", value ? strlen(value + 1) : 1) ||
+		    spell_append(pp, &len, "\n", 1))
+			return 1;
+	}
+
+	// tokens from it are spelled from the source, so it is kept for as long as the preprocessor
+	char *source = arena_alloc(&pp->_arena, len);
+	if (!source)
+		return out_of_memory(pp);
+	memcpy(source, pp->_spell, len);
+
+	int file_id = add_file(pp, "<command line>", 14, NULL);
+	if (file_id < 0)
+		return 1;
+
+	pp->_files[file_id]->source = source;
+	pp->_files[file_id]->size = len;
+	return enter_file(pp, file_id, NULL) != 0;
+}
+
+// Precompiled headers. Identifier ids, constant and literal indices and file ids are all handed out in order from the
+// start of a translation unit, so a translation unit that adds the ones of the file before anything else gets the very
+// same ones. Macro bodies are then used right out of the mapping. What the header expanded to is not kept, the parser
+// starts out with the typedef names it declared instead of going through its tokens again.
+
+#define PP_PCH_MAGIC "CCPCH\0\0"
+
+// Bumped whenever the file layout or the meaning of what is in it changes, files of other versions are rejected
+#define PP_PCH_VERSION 2
+
+// A source the precompiled header was made from, by its id in the translation unit
+typedef struct PPPchFile
+{
+	// content hash and size of a file, checked against the file as it is now before anything is used
+	uint64_t hash;
+	uint64_t size;
+
+	// index of its first line start in the lines section
+	uint64_t lines;
+	uint32_t num_lines;
+
+	uint32_t guard;
+	TokenCacheString name;
+
+	// the whole text of a source that is not a file, the predefined macros
+	TokenCacheString source;
+	uint32_t is_file;
+	uint32_t once;
+} PPPchFile;
+
+typedef struct PPPchMacro
+{
+	uint32_t name;
+
+	// index of the body in the tokens section
+	uint32_t body;
+	uint32_t body_len;
+	uint32_t num_params;
+
+	// kind of the token the macro is named by, keywords can be macro names too
+	uint8_t name_kind;
+	uint8_t function_like;
+	uint8_t variadic;
+	uint8_t _pad;
+} PPPchMacro;
+
+// Start of a precompiled header, sections are found by their offset from the start of the file
+typedef struct PPPchHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t num_token_kinds;
+	uint32_t token_size;
+
+	uint32_t num_identifiers;
+	uint32_t num_constants;
+	uint32_t num_literals;
+	uint32_t num_spans;
+	uint32_t num_invalid;
+	uint32_t num_files;
+	uint32_t num_macros;
+	uint32_t num_lines;
+	uint32_t num_tokens;
+	uint32_t num_typedef_names;
+
+	// path of the prefix header, null terminated
+	TokenCacheString header;
+
+	// of the -I, -D and -U options the header was preprocessed with
+	uint64_t options_hash;
+
+	uint64_t identifiers;
+	uint64_t constants;
+	uint64_t literals;
+	uint64_t spans;
+	uint64_t invalid_tokens;
+	uint64_t files;
+	uint64_t macros;
+	uint64_t tokens;
+	uint64_t lines;
+	uint64_t typedef_names;
+	uint64_t strings;
+	uint64_t strings_size;
+	uint64_t file_size;
+
+	// token_cache_hash of everything after the header
+	uint64_t checksum;
+} PPPchHeader;
+
+// Hash of the options that change what a header preprocesses to
+static int options_hash(Preprocessor *pp, uint64_t *hash)
+{
+	const PreprocessorOptions *options = pp->options;
+	uint32_t len = 0;
+	for (int i = 0; options && i < options->num_include_dirs; i++)
+	{
+		const char *dir = options->include_dirs[i];
+		if (spell_append(pp, &len, "I", 1) || spell_append(pp, &len, dir, strlen(dir) + 1))
+			return 1;
+	}
+
+	// D and U are already part of the arguments
+	for (int i = 0; options && i < options->num_macro_args; i++)
+	{
+		const char *arg = options->macro_args[i];
+		if (spell_append(pp, &len, arg, strlen(arg) + 1))
+			return 1;
+	}
+
+	*hash = len ? token_cache_hash(pp->_spell, len) : 0;
+	return 0;
+}
+
+// Checks that a string of the file is inside the strings section, and that it is null terminated when it has to be
+static int pch_string_fits(const PPPchHeader *h, const TokenCacheString *s, int terminated)
+{
+	const char *strings = (const char *)h + h->strings;
+	return s->offset <= h->strings_size && s->len + terminated <= h->strings_size - s->offset &&
+	       (!terminated || strings[s->offset + s->len] == 0);
+}
+
+// Checks the current sources against the ones the precompiled header was made from, opening each file in cbs. Returns
+// !0 when any of them changed.
+static int pch_inputs_changed(const PPPchHeader *h, CharBuffer **cbs)
+{
+	const PPPchFile *files = (const PPPchFile *)((const char *)h + h->files);
+	const char *strings = (const char *)h + h->strings;
+
+	// file 0 is the main source the header was included from, it is not part of the header
+	for (uint32_t i = 1; i < h->num_files; i++)
+	{
+		const PPPchFile *pf = &files[i];
+		if (!pf->is_file)
+			continue;
+
+		cbs[i] = open_char_buffer(strings + pf->name.offset, 0);
+		const char *source = cbs[i] ? cb_resident_source(cbs[i]) : NULL;
+		if (!source || cbs[i]->_size != pf->size || token_cache_hash(source, pf->size) != pf->hash)
+			return 1;
+	}
+	return 0;
+}
+
+// Checks what indices and ids of the file point at, so that nothing read from it can be out of bounds
+static int pch_consistent(const PPPchHeader *h)
+{
+	const char *base = (const char *)h;
+	const TokenCacheString *identifiers = (const TokenCacheString *)(base + h->identifiers);
+	const StringLiteral *literals = (const StringLiteral *)(base + h->literals);
+	const TokenCacheString *spans = (const TokenCacheString *)(base + h->spans);
+	const TokenCacheString *invalid = (const TokenCacheString *)(base + h->invalid_tokens);
+	const PPPchFile *files = (const PPPchFile *)(base + h->files);
+	const PPPchMacro *macros = (const PPPchMacro *)(base + h->macros);
+	const LexedToken *tokens = (const LexedToken *)(base + h->tokens);
+	const uint32_t *typedef_names = (const uint32_t *)(base + h->typedef_names);
+
+	for (uint32_t i = 0; i < h->num_identifiers; i++)
+	{
+		if (!pch_string_fits(h, &identifiers[i], 0))
+			return 0;
+	}
+
+	for (uint32_t i = 0; i < h->num_literals; i++)
+	{
+		if (literals[i].first_span > h->num_spans || literals[i].num_spans > h->num_spans - literals[i].first_span)
+			return 0;
+	}
+
+	for (uint32_t i = 0; i < h->num_spans; i++)
+	{
+		if (!pch_string_fits(h, &spans[i], 0))
+			return 0;
+	}
+
+	for (uint32_t i = 0; i < h->num_invalid; i++)
+	{
+		if (!pch_string_fits(h, &invalid[i], 1))
+			return 0;
+	}
+
+	for (uint32_t i = 1; i < h->num_files; i++)
+	{
+		const PPPchFile *pf = &files[i];
+		if (!pch_string_fits(h, &pf->name, 1) || !pch_string_fits(h, &pf->source, 0) || pf->lines > h->num_lines ||
+		    pf->num_lines > h->num_lines - pf->lines || (pf->guard != INTERN_NO_ID && pf->guard >= h->num_identifiers))
+			return 0;
+	}
+
+	for (uint32_t i = 0; i < h->num_macros; i++)
+	{
+		const PPPchMacro *pm = &macros[i];
+		if (pm->name >= h->num_identifiers || pm->body > h->num_tokens || pm->body_len > h->num_tokens - pm->body ||
+		    pm->num_params > PP_MAX_MACRO_PARAMS + 1 ||
+		    (pm->name_kind != TOK_IDENTIFIER && pm->name_kind > TOK_LAST_KEYWORD))
+			return 0;
+	}
+
+	for (uint32_t i = 0; i < h->num_tokens; i++)
+	{
+		const LexedToken *tok = &tokens[i];
+		uint32_t limit = tok->kind == TOK_IDENTIFIER           ? h->num_identifiers
+		                 : tok->kind == TOK_STRING_LITERAL     ? h->num_literals
+		                 : tok->kind == TOK_NUMERICAL_CONSTANT ? h->num_constants
+		                 : tok->kind == TOK_INVALID            ? h->num_invalid
+		                                                       : UINT32_MAX;
+		// the payload of a parameter in a macro body is the parameter index
+		if (tok->kind >= TOK_COUNT || tok->file >= h->num_files ||
+		    (limit != UINT32_MAX && tok->payload >= limit && !(tok->flags & PP_FLAG_PARAM)))
+			return 0;
+	}
+
+	for (uint32_t i = 0; i < h->num_typedef_names; i++)
+	{
+		if (typedef_names[i] >= h->num_identifiers)
+			return 0;
+	}
+
+	return 1;
+}
+
+// Maps options->include_pch into *header and checks its layout. Returns !0 after an error was reported.
+static int map_pch(Preprocessor *pp, const PPPchHeader **header)
+{
+	const char *path = pp->options->include_pch;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return pp_error(pp, NULL, "failed to open the precompiled header %s", path);
+
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(PPPchHeader))
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return pp_error(pp, NULL, "%s is not a precompiled header", path);
+
+	pp->_pch_map = map;
+	pp->_pch_size = st.st_size;
+
+	const PPPchHeader *h = map;
+	uint64_t file_size = st.st_size;
+	if (memcmp(h->magic, PP_PCH_MAGIC, 8) != 0)
+		return pp_error(pp, NULL, "%s is not a precompiled header", path);
+
+	if (h->version != PP_PCH_VERSION || h->num_token_kinds != TOK_COUNT || h->token_size != sizeof(LexedToken))
+		return pp_error(pp, NULL, "%s was precompiled by another version of the compiler", path);
+
+	if (h->file_size != file_size ||
+	    !token_cache_section_fits(h->identifiers, h->num_identifiers, sizeof(TokenCacheString), file_size) ||
+	    !token_cache_section_fits(h->constants, h->num_constants, sizeof(TokenCacheConstant), file_size) ||
+	    !token_cache_section_fits(h->literals, h->num_literals, sizeof(StringLiteral), file_size) ||
+	    !token_cache_section_fits(h->spans, h->num_spans, sizeof(TokenCacheString), file_size) ||
+	    !token_cache_section_fits(h->invalid_tokens, h->num_invalid, sizeof(TokenCacheString), file_size) ||
+	    !token_cache_section_fits(h->files, h->num_files, sizeof(PPPchFile), file_size) ||
+	    !token_cache_section_fits(h->macros, h->num_macros, sizeof(PPPchMacro), file_size) ||
+	    !token_cache_section_fits(h->tokens, h->num_tokens, sizeof(LexedToken), file_size) ||
+	    !token_cache_section_fits(h->lines, h->num_lines, sizeof(uint32_t), file_size) ||
+	    !token_cache_section_fits(h->typedef_names, h->num_typedef_names, sizeof(uint32_t), file_size) ||
+	    !token_cache_section_fits(h->strings, h->strings_size, 1, file_size) ||
+	    h->num_files < 2 || h->num_files > UINT16_MAX || !pch_string_fits(h, &h->header, 1) ||
+	    h->checksum != token_cache_hash((const char *)map + sizeof(PPPchHeader), file_size - sizeof(PPPchHeader)) ||
+	    !pch_consistent(h))
+		return pp_error(pp, NULL, "%s is damaged", path);
+
+	pp->_pch_header = (const char *)map + h->strings + h->header.offset;
+	*header = h;
+	return 0;
+}
+
+// Adds the identifiers, constants, literals and invalid tokens of the file to the still empty td, which gives each of
+// them the index it had when the file was written. Returns !0 after an error was reported.
+static int restore_pch_token_data(Preprocessor *pp, const PPPchHeader *h)
+{
+	TokenData *td = pp->td;
+	const char *base = (const char *)h;
+	const char *strings = base + h->strings;
+
+	const TokenCacheString *identifiers = (const TokenCacheString *)(base + h->identifiers);
+	for (uint32_t i = 0; i < h->num_identifiers; i++)
+	{
+		uint32_t id = intern(td->identifiers, strings + identifiers[i].offset, identifiers[i].len);
+		if (id == INTERN_NO_ID)
+			return out_of_memory(pp);
+		if (id != i)
+			return pp_error(pp, NULL, "%s is damaged", pp->options->include_pch);
+	}
+
+	const TokenCacheConstant *constants = (const TokenCacheConstant *)(base + h->constants);
+	for (uint32_t i = 0; i < h->num_constants; i++)
+	{
+		const TokenCacheConstant *c = &constants[i];
+		NumConstant nc = {c->int_value, c->float_value, c->floating, (floating_types)c->floating_type,
+		                  (int_types)c->int_type};
+		uint32_t idx = pool_num_constant(td->num_constants, &nc);
+		if (idx == NUM_CONSTANT_NO_IDX)
+			return out_of_memory(pp);
+		if (idx != i)
+			return pp_error(pp, NULL, "%s is damaged", pp->options->include_pch);
+	}
+
+	// the spans point into the strings of the mapping, which stays until pp_free
+	const TokenCacheString *span_strings = (const TokenCacheString *)(base + h->spans);
+	StringSpan *spans = arena_alloc(&pp->_arena, (h->num_spans + 1) * sizeof(StringSpan));
+	if (!spans)
+		return out_of_memory(pp);
+	for (uint32_t i = 0; i < h->num_spans; i++)
+		spans[i] = (StringSpan){strings + span_strings[i].offset, span_strings[i].len};
+
+	const StringLiteral *literals = (const StringLiteral *)(base + h->literals);
+	for (uint32_t i = 0; i < h->num_literals; i++)
+	{
+		if (append_string_literal(td, spans + literals[i].first_span, literals[i].num_spans) == UINT32_MAX)
+			return out_of_memory(pp);
+	}
+
+	const TokenCacheString *invalid = (const TokenCacheString *)(base + h->invalid_tokens);
+	for (uint32_t i = 0; i < h->num_invalid; i++)
+	{
+		if (append_invalid_token(td, strings + invalid[i].offset, invalid[i].len) == UINT32_MAX)
+			return out_of_memory(pp);
+	}
+
+	return 0;
+}
+
+// Adds the sources of the file under the ids they had, with the files in cbs that were opened to check them. Returns
+// !0 after an error was reported.
+static int restore_pch_files(Preprocessor *pp, const PPPchHeader *h, CharBuffer **cbs)
+{
+	const char *base = (const char *)h;
+	const char *strings = base + h->strings;
+	const PPPchFile *files = (const PPPchFile *)(base + h->files);
+	uint32_t *lines = (uint32_t *)(base + h->lines);
+
+	for (uint32_t i = 1; i < h->num_files; i++)
+	{
+		const PPPchFile *pf = &files[i];
+		const char *name = strings + pf->name.offset;
+		struct stat st;
+		int has_identity = cbs[i] && stat(name, &st) == 0;
+		if (add_file(pp, name, pf->name.len, has_identity ? &st : NULL) < 0)
+			return 1;
+
+		PPFile *file = pp->_files[i];
+		file->guard = pf->guard;
+		file->once = pf->once;
+
+		// the mapping is read only, nothing writes to a line table once it is complete
+		file->_lines = (LineTable){lines + pf->lines, pf->num_lines, pf->num_lines};
+		file->lines_started = 1;
+
+		if (cbs[i])
+		{
+			file->cb = cbs[i];
+			file->owns_cb = 1;
+			file->source = cb_resident_source(cbs[i]);
+			file->size = cbs[i]->_size;
+			cbs[i] = NULL;
+			pp->num_headers++;
+		}
+		else
+		{
+			file->source = strings + pf->source.offset;
+			file->size = pf->source.len;
+		}
+	}
+
+	return 0;
+}
+
+// Defines the macros of the file, their bodies are used right out of the mapping. Returns !0 after an error was
+// reported.
+static int restore_pch_macros(Preprocessor *pp, const PPPchHeader *h)
+{
+	const char *base = (const char *)h;
+	const PPPchMacro *macros = (const PPPchMacro *)(base + h->macros);
+	LexedToken *tokens = (LexedToken *)(base + h->tokens);
+
+	for (uint32_t i = 0; i < h->num_macros; i++)
+	{
+		const PPPchMacro *pm = &macros[i];
+		PPMacro *m = arena_calloc(&pp->_arena, 1, sizeof(PPMacro));
+		if (!m)
+			return out_of_memory(pp);
+
+		// bodies are only ever read, a #define of the same name makes a new one
+		m->body = tokens + pm->body;
+		m->body_len = pm->body_len;
+		m->num_params = pm->num_params;
+		m->function_like = pm->function_like;
+		m->variadic = pm->variadic;
+
+		LexedToken name = {0, pm->name, pm->name_kind, 0, 0};
+		if (set_macro(pp, &name, m))
+			return out_of_memory(pp);
+	}
+
+	return 0;
+}
+
+// Starts the translation unit from options->include_pch. Returns 0 when it was used, 1 when it no longer matches the
+// options or the headers it was made from and -1 after an error was reported.
+static int load_pch(Preprocessor *pp)
+{
+	const PPPchHeader *h = NULL;
+	if (map_pch(pp, &h))
+		return -1;
+
+	uint64_t hash;
+	if (options_hash(pp, &hash))
+		return -1;
+
+	// ids can only be the same when nothing but what every translation unit starts with is in td yet, which is not
+	// the case when the main source was lexed up front
+	TokenData *td = pp->td;
+	if (hash != h->options_hash || td->identifiers->count != PP_ID_COUNT + NUM_KEYWORDS ||
+	    td->num_constants->count != 2 || td->_str_lit_idx || td->num_invalid_tokens)
+		return 1;
+
+	ArenaMark mark = arena_mark(&pp->_scratch);
+	CharBuffer **cbs = arena_calloc(&pp->_scratch, h->num_files, sizeof(CharBuffer *));
+	if (!cbs)
+		return out_of_memory(pp);
+
+	int res = pch_inputs_changed(h, cbs);
+	if (!res)
+	{
+		res = restore_pch_token_data(pp, h) || restore_pch_files(pp, h, cbs) || restore_pch_macros(pp, h) ? -1 : 0;
+	}
+
+	if (!res)
+	{
+		pp->typedef_names = (const uint32_t *)((const char *)h + h->typedef_names);
+		pp->num_typedef_names = h->num_typedef_names;
+	}
+
+	for (uint32_t i = 0; i < h->num_files; i++)
+	{
+		if (cbs[i])
+			delete_char_buffer(cbs[i]);
+	}
+	arena_reset(&pp->_scratch, mark);
+
+	pp->used_pch = res == 0;
+	return res;
+}
+
+// Includes the header a precompiled header that no longer matches was made from, as the first source after the
+// predefined macros
+static int include_prefix(Preprocessor *pp)
+{
+	int file_id = find_file(pp, pp->_pch_header, strlen(pp->_pch_header));
+	if (file_id == -1)
+		return pp_error(pp, NULL, "%s: no such file", pp->_pch_header);
+	return file_id < 0 || enter_file(pp, file_id, NULL);
+}
+
+// Everything but the main source, which is already the first frame
+static int init_translation_unit(Preprocessor *pp)
+{
+	TokenData *td = pp->td;
+
+	pp->_ids = arena_alloc(&pp->_arena, (PP_ID_COUNT + NUM_KEYWORDS) * sizeof(uint32_t));
+	if (!pp->_ids)
+		return out_of_memory(pp);
+
+	for (int i = 0; i < PP_ID_COUNT + NUM_KEYWORDS; i++)
+	{
+		const char *str = i < PP_ID_COUNT ? pp_ident_spelling[i] : keyword_spelling[i - PP_ID_COUNT];
+		pp->_ids[i] = intern(td->identifiers, str, strlen(str));
+		if (pp->_ids[i] == INTERN_NO_ID)
+			return out_of_memory(pp);
+	}
+
+	NumConstant zero = {0, 0, 0, FLOATING_TYPE_DOUBLE, INT_TYPE_SIGNED_INT};
+	NumConstant one = {1, 0, 0, FLOATING_TYPE_DOUBLE, INT_TYPE_SIGNED_INT};
+	pp->_zero = pool_num_constant(td->num_constants, &zero);
+	pp->_one = pool_num_constant(td->num_constants, &one);
+	if (pp->_zero == NUM_CONSTANT_NO_IDX || pp->_one == NUM_CONSTANT_NO_IDX)
+		return out_of_memory(pp);
+
+	if (define_builtin(pp, PP_ID_FILE_MACRO, PP_BUILTIN_FILE) || define_builtin(pp, PP_ID_LINE_MACRO, PP_BUILTIN_LINE))
+		return out_of_memory(pp);
+
+	// the predefined macros are part of a precompiled header, a stale one is replaced by the header it was made from
+	if (pp->options && pp->options->include_pch)
+	{
+		int res = load_pch(pp);
+		if (res <= 0)
+			return res != 0;
+		if (include_prefix(pp))
+			return 1;
+	}
+
+	return push_predefined(pp);
+}
+
+// Sets up pp and the entry for the main source, the frame for it is left to the caller
+static int init_main(Preprocessor *pp, CharBuffer *cb, const char *file_name, const PreprocessorOptions *options)
+{
+	memset(pp, 0, sizeof(Preprocessor));
+	arena_init(&pp->_arena, PP_FIRST_CHUNK);
+	arena_init(&pp->_scratch, PP_SCRATCH_CHUNK);
+	pp->options = options;
+
+	pp->_frames = arena_calloc(&pp->_arena, PP_MAX_INCLUDE_DEPTH, sizeof(PPFrame));
+	pp->_paths = alloc_intern_table(&pp->_arena);
+	if (!pp->_frames || !pp->_paths)
+	{
+		printf("Error: failed to allocate the preprocessor (%s)\n", file_name);
+		return 1;
+	}
+
+	// no errors can be reported before there is a main source to report them in
+	struct stat st;
+	int has_identity = stat(file_name, &st) == 0;
+	if (add_file(pp, file_name, strlen(file_name), has_identity ? &st : NULL) < 0)
+		return 1;
+
+	PPFile *file = pp->_files[0];
+	file->cb = cb;
+	file->source = cb_resident_source(cb);
+	file->size = cb->_size;
+	file->lines_started = 1;
+
+	PPFrame *f = &pp->_frames[0];
+	f->file = file;
+	f->guard = INTERN_NO_ID;
+	pp->_num_frames = 1;
+	return 0;
+}
+
+int pp_init(Preprocessor *pp, CharBuffer *cb, const char *file_name, const PreprocessorOptions *options)
+{
+	if (init_main(pp, cb, file_name, options))
+		return 1;
+
+	LexerState *lexer = &pp->_frames[0].lexer;
+	int err = lexer_init(lexer, cb);
+	pp->td = lexer->td;
+	if (err)
+		return 1;
+
+	lexer->raw = 1;
+	lexer->defer_errors = 1;
+	pp->_files[0]->lines = &pp->td->lines;
+	return init_translation_unit(pp);
+}
+
+int pp_init_tokens(Preprocessor *pp, TokenData *td, CharBuffer *cb, const char *file_name,
+                   const PreprocessorOptions *options)
+{
+	if (init_main(pp, cb, file_name, options))
+	{
+		free_token_data(td);
+		return 1;
+	}
+
+	pp->td = td;
+	lexer_init_replay(&pp->_frames[0].lexer, td);
+	pp->_files[0]->lines = &td->lines;
+	return init_translation_unit(pp);
+}
+
+void pp_free(Preprocessor *pp)
+{
+	for (uint32_t i = 0; i < pp->_num_frames; i++)
+	{
+		if (pp->_frames[i].stream)
+			delete_char_buffer(pp->_frames[i].stream);
+	}
+
+	for (uint32_t i = 0; i < pp->_num_files; i++)
+	{
+		if (pp->_files[i]->owns_cb)
+			delete_char_buffer(pp->_files[i]->cb);
+		if (pp->_files[i]->cached)
+			token_cache_unmap(pp->_files[i]->cached);
+	}
+
+	if (pp->td)
+		free_token_data(pp->td);
+	if (pp->_pch_map)
+		munmap(pp->_pch_map, pp->_pch_size);
+	arena_release(&pp->_arena);
+	arena_release(&pp->_scratch);
+}
+
+// Kind of the token a macro named by id is written as, a keyword when it is one
+static uint8_t macro_name_kind(const Preprocessor *pp, uint32_t id)
+{
+	for (int i = 0; pp->_keyword_macros && i < NUM_KEYWORDS; i++)
+	{
+		if (pp->_ids[PP_ID_COUNT + i] == id)
+			return TOK_FIRST_KEYWORD + i;
+	}
+	return TOK_IDENTIFIER;
+}
+
+// Writes everything pp knows at the end of the prefix header to pch_path, along with the num_typedef_names typedef
+// names the header declared. Returns !0 after an error was printed.
+static int write_pch(Preprocessor *pp, const char *header_path, const char *pch_path, const uint32_t *typedef_names,
+                     uint32_t num_typedef_names)
+{
+	// only files that are there as a whole can be hashed
+	for (uint32_t i = 1; i < pp->_num_files; i++)
+	{
+		const PPFile *file = pp->_files[i];
+		if (file->has_identity && !file->source)
+		{
+			printf("Error: cannot precompile %s, %s is not a regular file\n", header_path, file->name);
+			return 1;
+		}
+	}
+
+	const TokenData *td = pp->td;
+	const InternTable *ids = td->identifiers;
+	const NumConstantPool *pool = td->num_constants;
+	PPPchHeader h = {0};
+
+	Arena *scratch = &pp->_scratch;
+	ArenaMark mark = arena_mark(scratch);
+	TokenCacheString *identifiers = arena_alloc(scratch, (ids->count + 1) * sizeof(TokenCacheString));
+	TokenCacheConstant *constants = arena_alloc(scratch, (pool->count + 1) * sizeof(TokenCacheConstant));
+	TokenCacheString *spans = arena_alloc(scratch, (td->_str_span_idx + 1) * sizeof(TokenCacheString));
+	TokenCacheString *invalid = arena_alloc(scratch, (td->num_invalid_tokens + 1) * sizeof(TokenCacheString));
+	PPPchFile *files = arena_calloc(scratch, pp->_num_files, sizeof(PPPchFile));
+	PPPchMacro *macros = arena_alloc(scratch, (pp->num_macros + 1) * sizeof(PPPchMacro));
+
+	// the sections that grow as they are put together, chars of all strings, the tokens and the line starts
+	TokenCacheImage strings = {0};
+	TokenCacheImage tokens = {0};
+	TokenCacheImage lines = {0};
+	TokenCacheImage img = {0};
+	int failed =
+		!identifiers || !constants || !spans || !invalid || !files || !macros || options_hash(pp, &h.options_hash);
+
+	for (uint32_t i = 0; i < ids->count && !failed; i++)
+	{
+		uint32_t len = intern_len(ids, i);
+		identifiers[i] = (TokenCacheString){token_cache_image_append(&strings, intern_str(ids, i), len, 1), len};
+	}
+
+	for (uint32_t i = 0; i < pool->count && !failed; i++)
+	{
+		const NumConstant *nc = &pool->constants[i];
+		constants[i] =
+			(TokenCacheConstant){nc->int_value, nc->float_value, nc->floating, nc->floating_type, nc->int_type, {0}};
+	}
+
+	for (int i = 0; i < td->_str_span_idx && !failed; i++)
+	{
+		const StringSpan *span = &td->string_spans[i];
+		spans[i] = (TokenCacheString){token_cache_image_append(&strings, span->ptr, span->len, 1), span->len};
+	}
+
+	for (uint32_t i = 0; i < td->num_invalid_tokens && !failed; i++)
+	{
+		const InvalidToken *inv = &td->invalid_tokens[i];
+		invalid[i] = (TokenCacheString){token_cache_image_append(&strings, inv->error, strlen(inv->error) + 1, 1),
+		                                inv->len};
+	}
+
+	// file 0 is the main source that only includes the header, translation units have their own
+	for (uint32_t i = 1; i < pp->_num_files && !failed; i++)
+	{
+		const PPFile *file = pp->_files[i];
+		PPPchFile *pf = &files[i];
+		uint32_t name_len = strlen(file->name);
+		pf->name = (TokenCacheString){token_cache_image_append(&strings, file->name, name_len + 1, 1), name_len};
+		pf->guard = file->guard;
+		pf->once = file->once;
+		pf->is_file = file->has_identity;
+		pf->num_lines = file->lines->count;
+		pf->lines = token_cache_image_append(&lines, file->lines->starts, pf->num_lines * sizeof(uint32_t), 4) /
+		            sizeof(uint32_t);
+
+		if (file->has_identity)
+		{
+			pf->hash = token_cache_hash(file->source, file->size);
+			pf->size = file->size;
+		}
+		else
+		{
+			pf->source = (TokenCacheString){token_cache_image_append(&strings, file->source, file->size, 1),
+			                                (uint32_t)file->size};
+		}
+	}
+
+	// __FILE__ and __LINE__ are defined by every translation unit itself
+	uint32_t num_macros = 0;
+	for (uint32_t id = 0; id < pp->_macros_cap && !failed; id++)
+	{
+		const PPMacro *m = pp->_macros[id];
+		if (!m || m->builtin)
+			continue;
+
+		uint64_t body = token_cache_image_append(&tokens, m->body, m->body_len * sizeof(LexedToken), 4);
+		macros[num_macros++] = (PPPchMacro){id,
+		                                    (uint32_t)(body / sizeof(LexedToken)),
+		                                    m->body_len,
+		                                    m->num_params,
+		                                    macro_name_kind(pp, id),
+		                                    m->function_like,
+		                                    m->variadic,
+		                                    0};
+	}
+
+	h.header = (TokenCacheString){token_cache_image_append(&strings, header_path, strlen(header_path) + 1, 1),
+	                              (uint32_t)strlen(header_path)};
+	failed |= strings.failed || tokens.failed || lines.failed || strings.size > UINT32_MAX;
+
+	if (!failed)
+	{
+		memcpy(h.magic, PP_PCH_MAGIC, 8);
+		h.version = PP_PCH_VERSION;
+		h.num_token_kinds = TOK_COUNT;
+		h.token_size = sizeof(LexedToken);
+		h.num_identifiers = ids->count;
+		h.num_constants = pool->count;
+		h.num_literals = td->_str_lit_idx;
+		h.num_spans = td->_str_span_idx;
+		h.num_invalid = td->num_invalid_tokens;
+		h.num_files = pp->_num_files;
+		h.num_macros = num_macros;
+		h.num_lines = lines.size / sizeof(uint32_t);
+		h.num_tokens = tokens.size / sizeof(LexedToken);
+		h.num_typedef_names = num_typedef_names;
+		h.strings_size = strings.size;
+
+		token_cache_image_append(&img, &h, sizeof(h), 8);
+		h.identifiers = token_cache_image_append(&img, identifiers, h.num_identifiers * sizeof(TokenCacheString), 8);
+		h.constants = token_cache_image_append(&img, constants, h.num_constants * sizeof(TokenCacheConstant), 8);
+		h.literals = token_cache_image_append(&img, td->string_literals, h.num_literals * sizeof(StringLiteral), 8);
+		h.spans = token_cache_image_append(&img, spans, h.num_spans * sizeof(TokenCacheString), 8);
+		h.invalid_tokens = token_cache_image_append(&img, invalid, h.num_invalid * sizeof(TokenCacheString), 8);
+		h.files = token_cache_image_append(&img, files, h.num_files * sizeof(PPPchFile), 8);
+		h.macros = token_cache_image_append(&img, macros, h.num_macros * sizeof(PPPchMacro), 8);
+		h.tokens = token_cache_image_append(&img, tokens.data, tokens.size, 8);
+		h.lines = token_cache_image_append(&img, lines.data, lines.size, 8);
+		h.typedef_names = token_cache_image_append(&img, typedef_names, num_typedef_names * sizeof(uint32_t), 8);
+		h.strings = token_cache_image_append(&img, strings.data, strings.size, 8);
+		h.file_size = img.size;
+		failed = img.failed;
+		if (!failed)
+		{
+			h.checksum = token_cache_hash(img.data + sizeof(h), img.size - sizeof(h));
+			memcpy(img.data, &h, sizeof(h));
+		}
+	}
+
+	if (failed)
+		printf("Error: ran out of memory while precompiling %s\n", header_path);
+	else if ((failed = token_cache_write_image(&img, pch_path)))
+		printf("Error: failed to write the precompiled header %s\n", pch_path);
+
+	arena_reset(scratch, mark);
+	mem_free(strings.data);
+	mem_free(tokens.data);
+	mem_free(lines.data);
+	mem_free(img.data);
+	return failed;
+}
+
+int pp_emit_pch(const char *header_path, const char *pch_path, const PreprocessorOptions *options,
+                PPPchParser parse_header)
+{
+	// the header is the one #include of an otherwise empty main source, so that the tokens of the macros it defines all
+	// come from sources that are still there when the precompiled header is used
+	char main_source[PP_MAX_PATH + 16];
+	if (strlen(header_path) >= PP_MAX_PATH || strpbrk(header_path, "\"\\\n"))
+	{
+		printf("Error: cannot precompile %s, the path cannot be written in an #include\n", header_path);
+		return 1;
+	}
+
+	CharBuffer cb;
+	cb_init_view(&cb, main_source, 0, snprintf(main_source, sizeof(main_source), "#include \"%s\"\n", header_path));
+
+	PreprocessorOptions prefix_options = *options;
+	prefix_options.include_pch = NULL;
+
+	Preprocessor pp;
+	uint32_t *typedef_names = NULL;
+	uint32_t num_typedef_names = 0;
+	int failed = pp_init(&pp, &cb, "<precompiled header>", &prefix_options) ||
+	             parse_header(&pp, &pp._arena, &typedef_names, &num_typedef_names) ||
+	             write_pch(&pp, header_path, pch_path, typedef_names, num_typedef_names);
+
+	pp_free(&pp);
+	return failed;
+}
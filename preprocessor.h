@@ -0,0 +1,189 @@
+#pragma once
+
+#include "lexer.h"
+#include "token_cache.h"
+
+// C11 5.2.4.1 asks for 15 levels, this is only a guard against a header that includes itself without end
+#define PP_MAX_INCLUDE_DEPTH 200
+
+// Longest diagnostic the preprocessor formats, longer ones are cut off
+#define PP_MAX_ERROR_LEN 512
+
+typedef struct PreprocessorOptions
+{
+	// searched in order for <...> includes, and for "..." ones after the directory of the including file
+	const char *const *include_dirs;
+	int num_include_dirs;
+
+	// -D and -U arguments in command line order without their '-', "DNAME", "DNAME=value" or "UNAME"
+	const char *const *macro_args;
+	int num_macro_args;
+
+	// headers are looked up here before being lexed and stored here after, NULL to always lex them
+	TokenCache *token_cache;
+
+	// precompiled header written by pp_emit_pch that every translation unit starts with, NULL for none
+	const char *include_pch;
+} PreprocessorOptions;
+
+struct PPFile;
+struct PPFrame;
+struct PPCond;
+struct PPContext;
+struct PPMacro;
+struct PPTokenVec;
+
+// Translation phases 3 to 6 on top of the lexer: directives, macro expansion and string literal concatenation. Tokens
+// are pulled through pp_next like they are from a LexerState, every source of the translation unit is lexed into the
+// same TokenData so identifier ids and literal indices mean the same everywhere.
+//
+// Headers are opened and lexed once. A header whose contents are all inside an #ifndef X ... #endif guard, or that
+// has #pragma once, is remembered along with its guard, and an #include of it while X is defined (or at all for
+// #pragma once) is skipped without even looking up the file again.
+typedef struct Preprocessor
+{
+	// owned by the preprocessor, its token arrays stay empty unless the main source was lexed up front
+	TokenData *td;
+	const PreprocessorOptions *options;
+
+	// tokens handed out by pp_next so far, in total and by kind
+	uint32_t num_tokens;
+	uint32_t tokens_by_kind[TOK_COUNT];
+
+	// When set, the wall time spent in pp_next is added up in seconds. The parser pulls tokens as it goes, so this is
+	// how --time-report tells preprocessing and parsing apart.
+	int timed;
+	double seconds;
+
+	// number of headers that were opened, and of #includes that were skipped because of a guard or #pragma once
+	uint32_t num_headers;
+	uint32_t num_skipped_includes;
+
+	// macros currently defined
+	uint32_t num_macros;
+
+	// set when the state after the prefix header came from options->include_pch, it is left unset when the file no
+	// longer matches the options or the headers it was made from and the prefix header is included instead
+	int used_pch;
+
+	// Identifier ids of the typedef names the header of the precompiled header declares at file scope, set along with
+	// used_pch. The tokens of the header are not handed out again, the parser starts out with these declared instead.
+	const uint32_t *typedef_names;
+	uint32_t num_typedef_names;
+
+	// When set, an error is only recorded in error, error_file and error_line instead of being printed, for callers
+	// that run the preprocessor ahead and only report the error once it is actually reached
+	int defer_errors;
+	char error[PP_MAX_ERROR_LEN];
+	const char *error_file;
+	int error_line;
+	int has_error;
+
+	// every source seen so far indexed by LexedToken.file, 0 is the main source
+	struct PPFile **_files;
+	uint32_t _num_files;
+	uint32_t _files_cap;
+
+	// include paths that were looked up, the file each of them turned out to be is in _path_files
+	InternTable *_paths;
+	int32_t *_path_files;
+	uint32_t _path_files_cap;
+
+	// sources being lexed, the innermost #include last, PP_MAX_INCLUDE_DEPTH of them allocated up front
+	struct PPFrame *_frames;
+	uint32_t _num_frames;
+
+	// where the line starts go when a file is lexed again, its own table is already complete
+	LineTable _scratch_lines;
+
+	// open #if groups of all frames
+	struct PPCond *_conds;
+	uint32_t _num_conds;
+	uint32_t _conds_cap;
+
+	// token lists being read ahead of the sources, the innermost macro expansion last
+	struct PPContext *_contexts;
+	uint32_t _num_contexts;
+	uint32_t _contexts_cap;
+
+	// Number of contexts that reading must not go below, 0 unless a list of tokens is being expanded on its own.
+	// The context right below is the list, once it runs out reading ends instead of going on with what follows it.
+	uint32_t _floor;
+
+	// indexed by interned identifier id
+	struct PPMacro **_macros;
+	uint32_t _macros_cap;
+
+	// number of defined macros named by a keyword, lookups for keywords are skipped while there are none
+	uint32_t _keyword_macros;
+
+	// interned ids of the keywords, directive names and other identifiers with a meaning to the preprocessor
+	uint32_t *_ids;
+
+	// pooled token lists, _vecs has all of them and _free_vecs the ones not in use
+	struct PPTokenVec **_vecs;
+	uint32_t _num_vecs;
+	uint32_t _vecs_cap;
+	struct PPTokenVec **_free_vecs;
+	uint32_t _num_free_vecs;
+
+	// chars of spellings being put together
+	char *_spell;
+	uint32_t _spell_cap;
+
+	// numeric constants 0 and 1, what defined evaluates to
+	uint32_t _zero;
+	uint32_t _one;
+
+	// the token read after a string literal to find out whether it continues
+	LexedToken _peeked;
+	int _has_peeked;
+
+	// Everything above that is allocated lives here until pp_free, macros, files, paths and the arrays alike. Tearing
+	// the preprocessor down is releasing its chunks, no matter how many macros or token lists there were.
+	Arena _arena;
+
+	// memory needed only while a single directive or token is handled, reset to a mark once done with it
+	Arena _scratch;
+
+	// the precompiled header, macro bodies, line tables and names of restored files point into it
+	void *_pch_map;
+	unsigned long _pch_size;
+	const char *_pch_header;
+} Preprocessor;
+
+// Prepares pp for preprocessing cb, which is named file_name in diagnostics and stays owned by the caller. options
+// have to outlive pp. Returns !0 after an error was reported, pp_free has to be called either way.
+int pp_init(Preprocessor *pp, CharBuffer *cb, const char *file_name, const PreprocessorOptions *options);
+
+// Same as pp_init, but the tokens of the main source are already in the token arrays of td, lexed by
+// tokenize_parallel with raw set. pp takes td over.
+int pp_init_tokens(Preprocessor *pp, TokenData *td, CharBuffer *cb, const char *file_name,
+                   const PreprocessorOptions *options);
+
+void pp_free(Preprocessor *pp);
+
+// Goes through the tokens of the header pp_emit_pch precompiles by pulling every one of them from pp, and returns the
+// ids of the typedef names the header declares at file scope in *names, allocated from arena. Returns !0 after an
+// error was reported.
+typedef int (*PPPchParser)(Preprocessor *pp, Arena *arena, uint32_t **names, uint32_t *num_names);
+
+// Preprocesses the header at header_path, reading it with parse_header, and writes what the preprocessor is left with
+// to pch_path: the macros, which headers are guarded or #pragma once, the typedef names of the header and the hashes
+// of everything that was read. A translation unit given the file as options->include_pch starts from there instead of
+// preprocessing the header again, as long as it has the same -I, -D and -U options and none of the headers changed.
+// Returns !0 after an error was printed.
+int pp_emit_pch(const char *header_path, const char *pch_path, const PreprocessorOptions *options,
+                PPPchParser parse_header);
+
+// Preprocesses up to the next token of the translation unit, adjacent string literals are already concatenated.
+// Returns 1 for a token, 0 at the end of the translation unit and -1 after an error was reported.
+int pp_next(Preprocessor *pp, LexedToken *tok);
+
+// Prints the error recorded while defer_errors was set, if there is one
+void pp_report_deferred_error(const Preprocessor *pp);
+
+// Resolves where tok came from to the name of its source and a 1 based line and column. Tokens of a macro expansion
+// are where they were written in the #define or the macro arguments, tokens made by ## or # where their left operand
+// was.
+void pp_source_location(const Preprocessor *pp, const LexedToken *tok, const char **file_name, int *line, int *col);
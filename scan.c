@@ -0,0 +1,309 @@
+#include "scan.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static int is_whitespace(char chr)
+{
+	return chr == ' ' || chr == '\n' || chr == '\t' || chr == '\v' || chr == '\f' || chr == '\r';
+}
+
+static const char *skip_whitespace_scalar(const char *p, const char *end, int *newlines)
+{
+	while (p < end && is_whitespace(*p))
+	{
+		if (*p == '\n')
+			(*newlines)++;
+		p++;
+	}
+	return p;
+}
+
+static const char *find_newline_scalar(const char *p, const char *end)
+{
+	const char *res = memchr(p, '\n', end - p);
+	return res ? res : end;
+}
+
+static const char *find_comment_end_scalar(const char *p, const char *end, int *newlines)
+{
+	for (; p + 1 < end; p++)
+	{
+		if (*p == '*' && p[1] == '/')
+			return p;
+		if (*p == '\n')
+			(*newlines)++;
+	}
+
+	// the last char can never start a complete "*/"
+	if (p < end && *p == '\n')
+		(*newlines)++;
+	return end;
+}
+
+static const char *find_string_special_scalar(const char *p, const char *end)
+{
+	while (p < end && *p != '"' && *p != '\\' && *p != '\n')
+		p++;
+	return p;
+}
+
+static const ScanKernels scalar_kernels = {
+	"scalar",
+	skip_whitespace_scalar,
+	find_newline_scalar,
+	find_comment_end_scalar,
+	find_string_special_scalar,
+};
+
+#ifdef SCAN_X86
+
+// Bits below the lowest set bit of mask, or all bits if mask is empty
+static unsigned int bits_before(unsigned int mask)
+{
+	return mask ? (mask & -mask) - 1 : ~0u;
+}
+
+// SSE2 is part of the x86-64 baseline so these need no runtime check
+
+static const char *skip_whitespace_sse2(const char *p, const char *end, int *newlines)
+{
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i tab = _mm_set1_epi8('\t');
+	// '\t' through '\r' are contiguous, (chr - '\t') <= 4 unsigned
+	const __m128i four = _mm_set1_epi8(4);
+
+	while (end - p >= 16)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i *)p);
+		__m128i ctrl = _mm_sub_epi8(chunk, tab);
+		__m128i ws = _mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(_mm_min_epu8(ctrl, four), ctrl));
+
+		unsigned int other = ~_mm_movemask_epi8(ws) & 0xFFFF;
+		unsigned int nl = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+
+		*newlines += __builtin_popcount(nl & bits_before(other));
+		if (other)
+			return p + __builtin_ctz(other);
+		p += 16;
+	}
+
+	return skip_whitespace_scalar(p, end, newlines);
+}
+
+static const char *find_newline_sse2(const char *p, const char *end)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+
+	while (end - p >= 16)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i *)p);
+		unsigned int nl = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+		if (nl)
+			return p + __builtin_ctz(nl);
+		p += 16;
+	}
+
+	return find_newline_scalar(p, end);
+}
+
+static const char *find_comment_end_sse2(const char *p, const char *end, int *newlines)
+{
+	const __m128i star = _mm_set1_epi8('*');
+	const __m128i slash = _mm_set1_epi8('/');
+	const __m128i newline = _mm_set1_epi8('\n');
+
+	// the second load reads one char ahead so a "*/" split across two chunks is still found
+	while (end - p >= 17)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i *)p);
+		__m128i ahead = _mm_loadu_si128((const __m128i *)(p + 1));
+		unsigned int close =
+			_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(chunk, star), _mm_cmpeq_epi8(ahead, slash)));
+		unsigned int nl = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+
+		*newlines += __builtin_popcount(nl & bits_before(close));
+		if (close)
+			return p + __builtin_ctz(close);
+		p += 16;
+	}
+
+	return find_comment_end_scalar(p, end, newlines);
+}
+
+static const char *find_string_special_sse2(const char *p, const char *end)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i newline = _mm_set1_epi8('\n');
+
+	while (end - p >= 16)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i *)p);
+		__m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+		                               _mm_or_si128(_mm_cmpeq_epi8(chunk, backslash), _mm_cmpeq_epi8(chunk, newline)));
+		unsigned int mask = _mm_movemask_epi8(special);
+		if (mask)
+			return p + __builtin_ctz(mask);
+		p += 16;
+	}
+
+	return find_string_special_scalar(p, end);
+}
+
+static const ScanKernels sse2_kernels = {
+	"sse2",
+	skip_whitespace_sse2,
+	find_newline_sse2,
+	find_comment_end_sse2,
+	find_string_special_sse2,
+};
+
+// AVX2 variants are compiled for the target with an attribute so the rest of the build stays baseline x86-64
+
+#define AVX2 __attribute__((target("avx2,popcnt,bmi")))
+
+AVX2 static const char *skip_whitespace_avx2(const char *p, const char *end, int *newlines)
+{
+	const __m256i space = _mm256_set1_epi8(' ');
+	const __m256i newline = _mm256_set1_epi8('\n');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i four = _mm256_set1_epi8(4);
+
+	while (end - p >= 32)
+	{
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+		__m256i ctrl = _mm256_sub_epi8(chunk, tab);
+		__m256i ws =
+			_mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), _mm256_cmpeq_epi8(_mm256_min_epu8(ctrl, four), ctrl));
+
+		unsigned int other = ~(unsigned int)_mm256_movemask_epi8(ws);
+		unsigned int nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+
+		*newlines += __builtin_popcount(nl & bits_before(other));
+		if (other)
+			return p + __builtin_ctz(other);
+		p += 32;
+	}
+
+	return skip_whitespace_sse2(p, end, newlines);
+}
+
+AVX2 static const char *find_newline_avx2(const char *p, const char *end)
+{
+	const __m256i newline = _mm256_set1_epi8('\n');
+
+	while (end - p >= 32)
+	{
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+		unsigned int nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+		if (nl)
+			return p + __builtin_ctz(nl);
+		p += 32;
+	}
+
+	return find_newline_sse2(p, end);
+}
+
+AVX2 static const char *find_comment_end_avx2(const char *p, const char *end, int *newlines)
+{
+	const __m256i star = _mm256_set1_epi8('*');
+	const __m256i slash = _mm256_set1_epi8('/');
+	const __m256i newline = _mm256_set1_epi8('\n');
+
+	while (end - p >= 33)
+	{
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+		__m256i ahead = _mm256_loadu_si256((const __m256i *)(p + 1));
+		unsigned int close = _mm256_movemask_epi8(
+			_mm256_and_si256(_mm256_cmpeq_epi8(chunk, star), _mm256_cmpeq_epi8(ahead, slash)));
+		unsigned int nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+
+		*newlines += __builtin_popcount(nl & bits_before(close));
+		if (close)
+			return p + __builtin_ctz(close);
+		p += 32;
+	}
+
+	return find_comment_end_sse2(p, end, newlines);
+}
+
+AVX2 static const char *find_string_special_avx2(const char *p, const char *end)
+{
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i newline = _mm256_set1_epi8('\n');
+
+	while (end - p >= 32)
+	{
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+		__m256i special =
+			_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+		                    _mm256_or_si256(_mm256_cmpeq_epi8(chunk, backslash), _mm256_cmpeq_epi8(chunk, newline)));
+		unsigned int mask = _mm256_movemask_epi8(special);
+		if (mask)
+			return p + __builtin_ctz(mask);
+		p += 32;
+	}
+
+	return find_string_special_sse2(p, end);
+}
+
+static const ScanKernels avx2_kernels = {
+	"avx2",
+	skip_whitespace_avx2,
+	find_newline_avx2,
+	find_comment_end_avx2,
+	find_string_special_avx2,
+};
+
+#endif
+
+// Kernels are picked once for the whole process, the first source lexed looks at the environment and the CPU and
+// every other one gets the same table
+static pthread_once_t selected_once = PTHREAD_ONCE_INIT;
+static const ScanKernels *selected;
+
+static void select_once(void)
+{
+	const char *forced = getenv("CCOMPILER_SCAN");
+	if (forced && strcmp(forced, "scalar") == 0)
+	{
+		selected = &scalar_kernels;
+		return;
+	}
+
+#ifdef SCAN_X86
+	if (forced && strcmp(forced, "sse2") == 0)
+	{
+		selected = &sse2_kernels;
+		return;
+	}
+
+	__builtin_cpu_init();
+	int has_avx2 = __builtin_cpu_supports("avx2");
+	if (forced && strcmp(forced, "avx2") == 0 && !has_avx2)
+		printf("Warning: CCOMPILER_SCAN=avx2 but the CPU has no AVX2, using sse2\n");
+
+	selected = has_avx2 ? &avx2_kernels : &sse2_kernels;
+#else
+	if (forced && (strcmp(forced, "sse2") == 0 || strcmp(forced, "avx2") == 0))
+		printf("Warning: CCOMPILER_SCAN=%s is only available on x86, using scalar\n", forced);
+
+	selected = &scalar_kernels;
+#endif
+}
+
+const ScanKernels *select_scan_kernels(void)
+{
+	pthread_once(&selected_once, select_once);
+	return selected;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+// Bulk scanning kernels used by the lexer to get through whitespace, comments and string literal bodies without
+// going through the char buffer one char at a time. Every kernel scans [p, end) and returns where it stopped.
+typedef struct ScanKernels
+{
+	const char *name;
+
+	// First char that is not whitespace, the number of '\n' before it is added to *newlines
+	const char *(*skip_whitespace)(const char *p, const char *end, int *newlines);
+
+	// First '\n', or end
+	const char *(*find_newline)(const char *p, const char *end);
+
+	// The '*' of the first "*/" that lies completely inside the range, or end. The number of '\n' before the
+	// returned position is added to *newlines
+	const char *(*find_comment_end)(const char *p, const char *end, int *newlines);
+
+	// First '"', '\\' or '\n', or end
+	const char *(*find_string_special)(const char *p, const char *end);
+} ScanKernels;
+
+// Picks the widest kernels the CPU supports. Setting CCOMPILER_SCAN to scalar, sse2 or avx2 forces a variant, one the
+// CPU lacks falls back to the widest it has with a warning. The choice is made on the first call, later ones return
+// the same kernels.
+const ScanKernels *select_scan_kernels(void);
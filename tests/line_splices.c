@@ -0,0 +1,32 @@
+// Line splices inside tokens, every one of them has to be taken out before the source is split into tokens
+// (translation phase 2). A splice that is not ends in an error or fails one of the checks below.
+
+#define SPLICED_NA\
+ME 42
+#if SPLICED_NAME != 4\
+2
+#error "a splice inside an identifier or a pp-number was kept"
+#endif
+
+#if '\\
+n' != 10 || 0x1\
+0 != 16 || 1 <\
+< 2 != 4
+#error "a splice inside a char literal, a pp-number or a punctuator was kept"
+#endif
+
+// a line comment goes on after a splice \
+#error "a splice at the end of a line comment was kept"
+
+#define str(x) #x
+#define xstr(x) str(x)
+
+in\
+t spliced_int = SPLICED_NAME;
+const char *spliced_spelling = xstr(0x1\
+0 '\\
+'');
+
+// the AST is only printed when everything before it made it through, ctest looks for this last literal
+const char *spliced_string = "hello,\
+ world";
@@ -0,0 +1,19 @@
+// The middle operand of a conditional nests, 2048 of them are past PARSER_MAX_DEPTH and have to be reported as such
+
+#define C0(m) x ? m : 0
+#define C1(m) C0(C0(m))
+#define C2(m) C1(C1(m))
+#define C3(m) C2(C2(m))
+#define C4(m) C3(C3(m))
+#define C5(m) C4(C4(m))
+#define C6(m) C5(C5(m))
+#define C7(m) C6(C6(m))
+#define C8(m) C7(C7(m))
+#define C9(m) C8(C8(m))
+#define C10(m) C9(C9(m))
+#define C11(m) C10(C10(m))
+
+int f(int x)
+{
+	return C11(1);
+}
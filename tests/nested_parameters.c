@@ -0,0 +1,17 @@
+// Function declarators nest through their parameters, 2048 of them are past PARSER_MAX_DEPTH and have to be reported
+// as such
+
+#define P0(m) int g(m)
+#define P1(m) P0(P0(m))
+#define P2(m) P1(P1(m))
+#define P3(m) P2(P2(m))
+#define P4(m) P3(P3(m))
+#define P5(m) P4(P4(m))
+#define P6(m) P5(P5(m))
+#define P7(m) P6(P6(m))
+#define P8(m) P7(P7(m))
+#define P9(m) P8(P8(m))
+#define P10(m) P9(P9(m))
+#define P11(m) P10(P10(m))
+
+int f(P11(int));
@@ -0,0 +1,17 @@
+// Array declarators nest through the type names of sizeof in their size, 2048 of them are past PARSER_MAX_DEPTH and
+// have to be reported as such
+
+#define S0(m) int[sizeof(m)]
+#define S1(m) S0(S0(m))
+#define S2(m) S1(S1(m))
+#define S3(m) S2(S2(m))
+#define S4(m) S3(S3(m))
+#define S5(m) S4(S4(m))
+#define S6(m) S5(S5(m))
+#define S7(m) S6(S6(m))
+#define S8(m) S7(S7(m))
+#define S9(m) S8(S8(m))
+#define S10(m) S9(S9(m))
+#define S11(m) S10(S10(m))
+
+int a[sizeof(S11(int))];
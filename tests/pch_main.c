@@ -0,0 +1,10 @@
+#include "pch_prefix.h"
+
+// without size_type and pch_node being typedef names these are multiplications and a syntax error
+int pch_main(void)
+{
+	size_type *p;
+	pch_node n;
+	int hidden = TWICE(3);
+	return (size_type)hidden * n.value;
+}
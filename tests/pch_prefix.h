@@ -0,0 +1,20 @@
+// Precompiled by the pch tests, pch_main.c has to be parsed with its typedef names known without going through it
+#ifndef PCH_PREFIX_H
+#define PCH_PREFIX_H
+
+typedef unsigned long size_type;
+typedef struct pch_node
+{
+	int value;
+} pch_node;
+
+#define TWICE(x) ((x) * 2)
+
+// a typedef in a block is gone by the end of the header
+static int block_scope(void)
+{
+	typedef int hidden;
+	return 0;
+}
+
+#endif
@@ -0,0 +1,250 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "char_buffer.h"
+#include "lexer.h"
+#include "num_constant.h"
+
+// Lexes a source again with retokenize after each of a few thousand random edits and checks that the tokens, their
+// payloads and the line table come out the same as a full tokenize of the edited source. Both with literals
+// concatenated and with raw preprocessing tokens. Edits the lexer rejects have to leave the tokens of the source
+// before them alone.
+
+#define CHECK_EDITS 4000
+#define CHECK_MAX_SOURCE 4096
+
+static const char base_source[] =
+	"#include <stdio.h>\n"
+	"#define CAT(a, b) a ## b\n"
+	"/* a block\n   comment */\n"
+	"static const char *s = \"one\" \"two\" u8\"three\";\n"
+	"int f(int a, ...) { return a ? a->b.c : 'x' + 0x1fu + 1.5e+3 + .5; }\n"
+	"// a line comment\\\n"
+	"that goes on\n"
+	"int v = a<<=b %:%: c <: 1 :> <% %> ..x;\n"
+	"char *t = \"sp\\\n"
+	"liced\";\n"
+	"int ma\\\n"
+	"in(void) { return L'a' + U\"w\"[0]; }\n";
+
+// what edits insert, the last few can leave a literal or a comment open
+static const char *const snippets[] = {
+	".", "..", "...", "%", ":", "%:", "%:%", "<", ":", ">", "=", "-", "+", "#", "##", "e+", "p-", "1", "0x", "x",
+	"u8", "L", "U", "u", " ", "\t", "\n", "\\\n", "\\\r\n", "\"s\"", "'c'", "/* c */", "// c\n", "/", "*", "\"", "'",
+};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15u;
+
+static uint32_t rng(uint32_t bound)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (uint32_t)(rng_state % bound);
+}
+
+static TokenData *tokenize_mode(const char *source, uint32_t size, int raw)
+{
+	CharBuffer cb;
+	cb_init_view(&cb, source, 0, size);
+	return tokenize_parallel(&cb, 1, raw);
+}
+
+static int same_literal(const TokenData *a, uint32_t a_idx, const TokenData *b, uint32_t b_idx)
+{
+	uint32_t a_len = string_literal_max_len(a, a_idx);
+	uint32_t b_len = string_literal_max_len(b, b_idx);
+	char *a_text = malloc(a_len + 1);
+	char *b_text = malloc(b_len + 1);
+	int same = a_text && b_text;
+	if (same)
+	{
+		a_len = decode_string_literal(a, a_idx, a_text);
+		b_len = decode_string_literal(b, b_idx, b_text);
+		same = a_len == b_len && memcmp(a_text, b_text, a_len) == 0;
+	}
+
+	free(a_text);
+	free(b_text);
+	return same;
+}
+
+static int same_payload(const TokenData *a, const TokenData *b, uint32_t i)
+{
+	uint32_t pa = a->payloads[i];
+	uint32_t pb = b->payloads[i];
+	switch (a->kinds[i])
+	{
+	case TOK_IDENTIFIER:
+	{
+		uint32_t len = intern_len(a->identifiers, pa);
+		return len == intern_len(b->identifiers, pb) &&
+		       memcmp(intern_str(a->identifiers, pa), intern_str(b->identifiers, pb), len) == 0;
+	}
+	case TOK_STRING_LITERAL:
+		return same_literal(a, pa, b, pb);
+	case TOK_NUMERICAL_CONSTANT:
+	{
+		const NumConstant *na = &a->num_constants->constants[pa];
+		const NumConstant *nb = &b->num_constants->constants[pb];
+		return na->int_value == nb->int_value && na->floating == nb->floating &&
+		       (na->floating ? na->float_value == nb->float_value && na->floating_type == nb->floating_type
+		                     : na->int_type == nb->int_type);
+	}
+	case TOK_INVALID:
+		return a->invalid_tokens[pa].error == b->invalid_tokens[pb].error &&
+		       a->invalid_tokens[pa].len == b->invalid_tokens[pb].len;
+	default:
+		return pa == pb;
+	}
+}
+
+// Returns the index of the first token that differs between the two, or of the token past the last one when only
+// the line tables do. -1 when they are the same.
+static long long first_difference(const TokenData *a, const TokenData *b)
+{
+	uint32_t count = a->_tok_idx < b->_tok_idx ? a->_tok_idx : b->_tok_idx;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (a->kinds[i] != b->kinds[i] || a->offsets[i] != b->offsets[i] || a->flags[i] != b->flags[i] ||
+		    !same_payload(a, b, i))
+			return i;
+	}
+
+	if (a->_tok_idx != b->_tok_idx || a->lines.count != b->lines.count ||
+	    memcmp(a->lines.starts, b->lines.starts, a->lines.count * sizeof(uint32_t)) != 0)
+		return count;
+
+	return -1;
+}
+
+static void print_source(const char *source, uint32_t size)
+{
+	fprintf(stderr, "source:\n%.*s\n", (int)size, source);
+}
+
+// Returns the number of failed checks
+static int check_mode(const char *name, int raw)
+{
+	uint32_t size = sizeof(base_source) - 1;
+	char *source = malloc(size);
+	if (!source)
+		return 1;
+	memcpy(source, base_source, size);
+
+	TokenData *td = tokenize_mode(source, size, raw);
+	if (!td)
+	{
+		fprintf(stderr, "%s: the initial source does not lex\n", name);
+		free(source);
+		return 1;
+	}
+
+	int failures = 0;
+	int accepted = 0;
+	for (int n = 0; n < CHECK_EDITS && failures < 10; n++)
+	{
+		// replace a few chars at a random offset by a snippet, or by nothing once the source gets large
+		uint32_t start = rng(size + 1);
+		uint32_t old_len = rng(4);
+		if (old_len > size - start)
+			old_len = size - start;
+		const char *insert = "";
+		if (size < CHECK_MAX_SOURCE && rng(3))
+			insert = snippets[rng(sizeof(snippets) / sizeof(*snippets))];
+		uint32_t new_len = strlen(insert);
+
+		uint32_t new_size = size - old_len + new_len;
+		char *edited = malloc(new_size ? new_size : 1);
+		if (!edited)
+			break;
+		memcpy(edited, source, start);
+		memcpy(edited + start, insert, new_len);
+		memcpy(edited + start + new_len, source + start + old_len, size - start - old_len);
+
+		CharBuffer cb;
+		cb_init_view(&cb, edited, 0, new_size);
+		int failed = retokenize(td, &cb, start, start + old_len, start + new_len);
+		TokenData *expected = tokenize_mode(edited, new_size, raw);
+		if (failed != !expected)
+		{
+			fprintf(stderr, "%s: replacing %u chars at %u by \"%s\" %s with retokenize but %s with tokenize\n", name,
+			        old_len, start, insert, failed ? "fails" : "lexes", expected ? "lexes" : "fails");
+			print_source(edited, new_size);
+			failures++;
+		}
+
+		// the tokens of the source before the edit are kept when it does not lex
+		if (failed)
+		{
+			if (expected)
+				free_token_data(expected);
+			expected = tokenize_mode(source, size, raw);
+			free(edited);
+		}
+		else
+		{
+			free(source);
+			source = edited;
+			size = new_size;
+			accepted++;
+		}
+
+		long long diff = expected ? first_difference(td, expected) : -1;
+		if (diff >= 0)
+		{
+			fprintf(stderr, "%s: replacing %u chars at %u by \"%s\" gives a different token %lld than tokenize\n", name,
+			        old_len, start, insert, diff);
+			print_source(source, size);
+			failures++;
+
+			// go on from the right tokens so one mistake is only reported once
+			free_token_data(td);
+			td = expected;
+			expected = NULL;
+		}
+
+		if (expected)
+			free_token_data(expected);
+	}
+
+	fprintf(stderr, "%s: %d edits lexed again, %d failed checks\n", name, accepted, failures);
+	free_token_data(td);
+	free(source);
+	return failures;
+}
+
+// "a ..b;" with a period inserted before the b is an ellipsis, which takes going back over both periods to find out
+static int check_ellipsis(void)
+{
+	static const char before[] = "a ..b;";
+	static const char after[] = "a ...b;";
+
+	TokenData *td = tokenize_mode(before, sizeof(before) - 1, 0);
+	if (!td)
+		return 1;
+
+	CharBuffer cb;
+	cb_init_view(&cb, after, 0, sizeof(after) - 1);
+	int failed = retokenize(td, &cb, 4, 4, 5);
+	int ok = !failed && td->_tok_idx == 4 && td->kinds[1] == TOK_ELLIPSIS && td->kinds[2] == TOK_IDENTIFIER;
+	if (!ok)
+		fprintf(stderr, "inserting a period into \"%s\" does not give an ellipsis\n", before);
+
+	free_token_data(td);
+	return !ok;
+}
+
+int main(void)
+{
+	// the errors the lexer prints about edits that do not lex are expected, the checks report to stderr
+	if (!freopen("/dev/null", "w", stdout))
+		return EXIT_FAILURE;
+
+	int failures = check_ellipsis();
+	failures += check_mode("tokenize", 0);
+	failures += check_mode("raw", 1);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
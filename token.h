@@ -1,132 +1,239 @@
 #pragma once
 
+#include "arena.h"
+#include "intern.h"
+#include "num_constant.h"
+
+// clang-format off
+// Single source of truth for every token. The Token enum, debug_tokens, the keyword tables in the lexer and the
+// generated keyword hash are all expanded from these lists so they cannot drift apart.
+
+// X(NAME, spelling)
+#define TOKEN_KEYWORDS(X) \
+	X(AUTO, "auto") \
+	X(BREAK, "break") \
+	X(CASE, "case") \
+	X(CHAR, "char") \
+	X(CONST, "const") \
+	X(CONTINUE, "continue") \
+	X(DEFAULT, "default") \
+	X(DO, "do") \
+	X(DOUBLE, "double") \
+	X(ELSE, "else") \
+	X(ENUM, "enum") \
+	X(EXTERN, "extern") \
+	X(FLOAT, "float") \
+	X(FOR, "for") \
+	X(GOTO, "goto") \
+	X(IF, "if") \
+	X(INLINE, "inline") \
+	X(INT, "int") \
+	X(LONG, "long") \
+	X(REGISTER, "register") \
+	X(RESTRICT, "restrict") \
+	X(RETURN, "return") \
+	X(SHORT, "short") \
+	X(SIGNED, "signed") \
+	X(SIZEOF, "sizeof") \
+	X(STATIC, "static") \
+	X(STRUCT, "struct") \
+	X(SWITCH, "switch") \
+	X(TYPEDEF, "typedef") \
+	X(UNION, "union") \
+	X(UNSIGNED, "unsigned") \
+	X(VOID, "void") \
+	X(VOLATILE, "volatile") \
+	X(WHILE, "while") \
+	X(ALIGNAS, "_Alignas") \
+	X(ALIGNOF, "_Alignof") \
+	X(ATOMIC, "_Atomic") \
+	X(BOOL, "_Bool") \
+	X(COMPLEX, "_Complex") \
+	X(GENERIC, "_Generic") \
+	X(IMAGINARY, "_Imaginary") \
+	X(NORETURN, "_Noreturn") \
+	X(STATIC_ASSERT, "_Static_assert") \
+	X(THREAD_LOCAL, "_Thread_local")
+
+// X(NAME)
+#define TOKEN_GENERAL(X) \
+	X(IDENTIFIER) \
+	X(CHAR_LITERAL) \
+	X(NUMERICAL_CONSTANT) \
+	X(STRING_LITERAL) \
+	X(INVALID)
+
+// X(NAME, spelling)
+#define TOKEN_PUNCTUATORS(X) \
+	X(OPEN_SQR_BRACK, "[") \
+	X(CLOSE_SQR_BRACK, "]") \
+	X(OPEN_PAREN, "(") \
+	X(CLOSE_PAREN, ")") \
+	X(OPEN_BRACK, "{") \
+	X(CLOSE_BRACK, "}") \
+	X(PERIOD, ".") \
+	X(RIGHT_ARROW, "->") \
+	X(INCREMENT, "++") \
+	X(DECREMENT, "--") \
+	X(AMPERSAND, "&") \
+	X(STAR, "*") \
+	X(PLUS, "+") \
+	X(MINUS, "-") \
+	X(TILDE, "~") \
+	X(BANG, "!") \
+	X(FORWARD_SLASH, "/") \
+	X(PERCENT, "%") \
+	X(BIT_SHIFT_LEFT, "<<") \
+	X(BIT_SHIFT_RIGHT, ">>") \
+	X(LSS, "<") \
+	X(GTR, ">") \
+	X(LSS_EQL, "<=") \
+	X(GTR_EQL, ">=") \
+	X(EQUALITY, "==") \
+	X(EQUALITY_NOT, "!=") \
+	X(CARET, "^") \
+	X(PIPE, "|") \
+	X(AND, "&&") \
+	X(OR, "||") \
+	X(COLON, ":") \
+	X(SEMI_COLON, ";") \
+	X(EQUAL, "=") \
+	X(COMMA, ",") \
+	X(ELLIPSIS, "...") \
+	X(QUESTION, "?") \
+	X(HASH, "#") \
+	X(DOUBLE_HASH, "##") \
+	X(STAR_EQL, "*=") \
+	X(FORWARD_SLASH_EQL, "/=") \
+	X(PERCENT_EQL, "%=") \
+	X(PLUS_EQL, "+=") \
+	X(MINUS_EQL, "-=") \
+	X(BIT_SHIFT_LEFT_EQL, "<<=") \
+	X(BIT_SHIFT_RIGHT_EQL, ">>=") \
+	X(AMPERSAND_EQL, "&=") \
+	X(CARET_EQL, "^=") \
+	X(PIPE_EQL, "|=")
+
+// Alternative spellings (C11 6.4.6p3), X(NAME, spelling) where NAME is the punctuator they stand for
+#define TOKEN_DIGRAPHS(X) \
+	X(OPEN_SQR_BRACK, "<:") \
+	X(CLOSE_SQR_BRACK, ":>") \
+	X(OPEN_BRACK, "<%") \
+	X(CLOSE_BRACK, "%>") \
+	X(HASH, "%:") \
+	X(DOUBLE_HASH, "%:%:")
+
+#define TOKEN_ENUM_NAME(name, ...) TOK_##name,
+
 // Not all tokens are going to be implemented yet
 typedef enum Token
 {
 	TOK_NO_TOKEN = -1,
 
 	// KEYWORDS
-	TOK_AUTO,
-	TOK_BREAK,
-	TOK_CASE,
-	TOK_CHAR,
-	TOK_CONST,
-	TOK_CONTINUE,
-	TOK_DEFAULT,
-	TOK_DO,
-	TOK_DOUBLE,
-	TOK_ELSE,
-	TOK_ENUM,
-	TOK_FLOAT,
-	TOK_FOR,
-	TOK_GOTO,
-	TOK_IF,
-	TOK_INLINE,
-	TOK_INT,
-	TOK_LONG,
-	TOK_RETURN,
-	TOK_SHORT,
-	TOK_SIGNED,
-	TOK_SIZEOF,
-	TOK_STATIC,
-	TOK_STRUCT,
-	TOK_SWITCH,
-	TOK_TYPEDEF,
-	TOK_UNION,
-	TOK_UNSIGNED,
-	TOK_VOID,
-	TOK_WHILE,
+	TOKEN_KEYWORDS(TOKEN_ENUM_NAME)
 
 	// GENERAL
-	TOK_IDENTIFIER,
-	TOK_CHAR_LITERAL,
-	TOK_NUMERICAL_CONSTANT,
-	TOK_STRING_LITERAL,
+	TOKEN_GENERAL(TOKEN_ENUM_NAME)
 
 	// PUNCTUATORS
-	TOK_OPEN_SQR_BRACK,
-	TOK_CLOSE_SQR_BRACK,
-	TOK_OPEN_PAREN,
-	TOK_CLOSE_PAREN,
-	TOK_OPEN_BRACK,
-	TOK_CLOSE_BRACK,
-	TOK_PERIOD,
-	TOK_RIGHT_ARROW,
-	TOK_INCREMENT,
-	TOK_DECREMENT,
-	TOK_AMPERSAND,
-	TOK_STAR,
-	TOK_PLUS,
-	TOK_MINUS,
-	TOK_TILDE,
-	TOK_BANG,
-	TOK_FORWARD_SLASH,
-	TOK_PERCENT,
-	TOK_BIT_SHIFT_LEFT,
-	TOK_BIT_SHIFT_RIGHT,
-	TOK_LSS,
-	TOK_GTR,
-	TOK_LSS_EQL,
-	TOK_GTR_EQL,
-	TOK_EQUALITY,
-	TOK_EQUALITY_NOT,
-	TOK_CARET,
-	TOK_PIPE,
-	TOK_AND,
-	TOK_OR,
-	TOK_COLON,
-	TOK_SEMI_COLON,
-	TOK_EQUAL,
-	TOK_COMMA,
+	TOKEN_PUNCTUATORS(TOKEN_ENUM_NAME)
+
+	TOK_COUNT
 } Token;
+// clang-format on
+
+_Static_assert(TOK_COUNT <= 256, "token kinds are stored in a single byte");
+
+#define TOK_FIRST_KEYWORD TOK_AUTO
+#define TOK_LAST_KEYWORD TOK_THREAD_LOCAL
 
-typedef enum int_types
+// Raw chars between the quotes of one string literal token, escape sequences are left undecoded. ptr points into
+// the source when it is resident in memory and into the TokenData arena when it was streamed.
+typedef struct StringSpan
 {
-	INT_TYPE_SIGNED_LLONG,
-	INT_TYPE_UNSIGNED_LLONG,
-	INT_TYPE_SIGNED_LONG,
-	INT_TYPE_UNSIGNED_LONG,
-	INT_TYPE_SIGNED_INT,
-	INT_TYPE_UNSIGNED_INT
-} int_types;
-
-typedef enum floating_types
+	const char *ptr;
+	uint32_t len;
+} StringSpan;
+
+// Adjacent string literal tokens are concatenated into a single literal made of consecutive spans
+typedef struct StringLiteral
 {
-	FLOATING_TYPE_DOUBLE,
-	FLOATING_TYPE_FLOAT,
-	FLOATING_TYPE_LDOUBLE
-} floating_types;
+	uint32_t first_span;
+	uint32_t num_spans;
+} StringLiteral;
 
-typedef struct NumConstant
+// Text the lexer could not make a valid token of, only produced when lexing preprocessing tokens. Skipped groups may
+// hold anything, so the error is only reported if the preprocessor actually gets to use the token.
+typedef struct InvalidToken
 {
-	int base;
-	int before_point;
-	int after_point;
-	int floating;
-	int exponent;
-	floating_types floating_type;
-	int_types int_type;
-} NumConstant;
+	const char *error;
 
-typedef struct TokenData
+	// length of the text in the source
+	uint32_t len;
+
+	// the text of a pp-number made by ##, which is in no source, NULL for the others
+	const char *text;
+} InvalidToken;
+
+// Source offset at which each line starts, starts[0] is where the source starts. Token positions are only turned into
+// a line and column through line_location when they are needed for a diagnostic.
+typedef struct LineTable
 {
-	int _overflow;
+	uint32_t *starts;
+	uint32_t count;
+	uint32_t _cap;
+} LineTable;
 
-	int _buf_max_size;
-	int _str_buf_max_size;
+typedef struct TokenData
+{
+	// owns every allocation below, including the TokenData itself
+	Arena _arena;
 
-	int _str_lit_max_len;
-	int _ident_max_len;
+	// set when an allocation failed
+	int _out_of_memory;
 
 	int _tok_idx;
-	int _ident_idx;
 	int _str_lit_idx;
-	int _num_const_idx;
-	int _line_num_idx;
-
-	Token *tokens;
-	char **identifiers;
-	char **string_literals;
-	NumConstant **num_constants;
-	int *line_numbers;
+	int _str_span_idx;
+
+	uint32_t _tok_cap;
+	uint32_t _str_lit_cap;
+	uint32_t _str_span_cap;
+
+	// the source string spans point into, NULL when it was streamed and the spans are copies
+	const char *_source;
+
+	// set when the tokens are preprocessing tokens (LexerState.raw), retokenize lexes the same way
+	int _raw;
+
+	// identifiers, char literals and streamed string literals are assembled here before being used
+	char *_scratch;
+	uint32_t _scratch_cap;
+
+	// The token stream as built by tokenize, one entry per token in each array. lexer_next hands tokens out one at a
+	// time instead and leaves these empty. offsets holds the source offset of the first char of
+	// the token. payloads holds the interned id for identifiers, the value for char literals, the index into
+	// string_literals, num_constants->constants or invalid_tokens for those, and the length in chars for everything
+	// else. flags holds the TOKEN_FLAG_* bits of lexer.h.
+	uint8_t *kinds;
+	uint32_t *offsets;
+	uint32_t *payloads;
+	uint8_t *flags;
+
+	InternTable *identifiers;
+	StringLiteral *string_literals;
+	StringSpan *string_spans;
+	NumConstantPool *num_constants;
+
+	InvalidToken *invalid_tokens;
+	uint32_t num_invalid_tokens;
+	uint32_t _invalid_cap;
+
+	// lines of the source lexed by tokenize or lexer_init, lines[0] starts at 0
+	LineTable lines;
+
+	// chars the lexer went past between tokens, for --stats
+	unsigned long whitespace_bytes;
+	unsigned long comment_bytes;
 } TokenData;
@@ -0,0 +1,512 @@
+#include "token_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TOKEN_CACHE_MAGIC "CCTOKENS"
+
+// longest path of a cache file
+#define TOKEN_CACHE_MAX_PATH 4096
+
+// first chunk of the arena the arrays of a store are built in
+#define TOKEN_CACHE_SCRATCH_CHUNK (64 * 1024)
+
+// Start of every cache file. Sections are found by their offset from the start of the file, so the file means the same
+// wherever it is mapped.
+typedef struct TokenCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t num_token_kinds;
+
+	uint64_t hash;
+	uint64_t source_size;
+
+	uint32_t num_tokens;
+	uint32_t num_lines;
+	uint32_t num_identifiers;
+	uint32_t num_literals;
+	uint32_t num_constants;
+	uint32_t num_invalid;
+	uint32_t strings_size;
+	uint32_t _pad;
+
+	uint64_t kinds;
+	uint64_t flags;
+	uint64_t offsets;
+	uint64_t payloads;
+	uint64_t lines;
+	uint64_t identifiers;
+	uint64_t literals;
+	uint64_t constants;
+	uint64_t invalid_tokens;
+	uint64_t strings;
+	uint64_t file_size;
+
+	// token_cache_hash of everything after the header, so a damaged file is never used
+	uint64_t checksum;
+} TokenCacheHeader;
+
+int token_cache_init(TokenCache *tc, const char *dir)
+{
+	tc->dir = dir;
+	atomic_init(&tc->hits, 0);
+	atomic_init(&tc->misses, 0);
+	atomic_init(&tc->stores, 0);
+	atomic_init(&tc->rejected, 0);
+
+	if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+	{
+		printf("Error: failed to create the token cache directory %s\n", dir);
+		return 1;
+	}
+	return 0;
+}
+
+void token_cache_print_stats(const TokenCache *tc)
+{
+	unsigned hits = atomic_load(&tc->hits);
+	unsigned misses = atomic_load(&tc->misses);
+	unsigned lookups = hits + misses;
+
+	printf("\nToken cache (%s):\n", tc->dir ? tc->dir : "disabled");
+	printf("# hits: %u (%.1f%%)\n", hits, lookups ? 100.0 * hits / lookups : 0.0);
+	printf("# misses: %u (%.1f%%)\n", misses, lookups ? 100.0 * misses / lookups : 0.0);
+	printf("# stored: %u\n", atomic_load(&tc->stores));
+	printf("# rejected: %u\n", atomic_load(&tc->rejected));
+}
+
+uint64_t token_cache_hash(const char *source, unsigned long size)
+{
+	// 8 chars at a time, multiply and rotate to mix
+	uint64_t h = 0x9E3779B97F4A7C15ull ^ size;
+	unsigned long i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t w;
+		memcpy(&w, source + i, 8);
+		h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+		h = (h << 31) | (h >> 33);
+	}
+
+	uint64_t tail = 0;
+	memcpy(&tail, source + i, size - i);
+	h = (h ^ tail) * 0xC4CEB9FE1A85EC53ull;
+	return h ^ (h >> 29);
+}
+
+static void cache_path(const TokenCache *tc, uint64_t hash, char *path)
+{
+	snprintf(path, TOKEN_CACHE_MAX_PATH, "%s/%016llx.tok", tc->dir, (unsigned long long)hash);
+}
+
+int token_cache_section_fits(uint64_t offset, uint64_t count, uint64_t elem_size, uint64_t file_size)
+{
+	return offset <= file_size && count <= (file_size - offset) / elem_size;
+}
+
+CachedTokens *token_cache_load(TokenCache *tc, uint64_t hash, unsigned long size)
+{
+	char path[TOKEN_CACHE_MAX_PATH];
+	cache_path(tc, hash, path);
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		atomic_fetch_add(&tc->misses, 1);
+		return NULL;
+	}
+
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(TokenCacheHeader))
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	CachedTokens *ct = map != MAP_FAILED ? mem_calloc(1, sizeof(CachedTokens)) : NULL;
+	if (!ct)
+	{
+		if (map != MAP_FAILED)
+			munmap(map, st.st_size);
+		atomic_fetch_add(&tc->rejected, 1);
+		atomic_fetch_add(&tc->misses, 1);
+		return NULL;
+	}
+
+	// the layout is checked here, payloads as the tokens are read
+	const TokenCacheHeader *h = map;
+	uint64_t file_size = st.st_size;
+	if (memcmp(h->magic, TOKEN_CACHE_MAGIC, 8) != 0 || h->version != TOKEN_CACHE_VERSION ||
+	    h->num_token_kinds != TOK_COUNT || h->hash != hash || h->source_size != size || h->file_size != file_size ||
+	    !token_cache_section_fits(h->kinds, h->num_tokens, 1, file_size) ||
+	    !token_cache_section_fits(h->flags, h->num_tokens, 1, file_size) ||
+	    !token_cache_section_fits(h->offsets, h->num_tokens, 4, file_size) ||
+	    !token_cache_section_fits(h->payloads, h->num_tokens, 4, file_size) ||
+	    !token_cache_section_fits(h->lines, h->num_lines, 4, file_size) ||
+	    !token_cache_section_fits(h->identifiers, h->num_identifiers, sizeof(TokenCacheString), file_size) ||
+	    !token_cache_section_fits(h->literals, h->num_literals, sizeof(TokenCacheString), file_size) ||
+	    !token_cache_section_fits(h->constants, h->num_constants, sizeof(TokenCacheConstant), file_size) ||
+	    !token_cache_section_fits(h->invalid_tokens, h->num_invalid, sizeof(TokenCacheString), file_size) ||
+	    !token_cache_section_fits(h->strings, h->strings_size, 1, file_size) || h->num_lines == 0 ||
+	    h->checksum != token_cache_hash((const char *)map + sizeof(TokenCacheHeader), file_size - sizeof(TokenCacheHeader)))
+	{
+		munmap(map, st.st_size);
+		mem_free(ct);
+		atomic_fetch_add(&tc->rejected, 1);
+		atomic_fetch_add(&tc->misses, 1);
+		return NULL;
+	}
+
+	const char *base = map;
+	ct->_map = map;
+	ct->_map_size = st.st_size;
+	ct->num_tokens = h->num_tokens;
+	ct->kinds = (const uint8_t *)(base + h->kinds);
+	ct->flags = (const uint8_t *)(base + h->flags);
+	ct->offsets = (const uint32_t *)(base + h->offsets);
+	ct->payloads = (const uint32_t *)(base + h->payloads);
+
+	// the mapping is read only, nothing writes to a line table once it is complete
+	ct->lines = (LineTable){(uint32_t *)(base + h->lines), h->num_lines, h->num_lines};
+
+	ct->num_identifiers = h->num_identifiers;
+	ct->num_literals = h->num_literals;
+	ct->num_constants = h->num_constants;
+	ct->num_invalid = h->num_invalid;
+	ct->identifiers = (const TokenCacheString *)(base + h->identifiers);
+	ct->literals = (const TokenCacheString *)(base + h->literals);
+	ct->constants = (const TokenCacheConstant *)(base + h->constants);
+	ct->invalid_tokens = (const TokenCacheString *)(base + h->invalid_tokens);
+	ct->strings = base + h->strings;
+	ct->strings_size = h->strings_size;
+	ct->source_size = size;
+
+	atomic_fetch_add(&tc->hits, 1);
+	return ct;
+}
+
+void token_cache_unmap(CachedTokens *ct)
+{
+	munmap(ct->_map, ct->_map_size);
+	mem_free(ct);
+}
+
+uint64_t token_cache_image_append(TokenCacheImage *img, const void *data, uint64_t size, uint64_t align)
+{
+	uint64_t offset = (img->size + align - 1) & ~(align - 1);
+	if (offset + size > img->cap)
+	{
+		uint64_t cap = img->cap ? img->cap * 2 : 64 * 1024;
+		while (cap < offset + size)
+			cap *= 2;
+
+		char *grown = mem_realloc(img->data, cap);
+		if (!grown)
+		{
+			img->failed = 1;
+			return 0;
+		}
+		img->data = grown;
+		img->cap = cap;
+	}
+
+	if (offset > img->size)
+		memset(img->data + img->size, 0, offset - img->size);
+	if (size)
+		memcpy(img->data + offset, data, size);
+	img->size = offset + size;
+	return offset;
+}
+
+int token_cache_write_image(const TokenCacheImage *img, const char *path)
+{
+	char tmp_path[TOKEN_CACHE_MAX_PATH];
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= (int)sizeof(tmp_path))
+		return 1;
+
+	// mkstemp makes the file private, cache files are meant to be shared like the headers they hold
+	int fd = mkstemp(tmp_path);
+	if (fd < 0)
+		return 1;
+
+	fchmod(fd, 0644);
+	uint64_t written = 0;
+	while (written < img->size)
+	{
+		ssize_t n = write(fd, img->data + written, img->size - written);
+		if (n <= 0)
+			break;
+		written += n;
+	}
+	close(fd);
+
+	if (written == img->size && rename(tmp_path, path) == 0)
+		return 0;
+
+	unlink(tmp_path);
+	return 1;
+}
+
+// Gives every distinct global index a local one in order of first appearance, map holds local + 1 per global index
+static int local_index(Arena *arena, uint32_t **map, uint32_t *map_cap, uint32_t global, uint32_t *count, int *is_new)
+{
+	if (global >= *map_cap)
+	{
+		uint32_t cap = *map_cap ? *map_cap : 256;
+		while (cap <= global)
+			cap *= 2;
+
+		uint32_t *grown = arena_grow(arena, *map, *map_cap * sizeof(uint32_t), cap * sizeof(uint32_t));
+		if (!grown)
+			return -1;
+		memset(grown + *map_cap, 0, (cap - *map_cap) * sizeof(uint32_t));
+		*map = grown;
+		*map_cap = cap;
+	}
+
+	*is_new = !(*map)[global];
+	if (*is_new)
+		(*map)[global] = ++*count;
+	return (*map)[global] - 1;
+}
+
+void token_cache_store(TokenCache *tc, uint64_t hash, const char *source, unsigned long size, const TokenData *td,
+                       const LexedToken *tokens, uint32_t num_tokens, const LineTable *lines)
+{
+	// everything but the image is only needed until it is written
+	Arena scratch;
+	arena_init(&scratch, TOKEN_CACHE_SCRATCH_CHUNK);
+	uint32_t n = num_tokens ? num_tokens : 1;
+	uint8_t *kinds = arena_alloc(&scratch, n);
+	uint8_t *flags = arena_alloc(&scratch, n);
+	uint32_t *offsets = arena_alloc(&scratch, n * sizeof(uint32_t));
+	uint32_t *payloads = arena_alloc(&scratch, n * sizeof(uint32_t));
+
+	// per kind of payload, the entries in order of their local index
+	TokenCacheString *identifiers = arena_alloc(&scratch, n * sizeof(TokenCacheString));
+	TokenCacheString *literals = arena_alloc(&scratch, n * sizeof(TokenCacheString));
+	TokenCacheConstant *constants = arena_alloc(&scratch, n * sizeof(TokenCacheConstant));
+	TokenCacheString *invalid = arena_alloc(&scratch, n * sizeof(TokenCacheString));
+	uint32_t num_identifiers = 0, num_literals = 0, num_constants = 0, num_invalid = 0;
+
+	uint32_t *ident_map = NULL, *const_map = NULL;
+	uint32_t ident_cap = 0, const_cap = 0;
+	TokenCacheImage strings = {0};
+	TokenCacheImage img = {0};
+	int failed = !kinds || !flags || !offsets || !payloads || !identifiers || !literals || !constants || !invalid;
+
+	for (uint32_t i = 0; i < num_tokens && !failed; i++)
+	{
+		const LexedToken *tok = &tokens[i];
+		uint32_t payload = tok->payload;
+		int is_new = 0;
+
+		// the index of the payload in the cache, -1 when it cannot be stored
+		int local = -1;
+
+		switch (tok->kind)
+		{
+		case TOK_IDENTIFIER:
+			local = local_index(&scratch, &ident_map, &ident_cap, payload, &num_identifiers, &is_new);
+			if (local >= 0 && is_new)
+			{
+				uint32_t len = intern_len(td->identifiers, payload);
+				uint64_t offset =
+					token_cache_image_append(&strings, intern_str(td->identifiers, payload), len, 1);
+				identifiers[local] = (TokenCacheString){(uint32_t)offset, len};
+			}
+			break;
+
+		case TOK_STRING_LITERAL: {
+			// raw literals are a single span right in the header
+			const StringLiteral *lit = &td->string_literals[payload];
+			const StringSpan *span = &td->string_spans[lit->first_span];
+			if (lit->num_spans != 1 || span->ptr < source || span->ptr + span->len > source + size)
+				break;
+
+			local = num_literals;
+			literals[num_literals++] = (TokenCacheString){(uint32_t)(span->ptr - source), span->len};
+			break;
+		}
+
+		case TOK_NUMERICAL_CONSTANT:
+			local = local_index(&scratch, &const_map, &const_cap, payload, &num_constants, &is_new);
+			if (local >= 0 && is_new)
+			{
+				const NumConstant *nc = &td->num_constants->constants[payload];
+				constants[local] = (TokenCacheConstant){nc->int_value, nc->float_value, nc->floating,
+				                                        nc->floating_type, nc->int_type, {0}};
+			}
+			break;
+
+		case TOK_INVALID: {
+			const InvalidToken *inv = &td->invalid_tokens[payload];
+			uint64_t offset = token_cache_image_append(&strings, inv->error, strlen(inv->error) + 1, 1);
+			local = num_invalid;
+			invalid[num_invalid++] = (TokenCacheString){(uint32_t)offset, inv->len};
+			break;
+		}
+
+		default:
+			local = payload;
+			break;
+		}
+
+		failed |= local < 0 || strings.failed || strings.size > UINT32_MAX;
+		kinds[i] = tok->kind;
+		flags[i] = tok->flags;
+		offsets[i] = tok->offset;
+		payloads[i] = local;
+	}
+
+	if (!failed)
+	{
+		TokenCacheHeader h = {0};
+		memcpy(h.magic, TOKEN_CACHE_MAGIC, 8);
+		h.version = TOKEN_CACHE_VERSION;
+		h.num_token_kinds = TOK_COUNT;
+		h.hash = hash;
+		h.source_size = size;
+		h.num_tokens = num_tokens;
+		h.num_lines = lines->count;
+		h.num_identifiers = num_identifiers;
+		h.num_literals = num_literals;
+		h.num_constants = num_constants;
+		h.num_invalid = num_invalid;
+		h.strings_size = strings.size;
+
+		token_cache_image_append(&img, &h, sizeof(h), 8);
+		h.kinds = token_cache_image_append(&img, kinds, num_tokens, 8);
+		h.flags = token_cache_image_append(&img, flags, num_tokens, 8);
+		h.offsets = token_cache_image_append(&img, offsets, num_tokens * sizeof(uint32_t), 8);
+		h.payloads = token_cache_image_append(&img, payloads, num_tokens * sizeof(uint32_t), 8);
+		h.lines = token_cache_image_append(&img, lines->starts, lines->count * sizeof(uint32_t), 8);
+		h.identifiers =
+			token_cache_image_append(&img, identifiers, num_identifiers * sizeof(TokenCacheString), 8);
+		h.literals = token_cache_image_append(&img, literals, num_literals * sizeof(TokenCacheString), 8);
+		h.constants =
+			token_cache_image_append(&img, constants, num_constants * sizeof(TokenCacheConstant), 8);
+		h.invalid_tokens =
+			token_cache_image_append(&img, invalid, num_invalid * sizeof(TokenCacheString), 8);
+		h.strings = token_cache_image_append(&img, strings.data, strings.size, 8);
+		h.file_size = img.size;
+		failed = img.failed;
+		if (!failed)
+			h.checksum = token_cache_hash(img.data + sizeof(h), img.size - sizeof(h));
+		if (!failed)
+			memcpy(img.data, &h, sizeof(h));
+	}
+
+	// written under a temporary name and renamed, so a file that is there is always complete
+	if (!failed)
+	{
+		char path[TOKEN_CACHE_MAX_PATH];
+		cache_path(tc, hash, path);
+		if (token_cache_write_image(&img, path) == 0)
+			atomic_fetch_add(&tc->stores, 1);
+	}
+
+	arena_release(&scratch);
+	mem_free(strings.data);
+	mem_free(img.data);
+}
+
+// Checks that a string of the file is inside the section it points into
+static int string_fits(const TokenCacheString *s, uint64_t section_size)
+{
+	return s->offset <= section_size && s->len <= section_size - s->offset;
+}
+
+int token_cache_bind(const CachedTokens *ct, TokenData *td, const char *source, Arena *arena, TokenCacheBinding *b)
+{
+	b->identifiers = arena_alloc(arena, (ct->num_identifiers + 1) * sizeof(uint32_t));
+	b->constants = arena_alloc(arena, (ct->num_constants + 1) * sizeof(uint32_t));
+	if (!b->identifiers || !b->constants)
+		return -1;
+
+	for (uint32_t i = 0; i < ct->num_identifiers; i++)
+	{
+		const TokenCacheString *s = &ct->identifiers[i];
+		if (!string_fits(s, ct->strings_size))
+			return 1;
+
+		b->identifiers[i] = intern(td->identifiers, ct->strings + s->offset, s->len);
+		if (b->identifiers[i] == INTERN_NO_ID)
+			return -1;
+	}
+
+	for (uint32_t i = 0; i < ct->num_constants; i++)
+	{
+		const TokenCacheConstant *c = &ct->constants[i];
+		NumConstant nc = {c->int_value, c->float_value, c->floating, (floating_types)c->floating_type,
+		                  (int_types)c->int_type};
+		b->constants[i] = pool_num_constant(td->num_constants, &nc);
+		if (b->constants[i] == NUM_CONSTANT_NO_IDX)
+			return -1;
+	}
+
+	// literals and invalid tokens are added back to back, so a local index is just an offset from the first one
+	b->first_literal = td->_str_lit_idx;
+	for (uint32_t i = 0; i < ct->num_literals; i++)
+	{
+		const TokenCacheString *s = &ct->literals[i];
+		if (!string_fits(s, ct->source_size))
+			return 1;
+		StringSpan span = {source + s->offset, s->len};
+		if (append_string_literal(td, &span, 1) == UINT32_MAX)
+			return -1;
+	}
+
+	b->first_invalid = td->num_invalid_tokens;
+	for (uint32_t i = 0; i < ct->num_invalid; i++)
+	{
+		const TokenCacheString *s = &ct->invalid_tokens[i];
+		if (s->offset >= ct->strings_size || !memchr(ct->strings + s->offset, 0, ct->strings_size - s->offset))
+			return 1;
+		if (append_invalid_token(td, ct->strings + s->offset, s->len) == UINT32_MAX)
+			return -1;
+	}
+
+	return 0;
+}
+
+int token_cache_token(const CachedTokens *ct, const TokenCacheBinding *b, uint32_t idx, LexedToken *tok)
+{
+	uint32_t payload = ct->payloads[idx];
+	tok->kind = ct->kinds[idx];
+	tok->flags = ct->flags[idx] & (TOKEN_FLAG_BOL | TOKEN_FLAG_SPACE);
+	tok->offset = ct->offsets[idx];
+
+	switch (tok->kind)
+	{
+	case TOK_IDENTIFIER:
+		if (payload >= ct->num_identifiers)
+			return 1;
+		tok->payload = b->identifiers[payload];
+		return 0;
+	case TOK_STRING_LITERAL:
+		if (payload >= ct->num_literals)
+			return 1;
+		tok->payload = b->first_literal + payload;
+		return 0;
+	case TOK_NUMERICAL_CONSTANT:
+		if (payload >= ct->num_constants)
+			return 1;
+		tok->payload = b->constants[payload];
+		return 0;
+	case TOK_INVALID:
+		if (payload >= ct->num_invalid)
+			return 1;
+		tok->payload = b->first_invalid + payload;
+		return 0;
+	default:
+		tok->payload = payload;
+		return tok->kind >= TOK_COUNT;
+	}
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdatomic.h>
+
+#include "lexer.h"
+
+// Bumped whenever the file layout or the meaning of what is in it changes, files of other versions are ignored
+#define TOKEN_CACHE_VERSION 1
+
+// A directory of lexed headers, one file per distinct header content named after its hash. Every compile that sees a
+// header with the same contents maps the file instead of lexing the header again. One cache can be shared by any
+// number of translation units, also on separate threads.
+typedef struct TokenCache
+{
+	const char *dir;
+
+	// counted across every translation unit the cache was used for
+	atomic_uint hits;
+	atomic_uint misses;
+	atomic_uint stores;
+
+	// files that were there but could not be used, from another version or cut short
+	atomic_uint rejected;
+} TokenCache;
+
+// A string of a cache file, as an offset into a section of chars
+typedef struct TokenCacheString
+{
+	uint32_t offset;
+	uint32_t len;
+} TokenCacheString;
+
+// NumConstant with a layout that does not depend on the enums
+typedef struct TokenCacheConstant
+{
+	uint64_t int_value;
+	double float_value;
+	uint8_t floating;
+	uint8_t floating_type;
+	uint8_t int_type;
+	uint8_t _pad[5];
+} TokenCacheConstant;
+
+// A cache file or one of its string sections being put together in memory. Precompiled headers are written the same
+// way.
+typedef struct TokenCacheImage
+{
+	char *data;
+	uint64_t size;
+	uint64_t cap;
+	int failed;
+} TokenCacheImage;
+
+// The preprocessing tokens of one header as lexed raw, mapped from a cache file. All arrays point into the mapping and
+// are used in place. Payloads are local to the file: identifier payloads index identifiers, string literal ones
+// literals, numeric constant ones constants and invalid token ones invalid_tokens.
+typedef struct CachedTokens
+{
+	void *_map;
+	unsigned long _map_size;
+
+	uint32_t num_tokens;
+	const uint8_t *kinds;
+	const uint8_t *flags;
+	const uint32_t *offsets;
+	const uint32_t *payloads;
+
+	// the line starts of the header, ready to be used as its line table
+	LineTable lines;
+
+	uint32_t num_identifiers;
+	uint32_t num_literals;
+	uint32_t num_constants;
+	uint32_t num_invalid;
+	const TokenCacheString *identifiers;
+	const TokenCacheString *literals;
+	const TokenCacheConstant *constants;
+	const TokenCacheString *invalid_tokens;
+
+	// identifier names and invalid token errors, literal spans are offsets into the header itself
+	const char *strings;
+	uint32_t strings_size;
+
+	unsigned long source_size;
+} CachedTokens;
+
+// What the local payloads of a CachedTokens turn into in one TokenData
+typedef struct TokenCacheBinding
+{
+	uint32_t *identifiers;
+	uint32_t *constants;
+	uint32_t first_literal;
+	uint32_t first_invalid;
+} TokenCacheBinding;
+
+// Creates dir if it does not exist yet. Returns !0 after an error was printed.
+int token_cache_init(TokenCache *tc, const char *dir);
+
+void token_cache_print_stats(const TokenCache *tc);
+
+// Content hash the cache files are named after
+uint64_t token_cache_hash(const char *source, unsigned long size);
+
+// Checks that count entries of elem_size bytes at offset are inside a file of file_size bytes
+int token_cache_section_fits(uint64_t offset, uint64_t count, uint64_t elem_size, uint64_t file_size);
+
+// Appends size bytes to img at the next multiple of align and returns their offset, failed is set when out of memory
+uint64_t token_cache_image_append(TokenCacheImage *img, const void *data, uint64_t size, uint64_t align);
+
+// Writes img to path under a temporary name that is renamed after, so a file at path is always complete. Returns !0
+// when it could not be written.
+int token_cache_write_image(const TokenCacheImage *img, const char *path);
+
+// Maps the cached tokens of a header of size chars with the given hash. Returns NULL when there are none that can be
+// used, the caller is expected to lex the header and store it then.
+CachedTokens *token_cache_load(TokenCache *tc, uint64_t hash, unsigned long size);
+
+void token_cache_unmap(CachedTokens *ct);
+
+// Writes the raw tokens of a header to the cache. Their payloads are those of td and source is the header the
+// string literal spans point into. A file that cannot be written only means the next compile lexes the header again,
+// so nothing is reported.
+void token_cache_store(TokenCache *tc, uint64_t hash, const char *source, unsigned long size, const TokenData *td,
+                       const LexedToken *tokens, uint32_t num_tokens, const LineTable *lines);
+
+// Adds the identifiers, literals and constants of ct to td, source being the header the cache was loaded for. The
+// binding's arrays come from arena. Returns 1 when the file turns out to be corrupt and -1 when out of memory.
+int token_cache_bind(const CachedTokens *ct, TokenData *td, const char *source, Arena *arena, TokenCacheBinding *b);
+
+// Reads token idx of ct with its payload in terms of the TokenData b was bound to, tok->file is left alone. Returns
+// !0 when the file turns out to be corrupt.
+int token_cache_token(const CachedTokens *ct, const TokenCacheBinding *b, uint32_t idx, LexedToken *tok);
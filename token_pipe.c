@@ -0,0 +1,157 @@
+#include "token_pipe.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TOKEN_PIPE_MASK (TOKEN_PIPE_SIZE - 1)
+
+// Spins for a short while before giving the core away, the other side usually catches up within a batch
+static void backoff(int *spins)
+{
+	if (++*spins < 128)
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+	else
+	{
+		sched_yield();
+	}
+}
+
+static void *preprocessor_thread(void *arg)
+{
+	TokenPipe *pipe = arg;
+
+	// counters run freely and wrap, only their differences and their low bits are ever used
+	uint32_t written = 0;
+	uint32_t published = 0;
+	uint32_t released = 0;
+	int status = 1;
+
+	while (!atomic_load_explicit(&pipe->_cancel, memory_order_relaxed))
+	{
+		if (written - released == TOKEN_PIPE_SIZE)
+		{
+			// everything written has to be visible before waiting, otherwise the consumer could be waiting for it
+			if (published != written)
+			{
+				atomic_store_explicit(&pipe->_published, written, memory_order_release);
+				published = written;
+			}
+
+			int spins = 0;
+			while ((released = atomic_load_explicit(&pipe->_released, memory_order_acquire)) ==
+			           written - TOKEN_PIPE_SIZE &&
+			       !atomic_load_explicit(&pipe->_cancel, memory_order_relaxed))
+				backoff(&spins);
+
+			continue;
+		}
+
+		int res = pp_next(pipe->pp, &pipe->_ring[written & TOKEN_PIPE_MASK]);
+		if (res <= 0)
+		{
+			status = res < 0 ? -1 : 1;
+			break;
+		}
+
+		written++;
+		if (written - published >= TOKEN_PIPE_BATCH)
+		{
+			atomic_store_explicit(&pipe->_published, written, memory_order_release);
+			published = written;
+		}
+	}
+
+	// the status is only set after the last tokens are published, so a consumer that sees it sees all of them
+	atomic_store_explicit(&pipe->_published, written, memory_order_release);
+	atomic_store_explicit(&pipe->_status, status, memory_order_release);
+	return NULL;
+}
+
+int token_pipe_start(TokenPipe *pipe, Preprocessor *pp)
+{
+	memset(pipe, 0, sizeof(TokenPipe));
+	pipe->pp = pp;
+	atomic_init(&pipe->_published, 0);
+	atomic_init(&pipe->_status, 0);
+	atomic_init(&pipe->_released, 0);
+	atomic_init(&pipe->_cancel, 0);
+
+	// the preprocessor runs ahead of the consumer, which may never get as far as an error
+	pp->defer_errors = 1;
+
+	pipe->_ring = mem_alloc(TOKEN_PIPE_SIZE * sizeof(LexedToken));
+	if (!pipe->_ring)
+	{
+		pp->defer_errors = 0;
+		return 1;
+	}
+
+	if (pthread_create(&pipe->_thread, NULL, preprocessor_thread, pipe) != 0)
+	{
+		pp->defer_errors = 0;
+		mem_free(pipe->_ring);
+		return 1;
+	}
+
+	pipe->_running = 1;
+	return 0;
+}
+
+int token_pipe_next(TokenPipe *pipe, LexedToken *tok)
+{
+	if (pipe->_read == pipe->_available)
+	{
+		// give back everything read so far before waiting, the preprocessor thread may be waiting for room
+		atomic_store_explicit(&pipe->_released, pipe->_read, memory_order_release);
+
+		int spins = 0;
+		while ((pipe->_available = atomic_load_explicit(&pipe->_published, memory_order_acquire)) == pipe->_read)
+		{
+			int status = atomic_load_explicit(&pipe->_status, memory_order_acquire);
+			if (status)
+			{
+				// the last tokens may have been published between the two loads
+				pipe->_available = atomic_load_explicit(&pipe->_published, memory_order_acquire);
+				if (pipe->_available == pipe->_read)
+				{
+					if (status < 0)
+					{
+						pp_report_deferred_error(pipe->pp);
+						return -1;
+					}
+					return 0;
+				}
+				break;
+			}
+
+			backoff(&spins);
+		}
+	}
+
+	*tok = pipe->_ring[pipe->_read & TOKEN_PIPE_MASK];
+	pipe->_read++;
+
+	if (!(pipe->_read & (TOKEN_PIPE_BATCH - 1)))
+		atomic_store_explicit(&pipe->_released, pipe->_read, memory_order_release);
+
+	return 1;
+}
+
+void token_pipe_stop(TokenPipe *pipe)
+{
+	if (!pipe->_running)
+		return;
+
+	atomic_store_explicit(&pipe->_cancel, 1, memory_order_relaxed);
+	pthread_join(pipe->_thread, NULL);
+	pipe->pp->defer_errors = 0;
+
+	mem_free(pipe->_ring);
+	pipe->_ring = NULL;
+	pipe->_running = 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "preprocessor.h"
+
+// Tokens the preprocessor thread can run ahead of the parser, must be a power of two
+#define TOKEN_PIPE_SIZE (16 * 1024)
+
+// Tokens are published and released in batches of this size so the two threads rarely touch each other's counters
+#define TOKEN_PIPE_BATCH 256
+
+// Runs the preprocessor, and with it the lexer, on its own thread and hands its tokens to a single consumer through a
+// lock-free ring. Both sides only wait when the ring is empty or full.
+typedef struct TokenPipe
+{
+	Preprocessor *pp;
+	pthread_t _thread;
+
+	LexedToken *_ring;
+
+	// number of tokens the preprocessor thread has made visible to the consumer, only written by the preprocessor thread
+	_Alignas(64) atomic_uint _published;
+
+	// set by the preprocessor thread after its last token was published, 1 at the end of the source and -1 after an error
+	atomic_int _status;
+
+	// number of tokens the consumer is done with, only written by the consumer
+	_Alignas(64) atomic_uint _released;
+
+	// set by the consumer to make the preprocessor thread stop early
+	atomic_int _cancel;
+
+	// consumer side copies, _available is the last value of _published seen
+	_Alignas(64) uint32_t _read;
+	uint32_t _available;
+
+	int _running;
+} TokenPipe;
+
+// Starts preprocessing on a new thread. While the pipe runs, the preprocessor and its TokenData belong to that thread
+// and must not be touched, stop the pipe first. Returns !0 if the thread could not be started.
+int token_pipe_start(TokenPipe *pipe, Preprocessor *pp);
+
+// Same contract as pp_next, tokens come out in the order the preprocessor produced them
+int token_pipe_next(TokenPipe *pipe, LexedToken *tok);
+
+// Makes the preprocessor thread stop and waits for it, does nothing if it already was stopped. Afterwards the
+// preprocessor and its TokenData can be used from the calling thread again, but no more tokens can be read from the pipe.
+void token_pipe_stop(TokenPipe *pipe);